@@ -0,0 +1,50 @@
+#include "ConfidenceMonitor.h"
+#include <algorithm>
+
+void
+ConfidenceMonitor::setPolicy(const ConfidencePolicy &policy) {
+    _policy = policy;
+    _policy.window = std::max(1, _policy.window);
+    _policy.minTokens = std::max(_policy.window, _policy.minTokens);
+    reset();
+}
+
+void
+ConfidenceMonitor::reset() {
+    _entropies.assign(_policy.window, 0.0f);
+    _margins.assign(_policy.window, 0.0f);
+    _entropySum = 0.0;
+    _lowMargins = 0;
+    _tokens = 0;
+    _entropyTotal = 0.0;
+    _marginTotal = 0.0;
+}
+
+bool
+ConfidenceMonitor::push(float entropy, float margin) {
+    if (!_policy.enabled) {
+        return false;
+    }
+    if (_policy.maxTokens > 0 && _tokens >= _policy.maxTokens) {
+        // past the decision window: the small model keeps the turn
+        return false;
+    }
+    const size_t slot = static_cast<size_t>(_tokens % _policy.window);
+    if (_tokens >= _policy.window) {
+        _entropySum -= _entropies[slot];
+        _lowMargins -= _margins[slot] < _policy.minMargin;
+    }
+    _entropies[slot] = entropy;
+    _margins[slot] = margin;
+    _entropySum += entropy;
+    _lowMargins += margin < _policy.minMargin;
+    _entropyTotal += entropy;
+    _marginTotal += margin;
+    _tokens++;
+
+    if (_tokens < _policy.minTokens) {
+        return false;
+    }
+    return _entropySum / _policy.window > _policy.maxMeanEntropy ||
+           static_cast<float>(_lowMargins) / _policy.window > _policy.maxLowMarginFraction;
+}
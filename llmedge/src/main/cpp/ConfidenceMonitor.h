@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// When a cascade's small model should hand the turn to the large one. Confidence is judged on a
+// rolling window of the sampling distributions: the mean entropy (nats) and the share of tokens
+// whose top-1/top-2 probability margin is below `minMargin`.
+struct ConfidencePolicy {
+    bool    enabled = false;
+    int32_t window = 16;
+    // no decision before this many tokens; after `maxTokens` (0 = never) the answer is kept
+    int32_t minTokens = 8;
+    int32_t maxTokens = 64;
+    float   maxMeanEntropy = 2.0f;
+    float   minMargin = 0.1f;
+    float   maxLowMarginFraction = 0.5f;
+};
+
+class ConfidenceMonitor {
+  public:
+    void setPolicy(const ConfidencePolicy& policy);
+    const ConfidencePolicy& policy() const { return _policy; }
+
+    void reset();
+
+    // Records the entropy and top-1/top-2 margin of one sampling step; true if the policy trips.
+    bool push(float entropy, float margin);
+
+    int64_t tokens() const { return _tokens; }
+    double  meanEntropy() const { return _tokens == 0 ? 0.0 : _entropyTotal / _tokens; }
+    double  meanMargin() const { return _tokens == 0 ? 0.0 : _marginTotal / _tokens; }
+
+  private:
+    ConfidencePolicy   _policy;
+    std::vector<float> _entropies;
+    std::vector<float> _margins;
+    double             _entropySum = 0.0;
+    int32_t            _lowMargins = 0;
+    int64_t            _tokens = 0;
+    double             _entropyTotal = 0.0;
+    double             _marginTotal = 0.0;
+};
@@ -0,0 +1,46 @@
+#include "FrameDedup.h"
+#include "ImageTokenBudget.h"
+#include <bitset>
+
+uint64_t
+frameDifferenceHash(const uint8_t *rgb, uint32_t nx, uint32_t ny) {
+    if (nx == 0 || ny == 0) {
+        return 0;
+    }
+    const std::vector<uint8_t> small = downscaleRgb(rgb, nx, ny, 9, 8);
+    uint64_t hash = 0;
+    for (int y = 0; y < 8; ++y) {
+        for (int x = 0; x < 8; ++x) {
+            const uint8_t *left = small.data() + 3 * (y * 9 + x);
+            const uint8_t *right = left + 3;
+            const int lumaLeft = 77 * left[0] + 150 * left[1] + 29 * left[2];
+            const int lumaRight = 77 * right[0] + 150 * right[1] + 29 * right[2];
+            hash = (hash << 1) | (lumaLeft > lumaRight ? 1u : 0u);
+        }
+    }
+    return hash;
+}
+
+bool
+isDistinctFrame(uint64_t hash, uint64_t lastKept, int maxDistance) {
+    return static_cast<int>(std::bitset<64>(hash ^ lastKept).count()) > maxDistance;
+}
+
+std::vector<size_t>
+selectDistinctFrames(const std::vector<uint64_t> &hashes, int maxDistance, size_t maxFrames) {
+    std::vector<size_t> distinct;
+    for (size_t i = 0; i < hashes.size(); ++i) {
+        if (distinct.empty() || isDistinctFrame(hashes[i], hashes[distinct.back()], maxDistance)) {
+            distinct.push_back(i);
+        }
+    }
+    if (maxFrames == 0 || distinct.size() <= maxFrames) {
+        return distinct;
+    }
+    std::vector<size_t> sampled(maxFrames);
+    for (size_t i = 0; i < maxFrames; ++i) {
+        // spread picks over the whole clip, first and last distinct frames included
+        sampled[i] = distinct[maxFrames == 1 ? 0 : i * (distinct.size() - 1) / (maxFrames - 1)];
+    }
+    return sampled;
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// 64-bit difference hash of packed 8-bit RGB: luminance is box-filtered to 9x8 and each bit
+// records whether a sample is brighter than its right neighbour. Frames that look alike differ
+// in few bits regardless of resolution or mild compression noise.
+uint64_t frameDifferenceHash(const uint8_t* rgb, uint32_t nx, uint32_t ny);
+
+// Whether a frame hashing to `hash` is worth keeping after one that hashed to `lastKept`.
+bool isDistinctFrame(uint64_t hash, uint64_t lastKept, int maxDistance);
+
+// Indices of the frames worth encoding, in order: a frame is skipped when its hash is within
+// `maxDistance` bits of the last frame kept, then the survivors are sampled evenly down to
+// `maxFrames` (0 = no limit). The first frame is always kept.
+std::vector<size_t> selectDistinctFrames(const std::vector<uint64_t>& hashes, int maxDistance, size_t maxFrames);
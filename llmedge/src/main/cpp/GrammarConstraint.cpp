@@ -0,0 +1,203 @@
+#include "GrammarConstraint.h"
+#include "ggml.h"
+#include "json-schema-to-grammar.h"
+#include <nlohmann/json.hpp>
+// llama.cpp's internal grammar API (llama.cpp/src, on the include path in both CMake builds):
+// the public sampler cannot snapshot parser stacks, which the mask cache keys on. Expect to
+// adapt this file when the llama.cpp submodule moves.
+#include "llama-grammar.h"
+#include <cmath>
+#include <functional>
+#include <stdexcept>
+
+// Upper bound on cached masks per grammar; 16 MB holds ~850 states of a 150k vocabulary.
+static constexpr size_t kMaskCacheBytes = 16u << 20;
+
+static uint64_t
+hashCombine(uint64_t seed, uint64_t value) {
+    return seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+}
+
+struct CompiledGrammar::StartState {
+    llama_grammar_stacks stacks;
+};
+
+CompiledGrammar::CompiledGrammar(const llama_vocab *vocab, const std::string &grammar, const std::string &root)
+    : _vocab(vocab) {
+    _grammar = llama_grammar_init_impl(vocab, grammar.c_str(), root.c_str(), false, nullptr, 0, nullptr, 0);
+    if (_grammar) {
+        _start = std::make_unique<StartState>();
+        _start->stacks = _grammar->stacks;
+    }
+}
+
+CompiledGrammar::~CompiledGrammar() {
+    if (_grammar) {
+        llama_grammar_free_impl(_grammar);
+    }
+}
+
+void
+CompiledGrammar::reset() {
+    if (!_grammar) return;
+    // The start stacks point into this grammar's own rules, so they stay valid; no re-parse.
+    _grammar->stacks = _start->stacks;
+    _grammar->partial_utf8 = {0, 0};
+}
+
+uint64_t
+CompiledGrammar::_stateKey() const {
+    uint64_t key = hashCombine(_grammar->partial_utf8.value, (uint64_t) _grammar->partial_utf8.n_remain);
+    for (const auto &stack: _grammar->stacks) {
+        key = hashCombine(key, stack.size());
+        for (const llama_grammar_element *element: stack) {
+            key = hashCombine(key, reinterpret_cast<uintptr_t>(element));
+        }
+    }
+    return key;
+}
+
+const std::vector<uint64_t> &
+CompiledGrammar::_maskForState(uint64_t key) {
+    auto it = _masks.find(key);
+    if (it != _masks.end()) {
+        maskHits++;
+        return it->second;
+    }
+    maskMisses++;
+
+    // Walk the whole vocabulary through the grammar once for this state.
+    const int32_t nVocab = llama_vocab_n_tokens(_vocab);
+    _scratch.resize(nVocab);
+    for (int32_t i = 0; i < nVocab; ++i) {
+        _scratch[i] = {i, 0.0f, 0.0f};
+    }
+    llama_token_data_array all = {_scratch.data(), _scratch.size(), -1, false};
+    llama_grammar_apply_impl(*_grammar, &all);
+
+    std::vector<uint64_t> mask((nVocab + 63) / 64, 0);
+    for (int32_t i = 0; i < nVocab; ++i) {
+        if (!std::isinf(_scratch[i].logit)) {
+            mask[i / 64] |= 1ULL << (i % 64);
+        }
+    }
+
+    const size_t bytes = mask.size() * sizeof(uint64_t);
+    if (_maskBytes + bytes > kMaskCacheBytes) {
+        _masks.clear();
+        _maskBytes = 0;
+    }
+    _maskBytes += bytes;
+    return _masks.emplace(key, std::move(mask)).first->second;
+}
+
+void
+CompiledGrammar::apply(llama_token_data_array *cur_p) {
+    const int64_t start = ggml_time_us();
+    const std::vector<uint64_t> &mask = _maskForState(_stateKey());
+    const llama_token nWords = (llama_token) mask.size() * 64;
+    size_t allowed = 0;
+    for (size_t i = 0; i < cur_p->size; ++i) {
+        const llama_token id = cur_p->data[i].id;
+        if (id < 0 || id >= nWords || !(mask[id / 64] & (1ULL << (id % 64)))) {
+            cur_p->data[i].logit = -INFINITY;
+        } else {
+            allowed++;
+        }
+    }
+    constraintMicros += ggml_time_us() - start;
+    // Happens when the candidates are a restricted head's token set that shares no token with
+    // what the grammar accepts here; sampling would pick among -inf logits.
+    if (allowed == 0 && cur_p->size > 0) {
+        throw std::runtime_error("grammar accepts none of the candidate tokens "
+                                 "(allowed tokens and grammar do not overlap)");
+    }
+}
+
+void
+CompiledGrammar::accept(llama_token token) {
+    const int64_t start = ggml_time_us();
+    llama_grammar_accept_impl(*_grammar, token);
+    constraintMicros += ggml_time_us() - start;
+}
+
+CompiledGrammar *
+GrammarCache::get(const llama_vocab *vocab, const std::string &grammar, const std::string &root) {
+    const uint64_t key = hashCombine(std::hash<std::string>{}(grammar), std::hash<std::string>{}(root));
+    auto found = _index.find(key);
+    if (found != _index.end()) {
+        _lru.splice(_lru.begin(), _lru, found->second);
+        return found->second->second.get();
+    }
+
+    auto compiled = std::make_unique<CompiledGrammar>(vocab, grammar, root);
+    if (!compiled->valid()) {
+        return nullptr;
+    }
+    _lru.emplace_front(key, std::move(compiled));
+    _index[key] = _lru.begin();
+    if (_lru.size() > _capacity) {
+        _index.erase(_lru.back().first);
+        _lru.pop_back();
+    }
+    return _lru.front().second.get();
+}
+
+CompiledGrammar *
+GrammarCache::getForJsonSchema(const llama_vocab *vocab, const std::string &schema) {
+    const uint64_t key = std::hash<std::string>{}(schema);
+    auto found = _schemaGrammars.find(key);
+    if (found == _schemaGrammars.end()) {
+        std::string grammar;
+        try {
+            grammar = json_schema_to_grammar(nlohmann::ordered_json::parse(schema));
+        } catch (const std::exception &e) {
+            throw std::runtime_error(std::string("invalid JSON schema: ") + e.what());
+        }
+        found = _schemaGrammars.emplace(key, std::move(grammar)).first;
+    }
+    return get(vocab, found->second, "root");
+}
+
+void
+GrammarCache::clear() {
+    _index.clear();
+    _lru.clear();
+    _schemaGrammars.clear();
+}
+
+static const char *
+grammar_sampler_name(const llama_sampler * /*smpl*/) {
+    return "llmedge-grammar";
+}
+
+static void
+grammar_sampler_accept(llama_sampler *smpl, llama_token token) {
+    CompiledGrammar *grammar = *static_cast<CompiledGrammar **>(smpl->ctx);
+    if (grammar) grammar->accept(token);
+}
+
+static void
+grammar_sampler_apply(llama_sampler *smpl, llama_token_data_array *cur_p) {
+    CompiledGrammar *grammar = *static_cast<CompiledGrammar **>(smpl->ctx);
+    if (grammar) grammar->apply(cur_p);
+}
+
+static void
+grammar_sampler_reset(llama_sampler *smpl) {
+    CompiledGrammar *grammar = *static_cast<CompiledGrammar **>(smpl->ctx);
+    if (grammar) grammar->reset();
+}
+
+llama_sampler *
+grammar_sampler_init(CompiledGrammar **active) {
+    static const llama_sampler_i iface = [] {
+        llama_sampler_i i{};
+        i.name = grammar_sampler_name;
+        i.accept = grammar_sampler_accept;
+        i.apply = grammar_sampler_apply;
+        i.reset = grammar_sampler_reset;
+        return i;
+    }();
+    return llama_sampler_init(&iface, active);
+}
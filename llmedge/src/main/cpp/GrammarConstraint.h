@@ -0,0 +1,73 @@
+#pragma once
+#include "llama.h"
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct llama_grammar;
+
+// A GBNF grammar parsed once, plus the token masks of the parser states it has visited.
+// Masks are keyed by the grammar's stack state, so repeated structure (string bodies,
+// separators, nested objects at the same depth) costs a bitset lookup instead of a walk of
+// the full vocabulary through the grammar.
+class CompiledGrammar {
+  public:
+    CompiledGrammar(const llama_vocab* vocab, const std::string& grammar, const std::string& root);
+    ~CompiledGrammar();
+
+    bool valid() const { return _grammar != nullptr; }
+
+    // rewind to the start symbol for a new response
+    void reset();
+    // mask out candidates the grammar cannot accept next; throws std::runtime_error if that
+    // leaves none (e.g. a restricted head whose tokens the grammar never accepts here)
+    void apply(llama_token_data_array* cur_p);
+    // advance the grammar by the sampled token
+    void accept(llama_token token);
+
+    int64_t maskHits    = 0;
+    int64_t maskMisses  = 0;
+    int64_t constraintMicros = 0;
+
+  private:
+    struct StartState;
+
+    uint64_t _stateKey() const;
+    const std::vector<uint64_t>& _maskForState(uint64_t key);
+
+    const llama_vocab*                                   _vocab;
+    llama_grammar*                                       _grammar = nullptr;
+    std::unique_ptr<StartState>                          _start;
+    std::unordered_map<uint64_t, std::vector<uint64_t>> _masks;
+    size_t                                               _maskBytes = 0;
+    std::vector<llama_token_data>                        _scratch;
+};
+
+// Compiled grammars keyed by hash of their source, evicted least-recently-used.
+class GrammarCache {
+  public:
+    explicit GrammarCache(size_t capacity = 8) : _capacity(capacity) {}
+
+    // Returns the compiled grammar, parsing it only on first use; nullptr if it does not parse.
+    CompiledGrammar* get(const llama_vocab* vocab, const std::string& grammar, const std::string& root);
+    // Converts a JSON schema to GBNF (memoized) and returns its compiled grammar.
+    // Throws std::runtime_error if the schema is not valid JSON or cannot be converted.
+    CompiledGrammar* getForJsonSchema(const llama_vocab* vocab, const std::string& schema);
+
+    void clear();
+
+  private:
+    using Entry = std::pair<uint64_t, std::unique_ptr<CompiledGrammar>>;
+
+    size_t                                                _capacity;
+    std::list<Entry>                                      _lru;
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> _index;
+    std::unordered_map<uint64_t, std::string>             _schemaGrammars;
+};
+
+// Sampler stage that applies `*active` when it is set; add it first in a sampler chain.
+// The stage does not own the grammar.
+llama_sampler* grammar_sampler_init(CompiledGrammar** active);
@@ -0,0 +1,70 @@
+#include "HistoryCompactor.h"
+#include <cstring>
+
+namespace HistoryCompactor {
+
+static constexpr const char* kSummaryHeader = "Summary of the earlier conversation:\n";
+
+size_t
+splitPoint(const std::vector<llama_chat_message> &messages, size_t firstTurn, int32_t keepRecentTurns) {
+    int32_t turns = 0;
+    for (size_t i = messages.size(); i > firstTurn; --i) {
+        if (std::strcmp(messages[i - 1].role, "user") == 0 && ++turns > keepRecentTurns) {
+            // messages[i - 1] opens the newest turn that is folded; keep everything after it
+            // up to the next user message
+            for (size_t j = i; j < messages.size(); ++j) {
+                if (std::strcmp(messages[j].role, "user") == 0) {
+                    return j;
+                }
+            }
+            return messages.size();
+        }
+    }
+    return firstTurn;
+}
+
+void
+splitSystemPrompt(const std::string &content, std::string &base, std::string &summary) {
+    const size_t header = content.rfind(kSummaryHeader);
+    if (header == std::string::npos) {
+        base = content;
+        summary.clear();
+        return;
+    }
+    size_t baseEnd = header;
+    while (baseEnd > 0 && content[baseEnd - 1] == '\n') {
+        --baseEnd;
+    }
+    base = content.substr(0, baseEnd);
+    summary = content.substr(header + std::strlen(kSummaryHeader));
+}
+
+std::string
+joinSystemPrompt(const std::string &base, const std::string &summary) {
+    if (summary.empty()) {
+        return base;
+    }
+    return base.empty() ? kSummaryHeader + summary : base + "\n\n" + kSummaryHeader + summary;
+}
+
+std::string
+summaryRequest(const std::vector<llama_chat_message> &messages, size_t begin, size_t end,
+               const std::string &previousSummary, int32_t summaryTokens) {
+    // about three words per four tokens in English text
+    std::string request = "Summarize the conversation below in at most " + std::to_string(summaryTokens * 3 / 4) +
+                          " words. Keep names, facts, numbers, decisions and open questions; drop greetings "
+                          "and filler. Reply with the summary only.\n\n";
+    if (!previousSummary.empty()) {
+        request += "Earlier summary:\n" + previousSummary + "\n\n";
+    }
+    request += "Conversation:\n";
+    for (size_t i = begin; i < end; ++i) {
+        const bool user = std::strcmp(messages[i].role, "user") == 0;
+        request += user ? "User: " : "Assistant: ";
+        request += messages[i].content;
+        request += "\n";
+    }
+    return request;
+}
+
+} // namespace HistoryCompactor
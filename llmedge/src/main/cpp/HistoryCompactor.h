@@ -0,0 +1,42 @@
+#pragma once
+#include "llama.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// When LLMInference folds older turns of a long chat into a summary. Compaction runs once the
+// session has been idle for `idleMillis` after a response and its KV cache holds at least
+// `triggerTokens` tokens; the last `keepRecentTurns` user turns (and what follows them) are kept
+// verbatim, everything older is summarized in at most `summaryTokens` tokens.
+struct CompactionPolicy {
+    bool    enabled = false;
+    int32_t triggerTokens = 2048;
+    int32_t keepRecentTurns = 2;
+    int32_t summaryTokens = 256;
+    int32_t idleMillis = 1500;
+    // decode threads while compacting, so it leaves the foreground cores alone
+    int32_t nThreads = 1;
+};
+
+// Builds the requests and the rewritten history for a compaction; the decoding itself is done by
+// LLMInference on its scratch sequence.
+namespace HistoryCompactor {
+
+// Index of the first message kept verbatim: the `keepRecentTurns`-th user message from the end.
+// Returns `firstTurn` (nothing to fold) if the history has no more turns than that.
+size_t splitPoint(const std::vector<llama_chat_message>& messages, size_t firstTurn, int32_t keepRecentTurns);
+
+// Splits a system prompt into the part written by the app and the summary appended by an earlier
+// compaction (empty if there was none).
+void splitSystemPrompt(const std::string& content, std::string& base, std::string& summary);
+
+// `base` with `summary` appended under a fixed header.
+std::string joinSystemPrompt(const std::string& base, const std::string& summary);
+
+// The user message asking the model to merge `previousSummary` and messages [begin, end) into
+// one summary of at most about `summaryTokens` tokens.
+std::string summaryRequest(const std::vector<llama_chat_message>& messages, size_t begin, size_t end,
+                           const std::string& previousSummary, int32_t summaryTokens);
+
+} // namespace HistoryCompactor
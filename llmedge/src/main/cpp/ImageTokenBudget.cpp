@@ -0,0 +1,119 @@
+#include "ImageTokenBudget.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+// luminance step (out of 255) that counts as an edge
+static constexpr int kEdgeThreshold = 24;
+// edge density at which an image gets its full token budget under the automatic policy
+static constexpr float kFullDetailDensity = 0.12f;
+// the automatic policy never goes below this fraction of the full token count
+static constexpr float kMinAutoFraction = 0.25f;
+
+static int
+luma(const uint8_t *px) {
+    return (77 * px[0] + 150 * px[1] + 29 * px[2]) >> 8;
+}
+
+float
+imageComplexity(const uint8_t *rgb, uint32_t nx, uint32_t ny) {
+    if (nx < 2 || ny < 2) {
+        return 0.0f;
+    }
+    const uint32_t stepX = std::max(1u, nx / 128);
+    const uint32_t stepY = std::max(1u, ny / 128);
+    size_t edges = 0;
+    size_t samples = 0;
+    for (uint32_t y = 0; y + 1 < ny; y += stepY) {
+        for (uint32_t x = 0; x + 1 < nx; x += stepX) {
+            const uint8_t *px = rgb + 3 * (static_cast<size_t>(y) * nx + x);
+            const int center = luma(px);
+            const int dx = std::abs(luma(px + 3) - center);
+            const int dy = std::abs(luma(px + 3 * static_cast<size_t>(nx)) - center);
+            edges += std::max(dx, dy) > kEdgeThreshold;
+            ++samples;
+        }
+    }
+    return samples == 0 ? 0.0f : static_cast<float>(edges) / samples;
+}
+
+int32_t
+imageTokenTarget(const ImageTokenBudget &budget, int32_t fullTokens, float complexity) {
+    int32_t target = fullTokens;
+    if (budget.maxTokens > 0) {
+        target = std::min(target, budget.maxTokens);
+    }
+    if (budget.automatic) {
+        const float fraction = std::clamp(complexity / kFullDetailDensity, kMinAutoFraction, 1.0f);
+        target = std::min(target, static_cast<int32_t>(std::ceil(fraction * fullTokens)));
+    }
+    return std::max(1, target);
+}
+
+std::vector<uint8_t>
+downscaleRgb(const uint8_t *rgb, uint32_t nx, uint32_t ny, uint32_t outNx, uint32_t outNy) {
+    std::vector<uint8_t> out(3 * static_cast<size_t>(outNx) * outNy);
+    for (uint32_t oy = 0; oy < outNy; ++oy) {
+        const uint32_t y0 = static_cast<uint32_t>(static_cast<uint64_t>(oy) * ny / outNy);
+        const uint32_t y1 = std::max(y0 + 1, static_cast<uint32_t>(static_cast<uint64_t>(oy + 1) * ny / outNy));
+        for (uint32_t ox = 0; ox < outNx; ++ox) {
+            const uint32_t x0 = static_cast<uint32_t>(static_cast<uint64_t>(ox) * nx / outNx);
+            const uint32_t x1 = std::max(x0 + 1, static_cast<uint32_t>(static_cast<uint64_t>(ox + 1) * nx / outNx));
+            uint32_t sum[3] = {0, 0, 0};
+            for (uint32_t y = y0; y < y1; ++y) {
+                for (uint32_t x = x0; x < x1; ++x) {
+                    const uint8_t *px = rgb + 3 * (static_cast<size_t>(y) * nx + x);
+                    sum[0] += px[0];
+                    sum[1] += px[1];
+                    sum[2] += px[2];
+                }
+            }
+            const uint32_t n = (y1 - y0) * (x1 - x0);
+            uint8_t *dst = out.data() + 3 * (static_cast<size_t>(oy) * outNx + ox);
+            for (int c = 0; c < 3; ++c) {
+                dst[c] = static_cast<uint8_t>(sum[c] / n);
+            }
+        }
+    }
+    return out;
+}
+
+int32_t
+imagePoolFactor(int32_t nx, int32_t ny, int32_t target) {
+    if (nx * ny <= target) {
+        return 1;
+    }
+    int32_t k = 2;
+    while (((nx + k - 1) / k) * ((ny + k - 1) / k) > target && (k < nx || k < ny)) {
+        ++k;
+    }
+    return k;
+}
+
+std::vector<float>
+poolImageEmbeddings(const float *embd, int32_t nEmbd, int32_t &nx, int32_t &ny, int32_t k) {
+    const int32_t outNx = (nx + k - 1) / k;
+    const int32_t outNy = (ny + k - 1) / k;
+    std::vector<float> out(static_cast<size_t>(outNx) * outNy * nEmbd, 0.0f);
+    for (int32_t oy = 0; oy < outNy; ++oy) {
+        for (int32_t ox = 0; ox < outNx; ++ox) {
+            float *dst = out.data() + (static_cast<size_t>(oy) * outNx + ox) * nEmbd;
+            int32_t n = 0;
+            for (int32_t y = oy * k; y < std::min(ny, (oy + 1) * k); ++y) {
+                for (int32_t x = ox * k; x < std::min(nx, (ox + 1) * k); ++x) {
+                    const float *src = embd + (static_cast<size_t>(y) * nx + x) * nEmbd;
+                    for (int32_t e = 0; e < nEmbd; ++e) {
+                        dst[e] += src[e];
+                    }
+                    ++n;
+                }
+            }
+            for (int32_t e = 0; e < nEmbd; ++e) {
+                dst[e] /= static_cast<float>(n);
+            }
+        }
+    }
+    nx = outNx;
+    ny = outNy;
+    return out;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// How many image tokens an image may produce. `maxTokens` caps every image (0 = no cap);
+// `automatic` additionally scales the budget with imageComplexity(), so flat screenshots and
+// low-detail photos use a fraction of the projector's full token count.
+struct ImageTokenBudget {
+    int32_t maxTokens = 0;
+    bool    automatic = false;
+};
+
+// Fraction of sampled pixels (on a grid of at most 128x128) whose luminance gradient exceeds a
+// fixed edge threshold, in [0, 1]. `rgb` is packed 8-bit RGB.
+float imageComplexity(const uint8_t* rgb, uint32_t nx, uint32_t ny);
+
+// Tokens to keep out of `fullTokens` under `budget` for an image of the given complexity;
+// never less than 1 or more than `fullTokens`.
+int32_t imageTokenTarget(const ImageTokenBudget& budget, int32_t fullTokens, float complexity);
+
+// Box-filtered resize of packed RGB to outNx x outNy (which must not exceed nx x ny).
+std::vector<uint8_t> downscaleRgb(const uint8_t* rgb, uint32_t nx, uint32_t ny, uint32_t outNx, uint32_t outNy);
+
+// Smallest k >= 2 for which pooling an nx x ny token grid in k x k cells gives at most `target`
+// tokens, or 1 if the grid already fits.
+int32_t imagePoolFactor(int32_t nx, int32_t ny, int32_t target);
+
+// Averages k x k cells of a row-major nx x ny grid of `nEmbd`-float embeddings (edge cells are
+// averaged over the tokens they cover). Updates `nx` and `ny` to the pooled grid.
+std::vector<float> poolImageEmbeddings(const float* embd, int32_t nEmbd, int32_t& nx, int32_t& ny, int32_t k);
@@ -0,0 +1,80 @@
+#include "KvSessionManager.h"
+#include "LLMInference.h"
+#include <unistd.h>
+
+KvSessionManager &
+KvSessionManager::instance() {
+    static KvSessionManager manager;
+    return manager;
+}
+
+void
+KvSessionManager::configure(const std::string &directory, size_t budgetBytes) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _directory = directory;
+    _budgetBytes = directory.empty() ? 0 : budgetBytes;
+    _enforceBudget(nullptr);
+}
+
+bool
+KvSessionManager::acquire(LLMInference *session, bool busy) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    bool wasBusy = false;
+    auto found = _index.find(session);
+    if (found == _index.end()) {
+        _lru.push_front({session, busy});
+        _index[session] = _lru.begin();
+    } else {
+        _lru.splice(_lru.begin(), _lru, found->second);
+        wasBusy = found->second->busy;
+        found->second->busy = wasBusy || busy;
+    }
+    if (session->isPagedOut()) {
+        session->pageIn();
+    }
+    _enforceBudget(session);
+    return wasBusy;
+}
+
+void
+KvSessionManager::release(LLMInference *session) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto found = _index.find(session);
+    if (found != _index.end()) {
+        found->second->busy = false;
+    }
+}
+
+void
+KvSessionManager::remove(LLMInference *session) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto found = _index.find(session);
+    if (found != _index.end()) {
+        _lru.erase(found->second);
+        _index.erase(found);
+    }
+}
+
+void
+KvSessionManager::_enforceBudget(const LLMInference *keep) {
+    if (_budgetBytes == 0) {
+        return;
+    }
+    size_t resident = 0;
+    for (const Entry &entry: _lru) {
+        resident += entry.session->kvCacheBytes();
+    }
+    // walk from the least recently used end
+    for (auto it = _lru.rbegin(); it != _lru.rend() && resident > _budgetBytes; ++it) {
+        LLMInference *session = it->session;
+        if (session == keep || it->busy || session->isPagedOut()) {
+            continue;
+        }
+        const size_t bytes = session->kvCacheBytes();
+        const std::string path =
+                _directory + "/kv-" + std::to_string(getpid()) + "-" + std::to_string(_nextFileId++) + ".bin";
+        if (session->pageOut(path)) {
+            resident -= bytes;
+        }
+    }
+}
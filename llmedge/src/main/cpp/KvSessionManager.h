@@ -0,0 +1,65 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class LLMInference;
+
+// Keeps the KV caches of all loaded LLMInference sessions under a RAM budget. Sessions are
+// ordered by last access; when the resident total exceeds the budget, the least recently used
+// idle sessions have their KV state written to a memory-mapped file and their llama_context
+// freed. The next access maps the file back into a fresh context.
+class KvSessionManager {
+  public:
+    static KvSessionManager& instance();
+
+    // Page files are created under `directory`; a budget of 0 disables paging (sessions that
+    // are already paged out are still restored on their next access).
+    void configure(const std::string& directory, size_t budgetBytes);
+
+    // Marks `session` most recently used, restoring its KV cache if it was paged out, then pages
+    // out idle sessions until the budget holds. `busy` sessions are never paged out until
+    // release() is called. Returns whether the session was already busy.
+    // Throws std::runtime_error if the restore fails.
+    bool acquire(LLMInference* session, bool busy);
+    void release(LLMInference* session);
+    void remove(LLMInference* session);
+
+  private:
+    struct Entry {
+        LLMInference* session;
+        bool          busy;
+    };
+
+    void _enforceBudget(const LLMInference* keep);
+
+    std::mutex                                                      _mutex;
+    std::string                                                     _directory;
+    size_t                                                          _budgetBytes = 0;
+    uint64_t                                                        _nextFileId = 0;
+    std::list<Entry>                                                _lru;
+    std::unordered_map<const LLMInference*, std::list<Entry>::iterator> _index;
+};
+
+// Keeps `session` busy for the lifetime of the hold, so no other session's acquire() can page it
+// out (and free its context) in the middle of an operation. A session that was already busy is
+// left to the release() of whoever made it busy.
+class KvSessionHold {
+  public:
+    explicit KvSessionHold(LLMInference* session)
+        : _session(session), _release(!KvSessionManager::instance().acquire(session, true)) {}
+    KvSessionHold(const KvSessionHold&) = delete;
+    KvSessionHold& operator=(const KvSessionHold&) = delete;
+    ~KvSessionHold() {
+        if (_release) {
+            KvSessionManager::instance().release(_session);
+        }
+    }
+
+  private:
+    LLMInference* _session;
+    bool          _release;
+};
@@ -1,4 +1,5 @@
 #include "LLMInference.h"
+#include "KvSessionManager.h"
 #ifdef __ANDROID__
 #include <android/log.h>
 #define TAG "[SmolLMAndroid-Cpp]"
@@ -11,25 +12,37 @@
 #define LOGe(...) fprintf(stderr, "%s ", TAG); fprintf(stderr, __VA_ARGS__); fprintf(stderr, "\n")
 #endif
 #include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <limits>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 void
 LLMInference::loadModel(const char *model_path, float minP, float temperature, bool storeChats, long contextSize,
-                        const char *chatTemplate, int nThreads, bool useMmap, bool useMlock, bool useVulkan) {
+                        long initialContextSize, const char *chatTemplate, int nThreads, bool useMmap, bool useMlock,
+                        bool useVulkan) {
     LOGi("loading model with"
          "\n\tmodel_path = %s"
          "\n\tminP = %f"
          "\n\ttemperature = %f"
          "\n\tstoreChats = %d"
          "\n\tcontextSize = %li"
+         "\n\tinitialContextSize = %li"
          "\n\tchatTemplate = %s"
          "\n\tnThreads = %d"
          "\n\tuseMmap = %d"
          "\n\tuseMlock = %d"
          "\n\tuseVulkan = %d",
-         model_path, minP, temperature, storeChats, contextSize, chatTemplate, nThreads, useMmap, useMlock, useVulkan);
+         model_path, minP, temperature, storeChats, contextSize, initialContextSize, chatTemplate, nThreads, useMmap,
+         useMlock, useVulkan);
 
     // load dynamic backends
     ggml_backend_load_all();
@@ -46,6 +59,7 @@ LLMInference::loadModel(const char *model_path, float minP, float temperature, b
         LOGe("failed to load model from %s", model_path);
         throw std::runtime_error("loadModel() failed");
     }
+    _modelPath = model_path;
 
     // create an instance of llama_context
     llama_context_params ctx_params = llama_context_default_params();
@@ -53,22 +67,37 @@ LLMInference::loadModel(const char *model_path, float minP, float temperature, b
     if (safeContext != contextSize) {
         LOGi("contextSize %ld adjusted to %ld to fit llama context limits", contextSize, safeContext);
     }
-    ctx_params.n_ctx = static_cast<uint32_t>(safeContext);
+    _nCtxMax = static_cast<uint32_t>(safeContext);
+    _nCtxInitial = static_cast<uint32_t>(initialContextSize > 0 ? std::min(initialContextSize, safeContext) : safeContext);
+    ctx_params.n_ctx = _nCtxInitial;
     // Optimal batch sizes are typically 512-2048 for modern ARM CPUs
     // Larger batches waste memory and reduce cache efficiency
     ctx_params.n_batch = std::min(static_cast<int>(safeContext), 512);
     ctx_params.n_threads = nThreads;
+    // sequence 1 is scratch space for passage KV (see encodePassage); one shared cell pool keeps
+    // the whole context available to the conversation in sequence 0
+    ctx_params.n_seq_max = 2;
+    ctx_params.kv_unified = true;
     ctx_params.no_perf = true; // disable performance metrics
+    ctx_params.cb_eval = _evalCallback;
+    ctx_params.cb_eval_user_data = this;
     _ctx = llama_init_from_model(_model, ctx_params);
     if (!_ctx) {
         LOGe("llama_new_context_with_model() returned null)");
         throw std::runtime_error("llama_new_context_with_model() returned null");
     }
+    _ctxParams = ctx_params;
+    _kvCells = _nCtxInitial;
+    _ctxGrows = 0;
+    _ctxShrinks = 0;
+    _ctxMigrationMicros = 0;
 
     // create an instance of llama_sampler
     llama_sampler_chain_params sampler_params = llama_sampler_chain_default_params();
     sampler_params.no_perf = true; // disable performance metrics
     _sampler = llama_sampler_chain_init(sampler_params);
+    // no-op until setGrammar(); must run before temperature/dist see the candidates
+    llama_sampler_chain_add(_sampler, grammar_sampler_init(&_activeGrammar));
     llama_sampler_chain_add(_sampler, llama_sampler_init_temp(temperature));
     llama_sampler_chain_add(_sampler, llama_sampler_init_dist(LLAMA_DEFAULT_SEED));
 
@@ -83,10 +112,13 @@ LLMInference::loadModel(const char *model_path, float minP, float temperature, b
     this->_storeChats = storeChats;
     _disableThinking = false;
     _reasoningBudget = -1;
+    KvSessionManager::instance().acquire(this, false);
 }
 
 void
 LLMInference::addChatMessage(const char *message, const char *role) {
+    std::unique_lock<std::mutex> hold = _holdCompaction();
+    KvSessionHold busy(this);
     _messages.push_back({strdup(role), strdup(message)});
 }
 
@@ -118,8 +150,15 @@ LLMInference::getContextSizeUsed() const {
     return _nCtxUsed;
 }
 
-void
-LLMInference::startCompletion(const char *query) {
+std::string
+LLMInference::_beginTurn(const char *query) {
+    _requireContext();
+    {
+        std::unique_lock<std::mutex> hold = _holdCompaction();
+        _turnActive = true;
+    }
+    // an idle compaction abandoned just now has released the session
+    KvSessionManager::instance().acquire(this, true);
     if (!_storeChats) {
         for (auto it = _messages.begin(); it != _messages.end();) {
             if (std::strcmp(it->role, "system") != 0) {
@@ -132,11 +171,27 @@ LLMInference::startCompletion(const char *query) {
         }
         _prevLen = 0;
         _formattedMessages.assign(llama_n_ctx(_ctx), 0);
+    } else if (_historyTruncated) {
+        // the KV cache lacks what the last deadline dropped: rebuild it from the stored chat
+        _prevLen = 0;
     }
+    _historyTruncated = false;
     _responseGenerationTime = 0;
     _responseNumTokens = 0;
+    _deadlineStop = false;
+    _deadlineAt = 0;
+    if (_nextDeadlineMicros > 0) {
+        _deadlineStart = ggml_time_us();
+        _deadlineAt = _deadlineStart + _nextDeadlineMicros;
+        _deadlineStats[0] = _nextDeadlineMicros;
+        _deadlineStats[1] = _deadlineStats[2] = _deadlineStats[3] = 0;
+        _nextDeadlineMicros = 0;
+    }
     _response.clear();
     _cacheResponseTokens.clear();
+    if (_activeGrammar) {
+        _activeGrammar->reset();
+    }
     std::string finalQuery = query ? std::string(query) : std::string();
     const bool suppressThinking = _disableThinking || _reasoningBudget == 0;
     if (suppressThinking && finalQuery.find("/no_think") == std::string::npos) {
@@ -160,26 +215,11 @@ LLMInference::startCompletion(const char *query) {
     if (newLen < 0) {
         throw std::runtime_error("llama_chat_apply_template() in LLMInference::startCompletion() failed");
     }
-    std::string prompt(_formattedMessages.begin() + _prevLen, _formattedMessages.begin() + newLen);
-    // Only add special tokens (like BOS) if we are at the start of the context
-    bool add_special = (_prevLen == 0); 
-    _promptTokens = common_tokenize(llama_model_get_vocab(_model), prompt, add_special, true);
-    if (_promptTokens.empty()) {
-        LOGe("tokenize() returned no tokens for prompt; aborting completion");
-        throw std::runtime_error("empty prompt tokenization");
-    }
-    if (_promptTokens.size() > static_cast<size_t>(std::numeric_limits<int32_t>::max())) {
-        LOGe("prompt token count %zu exceeds int32 range", _promptTokens.size());
-        throw std::runtime_error("prompt too long for llama_batch");
-    }
-
-    if (_batch == nullptr) {
-        _batch = new llama_batch();
-    }
-    std::memset(_batch, 0, sizeof(llama_batch));
-    _batch->token = _promptTokens.data();
-    _batch->n_tokens = static_cast<int32_t>(_promptTokens.size());
+    return std::string(_formattedMessages.begin() + _prevLen, _formattedMessages.begin() + newLen);
+}
 
+int
+LLMInference::_turnStartPos() {
     // Fix KV cache reuse
     int n_past = 0;
     if (_storeChats && _prevLen > 0) {
@@ -196,7 +236,29 @@ LLMInference::startCompletion(const char *query) {
          // Clear KV cache to ensure fresh start
          llama_memory_seq_rm(llama_get_memory(_ctx), -1, -1, -1);
     }
-    
+    return n_past;
+}
+
+void
+LLMInference::_setPromptBatch(int n_past) {
+    if (_promptTokens.empty()) {
+        LOGe("tokenize() returned no tokens for prompt; aborting completion");
+        throw std::runtime_error("empty prompt tokenization");
+    }
+    if (_promptTokens.size() > static_cast<size_t>(std::numeric_limits<int32_t>::max())) {
+        LOGe("prompt token count %zu exceeds int32 range", _promptTokens.size());
+        throw std::runtime_error("prompt too long for llama_batch");
+    }
+
+    _fitPromptToDeadline();
+
+    if (_batch == nullptr) {
+        _batch = new llama_batch();
+    }
+    std::memset(_batch, 0, sizeof(llama_batch));
+    _batch->token = _promptTokens.data();
+    _batch->n_tokens = static_cast<int32_t>(_promptTokens.size());
+
     LOGi("startCompletion: n_past=%d, n_tokens=%d, prevLen=%d", n_past, _batch->n_tokens, _prevLen);
 
     _batchPos.resize(_promptTokens.size());
@@ -204,6 +266,394 @@ LLMInference::startCompletion(const char *query) {
         _batchPos[i] = n_past + i;
     }
     _batch->pos = _batchPos.data();
+
+    _loopDetector.reset();
+    _loopBan = -1;
+    _loopNudges = 0;
+    _loopStats[4] = -1;
+
+    _escalated = false;
+    _confidence.reset();
+    if (_confidence.policy().enabled) {
+        _cascadeStats[0]++;
+    }
+}
+
+void
+LLMInference::startCompletion(const char *query) {
+    KvSessionManager::instance().acquire(this, true);
+    std::string prompt = _beginTurn(query);
+    // Only add special tokens (like BOS) if we are at the start of the context
+    bool add_special = (_prevLen == 0); 
+    _promptTokens = common_tokenize(llama_model_get_vocab(_model), prompt, add_special, true);
+    _startTurn(std::move(prompt), add_special);
+}
+
+bool
+LLMInference::startCompletionFrom(LLMInference &source, const char *query) {
+    KvSessionManager::instance().acquire(this, true);
+    std::string prompt = _beginTurn(query);
+    bool add_special = (_prevLen == 0);
+    const bool reuse = !source._turnTokens.empty() && source._turnAddSpecial == add_special &&
+                       source._turnText == prompt && source._vocabFingerprint() == _vocabFingerprint();
+    if (reuse) {
+        _promptTokens = source._turnTokens;
+        _cascadeStats[3]++;
+    } else {
+        _promptTokens = common_tokenize(llama_model_get_vocab(_model), prompt, add_special, true);
+    }
+    _startTurn(std::move(prompt), add_special);
+    return reuse;
+}
+
+void
+LLMInference::_startTurn(std::string prompt, bool addSpecial) {
+    if (_confidence.policy().enabled) {
+        // only a cascade's small model hands its tokenization on
+        _turnText = std::move(prompt);
+        _turnAddSpecial = addSpecial;
+        _turnTokens = _promptTokens;
+    }
+    _turnKvStart = _turnStartPos();
+    _setPromptBatch(_turnKvStart);
+}
+
+uint64_t
+LLMInference::_vocabFingerprint() {
+    if (_vocabHash == 0) {
+        // FNV-1a over the text of every token
+        const llama_vocab *vocab = llama_model_get_vocab(_model);
+        const int32_t nVocab = llama_vocab_n_tokens(vocab);
+        uint64_t hash = 0xcbf29ce484222325ULL ^ static_cast<uint64_t>(nVocab);
+        for (llama_token token = 0; token < nVocab; ++token) {
+            for (const char *c = llama_vocab_get_text(vocab, token); c != nullptr && *c != '\0'; ++c) {
+                hash = (hash ^ static_cast<uint8_t>(*c)) * 0x100000001b3ULL;
+            }
+            hash = (hash ^ 0xff) * 0x100000001b3ULL;
+        }
+        _vocabHash = hash == 0 ? 1 : hash;
+    }
+    return _vocabHash;
+}
+
+// Passage blob: header, the passage tokens, then the llama_state_seq data of the passage decoded
+// alone in the scratch sequence at positions [0, nTokens).
+struct PassageHeader {
+    uint32_t magic;
+    int32_t  nLayer;
+    int32_t  nEmbd;
+    int32_t  nVocab;
+    int32_t  nTokens;
+};
+static constexpr uint32_t kPassageMagic = 0x31564b50; // "PKV1"
+static constexpr llama_seq_id kScratchSeq = 1;
+
+void
+LLMInference::_ensureCapacity(uint32_t required) {
+    if (required > llama_n_ctx(_ctx)) {
+        _growContext(required);
+    }
+}
+
+void
+LLMInference::_decodeTokens(const llama_token *tokens, int32_t n, llama_pos pos, llama_seq_id seq) {
+    const int32_t nBatch = static_cast<int32_t>(llama_n_batch(_ctx));
+    llama_batch batch = llama_batch_init(std::min(n, nBatch), 0, 1);
+    for (int32_t i = 0; i < n; i += nBatch) {
+        common_batch_clear(batch);
+        for (int32_t j = i; j < std::min(n, i + nBatch); ++j) {
+            common_batch_add(batch, tokens[j], pos + j, {seq}, false);
+        }
+        if (llama_decode(_ctx, batch) != 0) {
+            llama_batch_free(batch);
+            throw std::runtime_error("llama_decode() failed while assembling passages");
+        }
+    }
+    llama_batch_free(batch);
+}
+
+std::vector<uint8_t>
+LLMInference::encodePassage(const char *text) {
+    std::unique_lock<std::mutex> hold = _holdCompaction();
+    // busy until the blob is copied out: paging this session out would free `_ctx` mid-decode
+    KvSessionHold busy(this);
+    _requireContext();
+    std::vector<llama_token> tokens = common_tokenize(llama_model_get_vocab(_model), text ? text : "", false, false);
+    if (tokens.empty()) {
+        return {};
+    }
+    _ensureCapacity(llama_memory_seq_pos_max(llama_get_memory(_ctx), 0) + 1 + tokens.size());
+    // taken after _ensureCapacity(), which may re-create `_ctx`
+    llama_memory_t memory = llama_get_memory(_ctx);
+    llama_memory_seq_rm(memory, kScratchSeq, -1, -1);
+    _decodeTokens(tokens.data(), static_cast<int32_t>(tokens.size()), 0, kScratchSeq);
+
+    const PassageHeader header = {kPassageMagic, llama_model_n_layer(_model), llama_model_n_embd(_model),
+                                  llama_vocab_n_tokens(llama_model_get_vocab(_model)),
+                                  static_cast<int32_t>(tokens.size())};
+    const size_t tokenBytes = tokens.size() * sizeof(llama_token);
+    std::vector<uint8_t> blob(sizeof(header) + tokenBytes + llama_state_seq_get_size(_ctx, kScratchSeq));
+    std::memcpy(blob.data(), &header, sizeof(header));
+    std::memcpy(blob.data() + sizeof(header), tokens.data(), tokenBytes);
+    const size_t stateBytes = llama_state_seq_get_data(_ctx, blob.data() + sizeof(header) + tokenBytes,
+                                                       blob.size() - sizeof(header) - tokenBytes, kScratchSeq);
+    llama_memory_seq_rm(memory, kScratchSeq, -1, -1);
+    blob.resize(sizeof(header) + tokenBytes + stateBytes);
+    return blob;
+}
+
+void
+LLMInference::startCompletionWithPassages(const char *query, const std::vector<std::vector<uint8_t>> &passages,
+                                          const std::vector<std::string> &gaps, float recomputeRatio) {
+    const int64_t start = ggml_time_us();
+    const llama_vocab *vocab = llama_model_get_vocab(_model);
+
+    // validate every blob before touching the conversation
+    std::vector<const PassageHeader *> headers;
+    for (const std::vector<uint8_t> &blob: passages) {
+        const auto *header = reinterpret_cast<const PassageHeader *>(blob.data());
+        if (blob.size() < sizeof(PassageHeader) || header->magic != kPassageMagic ||
+            header->nLayer != llama_model_n_layer(_model) || header->nEmbd != llama_model_n_embd(_model) ||
+            header->nVocab != llama_vocab_n_tokens(vocab) ||
+            blob.size() < sizeof(PassageHeader) + header->nTokens * sizeof(llama_token)) {
+            throw std::invalid_argument("passage KV was not encoded with this model");
+        }
+        headers.push_back(header);
+    }
+    if (passages.empty() || gaps.size() != passages.size() + 1) {
+        throw std::invalid_argument("expected at least one passage and one more gap than passages");
+    }
+
+    KvSessionManager::instance().acquire(this, true);
+    std::fill(std::begin(_passageStats), std::end(_passageStats), 0);
+    std::string prompt = _beginTurn(query);
+    const size_t marker = prompt.find(kPassageMarker);
+    const bool addSpecial = (_prevLen == 0);
+    const llama_pos turnStart = _turnStartPos();
+    _turnKvStart = turnStart;
+    llama_pos pos = turnStart;
+    std::string passageText;
+    try {
+        if (marker == std::string::npos) {
+            throw std::invalid_argument("query does not contain the passage marker");
+        }
+        // prefix and the text between passages are prefilled as usual
+        auto prefill = [&](const std::string &text, bool special) {
+            std::vector<llama_token> tokens = common_tokenize(vocab, text, special, true);
+            if (tokens.empty()) return;
+            _ensureCapacity(pos + tokens.size());
+            _decodeTokens(tokens.data(), static_cast<int32_t>(tokens.size()), pos, 0);
+            pos += tokens.size();
+            _passageStats[2] += tokens.size();
+        };
+        prefill(prompt.substr(0, marker) + gaps[0], addSpecial);
+
+        // _ensureCapacity() may re-create `_ctx`, so the memory handle is looked up per use
+        const bool canShift = llama_memory_can_shift(llama_get_memory(_ctx));
+        for (size_t i = 0; i < passages.size(); ++i) {
+            const PassageHeader &header = *headers[i];
+            const auto *tokens = reinterpret_cast<const llama_token *>(passages[i].data() + sizeof(PassageHeader));
+            const uint8_t *state = passages[i].data() + sizeof(PassageHeader) + header.nTokens * sizeof(llama_token);
+            const size_t stateBytes = passages[i].size() - (state - passages[i].data());
+            _ensureCapacity(pos + header.nTokens);
+
+            // The first tokens of each passage are recomputed so they attend to everything before them;
+            // the cached rest is rotated to its new position and spliced in after them.
+            int32_t recompute = std::min<int32_t>(header.nTokens,
+                                                  static_cast<int32_t>(std::ceil(recomputeRatio * header.nTokens)));
+            if (!canShift) {
+                recompute = header.nTokens;
+            }
+            if (recompute > 0) {
+                _decodeTokens(tokens, recompute, pos, 0);
+            }
+            if (recompute < header.nTokens) {
+                llama_memory_t memory = llama_get_memory(_ctx);
+                llama_memory_seq_rm(memory, kScratchSeq, -1, -1);
+                if (llama_state_seq_set_data(_ctx, state, stateBytes, kScratchSeq) != stateBytes) {
+                    throw std::runtime_error("failed to restore passage KV");
+                }
+                llama_memory_seq_rm(memory, kScratchSeq, 0, recompute);
+                llama_memory_seq_add(memory, kScratchSeq, recompute, -1, pos);
+                llama_memory_seq_cp(memory, kScratchSeq, 0, -1, -1);
+                llama_memory_seq_rm(memory, kScratchSeq, -1, -1);
+            }
+            pos += header.nTokens;
+            _passageStats[0] += header.nTokens - recompute;
+            _passageStats[1] += recompute;
+            passageText += common_detokenize(vocab, std::vector<llama_token>(tokens, tokens + header.nTokens), false);
+            if (i + 1 < passages.size()) {
+                prefill(gaps[i + 1], false);
+                passageText += gaps[i + 1];
+            }
+        }
+    } catch (...) {
+        // drop the half-assembled turn so the conversation is left as it was
+        if (_ctx) {
+            llama_memory_t memory = llama_get_memory(_ctx);
+            llama_memory_seq_rm(memory, kScratchSeq, -1, -1);
+            llama_memory_seq_rm(memory, 0, turnStart, -1);
+        }
+        free(const_cast<char *>(_messages.back().role));
+        free(const_cast<char *>(_messages.back().content));
+        _messages.pop_back();
+        KvSessionManager::instance().release(this);
+        throw;
+    }
+
+    // keep the real text in the history so later turns are formatted consistently
+    llama_chat_message &message = _messages.back();
+    std::string content(message.content);
+    const size_t contentMarker = content.find(kPassageMarker);
+    if (contentMarker != std::string::npos) {
+        content.replace(contentMarker, std::strlen(kPassageMarker), gaps[0] + passageText + gaps.back());
+        free(const_cast<char *>(message.content));
+        message.content = strdup(content.c_str());
+    }
+
+    // the tail ends in the assistant header; completionLoop() decodes it and samples
+    const std::string tail = gaps.back() + prompt.substr(marker + std::strlen(kPassageMarker));
+    _promptTokens = common_tokenize(vocab, tail, false, true);
+    _passageStats[2] += _promptTokens.size();
+    _passageStats[3] += ggml_time_us() - start;
+    _setPromptBatch(pos);
+}
+
+std::vector<int64_t>
+LLMInference::getPassageStats() const {
+    return {_passageStats[0], _passageStats[1], _passageStats[2], _passageStats[3]};
+}
+
+std::string
+LLMInference::compressContext(const char *query, const char *context, float targetRatio) {
+    if (!(targetRatio > 0.0f && targetRatio <= 1.0f)) {
+        throw std::invalid_argument("targetRatio must be in (0, 1]");
+    }
+    const int64_t start = ggml_time_us();
+    std::unique_lock<std::mutex> hold = _holdCompaction();
+    KvSessionHold busy(this);
+    _requireContext();
+    const llama_vocab *vocab = llama_model_get_vocab(_model);
+    std::vector<llama_token> prefix = common_tokenize(vocab, query ? query : "", true, false);
+    const std::vector<llama_token> tokens = common_tokenize(vocab, context ? context : "", false, false);
+    _compressionStats[0] = static_cast<int64_t>(tokens.size());
+    _compressionStats[1] = static_cast<int64_t>(tokens.size());
+    _compressionStats[2] = 0;
+    if (tokens.empty() || targetRatio >= 1.0f) {
+        return context ? context : "";
+    }
+    if (prefix.empty()) {
+        prefix.push_back(llama_vocab_bos(vocab));
+    }
+
+    // score every context token in the scratch sequence, conditioned on the query:
+    // surprisal[i] = -log p(tokens[i] | query, tokens[0..i)), read from the logits of the previous position
+    const size_t total = prefix.size() + tokens.size();
+    _ensureCapacity(llama_memory_seq_pos_max(llama_get_memory(_ctx), 0) + 1 + total);
+    // taken after _ensureCapacity(), which may re-create `_ctx`
+    llama_memory_t memory = llama_get_memory(_ctx);
+    llama_memory_seq_rm(memory, kScratchSeq, -1, -1);
+    // the restricted head (if any) would cut the graph before the full-vocabulary logits
+    const RestrictedHead *restrictedHead = _restrictedHead;
+    _restrictedHead = nullptr;
+    const int32_t nVocab = llama_vocab_n_tokens(vocab);
+    const int32_t nBatch = static_cast<int32_t>(llama_n_batch(_ctx));
+    std::vector<float> surprisal(tokens.size(), 0.0f);
+    llama_batch batch = llama_batch_init(nBatch, 0, 1);
+    for (size_t i = 0; i < total; i += nBatch) {
+        common_batch_clear(batch);
+        const size_t end = std::min(total, i + nBatch);
+        for (size_t j = i; j < end; ++j) {
+            const llama_token token = j < prefix.size() ? prefix[j] : tokens[j - prefix.size()];
+            // position j predicts token j + 1, which is a context token from the last prefix token on
+            common_batch_add(batch, token, static_cast<llama_pos>(j), {kScratchSeq},
+                             j + 1 >= prefix.size() && j + 1 < total);
+        }
+        if (llama_decode(_ctx, batch) != 0) {
+            llama_batch_free(batch);
+            llama_memory_seq_rm(memory, kScratchSeq, -1, -1);
+            _restrictedHead = restrictedHead;
+            throw std::runtime_error("llama_decode() failed while scoring context tokens");
+        }
+        for (size_t j = i; j < end; ++j) {
+            if (j + 1 < prefix.size() || j + 1 >= total) {
+                continue;
+            }
+            const float *logits = llama_get_logits_ith(_ctx, static_cast<int32_t>(j - i));
+            const float maxLogit = *std::max_element(logits, logits + nVocab);
+            double sum = 0.0;
+            for (int32_t v = 0; v < nVocab; ++v) {
+                sum += std::exp(logits[v] - maxLogit);
+            }
+            const size_t target = j + 1 - prefix.size();
+            surprisal[target] = static_cast<float>(std::log(sum) + maxLogit - logits[tokens[target]]);
+        }
+    }
+    llama_batch_free(batch);
+    llama_memory_seq_rm(memory, kScratchSeq, -1, -1);
+    _restrictedHead = restrictedHead;
+
+    // tokens are kept or dropped in units that detokenize to valid UTF-8 on their own (byte-fallback
+    // tokens of one character stay together), scored by their mean surprisal
+    struct Unit {
+        size_t first;
+        size_t count;
+        float  score;
+        bool   keep;
+    };
+    std::vector<Unit> units;
+    std::string pending;
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        if (pending.empty()) {
+            units.push_back({i, 0, 0.0f, false});
+        }
+        Unit &unit = units.back();
+        pending += common_token_to_piece(_ctx, tokens[i]);
+        unit.count++;
+        unit.score += surprisal[i];
+        if (_isValidUtf8(pending.c_str())) {
+            unit.score /= static_cast<float>(unit.count);
+            // line breaks carry the passage boundaries and headers
+            unit.keep = pending.find('\n') != std::string::npos;
+            pending.clear();
+        }
+    }
+    if (!pending.empty()) {
+        units.back().score /= static_cast<float>(units.back().count);
+    }
+
+    // keep the most surprising units until `targetRatio` of the tokens remain
+    const size_t budget = static_cast<size_t>(std::ceil(targetRatio * tokens.size()));
+    size_t kept = 0;
+    std::vector<size_t> order(units.size());
+    for (size_t i = 0; i < units.size(); ++i) {
+        order[i] = i;
+        kept += units[i].keep ? units[i].count : 0;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return units[a].score > units[b].score; });
+    for (size_t i = 0; i < order.size() && kept < budget; ++i) {
+        if (!units[order[i]].keep) {
+            units[order[i]].keep = true;
+            kept += units[order[i]].count;
+        }
+    }
+    std::vector<llama_token> compressed;
+    compressed.reserve(kept);
+    for (const Unit &unit: units) {
+        if (unit.keep) {
+            compressed.insert(compressed.end(), tokens.begin() + unit.first, tokens.begin() + unit.first + unit.count);
+        }
+    }
+    _compressionStats[1] = static_cast<int64_t>(compressed.size());
+    _compressionStats[2] = ggml_time_us() - start;
+    LOGi("compressed context from %zu to %zu tokens in %lld us", tokens.size(), compressed.size(),
+         static_cast<long long>(_compressionStats[2]));
+    return common_detokenize(vocab, compressed, false);
+}
+
+std::vector<int64_t>
+LLMInference::getCompressionStats() const {
+    return {_compressionStats[0], _compressionStats[1], _compressionStats[2]};
 }
 
 // taken from:
@@ -245,6 +695,11 @@ LLMInference::_isValidUtf8(const char *response) {
 
 std::string
 LLMInference::completionLoop() {
+    _requireContext();
+    if (_deadlineStop) {
+        _deadlineStop = false;
+        return _endResponse();
+    }
     if (_batch == nullptr || _batch->n_tokens <= 0) {
         LOGe("completionLoop invoked with empty llama_batch");
         throw std::runtime_error("llama batch missing tokens");
@@ -254,7 +709,7 @@ LLMInference::completionLoop() {
     uint32_t contextSize = llama_n_ctx(_ctx);
     _nCtxUsed = llama_memory_seq_pos_max(llama_get_memory(_ctx), 0) + 1;
     if (_nCtxUsed + _batch->n_tokens > contextSize) {
-        throw std::runtime_error("context size reached");
+        _growContext(_nCtxUsed + _batch->n_tokens);
     }
 
     auto start = ggml_time_us();
@@ -262,20 +717,63 @@ LLMInference::completionLoop() {
     if (llama_decode(_ctx, *_batch) < 0) {
         throw std::runtime_error("llama_decode() failed");
     }
+    const bool decodeStep = _batch->n_tokens == 1;
+    if (!decodeStep) {
+        _prefillMicros += ggml_time_us() - start;
+        _prefillTokens += _batch->n_tokens;
+    }
+
+    if (_loopBan >= 0 && !_restrictedHead) {
+        llama_get_logits_ith(_ctx, -1)[_loopBan] = -INFINITY;
+    }
+    _loopBan = -1;
 
     // sample a token and check if it is an EOG (end of generation token)
     // convert the integer token to its corresponding word-piece
-    _currToken = llama_sampler_sample(_sampler, _ctx, -1);
+    _currToken = _restrictedHead ? _sampleRestricted() : llama_sampler_sample(_sampler, _ctx, -1);
     if (llama_vocab_is_eog(llama_model_get_vocab(_model), _currToken)) {
-        if (_storeChats) {
-            addChatMessage(_response.c_str(), "assistant");
+        return _endResponse();
+    }
+
+    const bool monitorConfidence = _confidence.policy().enabled && !_restrictedHead;
+    const bool detectPlateaus =
+            _loopDetector.policy().action != LoopPolicy::OFF && _loopDetector.policy().plateauWindow > 0;
+    const bool wantsEntropy = (detectPlateaus || monitorConfidence) && !_restrictedHead;
+    float margin = 0.0f;
+    const float entropy = wantsEntropy ? _samplingEntropy(monitorConfidence ? &margin : nullptr) : -1.0f;
+    if (monitorConfidence && _confidence.push(entropy, margin)) {
+        _escalated = true;
+        _cascadeStats[1]++;
+        _cascadeStats[2] = _responseNumTokens;
+        LOGi("escalating after %ld tokens (mean entropy %.2f, mean margin %.2f)", _responseNumTokens,
+             _confidence.meanEntropy(), _confidence.meanMargin());
+        return "[ESCALATE]";
+    }
+    const LoopDetector::Detection loop = _loopDetector.push(_currToken, entropy);
+    if (loop != LoopDetector::NONE) {
+        _loopStats[loop == LoopDetector::CYCLE ? 0 : 1]++;
+        if (_loopDetector.policy().action == LoopPolicy::NUDGE && _loopNudges < _loopDetector.policy().maxNudges &&
+            !_restrictedHead) {
+            // a cycle is steered off the token it would repeat next; a plateau off its current token
+            _loopBan = loop == LoopDetector::CYCLE ? _loopDetector.continuation() : _currToken;
+            _loopNudges++;
+            _loopStats[3]++;
+            _loopDetector.reset();
+        } else {
+            _loopStats[2]++;
+            _loopStats[4] = _responseNumTokens;
+            LOGi("stopping a %s after %ld tokens (period %d)",
+                 loop == LoopDetector::CYCLE ? "repetition cycle" : "low-entropy plateau", _responseNumTokens,
+                 _loopDetector.period());
+            return _endResponse();
         }
-        _response.clear();
-        _cacheResponseTokens.clear();
-        return "[EOG]";
     }
     std::string piece = common_token_to_piece(_ctx, _currToken, true);
     auto end = ggml_time_us();
+    if (decodeStep) {
+        _decodeStepMicros += end - start;
+        _decodeSteps += 1;
+    }
     _responseGenerationTime += (end - start);
     _responseNumTokens += 1;
     _cacheResponseTokens += piece;
@@ -298,6 +796,7 @@ LLMInference::completionLoop() {
 
     if (_isValidUtf8(_cacheResponseTokens.c_str())) {
         _response += _cacheResponseTokens;
+        _checkDeadline();
         std::string valid_utf8_piece = _cacheResponseTokens;
         _cacheResponseTokens.clear();
         return valid_utf8_piece;
@@ -306,8 +805,159 @@ LLMInference::completionLoop() {
     return "";
 }
 
+std::string
+LLMInference::_endResponse() {
+    if (_storeChats) {
+        addChatMessage(_response.c_str(), "assistant");
+    }
+    _response.clear();
+    _cacheResponseTokens.clear();
+    return "[EOG]";
+}
+
+// entropy (nats) of the full next-token distribution at temperature 1, and optionally the
+// probability margin between its two most likely tokens
+float
+LLMInference::_samplingEntropy(float *margin) {
+    const float *logits = llama_get_logits_ith(_ctx, -1);
+    const int32_t nVocab = llama_vocab_n_tokens(llama_model_get_vocab(_model));
+    const float maxLogit = *std::max_element(logits, logits + nVocab);
+    double sum = 0.0;
+    double weighted = 0.0;
+    double top2 = -INFINITY;
+    bool maxSeen = false;
+    for (int32_t i = 0; i < nVocab; ++i) {
+        const double z = logits[i] - maxLogit;
+        if (std::isinf(z)) {
+            continue;
+        }
+        const double e = std::exp(z);
+        sum += e;
+        weighted += e * z;
+        if (z == 0.0 && !maxSeen) {
+            maxSeen = true;
+        } else {
+            top2 = std::max(top2, z);
+        }
+    }
+    if (margin != nullptr) {
+        *margin = static_cast<float>((1.0 - std::exp(top2)) / sum);
+    }
+    return static_cast<float>(std::log(sum) - weighted / sum);
+}
+
+// tokens of decode time kept free when fitting the prompt, and the window before the deadline in
+// which generation stops at the next sentence boundary
+static constexpr int kDeadlineReserveTokens = 32;
+static constexpr int kDeadlineWrapUpTokens = 24;
+// prompt tokens always kept at the start (template, system prompt) when the middle is dropped
+static constexpr size_t kDeadlineHeadTokens = 32;
+
+void
+LLMInference::setDeadline(int64_t budgetMicros) {
+    _nextDeadlineMicros = std::max<int64_t>(0, budgetMicros);
+}
+
+void
+LLMInference::_fitPromptToDeadline() {
+    if (_deadlineAt == 0 || _prefillTokens == 0) {
+        // nothing measured yet: the first response of a session runs untruncated
+        return;
+    }
+    const double prefillPerToken = static_cast<double>(_prefillMicros) / _prefillTokens;
+    const double decodePerToken =
+            _decodeSteps > 0 ? static_cast<double>(_decodeStepMicros) / _decodeSteps : prefillPerToken;
+    const double left = static_cast<double>(_deadlineAt - ggml_time_us()) - kDeadlineReserveTokens * decodePerToken;
+    const size_t affordable = left > 0 ? static_cast<size_t>(left / prefillPerToken) : 0;
+    if (affordable >= _promptTokens.size()) {
+        return;
+    }
+    // keep the head (template, system prompt) and the tail (latest question, assistant header)
+    const size_t keep = std::max<size_t>(affordable, 2 * kDeadlineHeadTokens);
+    if (keep >= _promptTokens.size()) {
+        return;
+    }
+    const size_t head = std::min(kDeadlineHeadTokens, keep / 2);
+    const size_t dropped = _promptTokens.size() - keep;
+    _promptTokens.erase(_promptTokens.begin() + head, _promptTokens.begin() + head + dropped);
+    _deadlineStats[2] = static_cast<int64_t>(dropped);
+    _historyTruncated = _storeChats;
+    LOGi("deadline: dropped %zu prompt tokens (%.0f us/token prefill)", dropped, prefillPerToken);
+}
+
+static bool
+endsSentence(const std::string &text) {
+    const size_t last = text.find_last_not_of(" \t");
+    if (last == std::string::npos) {
+        return false;
+    }
+    const char c = text[last];
+    return c == '.' || c == '!' || c == '?' || c == '\n' || (last < text.size() - 1 && c == ':');
+}
+
+void
+LLMInference::_checkDeadline() {
+    if (_deadlineAt == 0 || _decodeSteps == 0) {
+        return;
+    }
+    const double perToken = static_cast<double>(_decodeStepMicros) / _decodeSteps;
+    const double left = static_cast<double>(_deadlineAt - ggml_time_us());
+    if (left < 1.5 * perToken) {
+        _deadlineStop = true;
+        _deadlineStats[3] = 2;
+    } else if (left < kDeadlineWrapUpTokens * perToken && endsSentence(_response)) {
+        _deadlineStop = true;
+        _deadlineStats[3] = 1;
+    }
+}
+
+std::vector<int64_t>
+LLMInference::getDeadlineStats() const {
+    return {_deadlineStats[0], _deadlineStats[1], _deadlineStats[2], _deadlineStats[3]};
+}
+
+void
+LLMInference::setLoopPolicy(const LoopPolicy &policy) {
+    _loopDetector.setPolicy(policy);
+}
+
+std::vector<int64_t>
+LLMInference::getLoopStats() const {
+    return {_loopStats[0], _loopStats[1], _loopStats[2], _loopStats[3], _loopStats[4]};
+}
+
+void
+LLMInference::setConfidencePolicy(const ConfidencePolicy &policy) {
+    _confidence.setPolicy(policy);
+    if (!policy.enabled) {
+        _turnText.clear();
+        _turnTokens.clear();
+    }
+}
+
+std::vector<int64_t>
+LLMInference::getCascadeStats() const {
+    return {_cascadeStats[0],
+            _cascadeStats[1],
+            _cascadeStats[2],
+            _cascadeStats[3],
+            static_cast<int64_t>(_confidence.meanEntropy() * 1000.0),
+            static_cast<int64_t>(_confidence.meanMargin() * 1000.0)};
+}
+
 void
 LLMInference::stopCompletion() {
+    if (_escalated) {
+        // the turn goes to the larger model: forget the query and everything decoded for it
+        free(const_cast<char *>(_messages.back().role));
+        free(const_cast<char *>(_messages.back().content));
+        _messages.pop_back();
+        if (_ctx) {
+            llama_memory_seq_rm(llama_get_memory(_ctx), 0, _turnKvStart, -1);
+        }
+        _escalated = false;
+        _historyTruncated = false;
+    }
     if (_storeChats) {
         _prevLen = llama_chat_apply_template(_chatTemplate, _messages.data(), _messages.size(), false, nullptr, 0);
         if (_prevLen < 0) {
@@ -316,8 +966,249 @@ LLMInference::stopCompletion() {
     } else {
         _prevLen = 0;
     }
+    if (_activeGrammar && _responseGenerationTime > 0) {
+        LOGi("grammar: %lld mask hits, %lld misses, constraint %.1f%% of decode time",
+             (long long) _activeGrammar->maskHits, (long long) _activeGrammar->maskMisses,
+             100.0 * _activeGrammar->constraintMicros / _responseGenerationTime);
+    }
+    if (_deadlineAt > 0) {
+        _deadlineStats[1] = ggml_time_us() - _deadlineStart;
+        _deadlineAt = 0;
+        _deadlineStop = false;
+    }
     _response.clear();
     _cacheResponseTokens.clear();
+    {
+        std::lock_guard<std::mutex> lock(_compactionMutex);
+        _turnActive = false;
+        if (_compactionPolicy.enabled && _storeChats && _ctx &&
+            llama_memory_seq_pos_max(llama_get_memory(_ctx), 0) + 1 >= _compactionPolicy.triggerTokens) {
+            _compactionDue = ggml_time_us() + static_cast<int64_t>(_compactionPolicy.idleMillis) * 1000;
+            _compactionWake.notify_one();
+        }
+    }
+    KvSessionManager::instance().release(this);
+}
+
+// applies `chatTemplate` to `messages`, growing `buffer` as needed
+static std::string
+formatChat(const char *chatTemplate, const std::vector<llama_chat_message> &messages, bool addAssistant,
+           std::vector<char> &buffer) {
+    int len = llama_chat_apply_template(chatTemplate, messages.data(), messages.size(), addAssistant, buffer.data(),
+                                        buffer.size());
+    if (len > (int) buffer.size()) {
+        buffer.resize(len);
+        len = llama_chat_apply_template(chatTemplate, messages.data(), messages.size(), addAssistant, buffer.data(),
+                                        buffer.size());
+    }
+    if (len < 0) {
+        throw std::runtime_error("llama_chat_apply_template() failed while compacting the history");
+    }
+    return std::string(buffer.begin(), buffer.begin() + len);
+}
+
+std::unique_lock<std::mutex>
+LLMInference::_holdCompaction() {
+    _compactionCancel = true;
+    std::unique_lock<std::mutex> lock(_compactionMutex);
+    _compactionCancel = false;
+    _compactionDue = 0;
+    return lock;
+}
+
+void
+LLMInference::setCompactionPolicy(const CompactionPolicy &policy) {
+    std::unique_lock<std::mutex> hold = _holdCompaction();
+    _compactionPolicy = policy;
+    _compactionPolicy.keepRecentTurns = std::max(0, policy.keepRecentTurns);
+    _compactionPolicy.summaryTokens = std::max(16, policy.summaryTokens);
+    _compactionPolicy.idleMillis = std::max(0, policy.idleMillis);
+    _compactionPolicy.nThreads = std::max(1, policy.nThreads);
+    if (policy.enabled && !_compactionThread.joinable()) {
+        _compactionThread = std::thread(&LLMInference::_compactionWorker, this);
+    }
+}
+
+bool
+LLMInference::compactHistory() {
+    std::unique_lock<std::mutex> hold = _holdCompaction();
+    if (_turnActive || !_storeChats) {
+        return false;
+    }
+    KvSessionHold busy(this);
+    return _compactHistory();
+}
+
+std::vector<int64_t>
+LLMInference::getCompactionStats() const {
+    return {_compactionStats[0], _compactionStats[1], _compactionStats[2], _compactionStats[3], _compactionStats[4]};
+}
+
+void
+LLMInference::_compactionWorker() {
+    // background priority; with one decode thread this is also the only thread doing the work
+    setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 10);
+    std::unique_lock<std::mutex> lock(_compactionMutex);
+    while (!_compactionExit) {
+        if (_compactionDue == 0) {
+            _compactionWake.wait(lock);
+            continue;
+        }
+        const int64_t wait = _compactionDue - ggml_time_us();
+        if (wait > 0) {
+            _compactionWake.wait_for(lock, std::chrono::microseconds(wait));
+            continue;
+        }
+        _compactionDue = 0;
+        if (_turnActive || !_compactionPolicy.enabled) {
+            continue;
+        }
+        try {
+            KvSessionHold busy(this);
+            _compactHistory();
+        } catch (const std::exception &error) {
+            LOGe("history compaction failed: %s", error.what());
+        }
+    }
+}
+
+// decodes the first `n` of `tokens` into the scratch sequence from position 0; false if a
+// foreground call asked to abandon the compaction in between
+bool
+LLMInference::_prefillScratch(const std::vector<llama_token> &tokens, int32_t n) {
+    _ensureCapacity(llama_memory_seq_pos_max(llama_get_memory(_ctx), 0) + 1 + n + _compactionPolicy.summaryTokens);
+    llama_memory_seq_rm(llama_get_memory(_ctx), kScratchSeq, -1, -1);
+    const int32_t nBatch = static_cast<int32_t>(llama_n_batch(_ctx));
+    for (int32_t i = 0; i < n; i += nBatch) {
+        if (_compactionCancel) {
+            return false;
+        }
+        _decodeTokens(tokens.data() + i, std::min(nBatch, n - i), i, kScratchSeq);
+    }
+    return !_compactionCancel;
+}
+
+// Called with `_compactionMutex` held and no turn in progress. The summary and the rebuilt
+// history are decoded in the scratch sequence, so sequence 0 and `_messages` are only replaced
+// once both are complete.
+bool
+LLMInference::_compactHistory() {
+    _requireContext();
+    const int64_t start = ggml_time_us();
+    size_t firstTurn = 0;
+    while (firstTurn < _messages.size() && std::strcmp(_messages[firstTurn].role, "system") == 0) {
+        ++firstTurn;
+    }
+    const size_t split = HistoryCompactor::splitPoint(_messages, firstTurn, _compactionPolicy.keepRecentTurns);
+    if (split == firstTurn) {
+        return false;
+    }
+    std::string base;
+    std::string previousSummary;
+    if (firstTurn > 0) {
+        HistoryCompactor::splitSystemPrompt(_messages[0].content, base, previousSummary);
+    }
+
+    const llama_vocab *vocab = llama_model_get_vocab(_model);
+    const llama_pos tokensBefore = llama_memory_seq_pos_max(llama_get_memory(_ctx), 0) + 1;
+    std::vector<char> buffer(4096);
+    const std::string request = HistoryCompactor::summaryRequest(_messages, firstTurn, split, previousSummary,
+                                                                 _compactionPolicy.summaryTokens);
+    const std::vector<llama_token> requestTokens = common_tokenize(
+            vocab, formatChat(_chatTemplate, {{"user", request.c_str()}}, true, buffer), true, true);
+
+    // low priority: fewer decode threads, and the restricted head (if any) would cut the
+    // graph before the full-vocabulary logits the summary is sampled from
+    const RestrictedHead *restrictedHead = _restrictedHead;
+    _restrictedHead = nullptr;
+    llama_set_n_threads(_ctx, _compactionPolicy.nThreads, _compactionPolicy.nThreads);
+    std::string summary;
+    std::vector<llama_chat_message> rebuilt;
+    std::vector<llama_token> rebuiltTokens;
+    bool complete = false;
+    try {
+        if (_prefillScratch(requestTokens, static_cast<int32_t>(requestTokens.size()) - 1)) {
+            // greedy, so the summary does not depend on the chat's sampling settings
+            std::vector<llama_token> summaryTokens;
+            llama_batch batch = llama_batch_init(1, 0, 1);
+            llama_token token = requestTokens.back();
+            llama_pos pos = static_cast<llama_pos>(requestTokens.size()) - 1;
+            const int32_t nVocab = llama_vocab_n_tokens(vocab);
+            while (!_compactionCancel && static_cast<int32_t>(summaryTokens.size()) < _compactionPolicy.summaryTokens) {
+                common_batch_clear(batch);
+                common_batch_add(batch, token, pos++, {kScratchSeq}, true);
+                if (llama_decode(_ctx, batch) != 0) {
+                    llama_batch_free(batch);
+                    throw std::runtime_error("llama_decode() failed while summarizing the history");
+                }
+                const float *logits = llama_get_logits_ith(_ctx, -1);
+                token = static_cast<llama_token>(std::max_element(logits, logits + nVocab) - logits);
+                if (llama_vocab_is_eog(vocab, token)) {
+                    break;
+                }
+                summaryTokens.push_back(token);
+            }
+            llama_batch_free(batch);
+            summary = common_detokenize(vocab, summaryTokens, false);
+            summary.erase(0, summary.find_first_not_of(" \n"));
+            summary.erase(summary.find_last_not_of(" \n") + 1);
+        }
+
+        if (!_compactionCancel && !summary.empty()) {
+            const std::string system = HistoryCompactor::joinSystemPrompt(base, summary);
+            rebuilt.push_back({"system", system.c_str()});
+            rebuilt.insert(rebuilt.end(), _messages.begin() + std::min<size_t>(firstTurn, 1),
+                           _messages.begin() + firstTurn);
+            rebuilt.insert(rebuilt.end(), _messages.begin() + split, _messages.end());
+            const std::string history = formatChat(_chatTemplate, rebuilt, false, buffer);
+            rebuiltTokens = common_tokenize(vocab, history, true, true);
+            complete = _prefillScratch(rebuiltTokens, static_cast<int32_t>(rebuiltTokens.size()));
+            if (complete) {
+                llama_memory_seq_rm(llama_get_memory(_ctx), 0, -1, -1);
+                llama_memory_seq_cp(llama_get_memory(_ctx), kScratchSeq, 0, -1, -1);
+                for (size_t i = 0; i < split; ++i) {
+                    if (i == 0 || i >= firstTurn) {
+                        free(const_cast<char *>(_messages[i].role));
+                        free(const_cast<char *>(_messages[i].content));
+                    }
+                }
+                rebuilt[0] = {strdup("system"), strdup(system.c_str())};
+                _messages = std::move(rebuilt);
+                _prevLen = static_cast<int>(history.size());
+                _nCtxUsed = static_cast<int>(rebuiltTokens.size());
+                _historyTruncated = false;
+            }
+        }
+    } catch (...) {
+        if (_ctx) {
+            llama_memory_seq_rm(llama_get_memory(_ctx), kScratchSeq, -1, -1);
+            llama_set_n_threads(_ctx, _ctxParams.n_threads, _ctxParams.n_threads_batch);
+        }
+        _restrictedHead = restrictedHead;
+        throw;
+    }
+    llama_memory_seq_rm(llama_get_memory(_ctx), kScratchSeq, -1, -1);
+    llama_set_n_threads(_ctx, _ctxParams.n_threads, _ctxParams.n_threads_batch);
+    _restrictedHead = restrictedHead;
+    if (!complete) {
+        if (_compactionCancel) {
+            _compactionStats[1]++;
+        }
+        return false;
+    }
+
+    // give back the cells an earlier grow allocated if the short history fits the initial size
+    if (llama_n_ctx(_ctx) > _nCtxInitial && rebuiltTokens.size() * 2 <= _nCtxInitial) {
+        _resizeContext(_nCtxInitial, true);
+        _ctxShrinks++;
+    }
+    _compactionStats[0]++;
+    _compactionStats[2] = tokensBefore;
+    _compactionStats[3] = static_cast<int64_t>(rebuiltTokens.size());
+    _compactionStats[4] = ggml_time_us() - start;
+    LOGi("compacted %zu messages: %d -> %zu KV tokens in %lld us", split - firstTurn, tokensBefore,
+         rebuiltTokens.size(), static_cast<long long>(_compactionStats[4]));
+    return true;
 }
 
 void
@@ -328,13 +1219,372 @@ LLMInference::setReasoningOptions(bool disableThinking, int reasoningBudget) {
     LOGi("Reasoning controls: disableThinking=%d, reasoningBudget=%d", _disableThinking, _reasoningBudget);
 }
 
+void
+LLMInference::_resizeContext(uint32_t nCtx, bool keepState) {
+    const int64_t start = ggml_time_us();
+    const uint32_t previous = _ctx ? llama_n_ctx(_ctx) : 0;
+    std::vector<uint8_t> state;
+    if (keepState && _ctx) {
+        state.resize(llama_state_seq_get_size(_ctx, 0));
+        state.resize(llama_state_seq_get_data(_ctx, state.data(), state.size(), 0));
+    }
+    // free the old context first so both KV buffers are never allocated at once
+    llama_free(_ctx);
+    _kvCells = 0;
+    _ctxParams.n_ctx = nCtx;
+    _ctx = llama_init_from_model(_model, _ctxParams);
+    const char *error = nullptr;
+    if (!_ctx) {
+        error = "llama_init_from_model() failed while resizing the context";
+    } else if (!state.empty() && llama_state_seq_set_data(_ctx, state.data(), state.size(), 0) != state.size()) {
+        error = "failed to migrate KV cache to the resized context";
+        llama_free(_ctx);
+        _ctx = nullptr;
+    }
+    if (error) {
+        LOGe("resizing the context to n_ctx=%u failed: %s", nCtx, error);
+        _rollbackResize(previous, state);
+        throw std::runtime_error(error);
+    }
+    _kvCells = nCtx;
+    _ctxLost = false;
+    _ctxMigrationMicros += ggml_time_us() - start;
+}
+
+// brings back the `nCtx`-cell context a failed _resizeContext() freed, with its sequence `state`
+void
+LLMInference::_rollbackResize(uint32_t nCtx, const std::vector<uint8_t>& state) {
+    _ctxParams.n_ctx = nCtx;
+    _ctx = nCtx > 0 ? llama_init_from_model(_model, _ctxParams) : nullptr;
+    if (!_ctx) {
+        LOGe("failed to re-create llama_context with n_ctx=%u; the session is unusable", nCtx);
+        _ctxLost = true;
+        return;
+    }
+    _kvCells = nCtx;
+    if (!state.empty() && llama_state_seq_set_data(_ctx, state.data(), state.size(), 0) != state.size()) {
+        // the cache cannot be resumed; the next completion re-processes the whole conversation
+        llama_memory_clear(llama_get_memory(_ctx), true);
+        _prevLen = 0;
+    }
+}
+
+void
+LLMInference::_requireContext() const {
+    if (_ctxLost) {
+        throw std::runtime_error("the llama_context was lost in a failed resize; call clearHistory() or reload the model");
+    }
+}
+
+void
+LLMInference::_growContext(uint32_t required) {
+    uint32_t nCtx = llama_n_ctx(_ctx);
+    if (required > _nCtxMax || nCtx >= _nCtxMax) {
+        throw std::runtime_error("context size reached");
+    }
+    while (nCtx < required) {
+        nCtx *= 2;
+    }
+    nCtx = std::min(nCtx, _nCtxMax);
+    LOGi("growing context %u -> %u cells (%u needed)", llama_n_ctx(_ctx), nCtx, required);
+    _resizeContext(nCtx, true);
+    _ctxGrows++;
+}
+
+void
+LLMInference::clearHistory() {
+    std::unique_lock<std::mutex> hold = _holdCompaction();
+    KvSessionHold busy(this);
+    for (auto it = _messages.begin(); it != _messages.end();) {
+        if (std::strcmp(it->role, "system") != 0) {
+            free(const_cast<char *>(it->role));
+            free(const_cast<char *>(it->content));
+            it = _messages.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    _prevLen = 0;
+    _nCtxUsed = 0;
+    _response.clear();
+    _cacheResponseTokens.clear();
+    if (_ctxLost) {
+        // a fresh, empty context is all a cleared history needs
+        _resizeContext(_nCtxInitial, false);
+    } else if (llama_n_ctx(_ctx) > _nCtxInitial) {
+        _resizeContext(_nCtxInitial, false);
+        _ctxShrinks++;
+    } else {
+        llama_memory_clear(llama_get_memory(_ctx), true);
+    }
+}
+
+// reads a "<key>: <n> kB" line of /proc/self/status; 0 where it is not available
+static int64_t
+readProcStatusKb(const char *key) {
+    FILE *file = std::fopen("/proc/self/status", "r");
+    if (!file) {
+        return 0;
+    }
+    char line[256];
+    int64_t value = 0;
+    const size_t keyLen = std::strlen(key);
+    while (std::fgets(line, sizeof(line), file)) {
+        if (std::strncmp(line, key, keyLen) == 0 && line[keyLen] == ':') {
+            value = std::strtoll(line + keyLen + 1, nullptr, 10);
+            break;
+        }
+    }
+    std::fclose(file);
+    return value;
+}
+
+std::vector<int64_t>
+LLMInference::getContextStats() const {
+    return {_ctx ? static_cast<int64_t>(llama_n_ctx(_ctx)) : 0, static_cast<int64_t>(_nCtxMax), _ctxGrows, _ctxShrinks,
+            _ctxMigrationMicros, readProcStatusKb("VmHWM"), readProcStatusKb("VmRSS")};
+}
+
+size_t
+LLMInference::kvCacheBytes() const {
+    // called by KvSessionManager for every session, so it must not touch `_ctx`, which the
+    // owning thread may be re-creating
+    const uint32_t cells = _kvCells;
+    if (cells == 0) {
+        return 0;
+    }
+    // f16 K and V per layer; the KV head count makes this right for GQA models
+    const int32_t nHead = std::max(llama_model_n_head(_model), 1);
+    const size_t embdKv = static_cast<size_t>(llama_model_n_embd(_model)) / nHead * llama_model_n_head_kv(_model);
+    return static_cast<size_t>(cells) * llama_model_n_layer(_model) * 2 * embdKv * sizeof(uint16_t);
+}
+
+bool
+LLMInference::pageOut(const std::string &path) {
+    if (_ctx == nullptr) {
+        return false;
+    }
+    const size_t size = llama_state_seq_get_size(_ctx, 0);
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        LOGe("pageOut: cannot create %s", path.c_str());
+        return false;
+    }
+    size_t written = 0;
+    if (ftruncate(fd, static_cast<off_t>(size)) == 0) {
+        void *map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED) {
+            written = llama_state_seq_get_data(_ctx, static_cast<uint8_t *>(map), size, 0);
+            munmap(map, size);
+        }
+    }
+    close(fd);
+    if (written == 0) {
+        unlink(path.c_str());
+        LOGe("pageOut: failed to write KV state to %s", path.c_str());
+        return false;
+    }
+    _pagedTokens = llama_memory_seq_pos_max(llama_get_memory(_ctx), 0) + 1;
+    _pagedCells = llama_n_ctx(_ctx);
+    _pagedBytes = written;
+    _pagedPath = path;
+    _pagedOut = true;
+    llama_free(_ctx);
+    _ctx = nullptr;
+    _kvCells = 0;
+    _pageOuts++;
+    LOGi("paged out %d tokens (%zu bytes) to %s", _pagedTokens, written, path.c_str());
+    return true;
+}
+
+void
+LLMInference::pageIn() {
+    if (_pagedPath.empty()) {
+        return;
+    }
+    const int64_t start = ggml_time_us();
+    _ctxParams.n_ctx = _pagedCells;
+    _ctx = llama_init_from_model(_model, _ctxParams);
+    if (!_ctx) {
+        throw std::runtime_error("llama_init_from_model() failed while restoring a paged session");
+    }
+    _kvCells = _pagedCells;
+    int fd = open(_pagedPath.c_str(), O_RDONLY);
+    void *map = fd >= 0 ? mmap(nullptr, _pagedBytes, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    size_t restored = 0;
+    if (map != MAP_FAILED) {
+        restored = llama_state_seq_set_data(_ctx, static_cast<const uint8_t *>(map), _pagedBytes, 0);
+        munmap(map, _pagedBytes);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    unlink(_pagedPath.c_str());
+    _pagedPath.clear();
+    _pagedOut = false;
+    if (restored != _pagedBytes) {
+        // the cache cannot be resumed; the next completion re-processes the whole conversation
+        llama_memory_clear(llama_get_memory(_ctx), true);
+        _prevLen = 0;
+        throw std::runtime_error("failed to restore paged KV cache");
+    }
+    _lastRestoreMicros = ggml_time_us() - start;
+    _lastRestoredTokens = _pagedTokens;
+    _pageIns++;
+    LOGi("restored %d tokens in %.2f ms", _pagedTokens, _lastRestoreMicros / 1000.0);
+}
+
+std::vector<int64_t>
+LLMInference::getPagingStats() const {
+    const int64_t prefillEstimate = _prefillTokens > 0 ? _lastRestoredTokens * _prefillMicros / _prefillTokens : 0;
+    return {_pageOuts, _pageIns, _lastRestoreMicros, _lastRestoredTokens, prefillEstimate, isPagedOut() ? 1 : 0};
+}
+
+void
+LLMInference::setGrammar(const char *grammar, bool isJsonSchema) {
+    if (grammar == nullptr || grammar[0] == '\0') {
+        _activeGrammar = nullptr;
+        return;
+    }
+    const llama_vocab *vocab = llama_model_get_vocab(_model);
+    CompiledGrammar *compiled = isJsonSchema ? _grammarCache.getForJsonSchema(vocab, grammar)
+                                             : _grammarCache.get(vocab, grammar, "root");
+    if (compiled == nullptr) {
+        throw std::runtime_error("failed to parse grammar");
+    }
+    compiled->reset();
+    _activeGrammar = compiled;
+}
+
+std::vector<int64_t>
+LLMInference::getGrammarStats() const {
+    if (_activeGrammar == nullptr) {
+        return {0, 0, 0};
+    }
+    return {_activeGrammar->maskHits, _activeGrammar->maskMisses, _activeGrammar->constraintMicros};
+}
+
+// llama.cpp has no hook to replace the lm_head, so the graph evaluation callback is used
+// instead: it copies the last row of the final norm ("result_norm") and returns false, which
+// makes the scheduler skip the rest of the graph - the full-vocabulary projection.
+bool
+LLMInference::_evalCallback(struct ggml_tensor *t, bool ask, void *userData) {
+    auto *self = static_cast<LLMInference *>(userData);
+    if (self->_restrictedHead == nullptr || std::strcmp(t->name, "result_norm") != 0) {
+        return false;
+    }
+    if (ask) {
+        return true;
+    }
+    if (t->type != GGML_TYPE_F32 || t->ne[0] != self->_restrictedHead->nEmbd || t->ne[1] == 0) {
+        return true;
+    }
+    const int64_t nEmbd = t->ne[0];
+    self->_hidden.resize(nEmbd);
+    ggml_backend_tensor_get(t, self->_hidden.data(), (t->ne[1] - 1) * t->nb[1], nEmbd * sizeof(float));
+    self->_hiddenCaptured = true;
+    return self->_validateRestrictedHead;
+}
+
+llama_token
+LLMInference::_sampleRestricted() {
+    const RestrictedHead &head = *_restrictedHead;
+    const size_t k = head.tokens.size();
+    const bool captured = _hiddenCaptured;
+    _hiddenCaptured = false;
+    if (captured) {
+        head.logits(_hidden.data(), _restrictedLogits);
+    }
+    _restrictedStats[0]++;
+
+    // without a captured hidden state the full head ran, so gather its logits instead
+    if (!captured || _validateRestrictedHead) {
+        const float *full = llama_get_logits_ith(_ctx, -1);
+        _restrictedLogits.resize(k);
+        if (captured) {
+            const int32_t nVocab = llama_vocab_n_tokens(llama_model_get_vocab(_model));
+            const llama_token fullArgmax = (llama_token) (std::max_element(full, full + nVocab) - full);
+            if (!std::binary_search(head.tokens.begin(), head.tokens.end(), fullArgmax)) {
+                _restrictedStats[3]++;
+            }
+            size_t subsetArgmax = 0;
+            for (size_t i = 1; i < k; ++i) {
+                if (full[head.tokens[i]] > full[head.tokens[subsetArgmax]]) subsetArgmax = i;
+            }
+            const size_t restrictedArgmax =
+                    std::max_element(_restrictedLogits.begin(), _restrictedLogits.end()) - _restrictedLogits.begin();
+            _restrictedStats[1]++;
+            if (restrictedArgmax != subsetArgmax) {
+                _restrictedStats[2]++;
+            }
+        }
+        for (size_t i = 0; i < k; ++i) {
+            _restrictedLogits[i] = full[head.tokens[i]];
+        }
+    }
+
+    _restrictedCandidates.resize(k);
+    for (size_t i = 0; i < k; ++i) {
+        _restrictedCandidates[i] = {head.tokens[i], _restrictedLogits[i], 0.0f};
+    }
+    llama_token_data_array cur = {_restrictedCandidates.data(), k, -1, false};
+    llama_sampler_apply(_sampler, &cur);
+    const llama_token token = cur.data[cur.selected].id;
+    llama_sampler_accept(_sampler, token);
+    return token;
+}
+
+void
+LLMInference::setAllowedTokens(const std::vector<llama_token> &tokens, bool validate) {
+    if (tokens.empty()) {
+        _restrictedHead = nullptr;
+        _validateRestrictedHead = false;
+        return;
+    }
+    const llama_vocab *vocab = llama_model_get_vocab(_model);
+    std::vector<llama_token> allowed = tokens;
+    for (llama_token eog: {llama_vocab_eos(vocab), llama_vocab_eot(vocab)}) {
+        if (eog != LLAMA_TOKEN_NULL) allowed.push_back(eog);
+    }
+    _restrictedHead = _restrictedHeadCache.get(_modelPath, allowed);
+    _validateRestrictedHead = validate;
+    std::fill(std::begin(_restrictedStats), std::end(_restrictedStats), 0);
+    LOGi("restricted head: %zu tokens, validate=%d", _restrictedHead->tokens.size(), validate);
+}
+
+std::vector<int64_t>
+LLMInference::getRestrictedHeadStats() const {
+    return {_restrictedStats[0], _restrictedStats[1], _restrictedStats[2], _restrictedStats[3]};
+}
+
+std::vector<llama_token>
+LLMInference::tokenize(const char *text) const {
+    return common_tokenize(llama_model_get_vocab(_model), text ? text : "", false, true);
+}
+
 LLMInference::~LLMInference() {
+    if (_compactionThread.joinable()) {
+        {
+            std::unique_lock<std::mutex> hold = _holdCompaction();
+            _compactionExit = true;
+            _compactionWake.notify_one();
+        }
+        _compactionThread.join();
+    }
+    KvSessionManager::instance().remove(this);
+    if (!_pagedPath.empty()) {
+        unlink(_pagedPath.c_str());
+    }
     // free memory held by the message text in messages
     // (as we had used strdup() to create a malloc'ed copy)
     for (llama_chat_message &message: _messages) {
         free(const_cast<char *>(message.role));
         free(const_cast<char *>(message.content));
     }
+    _activeGrammar = nullptr;
+    _grammarCache.clear();
+    _restrictedHead = nullptr;
+    _restrictedHeadCache.clear();
     llama_free(_ctx);
     llama_model_free(_model);
     delete _batch;
@@ -346,6 +1596,13 @@ llama_model* LLMInference::getModel() {
     return _model;
 }
 
-llama_context* LLMInference::getContext() {
-    return _ctx;
+ContextLease LLMInference::leaseContext() {
+    const bool wasBusy = KvSessionManager::instance().acquire(this, true);
+    return ContextLease(this, _ctx, !wasBusy);
+}
+
+ContextLease::~ContextLease() {
+    if (_release) {
+        KvSessionManager::instance().release(_session);
+    }
 }
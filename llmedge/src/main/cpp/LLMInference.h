@@ -1,9 +1,20 @@
 #pragma once
 #include "llama.h"
 #include "common.h"
+#include "ConfidenceMonitor.h"
+#include "GrammarConstraint.h"
+#include "HistoryCompactor.h"
+#include "LoopDetector.h"
+#include "RestrictedHead.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
+class ContextLease;
+
 class LLMInference {
     // llama.cpp-specific types
     llama_context* _ctx = nullptr;
@@ -22,6 +33,8 @@ class LLMInference {
     std::vector<llama_token> _promptTokens;
     std::vector<llama_pos>   _batchPos;
     int                      _prevLen = 0;
+    // KV position at which the current turn's prompt starts
+    llama_pos                _turnKvStart = 0;
     const char*              _chatTemplate;
 
     // stores the complete response for the given query
@@ -39,11 +52,148 @@ class LLMInference {
     // length of context window consumed during the conversation
     int _nCtxUsed = 0;
 
+    // elastic KV cache: `_ctx` starts with `_nCtxInitial` cells and is re-created with twice
+    // as many (up to `_nCtxMax`) when a decode would not fit, carrying sequence 0 across
+    llama_context_params _ctxParams;
+    uint32_t             _nCtxInitial = 0;
+    uint32_t             _nCtxMax = 0;
+    int64_t              _ctxGrows = 0;
+    int64_t              _ctxShrinks = 0;
+    int64_t              _ctxMigrationMicros = 0;
+    // cells of `_ctx` (0 while paged out), readable by KvSessionManager from other threads
+    std::atomic<uint32_t> _kvCells{0};
+    // a failed resize could not re-create `_ctx` at any size; entry points throw until
+    // clearHistory() brings up a fresh context
+    bool                 _ctxLost = false;
+
+    // KV paging (see KvSessionManager): while `_pagedPath` is set, `_ctx` is freed and the
+    // sequence state of its `_pagedCells`-cell cache lives in that file. `_pagedOut` mirrors it
+    // for KvSessionManager, which asks from other threads.
+    std::string _pagedPath;
+    std::atomic<bool> _pagedOut{false};
+    uint32_t    _pagedCells = 0;
+    size_t      _pagedBytes = 0;
+    int         _pagedTokens = 0;
+    int64_t     _pageOuts = 0;
+    int64_t     _pageIns = 0;
+    int64_t     _lastRestoreMicros = 0;
+    int         _lastRestoredTokens = 0;
+    // prompt-processing cost, to compare restores against re-prefilling the same tokens
+    int64_t     _prefillMicros = 0;
+    int64_t     _prefillTokens = 0;
+    int64_t     _decodeStepMicros = 0;
+    int64_t     _decodeSteps = 0;
+
+    // wall-clock deadline of the current response (see setDeadline); `_deadlineAt` is 0 when
+    // none is armed, `_deadlineStop` ends the response on the next completionLoop() call
+    int64_t _nextDeadlineMicros = 0;
+    int64_t _deadlineStart = 0;
+    int64_t _deadlineAt = 0;
+    bool    _deadlineStop = false;
+    // a deadline dropped prompt tokens of a stored chat, so the KV cache no longer matches
+    // `_messages`; the next turn prefills the whole chat again
+    bool    _historyTruncated = false;
+    // {deadline micros, elapsed micros, prompt tokens dropped, stop reason} of the last deadline
+    int64_t _deadlineStats[4] = {0, 0, 0, 0};
+
+    // {reused passage tokens, recomputed passage tokens, prefilled tokens, assembly micros}
+    // of the last startCompletionWithPassages()
+    int64_t _passageStats[4] = {0, 0, 0, 0};
+
+    // {context tokens, kept tokens, scoring micros} of the last compressContext()
+    int64_t _compressionStats[3] = {0, 0, 0};
+
+    // grammar-constrained decoding: `_activeGrammar` (owned by `_grammarCache`)
+    // is applied by the first stage of `_sampler` while it is set
+    GrammarCache     _grammarCache;
+    CompiledGrammar* _activeGrammar = nullptr;
+
+    // restricted-vocabulary decoding: while `_restrictedHead` is set, the graph is stopped
+    // after the final norm (see `_evalCallback`) and logits are computed for its rows only
+    std::string           _modelPath;
+    RestrictedHeadCache   _restrictedHeadCache;
+    const RestrictedHead* _restrictedHead = nullptr;
+    bool                  _validateRestrictedHead = false;
+    bool                  _hiddenCaptured = false;
+    std::vector<float>    _hidden;
+    std::vector<float>    _restrictedLogits;
+    std::vector<llama_token_data> _restrictedCandidates;
+    // {restricted steps, validated steps, mismatches, full argmax outside the subset}
+    int64_t _restrictedStats[4] = {0, 0, 0, 0};
+
+    // repetition-loop detection over the tokens of the current response: a detection either ends
+    // the response or bans `_loopBan` for the next step, per the detector's policy
+    LoopDetector _loopDetector;
+    llama_token  _loopBan = -1;
+    int32_t      _loopNudges = 0;
+    // {cycles, plateaus, stops, nudges, token count at which the current response was stopped or -1}
+    int64_t _loopStats[5] = {0, 0, 0, 0, -1};
+
+    // model cascade: while the monitor's policy is enabled, a response that trips it is abandoned
+    // with "[ESCALATE]" and stopCompletion() rolls the turn back, so the caller can hand it to a
+    // larger model; the turn's formatted text and tokens are kept for startCompletionFrom()
+    ConfidenceMonitor        _confidence;
+    bool                     _escalated = false;
+    std::string              _turnText;
+    bool                     _turnAddSpecial = false;
+    std::vector<llama_token> _turnTokens;
+    uint64_t                 _vocabHash = 0;
+    // {monitored responses, escalations, tokens generated before the last escalation,
+    //  tokenizations reused by startCompletionFrom()}
+    int64_t _cascadeStats[4] = {0, 0, 0, 0};
+
+    // idle history compaction (see CompactionPolicy): `_compactionThread` sleeps until
+    // `_compactionDue` and then folds older turns into the system prompt while holding
+    // `_compactionMutex`. Foreground calls set `_compactionCancel` and take the mutex
+    // (_holdCompaction()), so a compaction in progress is abandoned within one decode step.
+    CompactionPolicy        _compactionPolicy;
+    std::thread             _compactionThread;
+    std::mutex              _compactionMutex;
+    std::condition_variable _compactionWake;
+    std::atomic<bool>       _compactionCancel{false};
+    bool                    _compactionExit = false;
+    bool                    _turnActive = false;
+    int64_t                 _compactionDue = 0;
+    // {compactions, abandoned compactions, KV tokens before and after the last one, its micros}
+    int64_t _compactionStats[5] = {0, 0, 0, 0, 0};
+
+    std::string _beginTurn(const char* query);
+    void        _startTurn(std::string prompt, bool addSpecial);
+    uint64_t    _vocabFingerprint();
+    int         _turnStartPos();
+    void        _setPromptBatch(int n_past);
+    void        _ensureCapacity(uint32_t required);
+    void        _decodeTokens(const llama_token* tokens, int32_t n, llama_pos pos, llama_seq_id seq);
+
+    void _resizeContext(uint32_t nCtx, bool keepState);
+    void _rollbackResize(uint32_t nCtx, const std::vector<uint8_t>& state);
+    void _requireContext() const;
+    void _growContext(uint32_t required);
+
+    std::string _endResponse();
+    void        _fitPromptToDeadline();
+    void        _checkDeadline();
+    float       _samplingEntropy(float* margin = nullptr);
+
+    std::unique_lock<std::mutex> _holdCompaction();
+    void                         _compactionWorker();
+    bool                         _compactHistory();
+    bool                         _prefillScratch(const std::vector<llama_token>& tokens, int32_t n);
+
+    static bool _evalCallback(struct ggml_tensor* t, bool ask, void* userData);
+    llama_token _sampleRestricted();
+
     bool _isValidUtf8(const char* response);
 
   public:
+    // stands in for the retrieved passages in the query of startCompletionWithPassages()
+    static constexpr const char* kPassageMarker = "<|llmedge:passages|>";
+
+    // `contextSize` is the most the KV cache may grow to; it is allocated for
+    // `initialContextSize` tokens first and doubled as the conversation needs it
     void loadModel(const char* modelPath, float minP, float temperature, bool storeChats, long contextSize,
-                   const char* chatTemplate, int nThreads, bool useMmap, bool useMlock, bool useVulkan);
+                   long initialContextSize, const char* chatTemplate, int nThreads, bool useMmap, bool useMlock,
+                   bool useVulkan);
 
     void addChatMessage(const char* message, const char* role);
 
@@ -59,16 +209,138 @@ class LLMInference {
 
     void startCompletion(const char* query);
 
+    // Starts `query` as a turn escalated from `source`, the smaller model of a cascade whose
+    // response was abandoned. If both models share a vocabulary and format the turn identically,
+    // `source`'s prompt tokens are reused instead of tokenizing again; returns whether they were.
+    bool startCompletionFrom(LLMInference& source, const char* query);
+
     std::string completionLoop();
 
+    // Tokenizes and decodes `text` on its own and returns it with its KV state, to be stored at
+    // ingest time and spliced into prompts later; empty if the text has no tokens.
+    std::vector<uint8_t> encodePassage(const char* text);
+
+    // Like startCompletion(), but `kPassageMarker` in `query` is replaced by
+    // gaps[0] + passage[0] + gaps[1] + ... + passage[n-1] + gaps[n] without prefilling the
+    // passages: their cached KV is rotated to its position in the prompt and the first
+    // `recomputeRatio` of each passage's tokens is decoded again so it attends to what precedes it.
+    // Throws std::invalid_argument if a blob was encoded with another model.
+    void startCompletionWithPassages(const char* query, const std::vector<std::vector<uint8_t>>& passages,
+                                     const std::vector<std::string>& gaps, float recomputeRatio);
+
+    // {reused passage tokens, recomputed passage tokens, prefilled tokens, assembly micros}
+    std::vector<int64_t> getPassageStats() const;
+
+    // Drops the least informative tokens of `context` until `targetRatio` of them remain. Each
+    // token is scored by its surprisal under this model given `query` and the context before it;
+    // tokens containing line breaks are always kept. Uses the scratch sequence, so the
+    // conversation is not affected. Throws std::invalid_argument for a ratio outside (0, 1].
+    std::string compressContext(const char* query, const char* context, float targetRatio);
+
+    // {context tokens, kept tokens, scoring micros} of the last compressContext()
+    std::vector<int64_t> getCompressionStats() const;
+
     void stopCompletion();
 
+    // Gives the next response `budgetMicros` of wall-clock time from the start of the turn. Using
+    // the measured prefill and decode speeds, the middle of the prompt is dropped upfront if it
+    // could not be prefilled in time, and generation ends at a sentence boundary once the
+    // deadline is a few tokens away (or right before it, mid-sentence, if none comes). The stored
+    // chat keeps the dropped text, and the turn after a truncated one prefills it in full again.
+    void setDeadline(int64_t budgetMicros);
+
+    // {deadline micros, elapsed micros, prompt tokens dropped, stop reason} of the last response
+    // with a deadline; stop reason is 0 (ended on its own), 1 (sentence boundary) or 2 (hard stop)
+    std::vector<int64_t> getDeadlineStats() const;
+
+    // Monitors the confidence of every response from now on (see ConfidencePolicy); a response
+    // that trips the policy makes completionLoop() return "[ESCALATE]".
+    void setConfidencePolicy(const ConfidencePolicy& policy);
+
+    // {monitored responses, escalations, tokens generated before the last escalation,
+    //  tokenizations reused, mean entropy x1000 and mean top-2 margin x1000 of the last response}
+    std::vector<int64_t> getCascadeStats() const;
+
+    void setLoopPolicy(const LoopPolicy& policy);
+
+    // {cycle detections, plateau detections, responses stopped, nudges, token count at which
+    // the last response was stopped or -1}
+    std::vector<int64_t> getLoopStats() const;
+
     void setReasoningOptions(bool disableThinking, int reasoningBudget);
 
+    // Folds older turns into a summary appended to the system prompt once the session has been
+    // idle for a while after a response (see CompactionPolicy). The summary is generated by this
+    // model on a background thread and the KV cache is rebuilt for [system + summary + recent
+    // turns]; any foreground call abandons a compaction in progress.
+    void setCompactionPolicy(const CompactionPolicy& policy);
+
+    // Compacts now, on the calling thread, regardless of the idle timer and `triggerTokens`;
+    // returns false if there was nothing to fold or the compaction was abandoned.
+    bool compactHistory();
+
+    // {compactions, abandoned compactions, KV tokens before and after the last compaction,
+    //  micros of the last compaction}
+    std::vector<int64_t> getCompactionStats() const;
+
+    // Drops all but system messages, clears the KV cache and shrinks it back to its initial size.
+    void clearHistory();
+
+    // {allocated cells, max cells, grows, shrinks, migration micros, peak RSS KiB, RSS KiB}
+    std::vector<int64_t> getContextStats() const;
+
+    // Used by KvSessionManager: estimated bytes of the allocated KV cache (0 while paged out),
+    // writing the KV state to a memory-mapped file and freeing the context, and the reverse.
+    size_t kvCacheBytes() const;
+    bool   isPagedOut() const { return _pagedOut; }
+    bool   pageOut(const std::string& path);
+    void   pageIn();
+
+    // {page-outs, page-ins, last restore micros, last restored tokens,
+    //  estimated re-prefill micros for those tokens, paged out (0/1)}
+    std::vector<int64_t> getPagingStats() const;
+
+    // Constrain responses to a GBNF grammar (or a JSON schema); an empty string removes the
+    // constraint. Throws std::runtime_error if the grammar or schema does not compile.
+    void setGrammar(const char* grammar, bool isJsonSchema);
+
+    // {mask cache hits, mask cache misses, constraint micros} of the active grammar
+    std::vector<int64_t> getGrammarStats() const;
+
+    // Restrict sampling to `tokens` (end-of-generation tokens are always allowed) and compute
+    // logits for those rows only; an empty list restores the full vocabulary. With `validate`,
+    // the full head still runs and each step is checked against its argmax.
+    // Throws std::runtime_error if the model's output weights cannot be read.
+    void setAllowedTokens(const std::vector<llama_token>& tokens, bool validate);
+
+    // {restricted steps, validated steps, argmax mismatches, full argmax outside the subset}
+    std::vector<int64_t> getRestrictedHeadStats() const;
+
+    std::vector<llama_token> tokenize(const char* text) const;
+
     ~LLMInference();
 
-    // Expose internal model/context for JNI integrations (safe accessor)
-    // These return the raw pointers managed by this instance. Caller must not free them.
+    // Expose internal model/context for JNI integrations. Caller must not free them. The
+    // context is only valid while the lease lives: the session cannot be paged out (which
+    // frees the context) until the lease is destroyed.
     llama_model* getModel();
-    llama_context* getContext();
+    ContextLease leaseContext();
+};
+
+// Keeps a session busy in KvSessionManager while its raw llama_context is used.
+class ContextLease {
+  public:
+    ContextLease(LLMInference* session, llama_context* ctx, bool release)
+        : _session(session), _ctx(ctx), _release(release) {}
+    ContextLease(const ContextLease&) = delete;
+    ContextLease& operator=(const ContextLease&) = delete;
+    ~ContextLease();
+
+    llama_context* get() const { return _ctx; }
+
+  private:
+    LLMInference*  _session;
+    llama_context* _ctx;
+    // false when the session was already busy, so its own release() ends the hold
+    bool           _release;
 };
\ No newline at end of file
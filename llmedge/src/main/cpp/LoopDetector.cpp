@@ -0,0 +1,105 @@
+#include "LoopDetector.h"
+#include <algorithm>
+
+static constexpr uint64_t kHashBase = 0x100000001b3ULL;
+
+void
+LoopDetector::setPolicy(const LoopPolicy &policy) {
+    _policy = policy;
+    _policy.maxPeriod = std::max(1, _policy.maxPeriod);
+    _policy.minRepeats = std::max(2, _policy.minRepeats);
+    _policy.plateauWindow = std::max(0, _policy.plateauWindow);
+    reset();
+}
+
+void
+LoopDetector::reset() {
+    _tokens.clear();
+    _prefix.assign(1, 0);
+    _period = 0;
+    _entropies.assign(_policy.plateauWindow, 0.0f);
+    _windowTokens.assign(_policy.plateauWindow, -1);
+    _entropySum = 0.0;
+    _entropyCount = 0;
+    _windowCounts.clear();
+}
+
+uint64_t
+LoopDetector::_segmentHash(size_t begin, size_t end) const {
+    return _prefix[end] - _prefix[begin] * _powers[end - begin];
+}
+
+void
+LoopDetector::_compact() {
+    // keep only what the longest cycle check can look back over
+    const size_t keep = static_cast<size_t>(
+            std::max(_policy.minRepeats * _policy.maxPeriod, _policy.minSpan + _policy.maxPeriod));
+    if (_tokens.size() < 4 * keep) {
+        return;
+    }
+    _tokens.erase(_tokens.begin(), _tokens.end() - keep);
+    _prefix.assign(1, 0);
+    for (llama_token token: _tokens) {
+        _prefix.push_back(_prefix.back() * kHashBase + static_cast<uint32_t>(token) + 1);
+    }
+}
+
+llama_token
+LoopDetector::continuation() const {
+    return _period > 0 && _tokens.size() >= static_cast<size_t>(_period) ? _tokens[_tokens.size() - _period] : -1;
+}
+
+LoopDetector::Detection
+LoopDetector::push(llama_token token, float entropy) {
+    _period = 0;
+    if (_policy.action == LoopPolicy::OFF) {
+        return NONE;
+    }
+    _tokens.push_back(token);
+    _prefix.push_back(_prefix.back() * kHashBase + static_cast<uint32_t>(token) + 1);
+    while (_powers.size() < _tokens.size() + 1) {
+        _powers.push_back(_powers.back() * kHashBase);
+    }
+
+    const size_t n = _tokens.size();
+    for (int32_t p = 1; p <= _policy.maxPeriod; ++p) {
+        const size_t repeats = std::max<size_t>(_policy.minRepeats, (_policy.minSpan + p - 1) / p);
+        if (repeats * p > n) {
+            continue;
+        }
+        const uint64_t last = _segmentHash(n - p, n);
+        bool cycle = true;
+        for (size_t r = 2; r <= repeats && cycle; ++r) {
+            cycle = _segmentHash(n - r * p, n - (r - 1) * p) == last;
+        }
+        if (cycle) {
+            _period = p;
+            _compact();
+            return CYCLE;
+        }
+    }
+    _compact();
+
+    if (_policy.plateauWindow == 0 || entropy < 0.0f) {
+        return NONE;
+    }
+    const size_t window = static_cast<size_t>(_policy.plateauWindow);
+    const size_t slot = _entropyCount % window;
+    if (_entropyCount >= window) {
+        _entropySum -= _entropies[slot];
+        auto found = _windowCounts.find(_windowTokens[slot]);
+        if (found != _windowCounts.end() && --found->second == 0) {
+            _windowCounts.erase(found);
+        }
+    }
+    _entropies[slot] = entropy;
+    _windowTokens[slot] = token;
+    _entropySum += entropy;
+    _windowCounts[token]++;
+    _entropyCount++;
+    if (_entropyCount >= window && _entropySum / window < _policy.plateauEntropy &&
+        _windowCounts.size() * 2 < window) {
+        return PLATEAU;
+    }
+    return NONE;
+}
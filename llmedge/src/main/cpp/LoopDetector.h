@@ -0,0 +1,70 @@
+#pragma once
+#include "llama.h"
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// What completionLoop() does when LoopDetector fires.
+struct LoopPolicy {
+    enum Action : int32_t {
+        // the default: setLoopPolicy() turns detection on
+        OFF = 0,
+        // end the response as if the model had emitted EOG
+        STOP = 1,
+        // ban the token that would continue the loop for the next step; stop after `maxNudges`
+        NUDGE = 2,
+    };
+
+    Action  action = OFF;
+    // a cycle of period p in [1, maxPeriod] fires once it has repeated back-to-back at least
+    // `minRepeats` times and covers at least `minSpan` tokens
+    int32_t maxPeriod = 32;
+    int32_t minRepeats = 3;
+    int32_t minSpan = 24;
+    // a plateau fires when the mean sampling entropy (nats) of the last `plateauWindow` tokens is
+    // below `plateauEntropy` while fewer than half of them are distinct; 0 disables the check
+    int32_t plateauWindow = 64;
+    float   plateauEntropy = 0.1f;
+    int32_t maxNudges = 2;
+};
+
+// Detects repetition loops over the tokens of one response. Cycles are found with polynomial
+// rolling hashes over the recent token IDs, so each push() costs O(maxPeriod * minRepeats)
+// hash comparisons regardless of the response length.
+class LoopDetector {
+  public:
+    enum Detection { NONE, CYCLE, PLATEAU };
+
+    LoopDetector() { reset(); }
+
+    void setPolicy(const LoopPolicy& policy);
+    const LoopPolicy& policy() const { return _policy; }
+
+    void reset();
+
+    // Records a sampled token and the entropy of the distribution it was drawn from (negative if
+    // unknown). For CYCLE, `period()` is the cycle length and `continuation()` the token the
+    // cycle predicts next.
+    Detection push(llama_token token, float entropy);
+
+    int32_t     period() const { return _period; }
+    llama_token continuation() const;
+
+  private:
+    uint64_t _segmentHash(size_t begin, size_t end) const;
+    void     _compact();
+
+    LoopPolicy               _policy;
+    std::vector<llama_token> _tokens;
+    std::vector<uint64_t>    _prefix = {0};
+    std::vector<uint64_t>    _powers = {1};
+    int32_t                  _period = 0;
+
+    // ring buffers over the last `plateauWindow` tokens
+    std::vector<float>                   _entropies;
+    std::vector<llama_token>             _windowTokens;
+    double                               _entropySum = 0.0;
+    size_t                               _entropyCount = 0;
+    std::unordered_map<llama_token, int> _windowCounts;
+};
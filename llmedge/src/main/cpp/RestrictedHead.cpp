@@ -0,0 +1,117 @@
+#include "RestrictedHead.h"
+#include "ggml.h"
+#include "gguf.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <unistd.h>
+
+void
+RestrictedHead::logits(const float *hidden, std::vector<float> &out) const {
+    out.resize(tokens.size());
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        const float *row = weights.data() + i * nEmbd;
+        float sum = 0.0f;
+        for (int64_t j = 0; j < nEmbd; ++j) {
+            sum += row[j] * hidden[j];
+        }
+        out[i] = sum;
+    }
+}
+
+static std::unique_ptr<RestrictedHead>
+loadRestrictedHead(const std::string &modelPath, const std::vector<llama_token> &tokens) {
+    ggml_context *meta = nullptr;
+    gguf_init_params params = {true, &meta};
+    gguf_context *gguf = gguf_init_from_file(modelPath.c_str(), params);
+    if (!gguf) {
+        throw std::runtime_error("failed to read GGUF metadata for restricted head");
+    }
+
+    const char *name = "output.weight";
+    int64_t tensorId = gguf_find_tensor(gguf, name);
+    if (tensorId < 0) {
+        // models with tied embeddings project through the token embedding matrix
+        name = "token_embd.weight";
+        tensorId = gguf_find_tensor(gguf, name);
+    }
+    ggml_tensor *tensor = tensorId >= 0 ? ggml_get_tensor(meta, name) : nullptr;
+    const ggml_type_traits *traits = tensor ? ggml_get_type_traits(tensor->type) : nullptr;
+    if (!tensor || (tensor->type != GGML_TYPE_F32 && (!traits || !traits->to_float))) {
+        gguf_free(gguf);
+        ggml_free(meta);
+        throw std::runtime_error("model has no output projection usable for a restricted head");
+    }
+
+    auto head = std::make_unique<RestrictedHead>();
+    head->tokens = tokens;
+    head->nEmbd = tensor->ne[0];
+    head->weights.resize(tokens.size() * head->nEmbd);
+
+    const size_t rowBytes = ggml_row_size(tensor->type, tensor->ne[0]);
+    const size_t base = gguf_get_data_offset(gguf) + gguf_get_tensor_offset(gguf, tensorId);
+    const ggml_type type = tensor->type;
+    const int64_t nRows = tensor->ne[1];
+    gguf_free(gguf);
+    ggml_free(meta);
+
+    // pread takes a 64-bit off_t, so rows past 2 GiB into large models are reachable
+    const int fd = open(modelPath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("failed to open model for restricted head");
+    }
+    std::vector<uint8_t> row(rowBytes);
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        float *dst = head->weights.data() + i * head->nEmbd;
+        const bool ok = tokens[i] >= 0 && tokens[i] < nRows &&
+                        pread(fd, row.data(), rowBytes, (off_t) (base + (uint64_t) tokens[i] * rowBytes)) ==
+                                (ssize_t) rowBytes;
+        if (!ok) {
+            close(fd);
+            throw std::runtime_error("failed to read output rows for restricted head");
+        }
+        if (type == GGML_TYPE_F32) {
+            std::memcpy(dst, row.data(), rowBytes);
+        } else {
+            traits->to_float(row.data(), dst, head->nEmbd);
+        }
+    }
+    close(fd);
+    return head;
+}
+
+const RestrictedHead *
+RestrictedHeadCache::get(const std::string &modelPath, std::vector<llama_token> tokens) {
+    std::sort(tokens.begin(), tokens.end());
+    tokens.erase(std::unique(tokens.begin(), tokens.end()), tokens.end());
+    uint64_t key = 0xcbf29ce484222325ULL;
+    for (llama_token token: tokens) {
+        key = (key ^ (uint32_t) token) * 0x100000001b3ULL;
+    }
+
+    auto found = _index.find(key);
+    if (found != _index.end()) {
+        if (found->second->second->tokens == tokens) {
+            _lru.splice(_lru.begin(), _lru, found->second);
+            return found->second->second.get();
+        }
+        // hash collision with a different subset: replace it
+        _lru.erase(found->second);
+        _index.erase(found);
+    }
+
+    _lru.emplace_front(key, loadRestrictedHead(modelPath, tokens));
+    _index[key] = _lru.begin();
+    if (_lru.size() > _capacity) {
+        _index.erase(_lru.back().first);
+        _lru.pop_back();
+    }
+    return _lru.front().second.get();
+}
+
+void
+RestrictedHeadCache::clear() {
+    _index.clear();
+    _lru.clear();
+}
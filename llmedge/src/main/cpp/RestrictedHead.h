@@ -0,0 +1,39 @@
+#pragma once
+#include "llama.h"
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Output-projection rows for an allowed token subset, dequantized to f32.
+// logits[i] = dot(weights[i * nEmbd ...], hidden) for tokens[i].
+struct RestrictedHead {
+    std::vector<llama_token> tokens;
+    std::vector<float>       weights;
+    int64_t                  nEmbd = 0;
+
+    void logits(const float* hidden, std::vector<float>& out) const;
+};
+
+// Gathered output-weight slices keyed by hash of the sorted subset (verified against the
+// subset on a hit), evicted least-recently-used.
+class RestrictedHeadCache {
+  public:
+    explicit RestrictedHeadCache(size_t capacity = 4) : _capacity(capacity) {}
+
+    // Returns the head for `tokens`, reading its rows of `output.weight` (or the tied
+    // `token_embd.weight`) from the GGUF file on first use.
+    // Throws std::runtime_error if the file has no usable output tensor.
+    const RestrictedHead* get(const std::string& modelPath, std::vector<llama_token> tokens);
+
+    void clear();
+
+  private:
+    using Entry = std::pair<uint64_t, std::unique_ptr<RestrictedHead>>;
+
+    size_t                                                   _capacity;
+    std::list<Entry>                                         _lru;
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> _index;
+};
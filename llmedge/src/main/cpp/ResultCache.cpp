@@ -0,0 +1,344 @@
+#include "ResultCache.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// FIPS 180-4 SHA-256
+class Sha256 {
+  public:
+    void update(const void *data, size_t size) {
+        const auto *bytes = static_cast<const uint8_t *>(data);
+        _length += size;
+        while (size > 0) {
+            const size_t n = std::min(size, sizeof(_block) - _used);
+            std::memcpy(_block + _used, bytes, n);
+            _used += n;
+            bytes += n;
+            size -= n;
+            if (_used == sizeof(_block)) {
+                _compress();
+                _used = 0;
+            }
+        }
+    }
+
+    // length-prefixed, so consecutive fields cannot run into each other
+    void field(const void *data, size_t size) {
+        const uint64_t length = size;
+        update(&length, sizeof(length));
+        update(data, size);
+    }
+    void field(const std::string &text) { field(text.data(), text.size()); }
+
+    std::string hex() {
+        const uint64_t bits = _length * 8;
+        const uint8_t pad = 0x80;
+        update(&pad, 1);
+        const uint8_t zero = 0;
+        while (_used != 56) {
+            update(&zero, 1);
+        }
+        for (int i = 7; i >= 0; --i) {
+            const auto byte = static_cast<uint8_t>(bits >> (i * 8));
+            update(&byte, 1);
+        }
+        static const char *digits = "0123456789abcdef";
+        std::string out;
+        for (uint32_t word: _state) {
+            for (int i = 28; i >= 0; i -= 4) {
+                out += digits[(word >> i) & 0xf];
+            }
+        }
+        return out;
+    }
+
+  private:
+    static uint32_t _rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+    void _compress() {
+        static const uint32_t k[64] = {
+                0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+                0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+                0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+                0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+                0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+                0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+                0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+                0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = (uint32_t(_block[i * 4]) << 24) | (uint32_t(_block[i * 4 + 1]) << 16) |
+                   (uint32_t(_block[i * 4 + 2]) << 8) | uint32_t(_block[i * 4 + 3]);
+        }
+        for (int i = 16; i < 64; ++i) {
+            const uint32_t s0 = _rotr(w[i - 15], 7) ^ _rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            const uint32_t s1 = _rotr(w[i - 2], 17) ^ _rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = _state[0], b = _state[1], c = _state[2], d = _state[3];
+        uint32_t e = _state[4], f = _state[5], g = _state[6], h = _state[7];
+        for (int i = 0; i < 64; ++i) {
+            const uint32_t t1 = h + (_rotr(e, 6) ^ _rotr(e, 11) ^ _rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            const uint32_t t2 = (_rotr(a, 2) ^ _rotr(a, 13) ^ _rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        _state[0] += a;
+        _state[1] += b;
+        _state[2] += c;
+        _state[3] += d;
+        _state[4] += e;
+        _state[5] += f;
+        _state[6] += g;
+        _state[7] += h;
+    }
+
+    uint32_t _state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                          0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    uint8_t  _block[64] = {};
+    size_t   _used = 0;
+    uint64_t _length = 0;
+};
+
+// bumped whenever the key derivation changes, so old entries are never matched
+constexpr uint32_t kKeyVersion = 1;
+constexpr uint32_t kEntryMagic = 0x3143524c; // "LRC1"
+constexpr size_t   kIdentitySpan = 1 << 20;
+constexpr const char *kEntrySuffix = ".res";
+
+struct EntryHeader {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t size;
+};
+
+bool
+isKey(const std::string &key) {
+    return key.size() == 64 && std::all_of(key.begin(), key.end(), [](char c) {
+               return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+           });
+}
+
+} // namespace
+
+ResultCache &
+ResultCache::instance() {
+    static ResultCache cache;
+    return cache;
+}
+
+void
+ResultCache::configure(const std::string &directory, uint64_t budgetBytes) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _directory = budgetBytes == 0 ? "" : directory;
+    _budgetBytes = _directory.empty() ? 0 : budgetBytes;
+    _lru.clear();
+    _index.clear();
+    _storedBytes = 0;
+    if (_directory.empty()) {
+        return;
+    }
+    mkdir(_directory.c_str(), 0700);
+
+    // index what an earlier process stored, most recently used (touched) first
+    struct Found {
+        std::string key;
+        uint64_t    bytes;
+        int64_t     mtimeNs;
+    };
+    std::vector<Found> found;
+    if (DIR *dir = opendir(_directory.c_str())) {
+        while (dirent *item = readdir(dir)) {
+            const std::string name = item->d_name;
+            const std::string path = _directory + "/" + name;
+            struct stat st {};
+            if (name.find(".tmp") != std::string::npos) {
+                unlink(path.c_str()); // left over from an interrupted put()
+                continue;
+            }
+            const size_t suffix = name.size() - std::strlen(kEntrySuffix);
+            if (name.size() <= std::strlen(kEntrySuffix) || name.compare(suffix, std::string::npos, kEntrySuffix) != 0 ||
+                !isKey(name.substr(0, suffix)) || stat(path.c_str(), &st) != 0) {
+                continue;
+            }
+            found.push_back({name.substr(0, suffix), static_cast<uint64_t>(st.st_size),
+                             static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec});
+        }
+        closedir(dir);
+    }
+    std::sort(found.begin(), found.end(), [](const Found &a, const Found &b) { return a.mtimeNs > b.mtimeNs; });
+    for (const Found &entry: found) {
+        _lru.push_back({entry.key, entry.bytes});
+        _index[entry.key] = std::prev(_lru.end());
+        _storedBytes += entry.bytes;
+    }
+    _enforceBudget();
+}
+
+std::string
+ResultCache::key(const std::string &kind, const std::vector<std::string> &modelPaths, const std::string &params,
+                 const uint8_t *input, size_t inputSize) {
+    Sha256 sha;
+    sha.field(&kKeyVersion, sizeof(kKeyVersion));
+    sha.field(kind);
+    const uint64_t nModels = modelPaths.size();
+    sha.field(&nModels, sizeof(nModels));
+    for (const std::string &path: modelPaths) {
+        std::string digest;
+        if (!_modelIdentity(path, digest)) {
+            return "";
+        }
+        sha.field(digest);
+    }
+    sha.field(params);
+    sha.field(input, input ? inputSize : 0);
+    return sha.hex();
+}
+
+// size plus the SHA-256 of the first and last MiB: reading whole multi-GB weights per lookup would
+// cost more than many of the results it saves, and distinct model files differ in their headers
+// (tensor layout, metadata) or their last tensors. Cached per path until its size or mtime changes.
+bool
+ResultCache::_modelIdentity(const std::string &path, std::string &digest) {
+    struct stat st {};
+    if (stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    const uint64_t size = static_cast<uint64_t>(st.st_size);
+    const int64_t mtimeNs = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto known = _identities.find(path);
+        if (known != _identities.end() && known->second.size == size && known->second.mtimeNs == mtimeNs) {
+            digest = known->second.digest;
+            return true;
+        }
+    }
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    Sha256 sha;
+    sha.field(&size, sizeof(size));
+    std::vector<uint8_t> buffer(kIdentitySpan);
+    const off_t offsets[2] = {0, static_cast<off_t>(size > kIdentitySpan ? size - kIdentitySpan : 0)};
+    for (off_t offset: offsets) {
+        const ssize_t n = pread(fd, buffer.data(), buffer.size(), offset);
+        if (n < 0) {
+            close(fd);
+            return false;
+        }
+        sha.field(buffer.data(), static_cast<size_t>(n));
+    }
+    close(fd);
+    digest = sha.hex();
+    std::lock_guard<std::mutex> lock(_mutex);
+    _identities[path] = {size, mtimeNs, digest};
+    return true;
+}
+
+std::string
+ResultCache::_path(const std::string &key) const {
+    return _directory + "/" + key + kEntrySuffix;
+}
+
+bool
+ResultCache::get(const std::string &key, std::vector<uint8_t> &value) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_directory.empty() || !isKey(key)) {
+        return false;
+    }
+    auto found = _index.find(key);
+    if (found == _index.end()) {
+        _stats[1]++;
+        return false;
+    }
+    const std::string path = _path(key);
+    FILE *file = std::fopen(path.c_str(), "rb");
+    EntryHeader header {};
+    bool valid = file != nullptr && std::fread(&header, sizeof(header), 1, file) == 1 &&
+                 header.magic == kEntryMagic && header.size + sizeof(header) == found->second->bytes;
+    if (valid) {
+        value.resize(header.size);
+        valid = header.size == 0 || std::fread(value.data(), 1, value.size(), file) == value.size();
+    }
+    if (file) {
+        std::fclose(file);
+    }
+    if (!valid) {
+        // truncated or replaced behind our back: drop it rather than return garbage
+        _remove(found->second);
+        _stats[1]++;
+        return false;
+    }
+    _lru.splice(_lru.begin(), _lru, found->second);
+    utimensat(AT_FDCWD, path.c_str(), nullptr, 0); // recency survives restarts through the mtime
+    _stats[0]++;
+    return true;
+}
+
+void
+ResultCache::put(const std::string &key, const uint8_t *value, size_t size) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_directory.empty() || !isKey(key) || sizeof(EntryHeader) + size > _budgetBytes) {
+        return;
+    }
+    auto found = _index.find(key);
+    if (found != _index.end()) {
+        _remove(found->second);
+    }
+    // write to a temporary file and rename, so a reader never sees a partial entry
+    const std::string path = _path(key);
+    const std::string tmp = path + ".tmp" + std::to_string(getpid());
+    FILE *file = std::fopen(tmp.c_str(), "wb");
+    if (file == nullptr) {
+        return;
+    }
+    const EntryHeader header = {kEntryMagic, 0, size};
+    const bool written = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                         (size == 0 || std::fwrite(value, 1, size, file) == size);
+    if (std::fclose(file) != 0 || !written || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        unlink(tmp.c_str());
+        return;
+    }
+    _lru.push_front({key, sizeof(header) + size});
+    _index[key] = _lru.begin();
+    _storedBytes += sizeof(header) + size;
+    _stats[2]++;
+    _enforceBudget();
+}
+
+void
+ResultCache::_remove(std::list<Entry>::iterator entry) {
+    unlink(_path(entry->key).c_str());
+    _storedBytes -= entry->bytes;
+    _index.erase(entry->key);
+    _lru.erase(entry);
+}
+
+void
+ResultCache::_enforceBudget() {
+    while (_storedBytes > _budgetBytes && !_lru.empty()) {
+        _remove(std::prev(_lru.end()));
+        _stats[3]++;
+    }
+}
+
+std::vector<int64_t>
+ResultCache::stats() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return {_stats[0], _stats[1], _stats[2], _stats[3], static_cast<int64_t>(_lru.size()),
+            static_cast<int64_t>(_storedBytes)};
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Content-addressed store for results that are a pure function of their inputs: temperature-0
+// text, seeded diffusion images and speech, and transcripts. A key is the SHA-256 of the result
+// kind, the identity of every model file involved, the canonical generation parameters and the
+// input bytes; values are opaque bytes, one file per key under a directory. The store is kept
+// under a byte budget by evicting the least recently used entries, and a lookup never needs a
+// model to be loaded.
+class ResultCache {
+  public:
+    static ResultCache& instance();
+
+    // Entries are stored under `directory` (existing ones are indexed, so they survive restarts);
+    // an empty directory or a budget of 0 disables the cache.
+    void configure(const std::string& directory, uint64_t budgetBytes);
+
+    // Hex key of a result. Model files are identified by their size and a digest of their first
+    // and last MiB rather than their path, so a moved or re-downloaded copy keeps its entries.
+    // Returns an empty string if a model file cannot be read.
+    std::string key(const std::string& kind, const std::vector<std::string>& modelPaths, const std::string& params,
+                    const uint8_t* input, size_t inputSize);
+
+    // Reads the value stored for `key`; false on a miss or while the cache is disabled.
+    bool get(const std::string& key, std::vector<uint8_t>& value);
+    void put(const std::string& key, const uint8_t* value, size_t size);
+
+    // {hits, misses, stores, evictions, entries, stored bytes}
+    std::vector<int64_t> stats();
+
+  private:
+    struct Entry {
+        std::string key;
+        uint64_t    bytes;
+    };
+    struct ModelIdentity {
+        uint64_t    size;
+        int64_t     mtimeNs;
+        std::string digest;
+    };
+
+    bool        _modelIdentity(const std::string& path, std::string& digest);
+    std::string _path(const std::string& key) const;
+    void        _remove(std::list<Entry>::iterator entry);
+    void        _enforceBudget();
+
+    std::mutex                                                   _mutex;
+    std::string                                                  _directory;
+    uint64_t                                                     _budgetBytes = 0;
+    uint64_t                                                     _storedBytes = 0;
+    std::list<Entry>                                             _lru;
+    std::unordered_map<std::string, std::list<Entry>::iterator>  _index;
+    std::unordered_map<std::string, ModelIdentity>               _identities;
+    int64_t                                                      _stats[4] = {0, 0, 0, 0};
+};
@@ -0,0 +1,395 @@
+/**
+ * JNI bindings for a streaming keyword spotter used to gate Whisper streaming.
+ *
+ * The spotter computes log-mel features over 25 ms frames with a 10 ms hop and runs a small
+ * feed-forward ggml model over a sliding context of stacked frames. It shares whisper_jni's
+ * ggml build, so it adds no library of its own.
+ *
+ * Model file (GGUF):
+ *   kws.n_mels, kws.n_frames              feature bands and stacked context frames (u32)
+ *   fc1.weight/bias, fc2.weight/bias       hidden layers, ReLU
+ *   out.weight/bias                        class logits, class 0 = filler
+ *   feat.mean, feat.std (optional)         per-band feature normalization
+ *
+ * scripts/export_kws_gguf.py computes matching features for training and writes the file.
+ */
+
+#include <jni.h>
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if __has_include(<android/log.h>)
+#include <android/log.h>
+#else
+#include <cstdio>
+#include <cstdarg>
+#define ANDROID_LOG_DEBUG 3
+#define ANDROID_LOG_INFO 4
+#define ANDROID_LOG_WARN 5
+#define ANDROID_LOG_ERROR 6
+inline int __android_log_print(int level, const char* tag, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "[%s] ", tag);
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    fflush(stderr);
+    va_end(args);
+    return 0;
+}
+#endif
+
+#include "ggml.h"
+#include "ggml-cpu.h"
+#include "gguf.h"
+
+#define LOG_TAG "KeywordSpotterJNI"
+#define ALOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+#define ALOGI(...) __android_log_print(ANDROID_LOG_INFO,  LOG_TAG, __VA_ARGS__)
+
+namespace {
+
+constexpr int kSampleRate  = 16000;
+constexpr int kFrameLength = 400;   // 25 ms
+constexpr int kFrameShift  = 160;   // 10 ms
+constexpr int kFftSize     = 512;
+constexpr int kEvalStride  = 3;     // run the model every 30 ms of audio
+constexpr int kSmoothEvals = 10;    // posterior smoothing window (300 ms)
+constexpr int kRefractory  = 100;   // frames to stay quiet after a detection (1 s)
+
+double threadCpuMs() {
+    timespec ts{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// In-place iterative radix-2 FFT; size must be a power of two.
+void fft(std::vector<float>& re, std::vector<float>& im) {
+    const int n = (int)re.size();
+    for (int i = 1, j = 0; i < n; ++i) {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) {
+            std::swap(re[i], re[j]);
+            std::swap(im[i], im[j]);
+        }
+    }
+    for (int len = 2; len <= n; len <<= 1) {
+        const float ang = -2.0f * (float)M_PI / len;
+        const float wr = std::cos(ang), wi = std::sin(ang);
+        for (int i = 0; i < n; i += len) {
+            float cr = 1.0f, ci = 0.0f;
+            for (int k = 0; k < len / 2; ++k) {
+                const int a = i + k, b = i + k + len / 2;
+                const float tr = re[b] * cr - im[b] * ci;
+                const float ti = re[b] * ci + im[b] * cr;
+                re[b] = re[a] - tr;
+                im[b] = im[a] - ti;
+                re[a] += tr;
+                im[a] += ti;
+                const float nr = cr * wr - ci * wi;
+                ci = cr * wi + ci * wr;
+                cr = nr;
+            }
+        }
+    }
+}
+
+float hzToMel(float hz) { return 2595.0f * std::log10(1.0f + hz / 700.0f); }
+float melToHz(float mel) { return 700.0f * (std::pow(10.0f, mel / 2595.0f) - 1.0f); }
+
+struct KeywordSpotter {
+    // Model
+    ggml_context* weights = nullptr;
+    gguf_context* gguf = nullptr;
+    ggml_tensor* fc1_w = nullptr;
+    ggml_tensor* fc1_b = nullptr;
+    ggml_tensor* fc2_w = nullptr;
+    ggml_tensor* fc2_b = nullptr;
+    ggml_tensor* out_w = nullptr;
+    ggml_tensor* out_b = nullptr;
+    std::vector<float> featMean;
+    std::vector<float> featStd;
+    int n_mels = 40;
+    int n_frames = 98;
+    int n_threads = 1;
+    std::vector<uint8_t> computeBuffer;
+
+    // Front end
+    std::vector<float> window;
+    std::vector<float> melBank;   // n_mels x (kFftSize / 2 + 1)
+    std::vector<float> pending;   // samples not yet consumed by a full frame
+    std::deque<std::vector<float>> context;
+    int framesSinceEval = 0;
+    int quietFrames = 0;
+    std::deque<float> posteriors;
+
+    // Gate
+    float threshold = 0.5f;
+
+    // Stats
+    double audioSeconds = 0.0;
+    double cpuMs = 0.0;
+    int64_t evaluations = 0;
+    int64_t detections = 0;
+    float lastScore = 0.0f;
+
+    std::mutex mutex;
+
+    ~KeywordSpotter() {
+        if (weights) ggml_free(weights);
+        if (gguf) gguf_free(gguf);
+    }
+
+    void initFrontEnd() {
+        window.resize(kFrameLength);
+        for (int i = 0; i < kFrameLength; ++i) {
+            window[i] = 0.5f - 0.5f * std::cos(2.0f * (float)M_PI * i / (kFrameLength - 1));
+        }
+        const int n_bins = kFftSize / 2 + 1;
+        melBank.assign((size_t)n_mels * n_bins, 0.0f);
+        const float melLo = hzToMel(20.0f), melHi = hzToMel(kSampleRate / 2.0f);
+        std::vector<float> edges(n_mels + 2);
+        for (int m = 0; m < n_mels + 2; ++m) {
+            edges[m] = melToHz(melLo + (melHi - melLo) * m / (n_mels + 1)) * kFftSize / kSampleRate;
+        }
+        for (int m = 0; m < n_mels; ++m) {
+            for (int k = 0; k < n_bins; ++k) {
+                const float up = (k - edges[m]) / std::max(edges[m + 1] - edges[m], 1e-6f);
+                const float down = (edges[m + 2] - k) / std::max(edges[m + 2] - edges[m + 1], 1e-6f);
+                melBank[(size_t)m * n_bins + k] = std::max(0.0f, std::min(up, down));
+            }
+        }
+    }
+
+    std::vector<float> logMel(const float* frame) const {
+        std::vector<float> re(kFftSize, 0.0f), im(kFftSize, 0.0f);
+        for (int i = 0; i < kFrameLength; ++i) re[i] = frame[i] * window[i];
+        fft(re, im);
+        const int n_bins = kFftSize / 2 + 1;
+        std::vector<float> power(n_bins);
+        for (int k = 0; k < n_bins; ++k) power[k] = re[k] * re[k] + im[k] * im[k];
+        std::vector<float> mel(n_mels);
+        for (int m = 0; m < n_mels; ++m) {
+            const float* filter = melBank.data() + (size_t)m * n_bins;
+            float energy = 0.0f;
+            for (int k = 0; k < n_bins; ++k) energy += filter[k] * power[k];
+            float v = std::log(std::max(energy, 1e-10f));
+            if (!featMean.empty()) v = (v - featMean[m]) / std::max(featStd[m], 1e-6f);
+            mel[m] = v;
+        }
+        return mel;
+    }
+
+    // Probability that the stacked context contains a keyword (1 - P(filler)).
+    float score() {
+        ggml_init_params params = {computeBuffer.size(), computeBuffer.data(), false};
+        ggml_context* ctx = ggml_init(params);
+        if (!ctx) return 0.0f;
+
+        ggml_tensor* x = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, (int64_t)n_mels * n_frames);
+        float* dst = (float*)x->data;
+        for (const auto& frame : context) {
+            std::copy(frame.begin(), frame.end(), dst);
+            dst += n_mels;
+        }
+
+        ggml_tensor* h = ggml_relu(ctx, ggml_add(ctx, ggml_mul_mat(ctx, fc1_w, x), fc1_b));
+        h = ggml_relu(ctx, ggml_add(ctx, ggml_mul_mat(ctx, fc2_w, h), fc2_b));
+        ggml_tensor* probs = ggml_soft_max(ctx, ggml_add(ctx, ggml_mul_mat(ctx, out_w, h), out_b));
+
+        ggml_cgraph* gf = ggml_new_graph(ctx);
+        ggml_build_forward_expand(gf, probs);
+        float result = 0.0f;
+        if (ggml_graph_compute_with_ctx(ctx, gf, n_threads) == GGML_STATUS_SUCCESS) {
+            result = 1.0f - ((const float*)probs->data)[0];
+        }
+        ggml_free(ctx);
+        return result;
+    }
+
+    // Consumes samples and returns the offset of the first detection within them, or -1.
+    int feed(const float* samples, int n) {
+        const double cpuStart = threadCpuMs();
+        audioSeconds += (double)n / kSampleRate;
+
+        const size_t base = pending.size();
+        pending.insert(pending.end(), samples, samples + n);
+        int detectedAt = -1;
+        size_t pos = 0;
+        for (; pos + kFrameLength <= pending.size(); pos += kFrameShift) {
+            context.push_back(logMel(pending.data() + pos));
+            if ((int)context.size() > n_frames) context.pop_front();
+            if (quietFrames > 0) quietFrames--;
+            if ((int)context.size() < n_frames || ++framesSinceEval < kEvalStride) continue;
+            framesSinceEval = 0;
+
+            evaluations++;
+            posteriors.push_back(score());
+            if ((int)posteriors.size() > kSmoothEvals) posteriors.pop_front();
+            float smoothed = 0.0f;
+            for (float p : posteriors) smoothed += p;
+            lastScore = smoothed / posteriors.size();
+
+            if (detectedAt < 0 && quietFrames == 0 && lastScore >= threshold) {
+                detections++;
+                quietFrames = kRefractory;
+                posteriors.clear();
+                const size_t end = pos + kFrameLength;
+                detectedAt = (int)std::min<size_t>(end > base ? end - base : 0, (size_t)n);
+            }
+        }
+        pending.erase(pending.begin(), pending.begin() + pos);
+
+        cpuMs += threadCpuMs() - cpuStart;
+        return detectedAt;
+    }
+
+    void reset() {
+        pending.clear();
+        context.clear();
+        posteriors.clear();
+        framesSinceEval = 0;
+        quietFrames = 0;
+        lastScore = 0.0f;
+    }
+};
+
+ggml_tensor* requireTensor(ggml_context* ctx, const char* name) {
+    ggml_tensor* t = ggml_get_tensor(ctx, name);
+    if (!t) ALOGE("Keyword model is missing tensor %s", name);
+    return t;
+}
+
+int readU32(gguf_context* gguf, const char* key, int fallback) {
+    const int64_t id = gguf_find_key(gguf, key);
+    return id < 0 ? fallback : (int)gguf_get_val_u32(gguf, id);
+}
+
+bool loadModel(KeywordSpotter* kws, const char* path) {
+    gguf_init_params params = {false, &kws->weights};
+    kws->gguf = gguf_init_from_file(path, params);
+    if (!kws->gguf || !kws->weights) return false;
+
+    kws->n_mels = readU32(kws->gguf, "kws.n_mels", kws->n_mels);
+    kws->n_frames = readU32(kws->gguf, "kws.n_frames", kws->n_frames);
+    ggml_context* w = kws->weights;
+    kws->fc1_w = requireTensor(w, "fc1.weight");
+    kws->fc1_b = requireTensor(w, "fc1.bias");
+    kws->fc2_w = requireTensor(w, "fc2.weight");
+    kws->fc2_b = requireTensor(w, "fc2.bias");
+    kws->out_w = requireTensor(w, "out.weight");
+    kws->out_b = requireTensor(w, "out.bias");
+    if (!kws->fc1_w || !kws->fc1_b || !kws->fc2_w || !kws->fc2_b || !kws->out_w || !kws->out_b) {
+        return false;
+    }
+    if (kws->fc1_w->ne[0] != (int64_t)kws->n_mels * kws->n_frames || kws->out_w->ne[1] < 2) {
+        ALOGE("Keyword model shape mismatch: fc1 expects %lld inputs, features give %d",
+              (long long)kws->fc1_w->ne[0], kws->n_mels * kws->n_frames);
+        return false;
+    }
+
+    ggml_tensor* mean = ggml_get_tensor(w, "feat.mean");
+    ggml_tensor* stdev = ggml_get_tensor(w, "feat.std");
+    if (mean && stdev && mean->type == GGML_TYPE_F32 && stdev->type == GGML_TYPE_F32 &&
+        ggml_nelements(mean) == kws->n_mels && ggml_nelements(stdev) == kws->n_mels) {
+        kws->featMean.assign((float*)mean->data, (float*)mean->data + kws->n_mels);
+        kws->featStd.assign((float*)stdev->data, (float*)stdev->data + kws->n_mels);
+    }
+
+    // Activations, graph and the work buffer for quantized matmuls; the weights live elsewhere.
+    const size_t n_in = (size_t)kws->n_mels * kws->n_frames;
+    const size_t n_hidden = (size_t)std::max(kws->fc1_w->ne[1], kws->fc2_w->ne[1]);
+    kws->computeBuffer.resize(ggml_graph_overhead() + 32 * ggml_tensor_overhead() +
+                              sizeof(float) * (2 * n_in + 8 * n_hidden) + 1024 * 1024);
+    kws->initFrontEnd();
+    return true;
+}
+
+} // namespace
+
+extern "C" {
+
+JNIEXPORT jlong JNICALL
+Java_io_aatricks_llmedge_KeywordSpotter_nativeCreate(JNIEnv* env, jclass,
+                                                      jstring jModelPath,
+                                                      jint nThreads) {
+    if (!jModelPath) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalArgumentException"), "Model path cannot be null");
+        return 0;
+    }
+    const char* modelPath = env->GetStringUTFChars(jModelPath, nullptr);
+    auto* kws = new KeywordSpotter();
+    kws->n_threads = std::max(1, (int)nThreads);
+    const bool ok = modelPath && loadModel(kws, modelPath);
+    ALOGI("Keyword spotter %s: %s (mels=%d, frames=%d)", ok ? "loaded" : "failed to load",
+          modelPath ? modelPath : "", kws->n_mels, kws->n_frames);
+    if (modelPath) env->ReleaseStringUTFChars(jModelPath, modelPath);
+    if (!ok) {
+        delete kws;
+        env->ThrowNew(env->FindClass("java/lang/RuntimeException"), "Failed to load keyword spotter model");
+        return 0;
+    }
+    return reinterpret_cast<jlong>(kws);
+}
+
+JNIEXPORT void JNICALL
+Java_io_aatricks_llmedge_KeywordSpotter_nativeDestroy(JNIEnv*, jclass, jlong handlePtr) {
+    delete reinterpret_cast<KeywordSpotter*>(handlePtr);
+}
+
+JNIEXPORT void JNICALL
+Java_io_aatricks_llmedge_KeywordSpotter_nativeSetThreshold(JNIEnv*, jclass, jlong handlePtr, jfloat threshold) {
+    auto* kws = reinterpret_cast<KeywordSpotter*>(handlePtr);
+    if (!kws) return;
+    std::lock_guard<std::mutex> lock(kws->mutex);
+    kws->threshold = threshold;
+}
+
+JNIEXPORT jint JNICALL
+Java_io_aatricks_llmedge_KeywordSpotter_nativeFeed(JNIEnv* env, jclass, jlong handlePtr, jfloatArray jSamples) {
+    auto* kws = reinterpret_cast<KeywordSpotter*>(handlePtr);
+    if (!kws || !jSamples) return -1;
+    const jsize n = env->GetArrayLength(jSamples);
+    jfloat* samples = env->GetFloatArrayElements(jSamples, nullptr);
+    if (!samples) return -1;
+    int detectedAt;
+    {
+        std::lock_guard<std::mutex> lock(kws->mutex);
+        detectedAt = kws->feed(samples, n);
+    }
+    env->ReleaseFloatArrayElements(jSamples, samples, JNI_ABORT);
+    return detectedAt;
+}
+
+JNIEXPORT void JNICALL
+Java_io_aatricks_llmedge_KeywordSpotter_nativeReset(JNIEnv*, jclass, jlong handlePtr) {
+    auto* kws = reinterpret_cast<KeywordSpotter*>(handlePtr);
+    if (!kws) return;
+    std::lock_guard<std::mutex> lock(kws->mutex);
+    kws->reset();
+}
+
+JNIEXPORT void JNICALL
+Java_io_aatricks_llmedge_KeywordSpotter_nativeGetStats(JNIEnv* env, jclass, jlong handlePtr, jdoubleArray jOut) {
+    auto* kws = reinterpret_cast<KeywordSpotter*>(handlePtr);
+    if (!kws || !jOut || env->GetArrayLength(jOut) < 5) return;
+    std::lock_guard<std::mutex> lock(kws->mutex);
+    // Layout matches KeywordSpotter.Stats.fromNative.
+    const jdouble out[5] = {
+        kws->audioSeconds,
+        kws->cpuMs,
+        (jdouble)kws->evaluations,
+        (jdouble)kws->detections,
+        kws->lastScore,
+    };
+    env->SetDoubleArrayRegion(jOut, 0, 5, out);
+}
+
+} // extern "C"
@@ -2,8 +2,18 @@
 
 #include <jni.h>
 #include <atomic>
+#include <string>
+#include <vector>
 
 struct sd_ctx_t;
+struct upscaler_ctx_t;
+
+// LoRA selected for the next generation request on a handle (see nativeSetLoras).
+struct SdJniLora {
+    std::string path;
+    float multiplier = 1.0f;
+    bool isHighNoise = false;
+};
 
 struct SdHandle {
     sd_ctx_t* ctx = nullptr;
@@ -18,6 +28,10 @@ struct SdHandle {
     int stepsPerFrame = 0;
     int totalSteps = 0;
     int currentFrame = 0;
+    std::vector<SdJniLora> loras;
+    // ESRGAN post-step loaded with nativeLoadUpscaler.
+    upscaler_ctx_t* upscaler = nullptr;
+    int upscaleFactor = 0;
 };
 
 #if defined(SD_JNI_TESTING)
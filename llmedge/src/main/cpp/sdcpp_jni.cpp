@@ -293,6 +293,21 @@ static void sd_android_log_cb(enum sd_log_level_t level, const char* text, void*
     }
 }
 
+// Builds the sd_lora_t view of the handle's current LoRA set. The returned entries point
+// into handle->loras, which must stay unchanged until generation returns.
+static std::vector<sd_lora_t> collectLoras(const SdHandle* handle) {
+    std::vector<sd_lora_t> loras;
+    loras.reserve(handle->loras.size());
+    for (const auto& lora : handle->loras) {
+        sd_lora_t entry{};
+        entry.is_high_noise = lora.isHighNoise;
+        entry.multiplier = lora.multiplier;
+        entry.path = lora.path.c_str();
+        loras.push_back(entry);
+    }
+    return loras;
+}
+
 extern "C" JNIEXPORT jlong JNICALL
 Java_io_aatricks_llmedge_StableDiffusion_nativeCreate(
     JNIEnv* env, jclass clazz,
@@ -307,7 +322,8 @@ Java_io_aatricks_llmedge_StableDiffusion_nativeCreate(
         jboolean flashAttn,
         jboolean jvaeDecodeOnly,
         jfloat flowShift,
-        jstring jLoraModelDir, jint jLoraApplyMode) {
+        jstring jLoraModelDir, jint jLoraApplyMode,
+        jboolean jTaePreviewOnly) {
     (void)clazz;
     FILE* f = fopen("/tmp/sdcpp_log.txt", "a");
     if (f) {
@@ -343,6 +359,8 @@ Java_io_aatricks_llmedge_StableDiffusion_nativeCreate(
     // text encoder is selected correctly for SD 1.x models.
     p.t5xxl_path = t5xxlPath; // keep null if not provided
     p.taesd_path = taesdPath ? taesdPath : "";
+    // Keep the full VAE next to the TAE so deferred latents can be decoded at full quality.
+    p.tae_preview_only = jTaePreviewOnly;
     p.free_params_immediately = true;
     p.n_threads = nThreads > 0 ? nThreads : sd_get_num_physical_cores_safe();
     p.offload_params_to_cpu = offloadToCpu;
@@ -474,6 +492,10 @@ Java_io_aatricks_llmedge_StableDiffusion_nativeDestroy(JNIEnv* env, jobject, jlo
         delete t5;
         handle->t5_ctx = nullptr;
     }
+    if (handle->upscaler) {
+        free_upscaler_ctx(handle->upscaler);
+        handle->upscaler = nullptr;
+    }
     delete handle;
 }
 
@@ -519,6 +541,9 @@ Java_io_aatricks_llmedge_StableDiffusion_nativeTxt2Img(
     sd_img_gen_params_init(&gen);
     gen.prompt = prompt;
     gen.negative_prompt = negative;
+    std::vector<sd_lora_t> loras = collectLoras(handle);
+    gen.loras = loras.data();
+    gen.lora_count = static_cast<uint32_t>(loras.size());
     gen.width = width;
     gen.height = height;
     gen.sample_params = sample;
@@ -555,6 +580,88 @@ Java_io_aatricks_llmedge_StableDiffusion_nativeTxt2Img(
     return jbytes;
 }
 
+// Inpaints `jInitImage` (RGB888) where `jMask` (one byte per pixel, >127 = repaint) is set.
+// With crop enabled only the mask's bounding box is sampled and stitched back.
+extern "C" JNIEXPORT jbyteArray JNICALL
+Java_io_aatricks_llmedge_StableDiffusion_nativeInpaint(
+    JNIEnv* env, jobject thiz, jlong handlePtr,
+    jstring jPrompt, jstring jNegative,
+    jint width, jint height,
+    jint steps, jfloat cfg, jlong seed,
+    jbyteArray jInitImage, jbyteArray jMask, jfloat strength,
+    jboolean jCropEnabled, jint cropPadding, jint cropFeather, jint cropTargetSize) {
+    (void)thiz;
+    if (handlePtr == 0) {
+        ALOGE("StableDiffusion not initialized");
+        return nullptr;
+    }
+    auto* handle = reinterpret_cast<SdHandle*>(handlePtr);
+    if (!handle->ctx) {
+        throwJavaException(env, "java/lang/IllegalStateException",
+                           "StableDiffusion diffusion context is null (T5-only handle). Load a diffusion model before calling inpaint.");
+        return nullptr;
+    }
+    const jsize pixelCount = width * height;
+    if (!jInitImage || !jMask ||
+        env->GetArrayLength(jInitImage) < pixelCount * 3 ||
+        env->GetArrayLength(jMask) < pixelCount) {
+        throwJavaException(env, "java/lang/IllegalArgumentException", "Init image and mask must match width x height");
+        return nullptr;
+    }
+    std::vector<uint8_t> initData(static_cast<size_t>(pixelCount) * 3);
+    std::vector<uint8_t> maskData(static_cast<size_t>(pixelCount));
+    env->GetByteArrayRegion(jInitImage, 0, pixelCount * 3, reinterpret_cast<jbyte*>(initData.data()));
+    env->GetByteArrayRegion(jMask, 0, pixelCount, reinterpret_cast<jbyte*>(maskData.data()));
+
+    const char* prompt = jPrompt ? env->GetStringUTFChars(jPrompt, nullptr) : "";
+    const char* negative = jNegative ? env->GetStringUTFChars(jNegative, nullptr) : "";
+
+    sd_sample_params_t sample{};
+    sd_sample_params_init(&sample);
+    if (steps > 0) sample.sample_steps = steps;
+    sample.guidance.txt_cfg = cfg > 0 ? cfg : 7.0f;
+
+    sd_img_gen_params_t gen{};
+    sd_img_gen_params_init(&gen);
+    gen.prompt = prompt;
+    gen.negative_prompt = negative;
+    std::vector<sd_lora_t> loras = collectLoras(handle);
+    gen.loras = loras.data();
+    gen.lora_count = static_cast<uint32_t>(loras.size());
+    gen.width = width;
+    gen.height = height;
+    gen.sample_params = sample;
+    gen.seed = seed;
+    gen.batch_count = 1;
+    gen.strength = strength;
+    gen.init_image = {static_cast<uint32_t>(width), static_cast<uint32_t>(height), 3, initData.data()};
+    gen.mask_image = {static_cast<uint32_t>(width), static_cast<uint32_t>(height), 1, maskData.data()};
+    gen.inpaint_crop.enabled = jCropEnabled ? true : false;
+    if (cropPadding >= 0) gen.inpaint_crop.padding = cropPadding;
+    if (cropFeather >= 0) gen.inpaint_crop.feather = cropFeather;
+    gen.inpaint_crop.target_size = cropTargetSize;
+
+    sd_image_t* out = generate_image(handle->ctx, &gen);
+
+    if (jPrompt) env->ReleaseStringUTFChars(jPrompt, prompt);
+    if (jNegative) env->ReleaseStringUTFChars(jNegative, negative);
+
+    if (!out || !out[0].data) {
+        ALOGE("inpaint failed");
+        if (out) free(out);
+        return nullptr;
+    }
+
+    const size_t byteCount = (size_t)out[0].width * out[0].height * out[0].channel;
+    jbyteArray jbytes = env->NewByteArray((jsize)byteCount);
+    if (jbytes) {
+        env->SetByteArrayRegion(jbytes, 0, (jsize)byteCount, reinterpret_cast<jbyte*>(out[0].data));
+    }
+    free(out[0].data);
+    free(out);
+    return jbytes;
+}
+
 extern "C" JNIEXPORT jobjectArray JNICALL
 Java_io_aatricks_llmedge_StableDiffusion_nativeTxt2Vid(
     JNIEnv* env, jobject thiz, jlong handlePtr,
@@ -602,6 +709,9 @@ Java_io_aatricks_llmedge_StableDiffusion_nativeTxt2Vid(
     sd_vid_gen_params_init(&gen);
     gen.prompt = prompt;
     gen.negative_prompt = negative;
+    std::vector<sd_lora_t> loras = collectLoras(handle);
+    gen.loras = loras.data();
+    gen.lora_count = static_cast<uint32_t>(loras.size());
     gen.width = width;
     gen.height = height;
     gen.video_frames = videoFrames;
@@ -796,6 +906,61 @@ Java_io_aatricks_llmedge_StableDiffusion_nativeTxt2Vid(
 //   2) load diffusion+VAE -> generate using precomputed condition
 // -----------------------------------------------------------------------------
 
+// Converts a native condition into the Object[] layout consumed by StableDiffusion.kt:
+// {float[] cross, int[] cross_dims, float[] vec, int[] vec_dims, float[] concat, int[] concat_dims}.
+// Does not take ownership of `cond`. Returns nullptr with a pending Java exception on failure.
+static jobjectArray conditionToJavaArray(JNIEnv* env, const sd_condition_raw_t* cond) {
+    jclass objClass = env->FindClass("java/lang/Object");
+    if (!objClass) {
+        throwJavaException(env, "java/lang/RuntimeException", "Unable to find java/lang/Object");
+        return nullptr;
+    }
+
+    jobjectArray result = env->NewObjectArray(6, objClass, nullptr);
+    if (!result) {
+        throwJavaException(env, "java/lang/OutOfMemoryError", "Unable to allocate result array");
+        return nullptr;
+    }
+
+    // Helper lambda to push arrays
+    auto push_tensor = [&](const sd_tensor_raw_t* t, int data_index, int dims_index) {
+        if (t == nullptr || t->ndims == 0 || t->data == nullptr) {
+            env->SetObjectArrayElement(result, data_index, nullptr);
+            env->SetObjectArrayElement(result, dims_index, nullptr);
+            return;
+        }
+        size_t count = 1;
+        for (int i = 0; i < t->ndims; ++i) count *= (size_t)t->ne[i];
+
+        jfloatArray floatArr = env->NewFloatArray(static_cast<jsize>(count));
+        if (!floatArr) {
+            env->SetObjectArrayElement(result, data_index, nullptr);
+        } else {
+            env->SetFloatArrayRegion(floatArr, 0, static_cast<jsize>(count), reinterpret_cast<const jfloat*>(t->data));
+            env->SetObjectArrayElement(result, data_index, floatArr);
+            env->DeleteLocalRef(floatArr);
+        }
+
+        jintArray dimsArr = env->NewIntArray(t->ndims);
+        if (!dimsArr) {
+            env->SetObjectArrayElement(result, dims_index, nullptr);
+        } else {
+            jint dims[4] = {0,0,0,0};
+            for (int i = 0; i < t->ndims && i < 4; ++i) dims[i] = t->ne[i];
+            env->SetIntArrayRegion(dimsArr, 0, t->ndims, dims);
+            env->SetObjectArrayElement(result, dims_index, dimsArr);
+            env->DeleteLocalRef(dimsArr);
+        }
+    };
+
+    // The condition struct uses sd_tensor_raw_t members; pass by reference to the lambda
+    push_tensor(&cond->c_crossattn, 0, 1);
+    push_tensor(&cond->c_vector, 2, 3);
+    push_tensor(&cond->c_concat, 4, 5);
+
+    return result;
+}
+
 // JNI wrapper: precompute condition for a given prompt & video params
 extern "C" JNIEXPORT jobjectArray JNICALL
 Java_io_aatricks_llmedge_StableDiffusion_nativePrecomputeCondition(
@@ -903,60 +1068,98 @@ Java_io_aatricks_llmedge_StableDiffusion_nativePrecomputeCondition(
         return nullptr;
     }
 
-    // We'll return an Object[] = {float[] cross, int[] cross_dims, float[] vec, int[] vec_dims, float[] concat, int[] concat_dims}
-    jclass objClass = env->FindClass("java/lang/Object");
-    if (!objClass) {
-        sd_free_condition(cond);
-        throwJavaException(env, "java/lang/RuntimeException", "Unable to find java/lang/Object");
+    jobjectArray result = conditionToJavaArray(env, cond);
+
+    // Free native cond buffers
+    sd_free_condition(cond);
+
+    return result;
+}
+
+// JNI wrapper: precompute cond and uncond in one call so the text encoder weights are
+// loaded once and (for T5) both prompts share a single batched forward pass.
+// Returns Object[2] = {cond, uncond}, each in the conditionToJavaArray() layout.
+extern "C" JNIEXPORT jobjectArray JNICALL
+Java_io_aatricks_llmedge_StableDiffusion_nativePrecomputeConditionPair(
+        JNIEnv* env, jobject thiz, jlong handlePtr,
+        jstring jPrompt, jstring jNegative,
+        jint width, jint height, jint clipSkip) {
+    (void)thiz;
+
+    if (handlePtr == 0) {
+        throwJavaException(env, "java/lang/IllegalStateException", "StableDiffusion not initialized");
         return nullptr;
     }
-
-    jobjectArray result = env->NewObjectArray(6, objClass, nullptr);
-    if (!result) {
-        sd_free_condition(cond);
-        throwJavaException(env, "java/lang/OutOfMemoryError", "Unable to allocate result array");
+    auto* handle = reinterpret_cast<SdHandle*>(handlePtr);
+    if (!handle->ctx && !handle->t5_ctx) {
+        throwJavaException(env, "java/lang/IllegalStateException", "Invalid handle state");
         return nullptr;
     }
 
-    // Helper lambda to push arrays
-    auto push_tensor = [&](const sd_tensor_raw_t* t, int data_index, int dims_index) {
-        if (t == nullptr || t->ndims == 0 || t->data == nullptr) {
-            env->SetObjectArrayElement(result, data_index, nullptr);
-            env->SetObjectArrayElement(result, dims_index, nullptr);
-            return;
-        }
-        size_t count = 1;
-        for (int i = 0; i < t->ndims; ++i) count *= (size_t)t->ne[i];
+    const char* prompt = jPrompt ? env->GetStringUTFChars(jPrompt, nullptr) : "";
+    const char* negative = jNegative ? env->GetStringUTFChars(jNegative, nullptr) : "";
 
-        jfloatArray floatArr = env->NewFloatArray(static_cast<jsize>(count));
-        if (!floatArr) {
-            env->SetObjectArrayElement(result, data_index, nullptr);
+    sd_condition_raw_t* cond = nullptr;
+    sd_condition_raw_t* uncond = nullptr;
+    bool ok = false;
+    try {
+        if (handle->ctx) {
+            ok = sd_precompute_condition_pair(handle->ctx,
+                                              prompt,
+                                              negative,
+                                              clipSkip,
+                                              width,
+                                              height,
+                                              true,
+                                              &cond,
+                                              &uncond);
         } else {
-            env->SetFloatArrayRegion(floatArr, 0, static_cast<jsize>(count), reinterpret_cast<const jfloat*>(t->data));
-            env->SetObjectArrayElement(result, data_index, floatArr);
-            env->DeleteLocalRef(floatArr);
+            ok = sd_t5_precompute_condition_pair(handle->t5_ctx,
+                                                 sd_get_num_physical_cores_safe(),
+                                                 prompt,
+                                                 negative,
+                                                 false,
+                                                 &cond,
+                                                 &uncond);
         }
+    } catch (const std::exception& e) {
+        if (jPrompt) env->ReleaseStringUTFChars(jPrompt, prompt);
+        if (jNegative) env->ReleaseStringUTFChars(jNegative, negative);
+        throwJavaException(env, "java/lang/RuntimeException", e.what());
+        return nullptr;
+    }
 
-        jintArray dimsArr = env->NewIntArray(t->ndims);
-        if (!dimsArr) {
-            env->SetObjectArrayElement(result, dims_index, nullptr);
-        } else {
-            jint dims[4] = {0,0,0,0};
-            for (int i = 0; i < t->ndims && i < 4; ++i) dims[i] = t->ne[i];
-            env->SetIntArrayRegion(dimsArr, 0, t->ndims, dims);
-            env->SetObjectArrayElement(result, dims_index, dimsArr);
-            env->DeleteLocalRef(dimsArr);
-        }
-    };
+    if (jPrompt) env->ReleaseStringUTFChars(jPrompt, prompt);
+    if (jNegative) env->ReleaseStringUTFChars(jNegative, negative);
 
-    // The condition struct uses sd_tensor_raw_t members; pass by reference to the lambda
-    push_tensor(&cond->c_crossattn, 0, 1);
-    push_tensor(&cond->c_vector, 2, 3);
-    push_tensor(&cond->c_concat, 4, 5);
+    if (!ok || !cond || !uncond) {
+        sd_free_condition(cond);
+        sd_free_condition(uncond);
+        throwJavaException(env, "java/lang/IllegalStateException", "Condition precompute failed");
+        return nullptr;
+    }
 
-    // Free native cond buffers
+    jobjectArray result = nullptr;
+    jobjectArray condArr = conditionToJavaArray(env, cond);
+    jobjectArray uncondArr = condArr ? conditionToJavaArray(env, uncond) : nullptr;
     sd_free_condition(cond);
+    sd_free_condition(uncond);
+    if (!condArr || !uncondArr) {
+        return nullptr;
+    }
 
+    jclass objClass = env->FindClass("java/lang/Object");
+    if (objClass) {
+        result = env->NewObjectArray(2, objClass, nullptr);
+    }
+    if (!result) {
+        throwJavaException(env, "java/lang/OutOfMemoryError", "Unable to allocate result array");
+        return nullptr;
+    }
+    env->SetObjectArrayElement(result, 0, condArr);
+    env->SetObjectArrayElement(result, 1, uncondArr);
+    env->DeleteLocalRef(condArr);
+    env->DeleteLocalRef(uncondArr);
     return result;
 }
 
@@ -1051,6 +1254,9 @@ Java_io_aatricks_llmedge_StableDiffusion_nativeTxt2ImgWithPrecomputedCondition(
     sd_img_gen_params_init(&gen);
     gen.prompt = prompt;
     gen.negative_prompt = negative;
+    std::vector<sd_lora_t> loras = collectLoras(handle);
+    gen.loras = loras.data();
+    gen.lora_count = static_cast<uint32_t>(loras.size());
     gen.width = width;
     gen.height = height;
     gen.sample_params = sample;
@@ -1133,6 +1339,9 @@ Java_io_aatricks_llmedge_StableDiffusion_nativeTxt2VidWithPrecomputedCondition(
     sd_vid_gen_params_init(&gen);
     gen.prompt = prompt;
     gen.negative_prompt = negative;
+    std::vector<sd_lora_t> loras = collectLoras(handle);
+    gen.loras = loras.data();
+    gen.lora_count = static_cast<uint32_t>(loras.size());
     gen.width = width;
     gen.height = height;
     gen.video_frames = videoFrames;
@@ -1373,6 +1582,294 @@ Java_io_aatricks_llmedge_StableDiffusion_nativeSetProgressCallback(
     sd_set_progress_callback(sd_video_progress_wrapper, handle);
 }
 
+// Selects the LoRA set used by subsequent generation calls on this handle. With runtime
+// LoRA application the LoRA weights stay resident in a per-context pool, so switching sets
+// between requests does not reload files. Empty arrays clear the set.
+extern "C" JNIEXPORT void JNICALL
+Java_io_aatricks_llmedge_StableDiffusion_nativeSetLoras(
+        JNIEnv* env, jobject, jlong handlePtr,
+        jobjectArray jPaths, jfloatArray jMultipliers, jbooleanArray jHighNoise) {
+    if (handlePtr == 0) {
+        throwJavaException(env, "java/lang/IllegalStateException", "StableDiffusion not initialized");
+        return;
+    }
+    auto* handle = reinterpret_cast<SdHandle*>(handlePtr);
+    handle->loras.clear();
+    if (!jPaths) {
+        return;
+    }
+
+    const jsize count = env->GetArrayLength(jPaths);
+    if ((jMultipliers && env->GetArrayLength(jMultipliers) != count) ||
+        (jHighNoise && env->GetArrayLength(jHighNoise) != count)) {
+        throwJavaException(env, "java/lang/IllegalArgumentException", "LoRA arrays must have the same length");
+        return;
+    }
+    std::vector<jfloat> multipliers(count, 1.0f);
+    std::vector<jboolean> highNoise(count, JNI_FALSE);
+    if (jMultipliers && count > 0) env->GetFloatArrayRegion(jMultipliers, 0, count, multipliers.data());
+    if (jHighNoise && count > 0) env->GetBooleanArrayRegion(jHighNoise, 0, count, highNoise.data());
+
+    for (jsize i = 0; i < count; ++i) {
+        auto jPath = static_cast<jstring>(env->GetObjectArrayElement(jPaths, i));
+        if (!jPath) continue;
+        const char* path = env->GetStringUTFChars(jPath, nullptr);
+        if (path) {
+            SdJniLora lora;
+            lora.path = path;
+            lora.multiplier = multipliers[i];
+            lora.isHighNoise = highNoise[i] == JNI_TRUE;
+            handle->loras.push_back(std::move(lora));
+            env->ReleaseStringUTFChars(jPath, path);
+        }
+        env->DeleteLocalRef(jPath);
+    }
+    ALOGI("LoRA set updated: %zu entries", handle->loras.size());
+}
+
+// -----------------------------------------------------------------------------
+// Deferred VAE decode
+//
+// With deferral enabled, generation returns TAE drafts and keeps the final
+// latents native-side. Kotlin takes ownership of them as opaque pointers and
+// decodes them with the full VAE on demand.
+// -----------------------------------------------------------------------------
+
+extern "C" JNIEXPORT void JNICALL
+Java_io_aatricks_llmedge_StableDiffusion_nativeSetDeferredDecode(
+        JNIEnv* env, jobject, jlong handlePtr, jboolean enabled) {
+    if (handlePtr == 0) {
+        throwJavaException(env, "java/lang/IllegalStateException", "StableDiffusion not initialized");
+        return;
+    }
+    auto* handle = reinterpret_cast<SdHandle*>(handlePtr);
+    if (!handle->ctx) {
+        return;
+    }
+    sd_set_deferred_decode(handle->ctx, enabled == JNI_TRUE);
+}
+
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_io_aatricks_llmedge_StableDiffusion_nativeTakeDeferredLatents(
+        JNIEnv* env, jobject, jlong handlePtr) {
+    if (handlePtr == 0) {
+        throwJavaException(env, "java/lang/IllegalStateException", "StableDiffusion not initialized");
+        return nullptr;
+    }
+    auto* handle = reinterpret_cast<SdHandle*>(handlePtr);
+    if (!handle->ctx) {
+        return env->NewLongArray(0);
+    }
+    std::vector<sd_latent_t*> latents(sd_deferred_latent_count(handle->ctx));
+    const int count = latents.empty()
+            ? 0
+            : sd_take_deferred_latents(handle->ctx, latents.data(), static_cast<int>(latents.size()));
+    jlongArray result = env->NewLongArray(count);
+    if (!result) {
+        for (int i = 0; i < count; ++i) sd_free_latent(latents[i]);
+        return nullptr;
+    }
+    std::vector<jlong> ptrs(count);
+    for (int i = 0; i < count; ++i) ptrs[i] = reinterpret_cast<jlong>(latents[i]);
+    if (count > 0) env->SetLongArrayRegion(result, 0, count, ptrs.data());
+    return result;
+}
+
+// Returns {byte[] frame0, byte[] frame1, ...}; every frame is RGB888 with the
+// dimensions reported through `dimsOut` ({width, height}).
+extern "C" JNIEXPORT jobjectArray JNICALL
+Java_io_aatricks_llmedge_StableDiffusion_nativeDecodeLatent(
+        JNIEnv* env, jobject, jlong handlePtr, jlong latentPtr, jboolean tiled, jintArray dimsOut) {
+    if (handlePtr == 0 || latentPtr == 0) {
+        throwJavaException(env, "java/lang/IllegalStateException", "StableDiffusion not initialized");
+        return nullptr;
+    }
+    auto* handle = reinterpret_cast<SdHandle*>(handlePtr);
+    if (!handle->ctx) {
+        throwJavaException(env, "java/lang/IllegalStateException",
+                           "StableDiffusion diffusion context is null (T5-only handle)");
+        return nullptr;
+    }
+    auto* latent = reinterpret_cast<sd_latent_t*>(latentPtr);
+
+    int numFrames = 0;
+    sd_image_t* frames = sd_decode_latent(handle->ctx, latent, tiled == JNI_TRUE, &numFrames);
+    if (!frames || numFrames <= 0) {
+        ALOGE("sd_decode_latent failed");
+        if (frames) free(frames);
+        return nullptr;
+    }
+
+    jclass byteArrayCls = env->FindClass("[B");
+    jobjectArray result = byteArrayCls ? env->NewObjectArray(numFrames, byteArrayCls, nullptr) : nullptr;
+    for (int i = 0; i < numFrames; ++i) {
+        if (result && frames[i].data) {
+            const size_t byteCount = static_cast<size_t>(frames[i].width) * frames[i].height * frames[i].channel;
+            jbyteArray frameBytes = env->NewByteArray(static_cast<jsize>(byteCount));
+            if (frameBytes) {
+                env->SetByteArrayRegion(frameBytes, 0, static_cast<jsize>(byteCount),
+                                        reinterpret_cast<jbyte*>(frames[i].data));
+                env->SetObjectArrayElement(result, i, frameBytes);
+                env->DeleteLocalRef(frameBytes);
+            } else {
+                result = nullptr;
+            }
+        }
+        free(frames[i].data);
+    }
+    if (result && dimsOut && env->GetArrayLength(dimsOut) >= 2) {
+        jint dims[2] = {static_cast<jint>(frames[0].width), static_cast<jint>(frames[0].height)};
+        env->SetIntArrayRegion(dimsOut, 0, 2, dims);
+    }
+    free(frames);
+    return result;
+}
+
+// Loads (or replaces) the ESRGAN upscaler of the handle. Returns the upscale factor, 0 on failure.
+extern "C" JNIEXPORT jint JNICALL
+Java_io_aatricks_llmedge_StableDiffusion_nativeLoadUpscaler(
+        JNIEnv* env, jobject, jlong handlePtr, jstring jPath, jint tileSize) {
+    if (handlePtr == 0 || !jPath) {
+        throwJavaException(env, "java/lang/IllegalStateException", "StableDiffusion not initialized");
+        return 0;
+    }
+    auto* handle = reinterpret_cast<SdHandle*>(handlePtr);
+    if (handle->upscaler) {
+        free_upscaler_ctx(handle->upscaler);
+        handle->upscaler = nullptr;
+        handle->upscaleFactor = 0;
+    }
+    const char* path = env->GetStringUTFChars(jPath, nullptr);
+    handle->upscaler = new_upscaler_ctx(path, false, false, sd_get_num_physical_cores_safe(), tileSize);
+    env->ReleaseStringUTFChars(jPath, path);
+    if (!handle->upscaler) {
+        ALOGE("new_upscaler_ctx failed");
+        return 0;
+    }
+    handle->upscaleFactor = get_upscale_factor(handle->upscaler);
+    ALOGI("Loaded upscaler (x%d, tile %d)", handle->upscaleFactor, (int)tileSize);
+    return handle->upscaleFactor;
+}
+
+// Upscales RGB frames of width x height one by one with the handle's upscaler. Each frame is
+// tiled (upscaler tile size) so peak memory stays bounded for any resolution. A generation that
+// upscales its own output keeps a pending cancel (resetCancellation false) so it still stops.
+extern "C" JNIEXPORT jobjectArray JNICALL
+Java_io_aatricks_llmedge_StableDiffusion_nativeUpscale(
+        JNIEnv* env, jobject, jlong handlePtr, jobjectArray jFrames, jint width, jint height,
+        jboolean resetCancellation, jintArray dimsOut) {
+    if (handlePtr == 0 || !jFrames) {
+        throwJavaException(env, "java/lang/IllegalStateException", "StableDiffusion not initialized");
+        return nullptr;
+    }
+    auto* handle = reinterpret_cast<SdHandle*>(handlePtr);
+    if (!handle->upscaler || handle->upscaleFactor <= 0) {
+        throwJavaException(env, "java/lang/IllegalStateException", "No upscaler loaded");
+        return nullptr;
+    }
+    const jsize numFrames = env->GetArrayLength(jFrames);
+    const size_t inBytes = static_cast<size_t>(width) * height * 3;
+    jclass byteArrayCls = env->FindClass("[B");
+    jobjectArray result = byteArrayCls ? env->NewObjectArray(numFrames, byteArrayCls, nullptr) : nullptr;
+    std::vector<uint8_t> input(inBytes);
+    int outWidth = 0;
+    int outHeight = 0;
+    if (resetCancellation == JNI_TRUE) {
+        handle->cancellationRequested.store(false);
+    }
+    for (jsize i = 0; result && i < numFrames; ++i) {
+        if (handle->cancellationRequested.load()) {
+            ALOGI("Upscale cancelled after %d of %d frames", (int)i, (int)numFrames);
+            result = nullptr;
+            break;
+        }
+        auto frame = static_cast<jbyteArray>(env->GetObjectArrayElement(jFrames, i));
+        if (!frame || static_cast<size_t>(env->GetArrayLength(frame)) < inBytes) {
+            ALOGE("Upscale frame %d is missing or shorter than %dx%d RGB", (int)i, (int)width, (int)height);
+            result = nullptr;
+            break;
+        }
+        env->GetByteArrayRegion(frame, 0, static_cast<jsize>(inBytes), reinterpret_cast<jbyte*>(input.data()));
+        env->DeleteLocalRef(frame);
+
+        sd_image_t in{static_cast<uint32_t>(width), static_cast<uint32_t>(height), 3, input.data()};
+        sd_image_t out = upscale(handle->upscaler, in, static_cast<uint32_t>(handle->upscaleFactor));
+        if (!out.data) {
+            ALOGE("upscale failed on frame %d", (int)i);
+            result = nullptr;
+            break;
+        }
+        outWidth = static_cast<int>(out.width);
+        outHeight = static_cast<int>(out.height);
+        const size_t outBytes = static_cast<size_t>(out.width) * out.height * out.channel;
+        jbyteArray frameBytes = env->NewByteArray(static_cast<jsize>(outBytes));
+        if (frameBytes) {
+            env->SetByteArrayRegion(frameBytes, 0, static_cast<jsize>(outBytes), reinterpret_cast<jbyte*>(out.data));
+            env->SetObjectArrayElement(result, i, frameBytes);
+            env->DeleteLocalRef(frameBytes);
+        } else {
+            result = nullptr;
+        }
+        free(out.data);
+    }
+    if (result && dimsOut && env->GetArrayLength(dimsOut) >= 2) {
+        jint dims[2] = {static_cast<jint>(outWidth), static_cast<jint>(outHeight)};
+        env->SetIntArrayRegion(dimsOut, 0, 2, dims);
+    }
+    return result;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_io_aatricks_llmedge_StableDiffusion_nativeSetSparseAttention(
+        JNIEnv* env, jobject, jlong handlePtr, jboolean enabled, jint windowFrames, jint globalStride) {
+    if (handlePtr == 0) {
+        throwJavaException(env, "java/lang/IllegalStateException", "StableDiffusion not initialized");
+        return;
+    }
+    auto* handle = reinterpret_cast<SdHandle*>(handlePtr);
+    if (!handle->ctx) {
+        return;
+    }
+    sd_sparse_attention_params_t params{enabled == JNI_TRUE, windowFrames, globalStride};
+    sd_set_sparse_attention(handle->ctx, &params);
+}
+
+// Passing a null prefix disables checkpointing.
+extern "C" JNIEXPORT void JNICALL
+Java_io_aatricks_llmedge_StableDiffusion_nativeSetCheckpoint(
+        JNIEnv* env, jobject, jlong handlePtr, jstring jPathPrefix, jint everyNSteps, jboolean resume) {
+    if (handlePtr == 0) {
+        throwJavaException(env, "java/lang/IllegalStateException", "StableDiffusion not initialized");
+        return;
+    }
+    auto* handle = reinterpret_cast<SdHandle*>(handlePtr);
+    if (!handle->ctx) {
+        return;
+    }
+    const char* prefix = jPathPrefix ? env->GetStringUTFChars(jPathPrefix, nullptr) : nullptr;
+    sd_set_sampling_checkpoint(handle->ctx, prefix, everyNSteps, resume == JNI_TRUE);
+    if (prefix) env->ReleaseStringUTFChars(jPathPrefix, prefix);
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_io_aatricks_llmedge_StableDiffusion_nativeSpillLatent(
+        JNIEnv* env, jclass, jlong latentPtr, jstring jPath) {
+    if (latentPtr == 0 || !jPath) {
+        return JNI_FALSE;
+    }
+    const char* path = env->GetStringUTFChars(jPath, nullptr);
+    const bool ok = sd_latent_spill_to_file(reinterpret_cast<sd_latent_t*>(latentPtr), path);
+    env->ReleaseStringUTFChars(jPath, path);
+    return ok ? JNI_TRUE : JNI_FALSE;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_io_aatricks_llmedge_StableDiffusion_nativeFreeLatent(
+        JNIEnv*, jclass, jlong latentPtr) {
+    if (latentPtr == 0) return;
+    sd_free_latent(reinterpret_cast<sd_latent_t*>(latentPtr));
+}
+
 extern "C" JNIEXPORT void JNICALL
 Java_io_aatricks_llmedge_StableDiffusion_nativeCancelGeneration(
         JNIEnv* env, jobject, jlong handlePtr) {
@@ -1,5 +1,11 @@
 #include "LLMInference.h"
+#include "KvSessionManager.h"
+#include "ImageTokenBudget.h"
+#include "FrameDedup.h"
+#include "ResultCache.h"
 #include <jni.h>
+#include <algorithm>
+#include <cmath>
 #include <fstream>
 #include <memory>
 #include <mutex>
@@ -12,7 +18,7 @@
 extern "C" JNIEXPORT jlong JNICALL
 Java_io_aatricks_llmedge_SmolLM_loadModel(JNIEnv* env, jobject thiz, jstring modelPath, jfloat minP,
                                             jfloat temperature, jboolean storeChats, jlong contextSize,
-                                            jstring chatTemplate, jint nThreads, jboolean useMmap, jboolean useMlock,
+                                            jlong initialContextSize, jstring chatTemplate, jint nThreads, jboolean useMmap, jboolean useMlock,
                                             jboolean useVulkan) {
     jboolean    isCopy           = true;
     const char* modelPathCstr    = env->GetStringUTFChars(modelPath, &isCopy);
@@ -20,8 +26,8 @@ Java_io_aatricks_llmedge_SmolLM_loadModel(JNIEnv* env, jobject thiz, jstring mod
     const char* chatTemplateCstr = env->GetStringUTFChars(chatTemplate, &isCopy);
 
     try {
-        llmInference->loadModel(modelPathCstr, minP, temperature, storeChats, contextSize, chatTemplateCstr, nThreads,
-                                useMmap, useMlock, useVulkan);
+        llmInference->loadModel(modelPathCstr, minP, temperature, storeChats, contextSize, initialContextSize,
+                                chatTemplateCstr, nThreads, useMmap, useMlock, useVulkan);
     } catch (std::runtime_error& error) {
         env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
     }
@@ -38,7 +44,11 @@ Java_io_aatricks_llmedge_SmolLM_addChatMessage(JNIEnv* env, jobject thiz, jlong
     const char* messageCstr  = env->GetStringUTFChars(message, &isCopy);
     const char* roleCstr     = env->GetStringUTFChars(role, &isCopy);
     auto*       llmInference = reinterpret_cast<LLMInference*>(modelPtr);
-    llmInference->addChatMessage(messageCstr, roleCstr);
+    try {
+        llmInference->addChatMessage(messageCstr, roleCstr);
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+    }
     env->ReleaseStringUTFChars(message, messageCstr);
     env->ReleaseStringUTFChars(role, roleCstr);
 }
@@ -78,7 +88,11 @@ Java_io_aatricks_llmedge_SmolLM_startCompletion(JNIEnv* env, jobject thiz, jlong
     jboolean    isCopy       = true;
     const char* promptCstr   = env->GetStringUTFChars(prompt, &isCopy);
     auto*       llmInference = reinterpret_cast<LLMInference*>(modelPtr);
-    llmInference->startCompletion(promptCstr);
+    try {
+        llmInference->startCompletion(promptCstr);
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+    }
     env->ReleaseStringUTFChars(prompt, promptCstr);
 }
 
@@ -111,6 +125,466 @@ Java_io_aatricks_llmedge_SmolLM_stopCompletion(JNIEnv* env, jobject thiz, jlong
     llmInference->stopCompletion();
 }
 
+extern "C" JNIEXPORT void JNICALL
+Java_io_aatricks_llmedge_SmolLM_nativeSetGrammar(JNIEnv* env, jobject thiz, jlong modelPtr, jstring grammar,
+                                                 jboolean isJsonSchema) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    if (llmInference == nullptr) {
+        return;
+    }
+    const char* grammarCstr = grammar ? env->GetStringUTFChars(grammar, nullptr) : nullptr;
+    try {
+        llmInference->setGrammar(grammarCstr, isJsonSchema == JNI_TRUE);
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalArgumentException"), error.what());
+    }
+    if (grammarCstr) {
+        env->ReleaseStringUTFChars(grammar, grammarCstr);
+    }
+}
+
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_io_aatricks_llmedge_SmolLM_nativeGetGrammarStats(JNIEnv* env, jobject thiz, jlong modelPtr) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    if (llmInference == nullptr) {
+        return nullptr;
+    }
+    std::vector<int64_t> stats = llmInference->getGrammarStats();
+    jlongArray arr = env->NewLongArray(static_cast<jsize>(stats.size()));
+    if (!arr) return nullptr;
+    env->SetLongArrayRegion(arr, 0, static_cast<jsize>(stats.size()), reinterpret_cast<const jlong*>(stats.data()));
+    return arr;
+}
+
+extern "C" JNIEXPORT jintArray JNICALL
+Java_io_aatricks_llmedge_SmolLM_nativeTokenize(JNIEnv* env, jobject thiz, jlong modelPtr, jstring text) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    if (llmInference == nullptr || text == nullptr) {
+        return nullptr;
+    }
+    const char* textCstr = env->GetStringUTFChars(text, nullptr);
+    std::vector<llama_token> tokens = llmInference->tokenize(textCstr);
+    env->ReleaseStringUTFChars(text, textCstr);
+    jintArray arr = env->NewIntArray(static_cast<jsize>(tokens.size()));
+    if (!arr) return nullptr;
+    env->SetIntArrayRegion(arr, 0, static_cast<jsize>(tokens.size()), reinterpret_cast<const jint*>(tokens.data()));
+    return arr;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_io_aatricks_llmedge_SmolLM_nativeSetAllowedTokens(JNIEnv* env, jobject thiz, jlong modelPtr, jintArray tokens,
+                                                       jboolean validate) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    if (llmInference == nullptr) {
+        return;
+    }
+    std::vector<llama_token> allowed;
+    if (tokens != nullptr) {
+        allowed.resize(env->GetArrayLength(tokens));
+        env->GetIntArrayRegion(tokens, 0, static_cast<jsize>(allowed.size()), reinterpret_cast<jint*>(allowed.data()));
+    }
+    try {
+        llmInference->setAllowedTokens(allowed, validate == JNI_TRUE);
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+    }
+}
+
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_io_aatricks_llmedge_SmolLM_nativeGetRestrictedHeadStats(JNIEnv* env, jobject thiz, jlong modelPtr) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    if (llmInference == nullptr) {
+        return nullptr;
+    }
+    std::vector<int64_t> stats = llmInference->getRestrictedHeadStats();
+    jlongArray arr = env->NewLongArray(static_cast<jsize>(stats.size()));
+    if (!arr) return nullptr;
+    env->SetLongArrayRegion(arr, 0, static_cast<jsize>(stats.size()), reinterpret_cast<const jlong*>(stats.data()));
+    return arr;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_io_aatricks_llmedge_SmolLM_nativeClearHistory(JNIEnv* env, jobject thiz, jlong modelPtr) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    if (llmInference == nullptr) {
+        return;
+    }
+    try {
+        llmInference->clearHistory();
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+    }
+}
+
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_io_aatricks_llmedge_SmolLM_nativeGetContextStats(JNIEnv* env, jobject thiz, jlong modelPtr) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    if (llmInference == nullptr) {
+        return nullptr;
+    }
+    std::vector<int64_t> stats = llmInference->getContextStats();
+    jlongArray arr = env->NewLongArray(static_cast<jsize>(stats.size()));
+    if (!arr) return nullptr;
+    env->SetLongArrayRegion(arr, 0, static_cast<jsize>(stats.size()), reinterpret_cast<const jlong*>(stats.data()));
+    return arr;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_io_aatricks_llmedge_SmolLM_nativeConfigureSessionPaging(JNIEnv* env, jclass clazz, jstring directory,
+                                                             jlong ramBudgetBytes) {
+    const char* directoryCstr = directory ? env->GetStringUTFChars(directory, nullptr) : nullptr;
+    KvSessionManager::instance().configure(directoryCstr ? directoryCstr : "",
+                                           static_cast<size_t>(std::max<jlong>(ramBudgetBytes, 0)));
+    if (directoryCstr) {
+        env->ReleaseStringUTFChars(directory, directoryCstr);
+    }
+}
+
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_io_aatricks_llmedge_SmolLM_nativeGetPagingStats(JNIEnv* env, jobject thiz, jlong modelPtr) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    if (llmInference == nullptr) {
+        return nullptr;
+    }
+    std::vector<int64_t> stats = llmInference->getPagingStats();
+    jlongArray arr = env->NewLongArray(static_cast<jsize>(stats.size()));
+    if (!arr) return nullptr;
+    env->SetLongArrayRegion(arr, 0, static_cast<jsize>(stats.size()), reinterpret_cast<const jlong*>(stats.data()));
+    return arr;
+}
+
+extern "C" JNIEXPORT jbyteArray JNICALL
+Java_io_aatricks_llmedge_SmolLM_nativeEncodePassage(JNIEnv* env, jobject thiz, jlong modelPtr, jstring text) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    if (llmInference == nullptr || text == nullptr) {
+        return nullptr;
+    }
+    const char* textCstr = env->GetStringUTFChars(text, nullptr);
+    std::vector<uint8_t> blob;
+    try {
+        blob = llmInference->encodePassage(textCstr);
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+    }
+    env->ReleaseStringUTFChars(text, textCstr);
+    if (blob.empty()) return nullptr;
+    jbyteArray arr = env->NewByteArray(static_cast<jsize>(blob.size()));
+    if (!arr) return nullptr;
+    env->SetByteArrayRegion(arr, 0, static_cast<jsize>(blob.size()), reinterpret_cast<const jbyte*>(blob.data()));
+    return arr;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_io_aatricks_llmedge_SmolLM_nativeStartCompletionWithPassages(JNIEnv* env, jobject thiz, jlong modelPtr,
+                                                                  jstring query, jobjectArray passages,
+                                                                  jobjectArray gaps, jfloat recomputeRatio) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    if (llmInference == nullptr || query == nullptr || passages == nullptr || gaps == nullptr) {
+        return;
+    }
+    std::vector<std::vector<uint8_t>> blobs(env->GetArrayLength(passages));
+    for (size_t i = 0; i < blobs.size(); ++i) {
+        auto blob = static_cast<jbyteArray>(env->GetObjectArrayElement(passages, static_cast<jsize>(i)));
+        if (blob != nullptr) {
+            blobs[i].resize(env->GetArrayLength(blob));
+            env->GetByteArrayRegion(blob, 0, static_cast<jsize>(blobs[i].size()),
+                                    reinterpret_cast<jbyte*>(blobs[i].data()));
+            env->DeleteLocalRef(blob);
+        }
+    }
+    std::vector<std::string> gapTexts(env->GetArrayLength(gaps));
+    for (size_t i = 0; i < gapTexts.size(); ++i) {
+        auto gap = static_cast<jstring>(env->GetObjectArrayElement(gaps, static_cast<jsize>(i)));
+        if (gap != nullptr) {
+            const char* gapCstr = env->GetStringUTFChars(gap, nullptr);
+            gapTexts[i] = gapCstr;
+            env->ReleaseStringUTFChars(gap, gapCstr);
+            env->DeleteLocalRef(gap);
+        }
+    }
+    const char* queryCstr = env->GetStringUTFChars(query, nullptr);
+    try {
+        llmInference->startCompletionWithPassages(queryCstr, blobs, gapTexts, recomputeRatio);
+    } catch (std::invalid_argument& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalArgumentException"), error.what());
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+    }
+    env->ReleaseStringUTFChars(query, queryCstr);
+}
+
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_io_aatricks_llmedge_SmolLM_nativeGetPassageStats(JNIEnv* env, jobject thiz, jlong modelPtr) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    if (llmInference == nullptr) {
+        return nullptr;
+    }
+    std::vector<int64_t> stats = llmInference->getPassageStats();
+    jlongArray arr = env->NewLongArray(static_cast<jsize>(stats.size()));
+    if (!arr) return nullptr;
+    env->SetLongArrayRegion(arr, 0, static_cast<jsize>(stats.size()), reinterpret_cast<const jlong*>(stats.data()));
+    return arr;
+}
+
+extern "C" JNIEXPORT jstring JNICALL
+Java_io_aatricks_llmedge_SmolLM_nativeCompressContext(JNIEnv* env, jobject thiz, jlong modelPtr, jstring query,
+                                                      jstring context, jfloat targetRatio) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    if (llmInference == nullptr || query == nullptr || context == nullptr) {
+        return nullptr;
+    }
+    const char* queryCstr = env->GetStringUTFChars(query, nullptr);
+    const char* contextCstr = env->GetStringUTFChars(context, nullptr);
+    std::string compressed;
+    bool failed = false;
+    try {
+        compressed = llmInference->compressContext(queryCstr, contextCstr, targetRatio);
+    } catch (std::invalid_argument& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalArgumentException"), error.what());
+        failed = true;
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+        failed = true;
+    }
+    env->ReleaseStringUTFChars(query, queryCstr);
+    env->ReleaseStringUTFChars(context, contextCstr);
+    if (failed) return nullptr;
+    return env->NewStringUTF(compressed.c_str());
+}
+
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_io_aatricks_llmedge_SmolLM_nativeGetCompressionStats(JNIEnv* env, jobject thiz, jlong modelPtr) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    if (llmInference == nullptr) {
+        return nullptr;
+    }
+    std::vector<int64_t> stats = llmInference->getCompressionStats();
+    jlongArray arr = env->NewLongArray(static_cast<jsize>(stats.size()));
+    if (!arr) return nullptr;
+    env->SetLongArrayRegion(arr, 0, static_cast<jsize>(stats.size()), reinterpret_cast<const jlong*>(stats.data()));
+    return arr;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_io_aatricks_llmedge_SmolLM_nativeSetLoopPolicy(JNIEnv* env, jobject thiz, jlong modelPtr, jint action,
+                                                    jint maxPeriod, jint minRepeats, jint minSpan, jint plateauWindow,
+                                                    jfloat plateauEntropy, jint maxNudges) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    if (llmInference == nullptr) {
+        return;
+    }
+    LoopPolicy policy;
+    policy.action = static_cast<LoopPolicy::Action>(std::clamp(static_cast<int>(action), 0, 2));
+    policy.maxPeriod = maxPeriod;
+    policy.minRepeats = minRepeats;
+    policy.minSpan = minSpan;
+    policy.plateauWindow = plateauWindow;
+    policy.plateauEntropy = plateauEntropy;
+    policy.maxNudges = maxNudges;
+    llmInference->setLoopPolicy(policy);
+}
+
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_io_aatricks_llmedge_SmolLM_nativeGetLoopStats(JNIEnv* env, jobject thiz, jlong modelPtr) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    if (llmInference == nullptr) {
+        return nullptr;
+    }
+    std::vector<int64_t> stats = llmInference->getLoopStats();
+    jlongArray arr = env->NewLongArray(static_cast<jsize>(stats.size()));
+    if (!arr) return nullptr;
+    env->SetLongArrayRegion(arr, 0, static_cast<jsize>(stats.size()), reinterpret_cast<const jlong*>(stats.data()));
+    return arr;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_io_aatricks_llmedge_SmolLM_nativeSetDeadline(JNIEnv* env, jobject thiz, jlong modelPtr, jlong budgetMicros) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    if (llmInference == nullptr) {
+        return;
+    }
+    llmInference->setDeadline(budgetMicros);
+}
+
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_io_aatricks_llmedge_SmolLM_nativeGetDeadlineStats(JNIEnv* env, jobject thiz, jlong modelPtr) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    if (llmInference == nullptr) {
+        return nullptr;
+    }
+    std::vector<int64_t> stats = llmInference->getDeadlineStats();
+    jlongArray arr = env->NewLongArray(static_cast<jsize>(stats.size()));
+    if (!arr) return nullptr;
+    env->SetLongArrayRegion(arr, 0, static_cast<jsize>(stats.size()), reinterpret_cast<const jlong*>(stats.data()));
+    return arr;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_io_aatricks_llmedge_SmolLM_nativeSetConfidencePolicy(JNIEnv* env, jobject thiz, jlong modelPtr, jboolean enabled,
+                                                          jint window, jint minTokens, jint maxTokens,
+                                                          jfloat maxMeanEntropy, jfloat minMargin,
+                                                          jfloat maxLowMarginFraction) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    if (llmInference == nullptr) {
+        return;
+    }
+    ConfidencePolicy policy;
+    policy.enabled = enabled == JNI_TRUE;
+    policy.window = window;
+    policy.minTokens = minTokens;
+    policy.maxTokens = maxTokens;
+    policy.maxMeanEntropy = maxMeanEntropy;
+    policy.minMargin = minMargin;
+    policy.maxLowMarginFraction = maxLowMarginFraction;
+    llmInference->setConfidencePolicy(policy);
+}
+
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_io_aatricks_llmedge_SmolLM_nativeGetCascadeStats(JNIEnv* env, jobject thiz, jlong modelPtr) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    if (llmInference == nullptr) {
+        return nullptr;
+    }
+    std::vector<int64_t> stats = llmInference->getCascadeStats();
+    jlongArray arr = env->NewLongArray(static_cast<jsize>(stats.size()));
+    if (!arr) return nullptr;
+    env->SetLongArrayRegion(arr, 0, static_cast<jsize>(stats.size()), reinterpret_cast<const jlong*>(stats.data()));
+    return arr;
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_io_aatricks_llmedge_SmolLM_nativeStartCompletionFrom(JNIEnv* env, jobject thiz, jlong modelPtr, jlong sourcePtr,
+                                                          jstring query) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    auto* source = reinterpret_cast<LLMInference*>(sourcePtr);
+    if (llmInference == nullptr || source == nullptr || query == nullptr) {
+        return JNI_FALSE;
+    }
+    const char* queryCstr = env->GetStringUTFChars(query, nullptr);
+    bool reused = false;
+    try {
+        reused = llmInference->startCompletionFrom(*source, queryCstr);
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+    }
+    env->ReleaseStringUTFChars(query, queryCstr);
+    return reused ? JNI_TRUE : JNI_FALSE;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_io_aatricks_llmedge_SmolLM_nativeSetCompactionPolicy(JNIEnv* env, jobject thiz, jlong modelPtr, jboolean enabled,
+                                                          jint triggerTokens, jint keepRecentTurns, jint summaryTokens,
+                                                          jint idleMillis, jint nThreads) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    if (llmInference == nullptr) {
+        return;
+    }
+    CompactionPolicy policy;
+    policy.enabled = enabled == JNI_TRUE;
+    policy.triggerTokens = triggerTokens;
+    policy.keepRecentTurns = keepRecentTurns;
+    policy.summaryTokens = summaryTokens;
+    policy.idleMillis = idleMillis;
+    policy.nThreads = nThreads;
+    llmInference->setCompactionPolicy(policy);
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_io_aatricks_llmedge_SmolLM_nativeCompactHistory(JNIEnv* env, jobject thiz, jlong modelPtr) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    if (llmInference == nullptr) {
+        return JNI_FALSE;
+    }
+    try {
+        return llmInference->compactHistory() ? JNI_TRUE : JNI_FALSE;
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+        return JNI_FALSE;
+    }
+}
+
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_io_aatricks_llmedge_SmolLM_nativeGetCompactionStats(JNIEnv* env, jobject thiz, jlong modelPtr) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    if (llmInference == nullptr) {
+        return nullptr;
+    }
+    std::vector<int64_t> stats = llmInference->getCompactionStats();
+    jlongArray arr = env->NewLongArray(static_cast<jsize>(stats.size()));
+    if (!arr) return nullptr;
+    env->SetLongArrayRegion(arr, 0, static_cast<jsize>(stats.size()), reinterpret_cast<const jlong*>(stats.data()));
+    return arr;
+}
+
+// ResultCache JNI, used by ResultCache.kt. The cache lives in this library because it is loaded by
+// every entry point of the SDK, and a lookup must not need the whisper, bark or sdcpp libraries.
+static std::string
+jstringToString(JNIEnv* env, jstring text) {
+    if (text == nullptr) {
+        return "";
+    }
+    const char* cstr = env->GetStringUTFChars(text, nullptr);
+    std::string out(cstr);
+    env->ReleaseStringUTFChars(text, cstr);
+    return out;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_io_aatricks_llmedge_ResultCache_nativeConfigure(JNIEnv* env, jclass clazz, jstring directory, jlong budgetBytes) {
+    ResultCache::instance().configure(jstringToString(env, directory),
+                                      static_cast<uint64_t>(std::max<jlong>(budgetBytes, 0)));
+}
+
+extern "C" JNIEXPORT jstring JNICALL
+Java_io_aatricks_llmedge_ResultCache_nativeKey(JNIEnv* env, jclass clazz, jstring kind, jobjectArray modelPaths,
+                                               jstring params, jbyteArray input) {
+    std::vector<std::string> paths(modelPaths ? env->GetArrayLength(modelPaths) : 0);
+    for (size_t i = 0; i < paths.size(); ++i) {
+        auto path = static_cast<jstring>(env->GetObjectArrayElement(modelPaths, static_cast<jsize>(i)));
+        paths[i] = jstringToString(env, path);
+        env->DeleteLocalRef(path);
+    }
+    std::vector<uint8_t> bytes(input ? env->GetArrayLength(input) : 0);
+    if (!bytes.empty()) {
+        env->GetByteArrayRegion(input, 0, static_cast<jsize>(bytes.size()), reinterpret_cast<jbyte*>(bytes.data()));
+    }
+    const std::string key = ResultCache::instance().key(jstringToString(env, kind), paths,
+                                                        jstringToString(env, params), bytes.data(), bytes.size());
+    return key.empty() ? nullptr : env->NewStringUTF(key.c_str());
+}
+
+extern "C" JNIEXPORT jbyteArray JNICALL
+Java_io_aatricks_llmedge_ResultCache_nativeGet(JNIEnv* env, jclass clazz, jstring key) {
+    std::vector<uint8_t> value;
+    if (!ResultCache::instance().get(jstringToString(env, key), value)) {
+        return nullptr;
+    }
+    jbyteArray arr = env->NewByteArray(static_cast<jsize>(value.size()));
+    if (!arr) return nullptr;
+    env->SetByteArrayRegion(arr, 0, static_cast<jsize>(value.size()), reinterpret_cast<const jbyte*>(value.data()));
+    return arr;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_io_aatricks_llmedge_ResultCache_nativePut(JNIEnv* env, jclass clazz, jstring key, jbyteArray value) {
+    if (value == nullptr) {
+        return;
+    }
+    jbyte* bytes = env->GetByteArrayElements(value, nullptr);
+    ResultCache::instance().put(jstringToString(env, key), reinterpret_cast<const uint8_t*>(bytes),
+                                static_cast<size_t>(env->GetArrayLength(value)));
+    env->ReleaseByteArrayElements(value, bytes, JNI_ABORT);
+}
+
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_io_aatricks_llmedge_ResultCache_nativeGetStats(JNIEnv* env, jclass clazz) {
+    std::vector<int64_t> stats = ResultCache::instance().stats();
+    jlongArray arr = env->NewLongArray(static_cast<jsize>(stats.size()));
+    if (!arr) return nullptr;
+    env->SetLongArrayRegion(arr, 0, static_cast<jsize>(stats.size()), reinterpret_cast<const jlong*>(stats.data()));
+    return arr;
+}
+
 // Projector JNI stubs used by Projector.kt. These are lightweight placeholders
 // so the example can demonstrate the safe sequencing of projector usage.
 // Map to keep model pointer associated with mtmd_context (for embd dim lookup)
@@ -144,6 +618,180 @@ Java_io_aatricks_llmedge_Projector_nativeInitProjector(JNIEnv* env, jobject thiz
     return reinterpret_cast<jlong>(ctx);
 }
 
+static const mtmd_input_chunk*
+firstImageChunk(const mtmd_input_chunks* chunks) {
+    for (size_t i = 0; i < mtmd_input_chunks_size(chunks); ++i) {
+        const mtmd_input_chunk* c = mtmd_input_chunks_get(chunks, i);
+        if (c && mtmd_input_chunk_get_type(c) == MTMD_INPUT_CHUNK_TYPE_IMAGE) {
+            return c;
+        }
+    }
+    return nullptr;
+}
+
+// Tokenizes `bmp` as a single-image prompt; nullptr if it yields no image chunk.
+static mtmd_input_chunks*
+tokenizeImage(mtmd_context* ctx, const mtmd_bitmap* bmp) {
+    const mtmd_bitmap* bitmaps[1] = { bmp };
+    mtmd_input_text txt = { "<__media__>", false, false };
+    mtmd_input_chunks* chunks = mtmd_input_chunks_init();
+    if (mtmd_tokenize(ctx, chunks, &txt, bitmaps, 1) != 0 || firstImageChunk(chunks) == nullptr) {
+        mtmd_input_chunks_free(chunks);
+        return nullptr;
+    }
+    return chunks;
+}
+
+// Text-model embedding size for a projector, or 0 if it was initialized without a text model.
+static int
+projectorEmbdDim(mtmd_context* ctx) {
+    std::lock_guard<std::mutex> lk(g_mtmd_map_mutex);
+    auto it = g_mtmd_model_map.find(ctx);
+    return it != g_mtmd_model_map.end() && it->second ? llama_model_n_embd(it->second) : 0;
+}
+
+// Projector output for one image (or several concatenated): `nTokens` rows of embeddings,
+// laid out as an nx x ny grid when both are non-zero.
+struct EncodedImage {
+    std::vector<float> embd;
+    int32_t            nTokens = 0;
+    int32_t            nx = 0;
+    int32_t            ny = 0;
+};
+
+// Encodes `original`, keeping at most the number of image tokens `budget` allows. The bitmap is
+// downscaled first, which shrinks the token grid of dynamic-resolution projectors; if the
+// projector output is still over budget, its token grid is average-pooled. `stats` receives
+// {full tokens, written tokens, downscale x1000, pool factor, complexity x1000, encode micros}.
+static bool
+encodeBitmapWithBudget(mtmd_context* ctx, const mtmd_bitmap* original, int embdDim, const ImageTokenBudget& budget,
+                       EncodedImage& out, int64_t stats[6]) {
+    const int64_t start = ggml_time_us();
+    mtmd_input_chunks* chunks = tokenizeImage(ctx, original);
+    if (!chunks) {
+        return false;
+    }
+    const uint32_t srcNx = mtmd_bitmap_get_nx(original);
+    const uint32_t srcNy = mtmd_bitmap_get_ny(original);
+    const int32_t fullTokens = static_cast<int32_t>(mtmd_input_chunk_get_n_tokens(firstImageChunk(chunks)));
+    const float complexity = imageComplexity(mtmd_bitmap_get_data(original), srcNx, srcNy);
+    const int32_t target = imageTokenTarget(budget, fullTokens, complexity);
+
+    // fixed-resolution projectors resize internally, so stop as soon as a smaller bitmap
+    // no longer reduces the token count
+    mtmd_bitmap* scaled = nullptr;
+    float scale = 1.0f;
+    int32_t tokens = fullTokens;
+    for (int attempt = 0; attempt < 3 && tokens > target; ++attempt) {
+        const float next = scale * std::sqrt(static_cast<float>(target) / static_cast<float>(tokens));
+        const uint32_t outNx = std::max<uint32_t>(1, static_cast<uint32_t>(std::lround(srcNx * next)));
+        const uint32_t outNy = std::max<uint32_t>(1, static_cast<uint32_t>(std::lround(srcNy * next)));
+        std::vector<uint8_t> pixels = downscaleRgb(mtmd_bitmap_get_data(original), srcNx, srcNy, outNx, outNy);
+        mtmd_bitmap* candidate = mtmd_bitmap_init(outNx, outNy, pixels.data());
+        mtmd_input_chunks* candidateChunks = candidate ? tokenizeImage(ctx, candidate) : nullptr;
+        const int32_t candidateTokens = candidateChunks
+                ? static_cast<int32_t>(mtmd_input_chunk_get_n_tokens(firstImageChunk(candidateChunks)))
+                : tokens;
+        if (candidateTokens >= tokens) {
+            if (candidateChunks) mtmd_input_chunks_free(candidateChunks);
+            if (candidate) mtmd_bitmap_free(candidate);
+            break;
+        }
+        mtmd_input_chunks_free(chunks);
+        if (scaled) mtmd_bitmap_free(scaled);
+        chunks = candidateChunks;
+        scaled = candidate;
+        tokens = candidateTokens;
+        scale = next;
+    }
+
+    const mtmd_input_chunk* chunk = firstImageChunk(chunks);
+    bool encoded = false;
+    int32_t pool = 1;
+    if (mtmd_encode_chunk(ctx, chunk) == 0) {
+        const float* embd = mtmd_get_output_embd(ctx);
+        const mtmd_image_tokens* image_tokens = mtmd_input_chunk_get_tokens_image(chunk);
+        out.nx = image_tokens ? static_cast<int32_t>(mtmd_image_tokens_get_nx(image_tokens)) : 0;
+        out.ny = image_tokens ? static_cast<int32_t>(mtmd_image_tokens_get_ny(image_tokens)) : 0;
+        // pooling needs a plain token grid (no row separators or extra slices)
+        if (tokens > target && out.nx > 0 && out.ny > 0 && out.nx * out.ny == tokens) {
+            pool = imagePoolFactor(out.nx, out.ny, target);
+        }
+        if (pool > 1) {
+            out.embd = poolImageEmbeddings(embd, embdDim, out.nx, out.ny, pool);
+            tokens = out.nx * out.ny;
+        } else {
+            out.embd.assign(embd, embd + static_cast<size_t>(tokens) * embdDim);
+        }
+        out.nTokens = tokens;
+        encoded = true;
+    }
+
+    mtmd_input_chunks_free(chunks);
+    if (scaled) mtmd_bitmap_free(scaled);
+    stats[0] = fullTokens;
+    stats[1] = tokens;
+    stats[2] = std::lround(scale * 1000.0f);
+    stats[3] = pool;
+    stats[4] = std::lround(complexity * 1000.0f);
+    stats[5] = ggml_time_us() - start;
+    return encoded;
+}
+
+// Writes `image` to `outPath` (raw floats) and the metadata nativeDecodePreparedEmbeddings reads
+// to `outPath`.meta.json, along with the encode stats.
+static bool
+writeEncodedImage(mtmd_context* ctx, const char* outPath, const EncodedImage& image, int embdDim,
+                  const int64_t stats[6]) {
+    std::ofstream ofs(outPath, std::ios::binary);
+    if (!ofs) {
+        return false;
+    }
+    ofs.write(reinterpret_cast<const char*>(image.embd.data()), sizeof(float) * image.embd.size());
+    if (!ofs) {
+        return false;
+    }
+    std::ofstream mofs(std::string(outPath) + ".meta.json", std::ios::trunc);
+    if (!mofs) {
+        return false;
+    }
+    mofs << "{\n";
+    mofs << "  \"n_tokens\": " << image.nTokens << ",\n";
+    mofs << "  \"nx\": " << image.nx << ",\n";
+    mofs << "  \"ny\": " << image.ny << ",\n";
+    mofs << "  \"embd_dim\": " << embdDim << ",\n";
+    mofs << "  \"use_mrope\": " << (mtmd_decode_use_mrope(ctx) ? "true" : "false") << ",\n";
+    mofs << "  \"use_non_causal\": " << (mtmd_decode_use_non_causal(ctx) ? "true" : "false") << ",\n";
+    mofs << "  \"full_tokens\": " << stats[0] << ",\n";
+    mofs << "  \"downscale\": " << stats[2] / 1000.0 << ",\n";
+    mofs << "  \"pool\": " << stats[3] << "\n";
+    mofs << "}\n";
+    return static_cast<bool>(mofs);
+}
+
+// Encodes the image at `inPath` under `budget` and writes it to `outPath` (see writeEncodedImage).
+static bool
+encodeImageWithBudget(mtmd_context* ctx, const char* inPath, const char* outPath, const ImageTokenBudget& budget,
+                      int64_t stats[6]) {
+    const int embdDim = projectorEmbdDim(ctx);
+    if (embdDim <= 0) {
+        // We cannot safely determine embedding dimension; abort to avoid writing an incorrect
+        // amount of data. The caller should pass the text model pointer when initializing the
+        // projector so we can validate and compute the correct size.
+        return false;
+    }
+    // Use mtmd_helper_bitmap_init_from_file to load image and preprocess it
+    mtmd_bitmap* bmp = mtmd_helper_bitmap_init_from_file(ctx, inPath);
+    if (!bmp) {
+        return false;
+    }
+    EncodedImage image;
+    const bool ok = encodeBitmapWithBudget(ctx, bmp, embdDim, budget, image, stats) &&
+                    writeEncodedImage(ctx, outPath, image, embdDim, stats);
+    mtmd_bitmap_free(bmp);
+    return ok;
+}
+
 extern "C" JNIEXPORT jboolean JNICALL
 Java_io_aatricks_llmedge_Projector_nativeEncodeImage(JNIEnv* env, jobject thiz, jlong nativePtr, jstring imagePath, jstring outPath) {
     const char* inC = env->GetStringUTFChars(imagePath, nullptr);
@@ -165,120 +813,154 @@ Java_io_aatricks_llmedge_Projector_nativeEncodeImage(JNIEnv* env, jobject thiz,
             dst << src.rdbuf();
             ok = static_cast<bool>(src) && static_cast<bool>(dst);
         }
-        env->ReleaseStringUTFChars(imagePath, inC);
-        env->ReleaseStringUTFChars(outPath, outC);
-        return ok ? JNI_TRUE : JNI_FALSE;
+    } else {
+        int64_t stats[6];
+        ok = encodeImageWithBudget(ctx, inC, outC, ImageTokenBudget{}, stats);
     }
+    env->ReleaseStringUTFChars(imagePath, inC);
+    env->ReleaseStringUTFChars(outPath, outC);
+    return ok ? JNI_TRUE : JNI_FALSE;
+}
 
-    // Use mtmd_helper_bitmap_init_from_file to load image and preprocess it
-    mtmd_bitmap* bmp = mtmd_helper_bitmap_init_from_file(ctx, inC);
-    if (!bmp) {
-        env->ReleaseStringUTFChars(imagePath, inC);
-        env->ReleaseStringUTFChars(outPath, outC);
-        return JNI_FALSE;
+// Like nativeEncodeImage, under an image-token budget; returns the encode stats or null.
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_io_aatricks_llmedge_vision_Projector_nativeEncodeImageWithBudget(JNIEnv* env, jobject thiz, jlong nativePtr,
+                                                                      jstring imagePath, jstring outPath,
+                                                                      jint maxTokens, jboolean automatic) {
+    mtmd_context* ctx = reinterpret_cast<mtmd_context*>(nativePtr);
+    if (ctx == nullptr || imagePath == nullptr || outPath == nullptr) {
+        return nullptr;
     }
+    const char* inC = env->GetStringUTFChars(imagePath, nullptr);
+    const char* outC = env->GetStringUTFChars(outPath, nullptr);
+    int64_t stats[6] = {0, 0, 0, 0, 0, 0};
+    const bool ok = encodeImageWithBudget(ctx, inC, outC, ImageTokenBudget{maxTokens, automatic == JNI_TRUE}, stats);
+    env->ReleaseStringUTFChars(imagePath, inC);
+    env->ReleaseStringUTFChars(outPath, outC);
+    if (!ok) return nullptr;
+    jlongArray arr = env->NewLongArray(6);
+    if (!arr) return nullptr;
+    env->SetLongArrayRegion(arr, 0, 6, reinterpret_cast<const jlong*>(stats));
+    return arr;
+}
 
-    const mtmd_bitmap* bitmaps[1] = { bmp };
-    mtmd_input_text txt = { "<__media__>", false, false };
-    mtmd_input_chunks* chunks = mtmd_input_chunks_init();
-    int32_t tokRes = mtmd_tokenize(ctx, chunks, &txt, bitmaps, 1);
-    if (tokRes != 0) {
-        mtmd_bitmap_free(bmp);
-        mtmd_input_chunks_free(chunks);
-        env->ReleaseStringUTFChars(imagePath, inC);
-        env->ReleaseStringUTFChars(outPath, outC);
-        return JNI_FALSE;
+// Encodes the distinct frames of a clip into one prepared-embedding file. Each frame is hashed
+// (frameDifferenceHash) and skipped if it is within `maxDistance` bits of the last kept frame;
+// survivors are sampled evenly down to `maxFrames` and split `clipTokenBudget` (0 = no cap), each
+// getting at least one token. Returns {frames, kept frames, full tokens, written tokens, hash
+// micros, total micros, kept indices into `framePaths`...} or null.
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_io_aatricks_llmedge_vision_Projector_nativeEncodeFrames(JNIEnv* env, jobject thiz, jlong nativePtr,
+                                                             jobjectArray framePaths, jstring outPath,
+                                                             jint maxDistance, jint maxFrames,
+                                                             jint clipTokenBudget, jboolean automatic) {
+    mtmd_context* ctx = reinterpret_cast<mtmd_context*>(nativePtr);
+    if (ctx == nullptr || framePaths == nullptr || outPath == nullptr) {
+        return nullptr;
+    }
+    const int embdDim = projectorEmbdDim(ctx);
+    if (embdDim <= 0) {
+        return nullptr;
     }
+    const int64_t start = ggml_time_us();
 
-    // Encode image tokens
-    // find first image chunk
-    bool encoded = false;
-    // keep these in outer scope so we can write metadata after the loop
-    size_t n_tokens = 0;
-    int embd_dim = 0;
-    for (size_t i = 0; i < mtmd_input_chunks_size(chunks); ++i) {
-        const mtmd_input_chunk* c = mtmd_input_chunks_get(chunks, i);
-        if (c && mtmd_input_chunk_get_type(c) == MTMD_INPUT_CHUNK_TYPE_IMAGE) {
-            int32_t res = mtmd_encode_chunk(ctx, c);
-            if (res == 0) {
-                float* embd = mtmd_get_output_embd(ctx);
-                // Write raw float embeddings to outPath
-                std::ofstream ofs(outC, std::ios::binary);
-                if (ofs) {
-                        // We need to know size: tokens * embd_dim
-                        n_tokens = static_cast<size_t>(mtmd_input_chunk_get_n_tokens(c));
-                        {
-                            std::lock_guard<std::mutex> lk(g_mtmd_map_mutex);
-                            auto it = g_mtmd_model_map.find(ctx);
-                            if (it != g_mtmd_model_map.end() && it->second) {
-                                embd_dim = llama_model_n_embd(it->second);
-                            }
-                        }
-                        if (embd_dim <= 0) {
-                            // We cannot safely determine embedding dimension; abort to avoid
-                            // writing an incorrect amount of data. The caller should pass
-                            // the text model pointer when initializing the projector so
-                            // we can validate and compute the correct size.
-                            ofs.close();
-                            mtmd_bitmap_free(bmp);
-                            mtmd_input_chunks_free(chunks);
-                            env->ReleaseStringUTFChars(imagePath, inC);
-                            env->ReleaseStringUTFChars(outPath, outC);
-                            return JNI_FALSE;
-                        }
-                        size_t n_floats = static_cast<size_t>(n_tokens) * static_cast<size_t>(embd_dim);
-                        ofs.write(reinterpret_cast<const char*>(embd), sizeof(float) * n_floats);
-                    encoded = true;
-                }
-            }
-            break;
+    // one entry per frame that loaded; `inputIndex` maps it back to `framePaths`. Only frames
+    // distinct from the last distinct one stay decoded, since no other frame can be selected.
+    std::vector<mtmd_bitmap*> frames;
+    std::vector<uint64_t> hashes;
+    std::vector<size_t> inputIndex;
+    uint64_t lastDistinct = 0;
+    const jsize nFrames = env->GetArrayLength(framePaths);
+    for (jsize i = 0; i < nFrames; ++i) {
+        auto path = static_cast<jstring>(env->GetObjectArrayElement(framePaths, i));
+        if (path == nullptr) continue;
+        const char* pathC = env->GetStringUTFChars(path, nullptr);
+        mtmd_bitmap* bmp = mtmd_helper_bitmap_init_from_file(ctx, pathC);
+        env->ReleaseStringUTFChars(path, pathC);
+        env->DeleteLocalRef(path);
+        if (!bmp) continue;
+        const uint64_t hash = frameDifferenceHash(mtmd_bitmap_get_data(bmp), mtmd_bitmap_get_nx(bmp),
+                                                  mtmd_bitmap_get_ny(bmp));
+        if (hashes.empty() || isDistinctFrame(hash, lastDistinct, maxDistance)) {
+            lastDistinct = hash;
+        } else {
+            mtmd_bitmap_free(bmp);
+            bmp = nullptr;
         }
+        frames.push_back(bmp);
+        hashes.push_back(hash);
+        inputIndex.push_back(static_cast<size_t>(i));
     }
-
-        // If we encoded successfully, write a small metadata JSON file next to embeddings
-        if (encoded) {
-            std::string metaPath = std::string(outC) + ".meta.json";
-            std::ofstream mofs(metaPath, std::ios::trunc);
-            if (mofs) {
-                // Try to get image token shape if available
-                const mtmd_image_tokens* image_tokens = nullptr;
-                for (size_t i = 0; i < mtmd_input_chunks_size(chunks); ++i) {
-                    const mtmd_input_chunk* c2 = mtmd_input_chunks_get(chunks, i);
-                    if (c2 && mtmd_input_chunk_get_type(c2) == MTMD_INPUT_CHUNK_TYPE_IMAGE) {
-                        image_tokens = mtmd_input_chunk_get_tokens_image(c2);
-                        break;
-                    }
-                }
-
-                int nx = 0;
-                int ny = 0;
-                if (image_tokens) {
-                    nx = static_cast<int>(mtmd_image_tokens_get_nx(image_tokens));
-                    ny = static_cast<int>(mtmd_image_tokens_get_ny(image_tokens));
-                }
-
-                bool use_mrope = mtmd_decode_use_mrope(ctx);
-                bool use_non_causal = mtmd_decode_use_non_causal(ctx);
-
-                // write simple JSON
-                mofs << "{\n";
-                mofs << "  \"n_tokens\": " << n_tokens << ",\n";
-                mofs << "  \"nx\": " << nx << ",\n";
-                mofs << "  \"ny\": " << ny << ",\n";
-                mofs << "  \"embd_dim\": " << embd_dim << ",\n";
-                mofs << "  \"use_mrope\": " << (use_mrope ? "true" : "false") << ",\n";
-                mofs << "  \"use_non_causal\": " << (use_non_causal ? "true" : "false") << "\n";
-                mofs << "}\n";
-                mofs.close();
-            }
+    const std::vector<size_t> kept =
+            selectDistinctFrames(hashes, maxDistance, static_cast<size_t>(std::max(0, static_cast<int>(maxFrames))));
+    // distinct frames that sampling dropped are not needed either
+    std::vector<bool> isKept(frames.size(), false);
+    for (size_t index: kept) {
+        isKept[index] = true;
+    }
+    for (size_t i = 0; i < frames.size(); ++i) {
+        if (!isKept[i] && frames[i]) {
+            mtmd_bitmap_free(frames[i]);
+            frames[i] = nullptr;
         }
+    }
+    const int64_t hashMicros = ggml_time_us() - start;
 
-    mtmd_bitmap_free(bmp);
-    mtmd_input_chunks_free(chunks);
-    env->ReleaseStringUTFChars(imagePath, inC);
-    env->ReleaseStringUTFChars(outPath, outC);
+    // frames are concatenated in order; a shared grid width lets them stack into one tall grid
+    EncodedImage clip;
+    int64_t totals[6] = {0, 0, 0, 1, 0, 0};
+    bool ok = !kept.empty();
+    bool stackable = true;
+    const int32_t nKept = static_cast<int32_t>(kept.size());
+    for (size_t i = 0; ok && i < kept.size(); ++i) {
+        // an even split with the remainder on the first frames; 0 per frame would mean no cap
+        int32_t frameBudget = 0;
+        if (clipTokenBudget > 0) {
+            const int32_t extra = static_cast<int32_t>(i) < clipTokenBudget % nKept ? 1 : 0;
+            frameBudget = std::max<int32_t>(1, clipTokenBudget / nKept + extra);
+        }
+        EncodedImage frame;
+        int64_t stats[6];
+        ok = encodeBitmapWithBudget(ctx, frames[kept[i]], embdDim, ImageTokenBudget{frameBudget, automatic == JNI_TRUE},
+                                    frame, stats);
+        if (!ok) break;
+        stackable = stackable && frame.nx > 0 && frame.nx * frame.ny == frame.nTokens && (i == 0 || frame.nx == clip.nx);
+        clip.nx = frame.nx;
+        clip.ny += frame.ny;
+        clip.nTokens += frame.nTokens;
+        clip.embd.insert(clip.embd.end(), frame.embd.begin(), frame.embd.end());
+        totals[0] += stats[0];
+        totals[1] += stats[1];
+        totals[2] += stats[2];
+        totals[3] = std::max(totals[3], stats[3]);
+        totals[4] += stats[4];
+    }
+    if (ok) {
+        if (!stackable) {
+            clip.nx = 0;
+            clip.ny = 0;
+        }
+        totals[2] /= static_cast<int64_t>(kept.size());
+        totals[4] /= static_cast<int64_t>(kept.size());
+        totals[5] = ggml_time_us() - start;
+        const char* outC = env->GetStringUTFChars(outPath, nullptr);
+        ok = writeEncodedImage(ctx, outC, clip, embdDim, totals);
+        env->ReleaseStringUTFChars(outPath, outC);
+    }
+    for (mtmd_bitmap* bmp: frames) {
+        if (bmp) mtmd_bitmap_free(bmp);
+    }
+    if (!ok) return nullptr;
 
-    return encoded ? JNI_TRUE : JNI_FALSE;
+    std::vector<int64_t> result = {static_cast<int64_t>(nFrames), static_cast<int64_t>(kept.size()), totals[0],
+                                   totals[1], hashMicros, totals[5]};
+    for (size_t index: kept) {
+        result.push_back(static_cast<int64_t>(inputIndex[index]));
+    }
+    jlongArray arr = env->NewLongArray(static_cast<jsize>(result.size()));
+    if (!arr) return nullptr;
+    env->SetLongArrayRegion(arr, 0, static_cast<jsize>(result.size()), reinterpret_cast<const jlong*>(result.data()));
+    return arr;
 }
 
 extern "C" JNIEXPORT void JNICALL
@@ -405,7 +1087,8 @@ Java_io_aatricks_llmedge_SmolLM_nativeDecodePreparedEmbeddings(JNIEnv* env, jobj
         env->ReleaseStringUTFChars(metaPath, metaC);
         return JNI_FALSE;
     }
-    llama_context* lctx = llmInference->getContext();
+    ContextLease lease = llmInference->leaseContext();
+    llama_context* lctx = lease.get();
     if (!lctx) {
         env->ReleaseStringUTFChars(embdPath, embdC);
         env->ReleaseStringUTFChars(metaPath, metaC);
@@ -487,7 +1170,8 @@ extern "C" JNIEXPORT jbyteArray JNICALL
 Java_io_aatricks_llmedge_SmolLM_nativeGetStateBytes(JNIEnv* env, jobject thiz, jlong modelPtr) {
     if (!modelPtr) return nullptr;
     auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
-    llama_context* ctx = llmInference->getContext();
+    ContextLease lease = llmInference->leaseContext();
+    llama_context* ctx = lease.get();
     if (!ctx) return nullptr;
     size_t size = llama_state_get_size(ctx);
     if (size == 0) return nullptr;
@@ -505,7 +1189,8 @@ extern "C" JNIEXPORT jboolean JNICALL
 Java_io_aatricks_llmedge_SmolLM_nativeSetStateBytes(JNIEnv* env, jobject thiz, jlong modelPtr, jbyteArray state) {
     if (!modelPtr || !state) return JNI_FALSE;
     auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
-    llama_context* ctx = llmInference->getContext();
+    ContextLease lease = llmInference->leaseContext();
+    llama_context* ctx = lease.get();
     if (!ctx) return JNI_FALSE;
     jsize len = env->GetArrayLength(state);
     if (len <= 0) return JNI_FALSE;
@@ -520,7 +1205,8 @@ extern "C" JNIEXPORT jbyteArray JNICALL
 Java_io_aatricks_llmedge_SmolLM_nativeGetSequenceStateBytes(JNIEnv* env, jobject thiz, jlong modelPtr, jint seqId) {
     if (!modelPtr) return nullptr;
     auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
-    llama_context* ctx = llmInference->getContext();
+    ContextLease lease = llmInference->leaseContext();
+    llama_context* ctx = lease.get();
     if (!ctx) return nullptr;
     size_t size = llama_state_seq_get_size(ctx, static_cast<llama_seq_id>(seqId));
     if (size == 0) return nullptr;
@@ -538,7 +1224,8 @@ extern "C" JNIEXPORT jboolean JNICALL
 Java_io_aatricks_llmedge_SmolLM_nativeSetSequenceStateBytes(JNIEnv* env, jobject thiz, jlong modelPtr, jint seqId, jbyteArray state) {
     if (!modelPtr || !state) return JNI_FALSE;
     auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
-    llama_context* ctx = llmInference->getContext();
+    ContextLease lease = llmInference->leaseContext();
+    llama_context* ctx = lease.get();
     if (!ctx) return JNI_FALSE;
     jsize len = env->GetArrayLength(state);
     if (len <= 0) return JNI_FALSE;
@@ -552,7 +1239,8 @@ extern "C" JNIEXPORT void JNICALL
 Java_io_aatricks_llmedge_SmolLM_nativeClearKvCache(JNIEnv* env, jobject thiz, jlong modelPtr) {
     if (!modelPtr) return;
     auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
-    llama_context* ctx = llmInference->getContext();
+    ContextLease lease = llmInference->leaseContext();
+    llama_context* ctx = lease.get();
     if (!ctx) return;
     llama_memory_clear(llama_get_memory(ctx), true);
 }
\ No newline at end of file
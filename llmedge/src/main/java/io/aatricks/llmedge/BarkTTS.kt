@@ -353,9 +353,9 @@ class BarkTTS private constructor(private val handle: Long) : AutoCloseable {
                 println("[BarkTTS] Native library load disabled via llmedge.disableNativeLoad=true")
             } else {
                 try {
-                    // Load bark_jni library - same name on all platforms
-                    logD(LOG_TAG, "Loading libbark_jni.so")
-                    System.loadLibrary("bark_jni")
+                    // Load the bark_jni build matching the CPU features, falling back to the
+                    // baseline library
+                    logD(LOG_TAG, "Loaded lib${NativeLibraryLoader.load("bark_jni")}.so")
                 } catch (e: UnsatisfiedLinkError) {
                     logE(LOG_TAG, "Failed to load bark native library: ${e.message}")
                 }
@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2024 LLMEdge Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package io.aatricks.llmedge
+
+import java.io.File
+import java.io.FileNotFoundException
+import kotlin.math.min
+
+/** Detects a keyword in streamed 16kHz mono audio. */
+fun interface KeywordGate {
+    /** Returns the sample offset within [samples] where a keyword ended, or -1. */
+    fun detect(samples: FloatArray): Int
+
+    /** Drop buffered audio context, e.g. after the gate was bypassed for a while. */
+    fun reset() {}
+}
+
+/**
+ * Low-cost keyword spotter that gates [Whisper.StreamingTranscriber].
+ *
+ * A small feed-forward ggml model scores a sliding second of log-mel features every 30 ms, so
+ * the expensive Whisper decoder only runs after the keyword was heard. The native code ships in
+ * the whisper library and reuses its ggml build.
+ *
+ * Example usage:
+ * ```kotlin
+ * val spotter = KeywordSpotter.load("path/to/kws-hey-edge.gguf", sensitivity = 0.6f)
+ * val transcriber = whisper.createStreamingTranscriber(
+ *     Whisper.StreamingParams(keywordGate = spotter, keywordWindowMs = 8000)
+ * )
+ * ```
+ */
+class KeywordSpotter private constructor(handle: Long) : KeywordGate, AutoCloseable {
+
+    // Zeroed by close(); the native calls ignore a null handle. Calls are synchronized with
+    // close() so the model is never freed under a running detect().
+    private var handle: Long = handle
+
+    /**
+     * Cumulative cost counters.
+     *
+     * [cpuMs] is CPU time of the feeding thread, so it covers the whole model when the spotter
+     * runs with a single thread (the default).
+     */
+    data class Stats(
+            val audioSeconds: Double,
+            val cpuMs: Double,
+            val evaluations: Long,
+            val detections: Long,
+            val lastScore: Float
+    ) {
+        /** CPU milliseconds spent per second of audio listened to. */
+        val cpuMsPerAudioSecond: Double
+            get() = if (audioSeconds > 0.0) cpuMs / audioSeconds else 0.0
+
+        internal companion object {
+            const val NATIVE_SIZE = 5
+
+            fun fromNative(values: DoubleArray) =
+                    Stats(
+                            audioSeconds = values[0],
+                            cpuMs = values[1],
+                            evaluations = values[2].toLong(),
+                            detections = values[3].toLong(),
+                            lastScore = values[4].toFloat()
+                    )
+        }
+    }
+
+    /**
+     * Detection sensitivity in 0..1. Higher values fire on weaker matches: more false accepts,
+     * fewer missed keywords.
+     */
+    var sensitivity: Float = DEFAULT_SENSITIVITY
+        set(value) {
+            require(value in 0f..1f) { "sensitivity must be within 0..1" }
+            field = value
+            synchronized(this) { nativeSetThreshold(handle, thresholdFor(value)) }
+        }
+
+    @Synchronized
+    override fun detect(samples: FloatArray): Int =
+            if (samples.isEmpty()) -1 else nativeFeed(handle, samples)
+
+    @Synchronized override fun reset() = nativeReset(handle)
+
+    /** Cost and detection counters since the spotter was loaded. */
+    @Synchronized
+    fun stats(): Stats {
+        val out = DoubleArray(Stats.NATIVE_SIZE)
+        nativeGetStats(handle, out)
+        return Stats.fromNative(out)
+    }
+
+    /** Frees the model. Safe to call more than once; [detect] returns -1 afterwards. */
+    @Synchronized
+    override fun close() {
+        val current = handle
+        handle = 0L
+        if (current != 0L) nativeDestroy(current)
+    }
+
+    private external fun nativeCreate(modelPath: String, nThreads: Int): Long
+    private external fun nativeDestroy(handle: Long)
+    private external fun nativeSetThreshold(handle: Long, threshold: Float)
+    private external fun nativeFeed(handle: Long, samples: FloatArray): Int
+    private external fun nativeReset(handle: Long)
+    private external fun nativeGetStats(handle: Long, out: DoubleArray)
+
+    companion object {
+        const val DEFAULT_SENSITIVITY = 0.5f
+
+        // Dummy instance used to invoke the native constructor.
+        private val staticInvoker by lazy { KeywordSpotter(0L) }
+
+        /** Smoothed keyword posterior needed for a detection at [sensitivity]. */
+        internal fun thresholdFor(sensitivity: Float): Float = (1f - sensitivity).coerceIn(0.05f, 0.95f)
+
+        /**
+         * Load a keyword spotter model (GGUF, see keyword_spotter.cpp for the tensor layout).
+         * scripts/export_kws_gguf.py computes the training features and writes trained weights
+         * in this layout.
+         *
+         * @param modelPath Path to the keyword model
+         * @param sensitivity Detection sensitivity in 0..1
+         * @param nThreads Threads for the model; 1 keeps [Stats.cpuMs] exact
+         */
+        @JvmStatic
+        fun load(
+                modelPath: String,
+                sensitivity: Float = DEFAULT_SENSITIVITY,
+                nThreads: Int = 1
+        ): KeywordSpotter {
+            if (!File(modelPath).exists()) {
+                throw FileNotFoundException("Keyword model not found: $modelPath")
+            }
+            // The keyword spotter lives in the whisper library, which Whisper's companion loads.
+            Whisper.checkBindings()
+
+            val handle = staticInvoker.nativeCreate(modelPath, nThreads)
+            if (handle == 0L) {
+                throw RuntimeException("Failed to load keyword model from: $modelPath")
+            }
+            return KeywordSpotter(handle).also { it.sensitivity = sensitivity }
+        }
+    }
+}
+
+/**
+ * Passes audio through only inside a window opened by a keyword detection.
+ *
+ * Audio outside a window goes to the gate alone; the chunk containing the keyword is passed on
+ * whole so the transcriber hears the command that follows it.
+ */
+internal class KeywordWindow(private val gate: KeywordGate, private val windowSamples: Int) {
+    private var remaining = 0
+
+    val isOpen: Boolean
+        get() = remaining > 0
+
+    fun admit(samples: FloatArray): FloatArray {
+        if (remaining > 0) {
+            val passed = min(remaining, samples.size)
+            remaining -= passed
+            // The spotter did not hear the window audio, so it restarts from silence.
+            if (remaining == 0) gate.reset()
+            if (passed == samples.size) return samples
+            return samples.copyOfRange(0, passed) + admit(samples.copyOfRange(passed, samples.size))
+        }
+
+        val detectedAt = gate.detect(samples)
+        if (detectedAt < 0) return EMPTY
+        remaining = (windowSamples - (samples.size - detectedAt)).coerceAtLeast(0)
+        return samples
+    }
+
+    private companion object {
+        val EMPTY = FloatArray(0)
+    }
+}
@@ -57,7 +57,7 @@ object LLMEdgeManager {
         private val whisperMutex = Mutex() // For Whisper speech-to-text
         private val barkMutex = Mutex() // For Bark text-to-speech
 
-        // Phase 3: Model caching with LRU eviction
+        // Phase 3: Model caching with cost-aware eviction
         private val textModelCache =
                 ModelCache<io.aatricks.llmedge.SmolLM>(
                         maxCacheSize = 2,
@@ -87,7 +87,8 @@ object LLMEdgeManager {
         private data class LoadedTextModelSpec(
                 val modelId: String,
                 val filename: String,
-                val path: String?
+                val path: String?,
+                val temperature: Float? = null
         )
         private var currentTextModelSpec: LoadedTextModelSpec? = null
 
@@ -118,9 +119,15 @@ object LLMEdgeManager {
         private data class LoadedBarkModelSpec(
                 val modelId: String,
                 val filename: String,
-                val path: String?
+                val path: String?,
+                val seed: Int = 0,
+                val temperature: Float = 0.7f,
+                val fineTemperature: Float = 0.5f
         )
         private var currentBarkModelSpec: LoadedBarkModelSpec? = null
+        // Bark seeds its sampler once at load, so only the first generation after a load is
+        // reproducible from the seed; cached results force a reload, other requests reuse the model
+        private var barkGenerated = false
 
         data class ImageGenerationParams(
                 val prompt: String,
@@ -195,7 +202,29 @@ object LLMEdgeManager {
                 val prompt: String,
                 val modelId: String = DEFAULT_VISION_MODEL_ID,
                 val modelFilename: String = DEFAULT_VISION_MODEL_FILENAME,
-                val projFilename: String = DEFAULT_VISION_PROJ_FILENAME
+                val projFilename: String = DEFAULT_VISION_PROJ_FILENAME,
+                /** Cap on image tokens, applied while the projector encodes the image. */
+                val imageTokenBudget: io.aatricks.llmedge.vision.ImageTokenBudget =
+                        io.aatricks.llmedge.vision.ImageTokenBudget.FULL,
+                /**
+                 * Later frames of a clip or burst, after [image]. When set, the distinct frames
+                 * are encoded into one prompt as chosen by [frameSelection].
+                 */
+                val extraFrames: List<Bitmap> = emptyList(),
+                val frameSelection: io.aatricks.llmedge.vision.FrameSelection =
+                        io.aatricks.llmedge.vision.FrameSelection()
+        )
+
+        /**
+         * One run of [compareImageTokenBudgets]: the answer under [budget], its end-to-end
+         * latency, the encode stats, and its word-level F1 against the reference answer.
+         */
+        data class ImageTokenBudgetResult(
+                val budget: io.aatricks.llmedge.vision.ImageTokenBudget,
+                val answer: String,
+                val latencyMs: Long,
+                val encodeStats: io.aatricks.llmedge.vision.ImageEncodeStats?,
+                val answerF1: Float
         )
 
         /** Parameters for speech-to-text transcription. */
@@ -280,7 +309,16 @@ object LLMEdgeManager {
                  */
                 val vadThreshold: Float = 0.6f,
                 /** Enable VAD to only transcribe when speech is detected */
-                val useVad: Boolean = true
+                val useVad: Boolean = true,
+                /**
+                 * Keyword spotter model (GGUF). When set, Whisper only runs for [keywordWindowMs]
+                 * after the keyword is heard.
+                 */
+                val keywordModelPath: String? = null,
+                /** Keyword detection sensitivity in 0..1 (higher = more triggers) */
+                val keywordSensitivity: Float = KeywordSpotter.DEFAULT_SENSITIVITY,
+                /** How long a keyword detection keeps transcription open. Default: 8000ms */
+                val keywordWindowMs: Int = 8000
         )
 
         /**
@@ -361,6 +399,16 @@ object LLMEdgeManager {
                 )
         }
 
+        /**
+         * Hit rate and model loading time of the text and diffusion model caches, replaying the
+         * models they were asked for under their cost-aware eviction and under plain LRU.
+         */
+        fun getModelCachePolicyReport(): Map<String, ModelCache.PolicyComparison> =
+                mapOf(
+                        "text" to textModelCache.compareWithLru(),
+                        "diffusion" to diffusionModelCache.compareWithLru()
+                )
+
         /** Log performance snapshot to Android logcat for debugging */
         fun logPerformanceSnapshot() {
                 val snapshot = getPerformanceSnapshot()
@@ -404,6 +452,25 @@ object LLMEdgeManager {
                 textModelMutex.withLock {
                         contextRef = WeakReference(context.applicationContext)
 
+                        // A temperature-0 request is a pure function of the model and its
+                        // parameters, so it can be answered from the result cache without loading
+                        // the model.
+                        val resultKey =
+                                if (params.temperature == 0f && ResultCache.isEnabled) {
+                                        textResultKey(context, params)
+                                } else {
+                                        null
+                                }
+                        // Only a cached request is made reproducible (temperature-0 sampling, no
+                        // earlier turns), so a miss stores what a later hit returns; otherwise
+                        // the loaded model and its chat are used as they are.
+                        val deterministic = resultKey != null
+                        resultKey?.let { ResultCache.get(it) }?.let { bytes ->
+                                val text = ResultCache.decodeText(bytes)
+                                onProgress?.invoke(text)
+                                return@withLock text
+                        }
+
                         // Unload heavy diffusion models if loaded to free up memory
                         unloadDiffusionModel()
 
@@ -412,41 +479,77 @@ object LLMEdgeManager {
                                         context,
                                         params.modelId,
                                         params.modelFilename,
-                                        params.modelPath
+                                        params.modelPath,
+                                        temperature = if (deterministic) 0f else null
                                 )
 
                         // Reset and set system prompt if needed
                         // smol.addSystemPrompt(params.systemPrompt)
 
+                        // Earlier turns would make the answer depend on more than the request
+                        if (deterministic) {
+                                smol.clearHistory()
+                        }
+
                         // Apply runtime params that might change per generation
                         smol.setThinkingMode(params.thinkingMode)
                         params.reasoningBudget?.let { smol.setReasoningBudget(it) }
 
-                        if (onProgress != null) {
-                                val sb = StringBuilder()
-                                // We need to use flow for streaming and respect maxTokens
-                                var tokenCount = 0
-                                var flow = smol.getResponseAsFlow(params.prompt)
-                                if (params.maxTokens > 0) {
-                                        flow = flow.take(params.maxTokens)
-                                }
-                                flow.collect { token ->
-                                        if (token != "[EOG]") {
-                                                sb.append(token)
-                                                onProgress(token)
-                                                tokenCount++
-                                        }
+                        val text = generateTextWith(smol, params, onProgress)
+                        // an escalated response is cut short, not the model's answer
+                        if (!smol.lastResponseEscalated) {
+                                resultKey?.let { ResultCache.put(it, ResultCache.encodeText(text)) }
+                        }
+                        return@withLock text
+                }
+
+        private suspend fun generateTextWith(
+                smol: io.aatricks.llmedge.SmolLM,
+                params: TextGenerationParams,
+                onProgress: ((String) -> Unit)?
+        ): String {
+                if (onProgress != null) {
+                        val sb = StringBuilder()
+                        // We need to use flow for streaming and respect maxTokens
+                        var tokenCount = 0
+                        var flow = smol.getResponseAsFlow(params.prompt)
+                        if (params.maxTokens > 0) {
+                                flow = flow.take(params.maxTokens)
+                        }
+                        flow.collect { token ->
+                                if (token != "[EOG]") {
+                                        sb.append(token)
+                                        onProgress(token)
+                                        tokenCount++
                                 }
-                                return@withLock sb.toString()
-                        } else {
-                                // Use Dispatchers.IO for blocking native JNI operations
-                                // Dispatchers.Default has limited parallelism and is meant for
-                                // CPU-bound work
-                                return@withLock kotlinx.coroutines.withContext(
-                                        kotlinx.coroutines.Dispatchers.IO
-                                ) { smol.getResponse(params.prompt) }
                         }
+                        return sb.toString()
+                } else {
+                        // Use Dispatchers.IO for blocking native JNI operations
+                        // Dispatchers.Default has limited parallelism and is meant for
+                        // CPU-bound work
+                        return kotlinx.coroutines.withContext(
+                                kotlinx.coroutines.Dispatchers.IO
+                        ) { smol.getResponse(params.prompt, params.maxTokens) }
                 }
+        }
+
+        private suspend fun textResultKey(context: Context, params: TextGenerationParams): String? {
+                val modelFile =
+                        params.modelPath?.let { File(it) }
+                                ?: getFile(context, params.modelId, params.modelFilename)
+                return ResultCache.key(
+                        ResultCache.Kind.TEXT,
+                        listOf(modelFile),
+                        mapOf(
+                                "systemPrompt" to params.systemPrompt,
+                                "maxTokens" to params.maxTokens,
+                                "thinkingMode" to params.thinkingMode,
+                                "reasoningBudget" to params.reasoningBudget
+                        ),
+                        ResultCache.encodeText(params.prompt)
+                )
+        }
 
         fun getLastTextGenerationMetrics(): io.aatricks.llmedge.SmolLM.GenerationMetrics? {
                 return cachedSmolLM?.getLastGenerationMetrics()
@@ -522,6 +625,22 @@ object LLMEdgeManager {
                 whisperMutex.withLock {
                         contextRef = WeakReference(context.applicationContext)
 
+                        // Transcripts of audio seen before come from the result cache without
+                        // loading Whisper
+                        val resultKey =
+                                if (ResultCache.isEnabled) {
+                                        transcriptionResultKey(context, params)
+                                } else {
+                                        null
+                                }
+                        resultKey
+                                ?.let { ResultCache.get(it) }
+                                ?.let { ResultCache.decodeSegments(it) }
+                                ?.let { segments ->
+                                        onProgress?.invoke(100)
+                                        return@withLock segments
+                                }
+
                         val whisper =
                                 getOrLoadWhisper(context, params.modelId, params.modelFilename)
 
@@ -538,16 +657,33 @@ object LLMEdgeManager {
                                                 language = params.language,
                                                 tokenTimestamps = params.tokenTimestamps
                                         )
-                                return@withLock whisper.transcribe(
-                                        params.audioSamples,
-                                        whisperParams
-                                )
+                                val segments =
+                                        whisper.transcribe(params.audioSamples, whisperParams)
+                                resultKey?.let {
+                                        ResultCache.put(it, ResultCache.encodeSegments(segments))
+                                }
+                                return@withLock segments
                         } finally {
                                 // Clear callback after use
                                 whisper.setProgressCallback(null)
                         }
                 }
 
+        private suspend fun transcriptionResultKey(
+                context: Context,
+                params: TranscriptionParams
+        ): String? =
+                ResultCache.key(
+                        ResultCache.Kind.TRANSCRIPTION,
+                        listOf(getFile(context, params.modelId, params.modelFilename)),
+                        mapOf(
+                                "translate" to params.translate,
+                                "language" to params.language,
+                                "tokenTimestamps" to params.tokenTimestamps
+                        ),
+                        ResultCache.floatsToBytes(params.audioSamples)
+                )
+
         /**
          * Transcribe audio and return as a simple string (concatenated segments).
          *
@@ -615,6 +751,9 @@ object LLMEdgeManager {
         // Cached streaming transcriber for the current session
         @Volatile private var cachedStreamingTranscriber: Whisper.StreamingTranscriber? = null
 
+        // Keyword spotter gating the current streaming session, if configured
+        @Volatile private var cachedKeywordSpotter: KeywordSpotter? = null
+
         /**
          * Create a streaming transcriber for real-time audio transcription.
          *
@@ -656,6 +795,15 @@ object LLMEdgeManager {
                         val whisper =
                                 getOrLoadWhisper(context, params.modelId, params.modelFilename)
 
+                        // The old transcriber still feeds the old spotter until it is stopped.
+                        cachedStreamingTranscriber?.stop()
+                        cachedStreamingTranscriber = null
+                        cachedKeywordSpotter?.close()
+                        cachedKeywordSpotter =
+                                params.keywordModelPath?.let {
+                                        KeywordSpotter.load(it, params.keywordSensitivity)
+                                }
+
                         val streamingParams =
                                 Whisper.StreamingParams(
                                         stepMs = params.stepMs,
@@ -665,7 +813,9 @@ object LLMEdgeManager {
                                         language = params.language,
                                         nThreads = params.nThreads,
                                         vadThreshold = params.vadThreshold,
-                                        useVad = params.useVad
+                                        useVad = params.useVad,
+                                        keywordGate = cachedKeywordSpotter,
+                                        keywordWindowMs = params.keywordWindowMs
                                 )
 
                         val transcriber = whisper.createStreamingTranscriber(streamingParams)
@@ -710,10 +860,26 @@ object LLMEdgeManager {
                 return cachedStreamingTranscriber
         }
 
+        /**
+         * Cost and detection counters of the keyword spotter gating the active streaming session,
+         * including CPU milliseconds per second of audio.
+         */
+        fun getKeywordSpotterStats(): KeywordSpotter.Stats? = cachedKeywordSpotter?.stats()
+
         /** Stop and cleanup the streaming transcriber. */
         fun stopStreamingTranscription() {
                 cachedStreamingTranscriber?.stop()
                 cachedStreamingTranscriber = null
+                cachedKeywordSpotter?.let { spotter ->
+                        Log.i(
+                                TAG,
+                                "Keyword spotter: %.2f CPU ms per audio second".format(
+                                        spotter.stats().cpuMsPerAudioSecond
+                                )
+                        )
+                        spotter.close()
+                }
+                cachedKeywordSpotter = null
         }
 
         // ============================================================
@@ -739,6 +905,19 @@ object LLMEdgeManager {
                 barkMutex.withLock {
                         contextRef = WeakReference(context.applicationContext)
 
+                        // Seeded speech is reproducible, so it can come from the result cache
+                        // without loading Bark
+                        val resultKey =
+                                if (params.seed != 0 && ResultCache.isEnabled) {
+                                        speechResultKey(context, params)
+                                } else {
+                                        null
+                                }
+                        resultKey
+                                ?.let { ResultCache.get(it) }
+                                ?.let { ResultCache.decodeAudio(it) }
+                                ?.let { return@withLock it }
+
                         // Unload heavy models to free memory for Bark
                         unloadSmolLM()
                         unloadDiffusionModel()
@@ -750,7 +929,8 @@ object LLMEdgeManager {
                                         params.modelFilename,
                                         params.seed,
                                         params.temperature,
-                                        params.fineTemperature
+                                        params.fineTemperature,
+                                        reproducible = resultKey != null
                                 )
 
                         // Set progress callback if provided
@@ -762,13 +942,33 @@ object LLMEdgeManager {
 
                         try {
                                 val barkParams = BarkTTS.GenerateParams(nThreads = params.nThreads)
-                                return@withLock bark.generate(params.text, barkParams)
+                                barkGenerated = true
+                                val audio = bark.generate(params.text, barkParams)
+                                resultKey?.let {
+                                        ResultCache.put(it, ResultCache.encodeAudio(audio))
+                                }
+                                return@withLock audio
                         } finally {
                                 // Clear callback after use
                                 bark.setProgressCallback(null)
                         }
                 }
 
+        private suspend fun speechResultKey(
+                context: Context,
+                params: SpeechSynthesisParams
+        ): String? =
+                ResultCache.key(
+                        ResultCache.Kind.SPEECH,
+                        listOf(getFile(context, params.modelId, params.modelFilename)),
+                        mapOf(
+                                "seed" to params.seed,
+                                "temperature" to params.temperature,
+                                "fineTemperature" to params.fineTemperature
+                        ),
+                        ResultCache.encodeText(params.text)
+                )
+
         /**
          * Synthesize speech and save directly to a WAV file.
          *
@@ -846,16 +1046,22 @@ object LLMEdgeManager {
                 filename: String,
                 seed: Int,
                 temperature: Float,
-                fineTemperature: Float
+                fineTemperature: Float,
+                reproducible: Boolean = false
         ): BarkTTS {
                 val existingSpec = currentBarkModelSpec
                 val cached = cachedBark
 
-                // Check if we already have the right model loaded
+                // Check if we already have the right model loaded. Only a result that goes into
+                // the result cache must match its seed exactly, which needs a sampler that has
+                // not been used since it was seeded.
                 if (cached != null &&
                                 existingSpec != null &&
                                 existingSpec.modelId == modelId &&
-                                existingSpec.filename == filename
+                                existingSpec.filename == filename &&
+                                existingSpec.temperature == temperature &&
+                                existingSpec.fineTemperature == fineTemperature &&
+                                (seed == 0 || (existingSpec.seed == seed && !(reproducible && barkGenerated)))
                 ) {
                         return cached
                 }
@@ -867,6 +1073,7 @@ object LLMEdgeManager {
                 cached?.close()
                 cachedBark = null
                 currentBarkModelSpec = null
+                barkGenerated = false
 
                 Log.d(TAG, "Loading Bark model: $modelId/$filename")
                 val modelFile = getFile(context, modelId, filename)
@@ -881,7 +1088,14 @@ object LLMEdgeManager {
 
                 cachedBark = bark
                 currentBarkModelSpec =
-                        LoadedBarkModelSpec(modelId, filename, modelFile.absolutePath)
+                        LoadedBarkModelSpec(
+                                modelId,
+                                filename,
+                                modelFile.absolutePath,
+                                seed,
+                                temperature,
+                                fineTemperature
+                        )
 
                 Log.d(TAG, "Bark model loaded (sample rate: ${bark.getSampleRate()}Hz)")
                 return bark
@@ -899,6 +1113,7 @@ object LLMEdgeManager {
                 cachedBark?.close()
                 cachedBark = null
                 currentBarkModelSpec = null
+                barkGenerated = false
         }
 
         /** Unload all speech models to free memory. */
@@ -961,6 +1176,7 @@ object LLMEdgeManager {
                                         // (unlikely but safe)
                                         val metaFile = File(embedFile.absolutePath + ".meta.json")
                                         if (metaFile.exists()) metaFile.delete()
+                                        val frameFiles = mutableListOf(imageFile)
 
                                         try {
                                                 Log.d(TAG, "Vision: Preprocessing image...")
@@ -985,6 +1201,33 @@ object LLMEdgeManager {
                                                                 out
                                                         )
                                                 }
+                                                for (frame in params.extraFrames) {
+                                                        val frameFile =
+                                                                File.createTempFile(
+                                                                        "vision_frame",
+                                                                        ".jpg",
+                                                                        context.cacheDir
+                                                                )
+                                                        frameFiles += frameFile
+                                                        io.aatricks.llmedge.vision.ImageUtils
+                                                                .preprocessImage(
+                                                                        frame,
+                                                                        correctOrientation = true,
+                                                                        maxDimension = 672,
+                                                                        enhance = false
+                                                                )
+                                                                .let { bitmap ->
+                                                                        frameFile.outputStream().use {
+                                                                                out ->
+                                                                                bitmap.compress(
+                                                                                        Bitmap.CompressFormat
+                                                                                                .JPEG,
+                                                                                        90,
+                                                                                        out
+                                                                                )
+                                                                        }
+                                                                }
+                                                }
 
                                                 // 2. Load Model FIRST (Lightweight load for
                                                 // Projection validation)
@@ -1038,10 +1281,27 @@ object LLMEdgeManager {
                                                         "Vision: Encoding image to ${embedFile.absolutePath}"
                                                 )
                                                 val ok =
-                                                        projector.encodeImageToFile(
-                                                                imageFile.absolutePath,
-                                                                embedFile.absolutePath
-                                                        )
+                                                        if (frameFiles.size > 1) {
+                                                                lastClipEncodeStats =
+                                                                        projector.encodeFramesToFile(
+                                                                                frameFiles.map {
+                                                                                        it.absolutePath
+                                                                                },
+                                                                                embedFile.absolutePath,
+                                                                                params.frameSelection
+                                                                        )
+                                                                lastClipEncodeStats != null
+                                                        } else {
+                                                                lastClipEncodeStats = null
+                                                                projector.encodeImageToFile(
+                                                                        imageFile.absolutePath,
+                                                                        embedFile.absolutePath,
+                                                                        params.imageTokenBudget
+                                                                )
+                                                        }
+                                                lastImageEncodeStats =
+                                                        if (params.imageTokenBudget.isUnlimited) null
+                                                        else projector.lastEncodeStats
                                                 projector.close()
 
                                                 Log.d(TAG, "Vision: Projector returned $ok")
@@ -1120,7 +1380,7 @@ object LLMEdgeManager {
                                                 return@withLock result.text
                                         } finally {
                                                 // Cleanup
-                                                if (imageFile.exists()) imageFile.delete()
+                                                frameFiles.forEach { if (it.exists()) it.delete() }
                                                 if (embedFile.exists()) embedFile.delete()
                                                 if (metaFile.exists()) metaFile.delete()
                                                 adapter.close()
@@ -1133,6 +1393,77 @@ object LLMEdgeManager {
                                 smol.close()
                         }
                 }
+        @Volatile private var lastImageEncodeStats: io.aatricks.llmedge.vision.ImageEncodeStats? = null
+
+        @Volatile
+        private var lastClipEncodeStats: io.aatricks.llmedge.vision.ClipEncodeStats? = null
+
+        /**
+         * Describes a video clip or camera burst with one vision prompt. Frames that look like
+         * the frame before them are skipped, and only the distinct ones are encoded (see
+         * [io.aatricks.llmedge.vision.FrameSelection]).
+         */
+        suspend fun analyzeFrames(
+                context: Context,
+                frames: List<Bitmap>,
+                prompt: String,
+                selection: io.aatricks.llmedge.vision.FrameSelection =
+                        io.aatricks.llmedge.vision.FrameSelection(),
+                onProgress: ((String) -> Unit)? = null
+        ): String {
+                require(frames.isNotEmpty()) { "frames must not be empty" }
+                return analyzeImage(
+                        context,
+                        VisionAnalysisParams(
+                                image = frames.first(),
+                                prompt = prompt,
+                                extraFrames = frames.drop(1),
+                                frameSelection = selection
+                        ),
+                        onProgress
+                )
+        }
+
+        /** Frame selection and token stats of the last multi-frame [analyzeImage]. */
+        fun getLastClipEncodeStats(): io.aatricks.llmedge.vision.ClipEncodeStats? =
+                lastClipEncodeStats
+
+        /** Encode stats of the last [analyzeImage] that ran under an image-token budget. */
+        fun getLastImageEncodeStats(): io.aatricks.llmedge.vision.ImageEncodeStats? =
+                lastImageEncodeStats
+
+        /**
+         * Runs [analyzeImage] once with the full image-token count and once per entry of
+         * [budgets], and reports each run's latency, token reduction and answer F1 against
+         * [referenceAnswer] (or, if null, the full-budget answer).
+         */
+        suspend fun compareImageTokenBudgets(
+                context: Context,
+                params: VisionAnalysisParams,
+                budgets: List<io.aatricks.llmedge.vision.ImageTokenBudget>,
+                referenceAnswer: String? = null
+        ): List<ImageTokenBudgetResult> {
+                val runs =
+                        (listOf(io.aatricks.llmedge.vision.ImageTokenBudget.FULL) + budgets).map {
+                                budget ->
+                                val start = System.currentTimeMillis()
+                                val answer =
+                                        analyzeImage(context, params.copy(imageTokenBudget = budget))
+                                Triple(budget, answer, System.currentTimeMillis() - start) to
+                                        lastImageEncodeStats
+                        }
+                val reference = referenceAnswer ?: runs.first().first.second
+                return runs.map { (run, stats) ->
+                        ImageTokenBudgetResult(
+                                budget = run.first,
+                                answer = run.second,
+                                latencyMs = run.third,
+                                encodeStats = stats,
+                                answerF1 = io.aatricks.llmedge.rag.RAGEngine.answerF1(reference, run.second)
+                        )
+                }
+        }
+
         /**
          * Generates an image using the default or configured model. Automatically handles
          * sequential loading for low-memory devices.
@@ -1144,6 +1475,26 @@ object LLMEdgeManager {
         ): Bitmap? =
                 diffusionModelMutex.withLock {
                         contextRef = WeakReference(context.applicationContext)
+
+                        // A seeded image is reproducible, so it can come from the result cache
+                        // without loading the model.
+                        val resultKey =
+                                if (params.seed >= 0 && ResultCache.isEnabled) {
+                                        imageResultKey(context, params)
+                                } else {
+                                        null
+                                }
+                        resultKey
+                                ?.let { ResultCache.get(it) }
+                                ?.let { ResultCache.decodeImage(it) }
+                                ?.let { image ->
+                                        return rgbBytesToBitmap(
+                                                image.rgb,
+                                                image.width,
+                                                image.height
+                                        )
+                                }
+
                         unloadSmolLM() // Free up memory from LLM
                         // Sequential load logic is handled inside getOrLoadImageModel via
                         // auto-detection if null,
@@ -1182,9 +1533,53 @@ object LLMEdgeManager {
                                         seed = params.seed,
                                         easyCacheParams = finalEasyCacheParams
                                 )
-                        return model.txt2img(sdParams)
+                        val bitmap = model.txt2img(sdParams)
+                        if (resultKey != null && bitmap != null) {
+                                ResultCache.put(
+                                        resultKey,
+                                        ResultCache.encodeImage(
+                                                bitmap.width,
+                                                bitmap.height,
+                                                bitmapToRgbBytes(bitmap)
+                                        )
+                                )
+                        }
+                        return bitmap
                 }
 
+        private suspend fun imageResultKey(
+                context: Context,
+                params: ImageGenerationParams
+        ): String? {
+                val modelFile =
+                        getFile(context, DEFAULT_IMAGE_MODEL_ID, DEFAULT_IMAGE_MODEL_FILENAME)
+                // The prompt picks LoRAs from the directory by name, so every file in it is keyed
+                // by its name and contents rather than by the directory's path
+                val loraFiles =
+                        params.loraModelDir
+                                ?.let { File(it).listFiles() }
+                                ?.filter { it.isFile }
+                                ?.sortedBy { it.name }
+                                .orEmpty()
+                return ResultCache.key(
+                        ResultCache.Kind.IMAGE,
+                        listOf(modelFile) + loraFiles,
+                        mapOf(
+                                "negative" to params.negative,
+                                "width" to params.width,
+                                "height" to params.height,
+                                "steps" to params.steps,
+                                "cfgScale" to params.cfgScale,
+                                "seed" to params.seed,
+                                "flashAttn" to params.flashAttn,
+                                "easyCache" to params.easyCache,
+                                "loraFiles" to loraFiles.joinToString("/") { it.name },
+                                "loraApplyMode" to params.loraApplyMode
+                        ),
+                        ResultCache.encodeText(params.prompt)
+                )
+        }
+
         /** Generates a video using the default or configured model. */
         suspend fun generateVideo(
                 context: Context,
@@ -1390,29 +1785,15 @@ object LLMEdgeManager {
                                         flashAttn = params.flashAttn
                                 )
 
-                        cond =
-                                t5Model.precomputeCondition(
+                        val pair =
+                                t5Model.precomputeConditionPair(
                                         params.prompt,
                                         params.negative,
                                         params.width,
                                         params.height
                                 )
-                        uncond =
-                                if (params.negative.isNotEmpty()) {
-                                        t5Model.precomputeCondition(
-                                                params.negative,
-                                                "",
-                                                params.width,
-                                                params.height
-                                        )
-                                } else {
-                                        t5Model.precomputeCondition(
-                                                "",
-                                                "",
-                                                params.width,
-                                                params.height
-                                        )
-                                }
+                        cond = pair?.first
+                        uncond = pair?.second
                 } finally {
                         t5Model?.close()
                 }
@@ -1519,35 +1900,29 @@ object LLMEdgeManager {
                                 )
 
                         Log.i(TAG, "T5 model loaded, pre-computing condition")
-                        cond =
-                                t5Model.precomputeCondition(
-                                        params.prompt,
-                                        params.negative,
-                                        params.width,
-                                        params.height
-                                )
-                        Log.i(TAG, "Pre-computed condition (positive)")
-                        
-                        uncond = if (params.cfgScale != 1.0f) {
-                                if (params.negative.isNotEmpty()) {
-                                        t5Model.precomputeCondition(
+                        if (params.cfgScale != 1.0f) {
+                                // cond and uncond share one T5 load and a single batched encode.
+                                val pair =
+                                        t5Model.precomputeConditionPair(
+                                                params.prompt,
                                                 params.negative,
-                                                "",
                                                 params.width,
                                                 params.height
                                         )
-                                } else {
+                                cond = pair?.first
+                                uncond = pair?.second
+                        } else {
+                                cond =
                                         t5Model.precomputeCondition(
-                                                "",
-                                                "",
+                                                params.prompt,
+                                                params.negative,
                                                 params.width,
                                                 params.height
                                         )
-                                }
-                        } else {
                                 Log.i(TAG, "Skipping negative prompt pre-computation (cfgScale=1.0)")
-                                null
+                                uncond = null
                         }
+                        Log.i(TAG, "Pre-computed condition (positive)")
                         if (uncond != null) Log.i(TAG, "Pre-computed condition (negative)")
                 } finally {
                         Log.i(TAG, "Unloading T5 encoder")
@@ -2062,7 +2437,9 @@ object LLMEdgeManager {
                 context: Context,
                 modelId: String,
                 filename: String,
-                absolutePath: String? = null
+                absolutePath: String? = null,
+                // sampling temperature to load with, null for the SmolLM default
+                temperature: Float? = null
         ): io.aatricks.llmedge.SmolLM {
                 // Check existing cache first
                 cachedSmolLM?.let {
@@ -2071,7 +2448,8 @@ object LLMEdgeManager {
                         if (spec != null &&
                                         spec.modelId == modelId &&
                                         spec.filename == filename &&
-                                        spec.path == absolutePath
+                                        spec.path == absolutePath &&
+                                        spec.temperature == temperature
                         ) {
                                 return it
                         }
@@ -2097,11 +2475,12 @@ object LLMEdgeManager {
                 }
 
                 // Phase 3: Check model cache
-                val cacheKey = finalPath.absolutePath
+                val cacheKey = finalPath.absolutePath + (temperature?.let { "@t=$it" } ?: "")
                 textModelCache.get(cacheKey)?.let { cachedModel ->
                         Log.i(TAG, "Loaded SmolLM from cache: $cacheKey")
                         cachedSmolLM = cachedModel
-                        currentTextModelSpec = LoadedTextModelSpec(modelId, filename, absolutePath)
+                        currentTextModelSpec =
+                                LoadedTextModelSpec(modelId, filename, absolutePath, temperature)
                         return cachedModel
                 }
 
@@ -2147,7 +2526,12 @@ object LLMEdgeManager {
                         params =
                                 io.aatricks.llmedge.SmolLM.InferenceParams(
                                         numThreads = optimalThreads,
-                                        contextSize = overrideContextSize
+                                        contextSize = overrideContextSize,
+                                        temperature =
+                                                temperature
+                                                        ?: io.aatricks.llmedge.SmolLM
+                                                                .InferenceParams()
+                                                                .temperature
                                 )
                 )
 
@@ -2158,7 +2542,8 @@ object LLMEdgeManager {
                 textModelCache.put(cacheKey, smol, modelSize, loadTime)
 
                 cachedSmolLM = smol
-                currentTextModelSpec = LoadedTextModelSpec(modelId, filename, absolutePath)
+                currentTextModelSpec =
+                        LoadedTextModelSpec(modelId, filename, absolutePath, temperature)
                 return smol
         }
 
@@ -2396,6 +2781,19 @@ object LLMEdgeManager {
         // Reuse pixel buffers across conversions to reduce GC pressure
         private val pixelBufferThreadLocal = ThreadLocal<IntArray>()
 
+        private fun bitmapToRgbBytes(bitmap: Bitmap): ByteArray {
+                val pixels = IntArray(bitmap.width * bitmap.height)
+                bitmap.getPixels(pixels, 0, bitmap.width, 0, 0, bitmap.width, bitmap.height)
+                val rgb = ByteArray(pixels.size * 3)
+                for (i in pixels.indices) {
+                        val p = pixels[i]
+                        rgb[i * 3] = (p shr 16).toByte()
+                        rgb[i * 3 + 1] = (p shr 8).toByte()
+                        rgb[i * 3 + 2] = p.toByte()
+                }
+                return rgb
+        }
+
         private fun rgbBytesToBitmap(rgb: ByteArray, width: Int, height: Int): Bitmap {
                 val total = width * height
                 var pixels = pixelBufferThreadLocal.get()
@@ -4,29 +4,78 @@ import android.util.Log
 import java.util.LinkedHashMap
 
 /**
- * LRU cache for models with memory-aware eviction
+ * Cache for models with memory-aware eviction
+ *
+ * By default the entry evicted is the one that is cheapest to bring back: entries are ranked
+ * GreedyDual-Size-Frequency style by `L + uses * loadTimeMs / share`, where `share` is the part of
+ * the cache the entry takes up (its fraction of [maxMemoryMB], but at least one of the
+ * [maxCacheSize] slots) and `L` rises to the rank of each evicted entry so that entries which
+ * stopped being used age out. A model that is slow to load and used often outlives one that
+ * reloads in a moment, unless it also crowds out several others. Pinned entries are never
+ * evicted.
  *
  * @param T Model type that implements AutoCloseable
  * @param maxCacheSize Maximum number of models to keep in cache
  * @param maxMemoryMB Maximum memory to use for cache (approximate)
+ * @param evictionPolicy How the entry to evict is chosen
  */
 class ModelCache<T : AutoCloseable>(
     private val maxCacheSize: Int = 2,
     private val maxMemoryMB: Long = 4096,
     /** Optional provider to compute current available system memory (MB). If provided, cache will use this to be more memory-aware. */
-    var systemMemoryProvider: (() -> Long)? = null
+    var systemMemoryProvider: (() -> Long)? = null,
+    private val evictionPolicy: EvictionPolicy = EvictionPolicy.COST_AWARE
 ) {
     private val TAG = "ModelCache"
 
+    enum class EvictionPolicy {
+        /** Evict the least recently used entry. */
+        LRU,
+        /** Evict the entry with the lowest reload cost per byte, weighted by use (GDSF). */
+        COST_AWARE
+    }
+
     /** Cache entry with metadata */
     data class CacheEntry<T>(
             val model: T,
             val sizeBytes: Long,
             val loadTimeMs: Long,
             var lastUsedMs: Long = System.currentTimeMillis(),
-            var hitCount: Int = 0
+            var hitCount: Int = 0,
+            /** Eviction rank under [EvictionPolicy.COST_AWARE]; the lowest is evicted first. */
+            var priority: Double = 0.0
     )
 
+    /** One model request: a hit, or a load that took [loadTimeMs] and occupies [sizeBytes]. */
+    data class TraceAccess(val key: String, val sizeBytes: Long, val loadTimeMs: Long)
+
+    /** Outcome of replaying a trace under one policy. */
+    data class ReplayResult(
+            val policy: EvictionPolicy,
+            val hits: Int,
+            val misses: Int,
+            /** Time spent loading models on the misses. */
+            val reloadSeconds: Double
+    ) {
+        val hitRate: Double
+            get() = if (hits + misses > 0) hits.toDouble() / (hits + misses) else 0.0
+    }
+
+    /** The same trace replayed under [EvictionPolicy.LRU] and [EvictionPolicy.COST_AWARE]. */
+    data class PolicyComparison(val lru: ReplayResult, val costAware: ReplayResult) {
+        /** Loading time the cost-aware policy saves over LRU (negative if it costs more). */
+        val reloadSecondsSaved: Double
+            get() = lru.reloadSeconds - costAware.reloadSeconds
+
+        override fun toString(): String {
+            return "LRU hit_rate=${String.format("%.1f%%", lru.hitRate * 100)} " +
+                    "reload=${String.format("%.1fs", lru.reloadSeconds)}, " +
+                    "cost-aware hit_rate=${String.format("%.1f%%", costAware.hitRate * 100)} " +
+                    "reload=${String.format("%.1fs", costAware.reloadSeconds)}, " +
+                    "saved=${String.format("%.1fs", reloadSecondsSaved)}"
+        }
+    }
+
     /** Cache statistics */
     data class CacheStats(
             val entries: Int,
@@ -45,8 +94,18 @@ class ModelCache<T : AutoCloseable>(
         }
     }
 
-    // LinkedHashMap with access-order for LRU
+    // LinkedHashMap with access-order for LRU (and as the tie-break between equal priorities)
     private val cache = LinkedHashMap<String, CacheEntry<T>>(16, 0.75f, true)
+    private val pinnedKeys = HashSet<String>()
+
+    // GDSF inflation: the priority of the last evicted entry
+    private var inflation = 0.0
+
+    // Recent accesses, replayed by compareWithLru()
+    private val trace = ArrayDeque<TraceAccess>()
+
+    // Replays run quietly
+    private var logEvents = true
 
     // Statistics
     private var hits = 0
@@ -63,12 +122,14 @@ class ModelCache<T : AutoCloseable>(
         if (entry != null) {
             entry.lastUsedMs = System.currentTimeMillis()
             entry.hitCount++
+            entry.priority = priorityOf(entry)
             hits++
-            Log.d(TAG, "Cache HIT for '$key' (used ${entry.hitCount} times)")
+            record(TraceAccess(key, entry.sizeBytes, entry.loadTimeMs))
+            if (logEvents) Log.d(TAG, "Cache HIT for '$key' (used ${entry.hitCount} times)")
             return entry.model
         }
         misses++
-        Log.d(TAG, "Cache MISS for '$key'")
+        if (logEvents) Log.d(TAG, "Cache MISS for '$key'")
         return null
     }
 
@@ -83,7 +144,10 @@ class ModelCache<T : AutoCloseable>(
     fun put(key: String, model: T, sizeBytes: Long, loadTimeMs: Long = 0) {
         // Check if we need to evict
         while (shouldEvict(sizeBytes)) {
-            evictLRU()
+            if (!evictOne()) {
+                Log.w(TAG, "Nothing left to evict but pinned models; caching '$key' over budget")
+                break
+            }
         }
 
         // Remove existing entry if present
@@ -102,10 +166,76 @@ class ModelCache<T : AutoCloseable>(
                         loadTimeMs = loadTimeMs,
                         lastUsedMs = System.currentTimeMillis()
                 )
+        entry.priority = priorityOf(entry)
 
         cache[key] = entry
-        Log.i(TAG, "Cached '$key' (${sizeBytes / 1024 / 1024}MB, loaded in ${loadTimeMs}ms)")
-        logStats()
+        record(TraceAccess(key, sizeBytes, loadTimeMs))
+        if (logEvents) {
+            Log.i(TAG, "Cached '$key' (${sizeBytes / 1024 / 1024}MB, loaded in ${loadTimeMs}ms)")
+            logStats()
+        }
+    }
+
+    /** Keeps [key] in the cache until [unpin]; it may be pinned before it is loaded. */
+    @Synchronized
+    fun pin(key: String) {
+        pinnedKeys.add(key)
+    }
+
+    @Synchronized
+    fun unpin(key: String) {
+        pinnedKeys.remove(key)
+    }
+
+    @Synchronized
+    fun isPinned(key: String): Boolean = key in pinnedKeys
+
+    /** Reload time per share of the cache, weighted by how often the entry was used. */
+    private fun priorityOf(entry: CacheEntry<T>): Double {
+        val memoryShare = entry.sizeBytes / (1024.0 * 1024.0) / maxMemoryMB.coerceAtLeast(1L)
+        val share = maxOf(memoryShare, 1.0 / maxCacheSize.coerceAtLeast(1))
+        return inflation + (entry.hitCount + 1) * entry.loadTimeMs / share
+    }
+
+    private fun record(access: TraceAccess) {
+        if (trace.size == TRACE_CAPACITY) trace.removeFirst()
+        trace.addLast(access)
+    }
+
+    /** Evicts one unpinned entry as the policy dictates; false if there is none. */
+    private fun evictOne(): Boolean {
+        if (evictionPolicy == EvictionPolicy.LRU) return evictLRU()
+
+        // Strictly lower priority wins, so equal priorities fall back to LRU order
+        var victim: Map.Entry<String, CacheEntry<T>>? = null
+        for (candidate in cache.entries) {
+            if (candidate.key in pinnedKeys) continue
+            if (victim == null || candidate.value.priority < victim.value.priority) {
+                victim = candidate
+            }
+        }
+        val (key, entry) = victim ?: return false
+        inflation = entry.priority
+        evict(key, "lowest-priority", entry)
+        return true
+    }
+
+    private fun evict(key: String, reason: String, entry: CacheEntry<T>) {
+        cache.remove(key)
+        try {
+            entry.model.close()
+            evictions++
+            if (logEvents) {
+                Log.i(
+                        TAG,
+                        "Evicted $reason '$key' (used ${entry.hitCount} times, " +
+                                "${entry.sizeBytes / 1024 / 1024}MB, " +
+                                "loaded in ${entry.loadTimeMs}ms)"
+                )
+            }
+        } catch (e: Exception) {
+            Log.w(TAG, "Error closing evicted entry: ${e.message}")
+        }
     }
 
     /** Check if we should evict based on cache size and memory limits */
@@ -132,28 +262,16 @@ class ModelCache<T : AutoCloseable>(
         return newMemoryMB > effectiveMax
     }
 
-    /** Evict least recently used entry */
+    /**
+     * Evict least recently used unpinned entry
+     * @return false if every entry is pinned
+     */
     @Synchronized
-    fun evictLRU() {
-        if (cache.isEmpty()) return
-
+    fun evictLRU(): Boolean {
         // LinkedHashMap in access-order: first entry is LRU
-        val lruKey = cache.keys.first()
-        val lruEntry = cache.remove(lruKey)
-
-        lruEntry?.let { entry ->
-            try {
-                entry.model.close()
-                evictions++
-                Log.i(
-                        TAG,
-                        "Evicted LRU '$lruKey' (used ${entry.hitCount} times, " +
-                                "${entry.sizeBytes / 1024 / 1024}MB)"
-                )
-            } catch (e: Exception) {
-                Log.w(TAG, "Error closing evicted entry: ${e.message}")
-            }
-        }
+        val lru = cache.entries.firstOrNull { it.key !in pinnedKeys } ?: return false
+        evict(lru.key, "LRU", lru.value)
+        return true
     }
 
     /** Clear all cached models */
@@ -168,6 +286,8 @@ class ModelCache<T : AutoCloseable>(
             }
         }
         cache.clear()
+        trace.clear()
+        inflation = 0.0
         hits = 0
         misses = 0
         evictions = 0
@@ -219,4 +339,67 @@ class ModelCache<T : AutoCloseable>(
     fun contains(key: String): Boolean {
         return cache.containsKey(key)
     }
+
+    /** The last accesses (at most [TRACE_CAPACITY]), oldest first */
+    @Synchronized
+    fun getAccessTrace(): List<TraceAccess> = trace.toList()
+
+    /**
+     * Replays the recorded accesses under LRU and under the cost-aware policy, with this cache's
+     * limits and pins. The system memory provider is not consulted, so only [maxCacheSize] and
+     * [maxMemoryMB] bound the replay.
+     */
+    fun compareWithLru(): PolicyComparison {
+        val (accesses, pinned) = synchronized(this) { trace.toList() to pinnedKeys.toSet() }
+        return compare(accesses, maxCacheSize, maxMemoryMB, pinned)
+    }
+
+    companion object {
+        /** Accesses kept for [compareWithLru] */
+        const val TRACE_CAPACITY = 512
+
+        /**
+         * Hit rate and loading time of [trace] on a cache of [maxCacheSize] models and
+         * [maxMemoryMB] under [policy]. Models are not loaded: a miss costs its recorded load time.
+         */
+        fun replay(
+                trace: List<TraceAccess>,
+                maxCacheSize: Int,
+                maxMemoryMB: Long,
+                policy: EvictionPolicy,
+                pinned: Set<String> = emptySet()
+        ): ReplayResult {
+            val cache =
+                    ModelCache<AutoCloseable>(maxCacheSize, maxMemoryMB, evictionPolicy = policy)
+            cache.logEvents = false
+            pinned.forEach { cache.pin(it) }
+            var reloadMs = 0L
+            for (access in trace) {
+                if (cache.get(access.key) == null) {
+                    reloadMs += access.loadTimeMs
+                    cache.put(access.key, AutoCloseable {}, access.sizeBytes, access.loadTimeMs)
+                }
+            }
+            return ReplayResult(policy, cache.hits, cache.misses, reloadMs / 1000.0)
+        }
+
+        /** [replay] of [trace] under both policies. */
+        fun compare(
+                trace: List<TraceAccess>,
+                maxCacheSize: Int,
+                maxMemoryMB: Long,
+                pinned: Set<String> = emptySet()
+        ): PolicyComparison =
+                PolicyComparison(
+                        lru = replay(trace, maxCacheSize, maxMemoryMB, EvictionPolicy.LRU, pinned),
+                        costAware =
+                                replay(
+                                        trace,
+                                        maxCacheSize,
+                                        maxMemoryMB,
+                                        EvictionPolicy.COST_AWARE,
+                                        pinned
+                                )
+                )
+    }
 }
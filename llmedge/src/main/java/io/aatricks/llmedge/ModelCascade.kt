@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2024 LLMEdge Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package io.aatricks.llmedge
+
+/**
+ * Answers with a small model and hands a turn to a large one only when the small model is unsure.
+ *
+ * The small model generates under a [SmolLM.ConfidencePolicy] checked natively on every sampling
+ * step. If the rolling entropy or top-2 margin trips it, the partial answer is discarded, the
+ * turn is rolled back out of the small model's KV cache, and the large model answers instead,
+ * starting from the small model's prompt tokens when the two share a vocabulary and chat
+ * template. Both models are kept on the same conversation: the turn is added to the history of
+ * the model that did not answer it.
+ *
+ * Example usage:
+ * ```kotlin
+ * val cascade = ModelCascade(small, large, SmolLM.ConfidencePolicy(maxMeanEntropy = 1.5f))
+ * val answer = cascade.getResponse("Why is the sky blue?")
+ * Log.d("cascade", "${answer.tier} answered: ${answer.text}")
+ * ```
+ *
+ * Both models must be loaded and are not owned by the cascade.
+ */
+class ModelCascade(
+        private val small: SmolLM,
+        private val large: SmolLM,
+        policy: SmolLM.ConfidencePolicy = SmolLM.ConfidencePolicy(),
+) {
+    enum class Tier {
+        SMALL,
+        LARGE,
+    }
+
+    /**
+     * @property text The response.
+     * @property tier The model that produced [text].
+     * @property smallTokens Tokens the small model generated; discarded if [tier] is [Tier.LARGE].
+     * @property reusedTokenization True if the large model started from the small model's prompt
+     * tokens instead of tokenizing the turn again.
+     */
+    data class Answer(
+            val text: String,
+            val tier: Tier,
+            val smallTokens: Long,
+            val reusedTokenization: Boolean,
+    )
+
+    /**
+     * @property responses Turns answered through the cascade.
+     * @property escalations Turns answered by the large model.
+     */
+    data class Stats(val responses: Long, val escalations: Long) {
+        /** Share of turns the small model answered on its own. */
+        val smallTierFraction: Float
+            get() = if (responses == 0L) 0f else (responses - escalations).toFloat() / responses
+    }
+
+    private var responses = 0L
+    private var escalations = 0L
+
+    init {
+        require(small !== large) { "small and large must be different models" }
+        small.setConfidencePolicy(policy)
+    }
+
+    /** Changes the escalation policy of the small model. */
+    fun setPolicy(policy: SmolLM.ConfidencePolicy) {
+        small.setConfidencePolicy(policy)
+    }
+
+    /** Answers [query] with the small model, escalating to the large one on low confidence. */
+    @Synchronized
+    fun getResponse(query: String, maxTokens: Int = -1): Answer {
+        responses++
+        val smallText = small.getResponse(query, maxTokens)
+        val smallTokens = small.getLastGenerationMetrics().tokenCount
+        if (!small.lastResponseEscalated) {
+            large.addUserMessage(query)
+            large.addAssistantMessage(smallText)
+            return Answer(smallText, Tier.SMALL, smallTokens, reusedTokenization = false)
+        }
+        escalations++
+        val (largeText, reused) = large.getResponseEscalatedFrom(small, query, maxTokens)
+        small.addUserMessage(query)
+        small.addAssistantMessage(largeText)
+        return Answer(largeText, Tier.LARGE, smallTokens, reused)
+    }
+
+    fun getStats(): Stats = Stats(responses, escalations)
+}
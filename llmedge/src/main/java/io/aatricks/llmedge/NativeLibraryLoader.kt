@@ -0,0 +1,155 @@
+package io.aatricks.llmedge
+
+import android.os.Build
+import java.io.File
+
+/**
+ * Loads the fastest build of a multi-variant JNI library the CPU can run. `smollm`, `sdcpp`,
+ * `whisper_jni` and `bark_jni` are built once per instruction-set level as `<name>_<suffix>` (see
+ * `LLMEDGE_ARM64_VARIANTS` in the Android CMakeLists and `LLMEDGE_X86_VARIANTS_LIST` in the desktop
+ * one); the unsuffixed library is the portable fallback.
+ *
+ * For per-variant throughput comparisons, set the system property [VARIANT_PROPERTY] to a suffix
+ * (or to `none` for the baseline) before the library is first used, run the library's benchmark,
+ * and record [loadedLibrary] next to the result.
+ */
+object NativeLibraryLoader {
+    private const val TAG = "NativeLibraryLoader"
+
+    /** System property that forces a variant suffix instead of detecting one. */
+    const val VARIANT_PROPERTY = "llmedge.nativeVariant"
+
+    private val loaded = mutableMapOf<String, String>()
+
+    /**
+     * Loads the best available variant of [baseName] and returns the library name that was
+     * loaded. Later calls for the same [baseName] return the first result without reloading.
+     *
+     * @throws UnsatisfiedLinkError if neither a variant nor the baseline library can be loaded.
+     */
+    @Synchronized
+    fun load(baseName: String): String {
+        loaded[baseName]?.let {
+            return it
+        }
+        val forced = System.getProperty(VARIANT_PROPERTY)
+        val suffixes =
+                when {
+                    forced.isNullOrBlank() -> detectVariants()
+                    forced == "none" -> emptyList()
+                    else -> listOf(forced)
+                }
+        for (suffix in suffixes) {
+            val name = "${baseName}_$suffix"
+            try {
+                System.loadLibrary(name)
+                log("Loaded lib$name.so")
+                loaded[baseName] = name
+                return name
+            } catch (e: UnsatisfiedLinkError) {
+                log("lib$name.so not available: ${e.message}")
+            }
+        }
+        System.loadLibrary(baseName)
+        log("Loaded lib$baseName.so")
+        loaded[baseName] = baseName
+        return baseName
+    }
+
+    /** Returns the library loaded for [baseName], or null if [load] has not succeeded for it. */
+    @Synchronized fun loadedLibrary(baseName: String): String? = loaded[baseName]
+
+    /**
+     * Variant suffixes an arm64 CPU with the given `/proc/cpuinfo` feature flags can run, best
+     * first. Mirrors the selection SmolLM has always used for its `smollm_*` builds.
+     */
+    fun arm64Variants(features: Set<String>): List<String> {
+        val hasFp16 = "fp16" in features || "fphp" in features
+        val hasDotProd = "dotprod" in features || "asimddp" in features
+        val hasSve = "sve" in features
+        val hasI8mm = "i8mm" in features
+        val isAtLeastArmV82 = "asimd" in features && "crc32" in features && "aes" in features
+        val isAtLeastArmV84 = "dcpop" in features && "uscat" in features
+
+        val variants = mutableListOf<String>()
+        if (isAtLeastArmV84 && hasFp16 && hasDotProd) {
+            if (hasSve && hasI8mm) variants += "v8_4_fp16_dotprod_i8mm_sve"
+            if (hasSve) variants += "v8_4_fp16_dotprod_sve"
+            if (hasI8mm) variants += "v8_4_fp16_dotprod_i8mm"
+            variants += "v8_4_fp16_dotprod"
+        }
+        if ((isAtLeastArmV82 || isAtLeastArmV84) && hasFp16) {
+            if (hasDotProd) variants += "v8_2_fp16_dotprod"
+            variants += "v8_2_fp16"
+        }
+        variants += "v8"
+        return variants
+    }
+
+    /** Variant suffixes an x86-64 CPU with the given `/proc/cpuinfo` flags can run, best first. */
+    fun x86Variants(flags: Set<String>): List<String> {
+        val hasAvx2 = listOf("avx2", "fma", "f16c", "bmi2").all { it in flags }
+        val hasAvx512 =
+                hasAvx2 &&
+                        listOf("avx512f", "avx512cd", "avx512vl", "avx512dq", "avx512bw").all {
+                            it in flags
+                        }
+        return when {
+            hasAvx512 -> listOf("avx512", "avx2")
+            hasAvx2 -> listOf("avx2")
+            else -> emptyList()
+        }
+    }
+
+    /**
+     * Parses the first `Features` (arm) or `flags` (x86) line of `/proc/cpuinfo` content into a
+     * set of feature names.
+     */
+    fun parseCpuFeatures(cpuInfo: String): Set<String> {
+        val line =
+                cpuInfo.lineSequence().firstOrNull {
+                    val key = it.substringBefore(":").trim()
+                    it.contains(":") && (key == "Features" || key == "flags")
+                }
+                        ?: return emptySet()
+        return line.substringAfter(":").trim().split(Regex("\\s+")).filter { it.isNotEmpty() }.toSet()
+    }
+
+    private fun detectVariants(): List<String> {
+        val features =
+                try {
+                    parseCpuFeatures(File("/proc/cpuinfo").readText())
+                } catch (e: Exception) {
+                    emptySet()
+                }
+        if (!isAndroid()) {
+            val arch = System.getProperty("os.arch")?.lowercase() ?: ""
+            return if (arch == "amd64" || arch == "x86_64") x86Variants(features) else emptyList()
+        }
+        // Check if the app is running in an emulated device
+        // Note, this is not the OFFICIAL way to check if the app is running on an emulator
+        val isEmulated = Build.HARDWARE.contains("goldfish") || Build.HARDWARE.contains("ranchu")
+        log("CPU features: ${features.joinToString(" ")}; isEmulated: $isEmulated")
+        return when {
+            isEmulated -> emptyList()
+            Build.SUPPORTED_ABIS[0].equals("arm64-v8a") -> arm64Variants(features)
+            Build.SUPPORTED_32_BIT_ABIS.firstOrNull() == "armeabi-v7a" -> listOf("v7a")
+            else -> emptyList()
+        }
+    }
+
+    private fun isAndroid(): Boolean =
+            System.getProperty("java.vm.name")?.contains("Dalvik", ignoreCase = true) == true ||
+                    System.getProperty("java.vendor")?.contains("Android", ignoreCase = true) == true
+
+    private fun log(message: String) {
+        if (isAndroid()) {
+            try {
+                val logClass = Class.forName("android.util.Log")
+                logClass.getMethod("d", String::class.java, String::class.java).invoke(null, TAG, message)
+                return
+            } catch (_: Throwable) {}
+        }
+        println("D/$TAG: $message")
+    }
+}
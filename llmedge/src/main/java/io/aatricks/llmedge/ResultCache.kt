@@ -0,0 +1,246 @@
+/*
+ * Copyright (C) 2024 LLMEdge Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package io.aatricks.llmedge
+
+import java.io.File
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+
+/**
+ * On-disk cache of results that are a pure function of their inputs.
+ *
+ * A result is stored under the SHA-256 of its kind, the identity of every model file involved
+ * (size plus a digest of the file's head and tail, so the path does not matter), the canonical
+ * generation parameters and the input bytes. A lookup only hashes the inputs and reads one file,
+ * so [LLMEdgeManager] checks the cache before it loads a model: temperature-0 text, seeded
+ * images and speech, and transcripts of audio it has seen before come back without touching one.
+ *
+ * The cache is off until [configure] is called.
+ *
+ * Example usage:
+ * ```kotlin
+ * ResultCache.configure(File(context.cacheDir, "results"), maxBytes = 256L shl 20)
+ * val text = LLMEdgeManager.generateText(context, TextGenerationParams(prompt, temperature = 0f))
+ * Log.d("cache", "hit rate: ${ResultCache.getStats()?.hitRate}")
+ * ```
+ *
+ * The native store lives in the smollm library.
+ */
+object ResultCache {
+    private const val LOG_TAG = "ResultCache"
+
+    // Bumped when an encoding below changes, so old entries are no longer found.
+    private const val FORMAT_VERSION = 1
+
+    enum class Kind(internal val id: String) {
+        TEXT("text"),
+        IMAGE("image"),
+        TRANSCRIPTION("transcription"),
+        SPEECH("speech"),
+    }
+
+    /**
+     * @property hits Lookups that found a result.
+     * @property misses Lookups that did not.
+     * @property stores Results written.
+     * @property evictions Results deleted to stay under the byte budget.
+     * @property entries Results currently stored.
+     * @property storedBytes Their total size on disk.
+     */
+    data class Stats(
+            val hits: Long,
+            val misses: Long,
+            val stores: Long,
+            val evictions: Long,
+            val entries: Long,
+            val storedBytes: Long,
+    ) {
+        val hitRate: Float
+            get() = if (hits + misses == 0L) 0f else hits.toFloat() / (hits + misses)
+    }
+
+    /** A decoded image result. */
+    internal class Image(val width: Int, val height: Int, val rgb: ByteArray)
+
+    private val nativeAvailable: Boolean by lazy {
+        if (java.lang.Boolean.getBoolean("llmedge.disableNativeLoad")) {
+            false
+        } else {
+            try {
+                NativeLibraryLoader.load("smollm")
+                true
+            } catch (e: UnsatisfiedLinkError) {
+                println("W/$LOG_TAG: Result cache is not available: ${e.message}")
+                false
+            }
+        }
+    }
+
+    @Volatile private var enabled = false
+
+    /**
+     * Stores results under [directory], keeping at most [maxBytes] on disk by evicting the least
+     * recently used ones. Results already in [directory] are reused. A null directory or a
+     * budget of 0 turns the cache off.
+     */
+    fun configure(directory: File?, maxBytes: Long) {
+        if (!nativeAvailable) return
+        directory?.mkdirs()
+        nativeConfigure(directory?.absolutePath, maxBytes)
+        enabled = directory != null && maxBytes > 0
+    }
+
+    /** Whether [configure] turned the cache on. */
+    val isEnabled: Boolean
+        get() = enabled
+
+    /**
+     * Key of the result of [kind] produced by [modelFiles] from [input] under [params], or null
+     * if the cache is off or a model file cannot be read.
+     */
+    fun key(
+            kind: Kind,
+            modelFiles: List<File>,
+            params: Map<String, Any?>,
+            input: ByteArray
+    ): String? {
+        if (!enabled) return null
+        return nativeKey(
+                kind.id,
+                modelFiles.map { it.absolutePath }.toTypedArray(),
+                canonicalParams(params),
+                input
+        )
+    }
+
+    /** The result stored under [key], or null. */
+    fun get(key: String): ByteArray? = if (enabled) nativeGet(key) else null
+
+    fun put(key: String, value: ByteArray) {
+        if (enabled) nativePut(key, value)
+    }
+
+    /** Counters of the store, or null if the cache is off. */
+    fun getStats(): Stats? {
+        if (!enabled) return null
+        val values = nativeGetStats() ?: return null
+        return Stats(values[0], values[1], values[2], values[3], values[4], values[5])
+    }
+
+    /** One `name=value` line per parameter, sorted by name, so map order does not matter. */
+    internal fun canonicalParams(params: Map<String, Any?>): String =
+            buildString {
+                append("format=").append(FORMAT_VERSION).append('\n')
+                params.toSortedMap().forEach { (name, value) ->
+                    append(name).append('=').append(value ?: "null").append('\n')
+                }
+            }
+
+    internal fun encodeText(text: String): ByteArray = text.toByteArray(Charsets.UTF_8)
+
+    internal fun decodeText(bytes: ByteArray): String = String(bytes, Charsets.UTF_8)
+
+    internal fun floatsToBytes(samples: FloatArray): ByteArray {
+        val buffer = ByteBuffer.allocate(samples.size * 4).order(ByteOrder.LITTLE_ENDIAN)
+        buffer.asFloatBuffer().put(samples)
+        return buffer.array()
+    }
+
+    internal fun encodeImage(width: Int, height: Int, rgb: ByteArray): ByteArray {
+        val buffer = ByteBuffer.allocate(8 + rgb.size).order(ByteOrder.LITTLE_ENDIAN)
+        buffer.putInt(width).putInt(height).put(rgb)
+        return buffer.array()
+    }
+
+    internal fun decodeImage(bytes: ByteArray): Image? {
+        if (bytes.size < 8) return null
+        val buffer = ByteBuffer.wrap(bytes).order(ByteOrder.LITTLE_ENDIAN)
+        val width = buffer.int
+        val height = buffer.int
+        if (width <= 0 || height <= 0 || width.toLong() * height * 3 != buffer.remaining().toLong()
+        ) {
+            return null
+        }
+        val rgb = ByteArray(buffer.remaining())
+        buffer.get(rgb)
+        return Image(width, height, rgb)
+    }
+
+    internal fun encodeSegments(segments: List<Whisper.TranscriptionSegment>): ByteArray {
+        val texts = segments.map { it.text.toByteArray(Charsets.UTF_8) }
+        val size = 4 + texts.sumOf { 4 + 8 + 8 + 4 + it.size }
+        val buffer = ByteBuffer.allocate(size).order(ByteOrder.LITTLE_ENDIAN)
+        buffer.putInt(segments.size)
+        segments.forEachIndexed { i, segment ->
+            buffer.putInt(segment.index).putLong(segment.startTime).putLong(segment.endTime)
+            buffer.putInt(texts[i].size).put(texts[i])
+        }
+        return buffer.array()
+    }
+
+    internal fun decodeSegments(bytes: ByteArray): List<Whisper.TranscriptionSegment>? =
+            try {
+                val buffer = ByteBuffer.wrap(bytes).order(ByteOrder.LITTLE_ENDIAN)
+                val count = buffer.int
+                require(count >= 0 && count <= buffer.remaining() / 24)
+                List(count) {
+                    val index = buffer.int
+                    val start = buffer.long
+                    val end = buffer.long
+                    val text = ByteArray(buffer.int)
+                    buffer.get(text)
+                    Whisper.TranscriptionSegment(index, start, end, String(text, Charsets.UTF_8))
+                }
+            } catch (e: RuntimeException) {
+                // truncated or from an older encoding
+                null
+            }
+
+    internal fun encodeAudio(audio: BarkTTS.AudioResult): ByteArray {
+        val buffer =
+                ByteBuffer.allocate(8 + audio.samples.size * 4).order(ByteOrder.LITTLE_ENDIAN)
+        buffer.putInt(audio.sampleRate).putFloat(audio.durationSeconds)
+        buffer.asFloatBuffer().put(audio.samples)
+        return buffer.array()
+    }
+
+    internal fun decodeAudio(bytes: ByteArray): BarkTTS.AudioResult? {
+        if (bytes.size < 8 || (bytes.size - 8) % 4 != 0) return null
+        val buffer = ByteBuffer.wrap(bytes).order(ByteOrder.LITTLE_ENDIAN)
+        val sampleRate = buffer.int
+        val durationSeconds = buffer.float
+        val samples = FloatArray(buffer.remaining() / 4)
+        buffer.asFloatBuffer().get(samples)
+        return BarkTTS.AudioResult(samples, sampleRate, durationSeconds)
+    }
+
+    @JvmStatic private external fun nativeConfigure(directory: String?, budgetBytes: Long)
+
+    @JvmStatic
+    private external fun nativeKey(
+            kind: String,
+            modelPaths: Array<String>,
+            params: String,
+            input: ByteArray
+    ): String?
+
+    @JvmStatic private external fun nativeGet(key: String): ByteArray?
+
+    @JvmStatic private external fun nativePut(key: String, value: ByteArray)
+
+    @JvmStatic private external fun nativeGetStats(): LongArray?
+}
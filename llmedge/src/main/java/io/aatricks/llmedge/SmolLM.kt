@@ -17,7 +17,6 @@
 package io.aatricks.llmedge
 
 import android.content.Context
-import android.os.Build
 import android.util.Log
 import io.aatricks.llmedge.huggingface.HuggingFaceHub
 import java.io.File
@@ -42,6 +41,7 @@ class SmolLM(useVulkan: Boolean = true) : AutoCloseable {
                 temperature: Float,
                 storeChats: Boolean,
                 contextSize: Long,
+                initialContextSize: Long,
                 chatTemplate: String,
                 nThreads: Int,
                 useMmap: Boolean,
@@ -72,11 +72,83 @@ class SmolLM(useVulkan: Boolean = true) : AutoCloseable {
         fun startCompletion(instance: SmolLM, modelPtr: Long, prompt: String)
         fun completionLoop(instance: SmolLM, modelPtr: Long): String
         fun stopCompletion(instance: SmolLM, modelPtr: Long)
+        fun setGrammar(instance: SmolLM, modelPtr: Long, grammar: String?, isJsonSchema: Boolean) {}
+        fun getGrammarStats(instance: SmolLM, modelPtr: Long): LongArray? = null
+        fun tokenize(instance: SmolLM, modelPtr: Long, text: String): IntArray? = null
+        fun setAllowedTokens(instance: SmolLM, modelPtr: Long, tokens: IntArray?, validate: Boolean) {}
+        fun getRestrictedHeadStats(instance: SmolLM, modelPtr: Long): LongArray? = null
+        fun clearHistory(instance: SmolLM, modelPtr: Long) {}
+        fun getContextStats(instance: SmolLM, modelPtr: Long): LongArray? = null
+        fun getPagingStats(instance: SmolLM, modelPtr: Long): LongArray? = null
+        fun encodePassage(instance: SmolLM, modelPtr: Long, text: String): ByteArray? = null
+        fun startCompletionWithPassages(
+                instance: SmolLM,
+                modelPtr: Long,
+                query: String,
+                passages: Array<ByteArray>,
+                gaps: Array<String>,
+                recomputeRatio: Float
+        ) {}
+        fun getPassageStats(instance: SmolLM, modelPtr: Long): LongArray? = null
+        fun compressContext(
+                instance: SmolLM,
+                modelPtr: Long,
+                query: String,
+                context: String,
+                targetRatio: Float
+        ): String? = context
+        fun getCompressionStats(instance: SmolLM, modelPtr: Long): LongArray? = null
+        fun setLoopPolicy(
+                instance: SmolLM,
+                modelPtr: Long,
+                action: Int,
+                maxPeriod: Int,
+                minRepeats: Int,
+                minSpan: Int,
+                plateauWindow: Int,
+                plateauEntropy: Float,
+                maxNudges: Int
+        ) {}
+        fun getLoopStats(instance: SmolLM, modelPtr: Long): LongArray? = null
+        fun setDeadline(instance: SmolLM, modelPtr: Long, budgetMicros: Long) {}
+        fun getDeadlineStats(instance: SmolLM, modelPtr: Long): LongArray? = null
+        fun setConfidencePolicy(
+                instance: SmolLM,
+                modelPtr: Long,
+                enabled: Boolean,
+                window: Int,
+                minTokens: Int,
+                maxTokens: Int,
+                maxMeanEntropy: Float,
+                minMargin: Float,
+                maxLowMarginFraction: Float
+        ) {}
+        fun getCascadeStats(instance: SmolLM, modelPtr: Long): LongArray? = null
+        fun startCompletionFrom(instance: SmolLM, modelPtr: Long, sourcePtr: Long, query: String): Boolean {
+            startCompletion(instance, modelPtr, query)
+            return false
+        }
+        fun setCompactionPolicy(
+                instance: SmolLM,
+                modelPtr: Long,
+                enabled: Boolean,
+                triggerTokens: Int,
+                keepRecentTurns: Int,
+                summaryTokens: Int,
+                idleMillis: Int,
+                nThreads: Int
+        ) {}
+        fun compactHistory(instance: SmolLM, modelPtr: Long): Boolean = false
+        fun getCompactionStats(instance: SmolLM, modelPtr: Long): LongArray? = null
     }
     companion object {
         private const val LOG_TAG = "SmolLM"
         private const val DEFAULT_CONTEXT_SIZE_CAP: Long = 8_192L
         private const val MIN_CONTEXT_SIZE: Long = 1_024L
+        private const val DEFAULT_INITIAL_CONTEXT_SIZE: Long = 512L
+
+        /** Placeholder for the passages in the query of [getResponseWithPassages]. */
+        const val PASSAGE_MARKER = "<|llmedge:passages|>"
         private const val DEFAULT_REASONING_BUDGET: Int = -1
 
         private val isAndroidLogAvailable: Boolean =
@@ -158,98 +230,11 @@ class SmolLM(useVulkan: Boolean = true) : AutoCloseable {
             if (disableNativeLoad) {
                 println("[SmolLM] Native library load disabled via llmedge.disableNativeLoad=true")
             } else {
-                // check if the following CPU features are available,
-                // and load the native library accordingly
-                val cpuFeatures = getCPUFeatures()
-                val hasFp16 = cpuFeatures.contains("fp16") || cpuFeatures.contains("fphp")
-                val hasDotProd = cpuFeatures.contains("dotprod") || cpuFeatures.contains("asimddp")
-                val hasSve = cpuFeatures.contains("sve")
-                val hasI8mm = cpuFeatures.contains("i8mm")
-                val isAtLeastArmV82 =
-                        cpuFeatures.contains("asimd") &&
-                                cpuFeatures.contains("crc32") &&
-                                cpuFeatures.contains(
-                                        "aes",
-                                )
-                val isAtLeastArmV84 = cpuFeatures.contains("dcpop") && cpuFeatures.contains("uscat")
-
-                logD(logTag, "CPU features: $cpuFeatures")
-                logD(logTag, "- hasFp16: $hasFp16")
-                logD(logTag, "- hasDotProd: $hasDotProd")
-                logD(logTag, "- hasSve: $hasSve")
-                logD(logTag, "- hasI8mm: $hasI8mm")
-                logD(logTag, "- isAtLeastArmV82: $isAtLeastArmV82")
-                logD(logTag, "- isAtLeastArmV84: $isAtLeastArmV84")
-
-                // Check if the app is running in an emulated device
-                // Note, this is not the OFFICIAL way to check if the app is running
-                // on an emulator
-                val isEmulated =
-                        (Build.HARDWARE.contains("goldfish") || Build.HARDWARE.contains("ranchu"))
-                logD(logTag, "isEmulated: $isEmulated")
-
-                if (!isEmulated) {
-                    if (supportsArm64V8a()) {
-                        if (isAtLeastArmV84 && hasSve && hasI8mm && hasFp16 && hasDotProd) {
-                            logD(logTag, "Loading libsmollm_v8_4_fp16_dotprod_i8mm_sve.so")
-                            System.loadLibrary("smollm_v8_4_fp16_dotprod_i8mm_sve")
-                        } else if (isAtLeastArmV84 && hasSve && hasFp16 && hasDotProd) {
-                            logD(logTag, "Loading libsmollm_v8_4_fp16_dotprod_sve.so")
-                            System.loadLibrary("smollm_v8_4_fp16_dotprod_sve")
-                        } else if (isAtLeastArmV84 && hasI8mm && hasFp16 && hasDotProd) {
-                            logD(logTag, "Loading libsmollm_v8_4_fp16_dotprod_i8mm.so")
-                            System.loadLibrary("smollm_v8_4_fp16_dotprod_i8mm")
-                        } else if (isAtLeastArmV84 && hasFp16 && hasDotProd) {
-                            logD(logTag, "Loading libsmollm_v8_4_fp16_dotprod.so")
-                            System.loadLibrary("smollm_v8_4_fp16_dotprod")
-                        } else if (isAtLeastArmV82 && hasFp16 && hasDotProd) {
-                            logD(logTag, "Loading libsmollm_v8_2_fp16_dotprod.so")
-                            System.loadLibrary("smollm_v8_2_fp16_dotprod")
-                        } else if (isAtLeastArmV82 && hasFp16) {
-                            logD(logTag, "Loading libsmollm_v8_2_fp16.so")
-                            System.loadLibrary("smollm_v8_2_fp16")
-                        } else {
-                            logD(logTag, "Loading libsmollm_v8.so")
-                            System.loadLibrary("smollm_v8")
-                        }
-                    } else if (Build.SUPPORTED_32_BIT_ABIS[0]?.equals("armeabi-v7a") == true) {
-                        // armv7a (32bit) device
-                        logD(logTag, "Loading libsmollm_v7a.so")
-                        System.loadLibrary("smollm_v7a")
-                    } else {
-                        logD(logTag, "Loading default libsmollm.so")
-                        System.loadLibrary("smollm")
-                    }
-                } else {
-                    // load the default native library with no ARM
-                    // specific instructions
-                    logD(logTag, "Loading default libsmollm.so")
-                    System.loadLibrary("smollm")
-                }
+                // loads the smollm_* build matching the CPU features (dotprod, i8mm, SVE, ...)
+                logD(logTag, "Loaded lib${NativeLibraryLoader.load("smollm")}.so")
             }
         }
 
-        /**
-         * Reads the /proc/cpuinfo file and returns the line starting with 'Features :' that
-         * containing the available CPU features
-         */
-        private fun getCPUFeatures(): String {
-            val cpuInfo =
-                    try {
-                        File("/proc/cpuinfo").readText()
-                    } catch (e: FileNotFoundException) {
-                        ""
-                    }
-            val cpuFeatures =
-                    cpuInfo.substringAfter("Features")
-                            .substringAfter(":")
-                            .substringBefore("\n")
-                            .trim()
-            return cpuFeatures
-        }
-
-        private fun supportsArm64V8a(): Boolean = Build.SUPPORTED_ABIS[0].equals("arm64-v8a")
-
         private val defaultNativeBridgeProvider: (SmolLM) -> NativeBridge = { instance ->
             object : NativeBridge {
                 override fun loadModel(
@@ -259,6 +244,7 @@ class SmolLM(useVulkan: Boolean = true) : AutoCloseable {
                         temperature: Float,
                         storeChats: Boolean,
                         contextSize: Long,
+                        initialContextSize: Long,
                         chatTemplate: String,
                         nThreads: Int,
                         useMmap: Boolean,
@@ -271,6 +257,7 @@ class SmolLM(useVulkan: Boolean = true) : AutoCloseable {
                                 temperature,
                                 storeChats,
                                 contextSize,
+                                initialContextSize,
                                 chatTemplate,
                                 nThreads,
                                 useMmap,
@@ -326,6 +313,129 @@ class SmolLM(useVulkan: Boolean = true) : AutoCloseable {
                         instance.completionLoop(modelPtr)
                 override fun stopCompletion(instance: SmolLM, modelPtr: Long) =
                         instance.stopCompletion(modelPtr)
+                override fun setGrammar(
+                        instance: SmolLM,
+                        modelPtr: Long,
+                        grammar: String?,
+                        isJsonSchema: Boolean
+                ) = instance.nativeSetGrammar(modelPtr, grammar, isJsonSchema)
+                override fun getGrammarStats(instance: SmolLM, modelPtr: Long): LongArray? =
+                        instance.nativeGetGrammarStats(modelPtr)
+                override fun tokenize(instance: SmolLM, modelPtr: Long, text: String): IntArray? =
+                        instance.nativeTokenize(modelPtr, text)
+                override fun setAllowedTokens(
+                        instance: SmolLM,
+                        modelPtr: Long,
+                        tokens: IntArray?,
+                        validate: Boolean
+                ) = instance.nativeSetAllowedTokens(modelPtr, tokens, validate)
+                override fun getRestrictedHeadStats(instance: SmolLM, modelPtr: Long): LongArray? =
+                        instance.nativeGetRestrictedHeadStats(modelPtr)
+                override fun clearHistory(instance: SmolLM, modelPtr: Long) =
+                        instance.nativeClearHistory(modelPtr)
+                override fun getContextStats(instance: SmolLM, modelPtr: Long): LongArray? =
+                        instance.nativeGetContextStats(modelPtr)
+                override fun getPagingStats(instance: SmolLM, modelPtr: Long): LongArray? =
+                        instance.nativeGetPagingStats(modelPtr)
+                override fun encodePassage(instance: SmolLM, modelPtr: Long, text: String): ByteArray? =
+                        instance.nativeEncodePassage(modelPtr, text)
+                override fun startCompletionWithPassages(
+                        instance: SmolLM,
+                        modelPtr: Long,
+                        query: String,
+                        passages: Array<ByteArray>,
+                        gaps: Array<String>,
+                        recomputeRatio: Float
+                ) = instance.nativeStartCompletionWithPassages(modelPtr, query, passages, gaps, recomputeRatio)
+                override fun getPassageStats(instance: SmolLM, modelPtr: Long): LongArray? =
+                        instance.nativeGetPassageStats(modelPtr)
+                override fun compressContext(
+                        instance: SmolLM,
+                        modelPtr: Long,
+                        query: String,
+                        context: String,
+                        targetRatio: Float
+                ): String? = instance.nativeCompressContext(modelPtr, query, context, targetRatio)
+                override fun getCompressionStats(instance: SmolLM, modelPtr: Long): LongArray? =
+                        instance.nativeGetCompressionStats(modelPtr)
+                override fun setLoopPolicy(
+                        instance: SmolLM,
+                        modelPtr: Long,
+                        action: Int,
+                        maxPeriod: Int,
+                        minRepeats: Int,
+                        minSpan: Int,
+                        plateauWindow: Int,
+                        plateauEntropy: Float,
+                        maxNudges: Int
+                ) = instance.nativeSetLoopPolicy(
+                        modelPtr,
+                        action,
+                        maxPeriod,
+                        minRepeats,
+                        minSpan,
+                        plateauWindow,
+                        plateauEntropy,
+                        maxNudges
+                )
+                override fun getLoopStats(instance: SmolLM, modelPtr: Long): LongArray? =
+                        instance.nativeGetLoopStats(modelPtr)
+                override fun setDeadline(instance: SmolLM, modelPtr: Long, budgetMicros: Long) =
+                        instance.nativeSetDeadline(modelPtr, budgetMicros)
+                override fun getDeadlineStats(instance: SmolLM, modelPtr: Long): LongArray? =
+                        instance.nativeGetDeadlineStats(modelPtr)
+                override fun setConfidencePolicy(
+                        instance: SmolLM,
+                        modelPtr: Long,
+                        enabled: Boolean,
+                        window: Int,
+                        minTokens: Int,
+                        maxTokens: Int,
+                        maxMeanEntropy: Float,
+                        minMargin: Float,
+                        maxLowMarginFraction: Float
+                ) =
+                        instance.nativeSetConfidencePolicy(
+                                modelPtr,
+                                enabled,
+                                window,
+                                minTokens,
+                                maxTokens,
+                                maxMeanEntropy,
+                                minMargin,
+                                maxLowMarginFraction
+                        )
+                override fun getCascadeStats(instance: SmolLM, modelPtr: Long): LongArray? =
+                        instance.nativeGetCascadeStats(modelPtr)
+                override fun startCompletionFrom(
+                        instance: SmolLM,
+                        modelPtr: Long,
+                        sourcePtr: Long,
+                        query: String
+                ): Boolean = instance.nativeStartCompletionFrom(modelPtr, sourcePtr, query)
+                override fun setCompactionPolicy(
+                        instance: SmolLM,
+                        modelPtr: Long,
+                        enabled: Boolean,
+                        triggerTokens: Int,
+                        keepRecentTurns: Int,
+                        summaryTokens: Int,
+                        idleMillis: Int,
+                        nThreads: Int
+                ) =
+                        instance.nativeSetCompactionPolicy(
+                                modelPtr,
+                                enabled,
+                                triggerTokens,
+                                keepRecentTurns,
+                                summaryTokens,
+                                idleMillis,
+                                nThreads
+                        )
+                override fun compactHistory(instance: SmolLM, modelPtr: Long): Boolean =
+                        instance.nativeCompactHistory(modelPtr)
+                override fun getCompactionStats(instance: SmolLM, modelPtr: Long): LongArray? =
+                        instance.nativeGetCompactionStats(modelPtr)
             }
         }
 
@@ -345,6 +455,26 @@ class SmolLM(useVulkan: Boolean = true) : AutoCloseable {
             s.nativePtr = nativePtr
             return s
         }
+
+        /**
+         * Keeps the KV caches of all loaded models within [ramBudgetBytes]. When the budget is
+         * exceeded, the least recently used idle sessions are written to memory-mapped files under
+         * [directory] and their contexts freed. The next [addUserMessage] (or any other use) maps
+         * the state back, which is much cheaper than processing the conversation again. Pass a
+         * null directory to stop paging.
+         */
+        @JvmStatic
+        fun configureSessionPaging(directory: File?, ramBudgetBytes: Long) {
+            directory?.mkdirs()
+            try {
+                nativeConfigureSessionPaging(directory?.absolutePath, ramBudgetBytes)
+            } catch (e: UnsatisfiedLinkError) {
+                logW(LOG_TAG, "Session paging is not available: ${e.message}")
+            }
+        }
+
+        @JvmStatic
+        private external fun nativeConfigureSessionPaging(directory: String?, ramBudgetBytes: Long)
     }
 
     private var nativePtr = 0L
@@ -352,6 +482,10 @@ class SmolLM(useVulkan: Boolean = true) : AutoCloseable {
     private var useVulkanGPU = true
     private var currentThinkingMode = ThinkingMode.DEFAULT
     private var currentReasoningBudget = DEFAULT_REASONING_BUDGET
+    private var loopTokensSaved = 0L
+    // true if the last response was abandoned by the confidence policy, see [ModelCascade]
+    internal var lastResponseEscalated = false
+        private set
 
     init {
         this.useVulkanGPU = useVulkan
@@ -405,6 +539,9 @@ class SmolLM(useVulkan: Boolean = true) : AutoCloseable {
      *                       of the previous conversation the LLM can "remember". If null, the
      *                       value from the GGUF model file will be used, or a default value if
      *                       not present in the model file. (Default: null)
+     * @property initialContextSize KV cache cells allocated at load. The cache doubles as the
+     * conversation grows, up to [contextSize], without re-processing the prompt, and shrinks back on
+     * [clearHistory]. Set it to [contextSize] to allocate everything upfront. (Default: 512)
      * @property chatTemplate
      * ```
      * The chat template to use for formatting the conversation. This
@@ -444,6 +581,7 @@ class SmolLM(useVulkan: Boolean = true) : AutoCloseable {
             val contextSize: Long? = null,
             val chatTemplate: String? = null,
             val numThreads: Int = 4,
+            val initialContextSize: Long = DEFAULT_INITIAL_CONTEXT_SIZE,
             val useMmap: Boolean = true,
             val useMlock: Boolean = false,
             val thinkingMode: ThinkingMode = ThinkingMode.DEFAULT,
@@ -469,6 +607,290 @@ class SmolLM(useVulkan: Boolean = true) : AutoCloseable {
             get() = elapsedMicros / 1_000_000.0
     }
 
+    /**
+     * Counters of the active grammar constraint.
+     *
+     * @property maskCacheHits Decode steps whose allowed-token mask came from the cache.
+     * @property maskCacheMisses Decode steps that walked the vocabulary through the grammar.
+     * @property constraintMicros Time spent masking and advancing the grammar.
+     */
+    data class GrammarStats(
+            val maskCacheHits: Long,
+            val maskCacheMisses: Long,
+            val constraintMicros: Long,
+    ) {
+        val maskCacheHitRate: Float
+            get() {
+                val total = maskCacheHits + maskCacheMisses
+                return if (total == 0L) 0f else maskCacheHits.toFloat() / total
+            }
+    }
+
+    /**
+     * Counters of the restricted-vocabulary output head.
+     *
+     * @property restrictedSteps Decode steps sampled from the allowed subset.
+     * @property validatedSteps Steps checked against the full-vocabulary logits.
+     * @property argmaxMismatches Validated steps whose restricted argmax differed from the full
+     * logits' argmax over the same subset.
+     * @property argmaxOutsideSubset Validated steps whose unrestricted argmax was not allowed.
+     */
+    data class RestrictedHeadStats(
+            val restrictedSteps: Long,
+            val validatedSteps: Long,
+            val argmaxMismatches: Long,
+            val argmaxOutsideSubset: Long,
+    ) {
+        val exactMatch: Boolean
+            get() = argmaxMismatches == 0L
+    }
+
+    /**
+     * Size and growth of the elastic KV cache.
+     *
+     * @property allocatedTokens KV cells currently allocated.
+     * @property maxTokens Cells the cache may grow to (the resolved context size).
+     * @property grows Times the cache was doubled.
+     * @property shrinks Times [clearHistory] released a grown cache.
+     * @property migrationMicros Time spent moving KV state between allocations.
+     * @property peakRssKb Process peak resident set size (VmHWM), 0 where unavailable.
+     * @property rssKb Process resident set size (VmRSS), 0 where unavailable.
+     */
+    data class ContextStats(
+            val allocatedTokens: Long,
+            val maxTokens: Long,
+            val grows: Long,
+            val shrinks: Long,
+            val migrationMicros: Long,
+            val peakRssKb: Long,
+            val rssKb: Long,
+    )
+
+    /**
+     * KV paging of this session under [configureSessionPaging].
+     *
+     * @property pageOuts Times the KV cache was written out and its context freed.
+     * @property pageIns Times it was mapped back.
+     * @property lastRestoreMicros Duration of the most recent restore.
+     * @property lastRestoredTokens Tokens of KV state brought back by that restore.
+     * @property estimatedPrefillMicros Time re-processing those tokens would have taken, from
+     * this session's measured prompt throughput (0 before the first prompt).
+     * @property isPagedOut Whether the KV cache currently lives on disk.
+     */
+    data class PagingStats(
+            val pageOuts: Long,
+            val pageIns: Long,
+            val lastRestoreMicros: Long,
+            val lastRestoredTokens: Long,
+            val estimatedPrefillMicros: Long,
+            val isPagedOut: Boolean,
+    ) {
+        val restoreSpeedup: Double
+            get() =
+                    if (lastRestoreMicros <= 0L) 0.0
+                    else estimatedPrefillMicros.toDouble() / lastRestoreMicros
+    }
+
+    /**
+     * How the prompt of the last [getResponseWithPassages] was assembled.
+     *
+     * @property reusedTokens Passage tokens taken from their precomputed KV.
+     * @property recomputedTokens Passage tokens decoded again to restore cross-passage attention.
+     * @property prefilledTokens Other prompt tokens (template, question, separators).
+     * @property assemblyMicros Time to assemble everything before the last prompt chunk.
+     */
+    data class PassageStats(
+            val reusedTokens: Long,
+            val recomputedTokens: Long,
+            val prefilledTokens: Long,
+            val assemblyMicros: Long,
+    ) {
+        val reuseFraction: Float
+            get() {
+                val total = reusedTokens + recomputedTokens + prefilledTokens
+                return if (total == 0L) 0f else reusedTokens.toFloat() / total
+            }
+    }
+
+    /**
+     * How the native decode loop reacts to repetition loops. A cycle is a run of the same
+     * [maxPeriod]-or-shorter token sequence repeated back to back; a plateau is a stretch of
+     * near-deterministic sampling over few distinct tokens.
+     *
+     * @property action What to do when a loop is detected.
+     * @property maxPeriod Longest cycle, in tokens, that is looked for.
+     * @property minRepeats Back-to-back repetitions needed before a cycle counts.
+     * @property minSpan Fewest tokens a cycle must cover, so short legitimate repeats pass.
+     * @property plateauWindow Tokens over which the sampling entropy is averaged; 0 disables
+     * plateau detection (and its per-token entropy pass over the vocabulary).
+     * @property plateauEntropy Mean entropy (nats) below which the window counts as a plateau.
+     * @property maxNudges Nudges per response before [Action.NUDGE] falls back to stopping.
+     */
+    data class LoopPolicy(
+            val action: Action = Action.STOP,
+            val maxPeriod: Int = 32,
+            val minRepeats: Int = 3,
+            val minSpan: Int = 24,
+            val plateauWindow: Int = 64,
+            val plateauEntropy: Float = 0.1f,
+            val maxNudges: Int = 2,
+    ) {
+        enum class Action {
+            /** Generate until EOS or the token limit. */
+            OFF,
+            /** End the response as if the model had emitted end-of-generation. */
+            STOP,
+            /** Ban the token that would continue the loop for one step, then keep generating. */
+            NUDGE,
+        }
+    }
+
+    /**
+     * Loop detections since the model was loaded.
+     *
+     * @property cycleDetections Repeated n-gram cycles detected.
+     * @property plateauDetections Low-entropy plateaus detected.
+     * @property stoppedResponses Responses ended early because of a loop.
+     * @property nudges Times a loop was steered off instead of stopped.
+     * @property tokensSaved Tokens not generated because responses were stopped: the rest of the
+     * `maxTokens` budget, or of the context if there was none. Counted by [getResponse] and
+     * [getResponseWithPassages].
+     */
+    data class LoopStats(
+            val cycleDetections: Long,
+            val plateauDetections: Long,
+            val stoppedResponses: Long,
+            val nudges: Long,
+            val tokensSaved: Long,
+    )
+
+    /**
+     * Outcome of the last [getResponseWithDeadline].
+     *
+     * @property deadlineMs The wall-clock budget of the response.
+     * @property elapsedMs Time from the start of the turn until the response was complete.
+     * @property droppedPromptTokens Prompt tokens dropped from the middle of the prompt because,
+     * at the measured prefill speed, the whole prompt could not have been processed in time.
+     * The chat history keeps them: the next response prefills the whole conversation again.
+     * @property stopReason Why generation ended.
+     */
+    data class DeadlineReport(
+            val deadlineMs: Long,
+            val elapsedMs: Long,
+            val droppedPromptTokens: Long,
+            val stopReason: StopReason,
+    ) {
+        enum class StopReason {
+            /** The model finished (or hit `maxTokens`) before the deadline mattered. */
+            COMPLETED,
+            /** Ended at a sentence boundary shortly before the deadline. */
+            SENTENCE_BOUNDARY,
+            /** No sentence boundary came in time; ended one token before the deadline. */
+            HARD_STOP,
+        }
+
+        /** True if the response was complete within the deadline. */
+        val met: Boolean
+            get() = elapsedMs <= deadlineMs
+
+        /** Time left at the end (negative if the deadline was missed). */
+        val slackMs: Long
+            get() = deadlineMs - elapsedMs
+    }
+
+    /**
+     * When the small model of a [ModelCascade] gives a turn up to the large one. Each sampling step
+     * is scored by the entropy of the next-token distribution and the probability margin between
+     * its two most likely tokens; the decision is made on a rolling [window] of steps.
+     *
+     * @property window Sampling steps the means are taken over.
+     * @property minTokens No decision before this many tokens (at least [window]).
+     * @property maxTokens Once this many tokens were generated confidently, the small model keeps
+     * the turn; 0 monitors the whole response.
+     * @property maxMeanEntropy Escalate when the mean entropy (nats) over the window is above this.
+     * @property minMargin A step whose top-1/top-2 margin is below this counts as low-margin.
+     * @property maxLowMarginFraction Escalate when more than this share of the window is low-margin.
+     */
+    data class ConfidencePolicy(
+            val window: Int = 16,
+            val minTokens: Int = 8,
+            val maxTokens: Int = 64,
+            val maxMeanEntropy: Float = 2.0f,
+            val minMargin: Float = 0.1f,
+            val maxLowMarginFraction: Float = 0.5f,
+    )
+
+    /**
+     * Confidence monitoring since the model was loaded.
+     *
+     * @property monitoredResponses Responses started while a [ConfidencePolicy] was set.
+     * @property escalations Responses given up to a larger model.
+     * @property tokensBeforeLastEscalation Tokens generated, then discarded, by the last escalated
+     * response.
+     * @property reusedTokenizations Escalated turns that reused the smaller model's prompt tokens.
+     * @property lastMeanEntropy Mean entropy of the last monitored response.
+     * @property lastMeanMargin Mean top-1/top-2 margin of the last monitored response.
+     */
+    data class CascadeStats(
+            val monitoredResponses: Long,
+            val escalations: Long,
+            val tokensBeforeLastEscalation: Long,
+            val reusedTokenizations: Long,
+            val lastMeanEntropy: Float,
+            val lastMeanMargin: Float,
+    )
+
+    /**
+     * When older turns of a long chat are folded into a summary (see [setHistoryCompaction]).
+     *
+     * @property triggerTokens Compact once the KV cache holds at least this many tokens.
+     * @property keepRecentTurns User turns, with their responses, that are always kept verbatim.
+     * @property summaryTokens Longest summary the model may write.
+     * @property idleMs Time without a new request after a response before compaction starts.
+     * @property threads Decode threads used while compacting; keep low so the app stays responsive.
+     */
+    data class CompactionPolicy(
+            val triggerTokens: Int = 2048,
+            val keepRecentTurns: Int = 2,
+            val summaryTokens: Int = 256,
+            val idleMs: Int = 1500,
+            val threads: Int = 1,
+    )
+
+    /**
+     * History compactions since the model was loaded.
+     *
+     * @property compactions Compactions that replaced the history.
+     * @property abandonedCompactions Compactions given up because a request came in.
+     * @property tokensBefore KV tokens before the last compaction.
+     * @property tokensAfter KV tokens after the last compaction.
+     * @property lastDurationMs Time the last compaction took.
+     */
+    data class CompactionStats(
+            val compactions: Long,
+            val abandonedCompactions: Long,
+            val tokensBefore: Long,
+            val tokensAfter: Long,
+            val lastDurationMs: Long,
+    )
+
+    /**
+     * Result of the last [compressContext].
+     *
+     * @property contextTokens Tokens in the context before compression.
+     * @property keptTokens Tokens left after dropping the least informative ones.
+     * @property scoringMicros Time spent scoring and selecting tokens.
+     */
+    data class CompressionStats(
+            val contextTokens: Long,
+            val keptTokens: Long,
+            val scoringMicros: Long,
+    ) {
+        /** Fraction of the context tokens that were kept. */
+        val ratio: Float
+            get() = if (contextTokens == 0L) 1f else keptTokens.toFloat() / contextTokens
+    }
+
     /**
      * Loads the GGUF model from the given path. This function will read the metadata from the GGUF
      * model file, such as the context size and chat template, and use them if they are not
@@ -515,6 +937,7 @@ class SmolLM(useVulkan: Boolean = true) : AutoCloseable {
                                 params.temperature,
                                 params.storeChats,
                                 resolvedContextSize,
+                                params.initialContextSize.coerceIn(1L, resolvedContextSize),
                                 resolvedChatTemplate,
                                 params.numThreads,
                                 params.useMmap,
@@ -668,8 +1091,8 @@ class SmolLM(useVulkan: Boolean = true) : AutoCloseable {
      * @param query The query to ask the LLM.
      * @return A Flow of Strings, where each String is a piece of the response.
      * ```
-     *         The flow completes when the LLM has finished generating the response.
-     *         The special token "[EOG]" (End Of Generation) indicates the end of the response.
+     *         The flow completes when the LLM has finished generating the response, or early
+     *         when a confidence policy hands the turn to a larger model (see [ModelCascade]).
      * @throws IllegalStateException
      * ```
      * if the model is not loaded.
@@ -677,13 +1100,19 @@ class SmolLM(useVulkan: Boolean = true) : AutoCloseable {
     fun getResponseAsFlow(query: String): Flow<String> =
             flow {
                         verifyHandle()
+                        lastResponseEscalated = false
                         nativeBridge.startCompletion(this@SmolLM, nativePtr, query)
-                        var piece = nativeBridge.completionLoop(this@SmolLM, nativePtr)
-                        while (piece != "[EOG]") {
-                            emit(piece) // Emit immediately for fastest TTFT
-                            piece = nativeBridge.completionLoop(this@SmolLM, nativePtr)
+                        // also stopped when the collector cancels early, e.g. through take()
+                        try {
+                            var piece = nativeBridge.completionLoop(this@SmolLM, nativePtr)
+                            while (piece != "[EOG]" && piece != "[ESCALATE]") {
+                                emit(piece) // Emit immediately for fastest TTFT
+                                piece = nativeBridge.completionLoop(this@SmolLM, nativePtr)
+                            }
+                            lastResponseEscalated = piece == "[ESCALATE]"
+                        } finally {
+                            nativeBridge.stopCompletion(this@SmolLM, nativePtr)
                         }
-                        nativeBridge.stopCompletion(this@SmolLM, nativePtr)
                     }
                     .flowOn(Dispatchers.IO) // Run on IO dispatcher for better performance
 
@@ -700,11 +1129,249 @@ class SmolLM(useVulkan: Boolean = true) : AutoCloseable {
         verifyHandle()
         logD(LOG_TAG, "getResponse: starting completion. maxTokens=$maxTokens, queryLength=${query.length}")
         nativeBridge.startCompletion(this@SmolLM, nativePtr, query)
+        return collectResponse(maxTokens)
+    }
+
+    /**
+     * Computes the KV cache of a retrieved passage on its own so it can be stored at ingest time
+     * and reused by [getResponseWithPassages] instead of prefilling the passage for every query.
+     * The result is only valid for the currently loaded model. Returns null for empty text.
+     */
+    fun encodePassage(text: String): ByteArray? {
+        verifyHandle()
+        return nativeBridge.encodePassage(this, nativePtr, text)
+    }
+
+    /**
+     * Like [getResponse], but [PASSAGE_MARKER] in [query] stands for
+     * `gaps[0] + passage[0] + gaps[1] + ... + passage[n-1] + gaps[n]`, where the passages are
+     * blobs from [encodePassage]. Their cached KV is rotated into place instead of being
+     * prefilled; the first [recomputeRatio] of each passage's tokens is decoded again so the
+     * passage still attends to the text before it.
+     *
+     * @throws IllegalArgumentException if a passage was encoded with another model.
+     */
+    fun getResponseWithPassages(
+            query: String,
+            passages: List<ByteArray>,
+            gaps: List<String>,
+            recomputeRatio: Float = 0.15f,
+            maxTokens: Int = -1,
+    ): String {
+        verifyHandle()
+        require(gaps.size == passages.size + 1) { "Expected ${passages.size + 1} gaps, got ${gaps.size}" }
+        nativeBridge.startCompletionWithPassages(
+                this,
+                nativePtr,
+                query,
+                passages.toTypedArray(),
+                gaps.toTypedArray(),
+                recomputeRatio.coerceIn(0f, 1f)
+        )
+        return collectResponse(maxTokens)
+    }
+
+    /** Returns how the last [getResponseWithPassages] prompt was assembled, or null. */
+    fun getPassageStats(): PassageStats? {
+        verifyHandle()
+        val stats = nativeBridge.getPassageStats(this, nativePtr) ?: return null
+        if (stats.size < 4) return null
+        return PassageStats(
+                reusedTokens = stats[0],
+                recomputedTokens = stats[1],
+                prefilledTokens = stats[2],
+                assemblyMicros = stats[3]
+        )
+    }
+
+    /**
+     * Shortens retrieved [context] before it is placed in another model's prompt by dropping the
+     * tokens this model finds most predictable given [query] and the text before them, until
+     * about [targetRatio] of the tokens remain. Line breaks are always kept. Intended for a small
+     * model loaded next to the one that answers; the chat history is not affected.
+     *
+     * @throws IllegalArgumentException if [targetRatio] is not in (0, 1].
+     */
+    fun compressContext(query: String, context: String, targetRatio: Float): String {
+        verifyHandle()
+        require(targetRatio > 0f && targetRatio <= 1f) { "targetRatio must be in (0, 1], got $targetRatio" }
+        return nativeBridge.compressContext(this, nativePtr, query, context, targetRatio) ?: context
+    }
+
+    /** Returns the token counts and cost of the last [compressContext], or null. */
+    fun getCompressionStats(): CompressionStats? {
+        verifyHandle()
+        val stats = nativeBridge.getCompressionStats(this, nativePtr) ?: return null
+        if (stats.size < 3) return null
+        return CompressionStats(contextTokens = stats[0], keptTokens = stats[1], scoringMicros = stats[2])
+    }
+
+    /**
+     * Like [getResponse], but the response must be complete within [deadlineMs] of this call.
+     * The native loop uses the prefill and decode speeds measured on earlier responses: a prompt
+     * that could not be processed in time loses tokens from its middle (the start and the latest
+     * turn are kept), and generation ends at a sentence boundary once the deadline is a few tokens
+     * away instead of being cut mid-word. The first response after loading has no measurements
+     * and is only stopped by the decode-time check. See [getDeadlineReport] for the outcome.
+     *
+     * @throws IllegalArgumentException if [deadlineMs] is not positive.
+     */
+    fun getResponseWithDeadline(query: String, deadlineMs: Long, maxTokens: Int = -1): String {
+        verifyHandle()
+        require(deadlineMs > 0) { "deadlineMs must be positive, got $deadlineMs" }
+        nativeBridge.setDeadline(this, nativePtr, deadlineMs * 1000)
+        nativeBridge.startCompletion(this, nativePtr, query)
+        return collectResponse(maxTokens)
+    }
+
+    /** Returns whether the last [getResponseWithDeadline] met its deadline, or null. */
+    fun getDeadlineReport(): DeadlineReport? {
+        verifyHandle()
+        val stats = nativeBridge.getDeadlineStats(this, nativePtr) ?: return null
+        if (stats.size < 4 || stats[0] <= 0) return null
+        return DeadlineReport(
+                deadlineMs = stats[0] / 1000,
+                elapsedMs = stats[1] / 1000,
+                droppedPromptTokens = stats[2],
+                stopReason = DeadlineReport.StopReason.values()[stats[3].toInt().coerceIn(0, 2)]
+        )
+    }
+
+    /**
+     * Sets how repetition loops are handled from the next response on. Loop detection is off
+     * until this is called.
+     */
+    fun setLoopPolicy(policy: LoopPolicy) {
+        verifyHandle()
+        nativeBridge.setLoopPolicy(
+                this,
+                nativePtr,
+                policy.action.ordinal,
+                policy.maxPeriod,
+                policy.minRepeats,
+                policy.minSpan,
+                policy.plateauWindow,
+                policy.plateauEntropy,
+                policy.maxNudges
+        )
+    }
+
+    /** Returns loop detection counts and the tokens saved by stopping loops, or null. */
+    fun getLoopStats(): LoopStats? {
+        verifyHandle()
+        val stats = nativeBridge.getLoopStats(this, nativePtr) ?: return null
+        if (stats.size < 4) return null
+        return LoopStats(
+                cycleDetections = stats[0],
+                plateauDetections = stats[1],
+                stoppedResponses = stats[2],
+                nudges = stats[3],
+                tokensSaved = loopTokensSaved
+        )
+    }
+
+    /**
+     * Monitors the confidence of every response from now on, or stops monitoring if [policy] is
+     * null. A response that trips the policy ends early and [getResponse] returns what was
+     * generated so far; the turn is removed from the history. Normally set by [ModelCascade].
+     */
+    fun setConfidencePolicy(policy: ConfidencePolicy?) {
+        verifyHandle()
+        val p = policy ?: ConfidencePolicy()
+        nativeBridge.setConfidencePolicy(
+                this,
+                nativePtr,
+                policy != null,
+                p.window,
+                p.minTokens,
+                p.maxTokens,
+                p.maxMeanEntropy,
+                p.minMargin,
+                p.maxLowMarginFraction
+        )
+    }
+
+    /**
+     * Keeps long chats short: once the model has been idle for [CompactionPolicy.idleMs] after a
+     * response and the conversation exceeds [CompactionPolicy.triggerTokens], a native background
+     * thread asks this model to summarize all but the most recent turns, appends the summary to
+     * the system prompt and rebuilds the KV cache from [system + summary + recent turns]. A new
+     * request abandons a compaction in progress, so it is never waited on for long. Null turns
+     * compaction off. Has no effect unless chats are stored.
+     */
+    fun setHistoryCompaction(policy: CompactionPolicy?) {
+        verifyHandle()
+        val p = policy ?: CompactionPolicy()
+        nativeBridge.setCompactionPolicy(
+                this,
+                nativePtr,
+                policy != null,
+                p.triggerTokens,
+                p.keepRecentTurns,
+                p.summaryTokens,
+                p.idleMs,
+                p.threads
+        )
+    }
+
+    /**
+     * Compacts the history now on the calling thread, using the last [CompactionPolicy] (or the
+     * defaults) but ignoring its idle time and token threshold. Returns false if there were not
+     * enough turns to fold.
+     */
+    fun compactHistory(): Boolean {
+        verifyHandle()
+        return nativeBridge.compactHistory(this, nativePtr)
+    }
+
+    /** Returns history compaction counts and the effect of the last compaction, or null. */
+    fun getCompactionStats(): CompactionStats? {
+        verifyHandle()
+        val stats = nativeBridge.getCompactionStats(this, nativePtr) ?: return null
+        if (stats.size < 5) return null
+        return CompactionStats(
+                compactions = stats[0],
+                abandonedCompactions = stats[1],
+                tokensBefore = stats[2],
+                tokensAfter = stats[3],
+                lastDurationMs = stats[4] / 1000
+        )
+    }
+
+    /** Returns confidence-monitoring and escalation counts, or null. */
+    fun getCascadeStats(): CascadeStats? {
+        verifyHandle()
+        val stats = nativeBridge.getCascadeStats(this, nativePtr) ?: return null
+        if (stats.size < 6) return null
+        return CascadeStats(
+                monitoredResponses = stats[0],
+                escalations = stats[1],
+                tokensBeforeLastEscalation = stats[2],
+                reusedTokenizations = stats[3],
+                lastMeanEntropy = stats[4] / 1000f,
+                lastMeanMargin = stats[5] / 1000f
+        )
+    }
+
+    /**
+     * Answers [query] as a turn escalated from [source], reusing [source]'s prompt tokens when
+     * both models share a vocabulary and chat formatting. Returns the response and whether the
+     * tokens were reused.
+     */
+    internal fun getResponseEscalatedFrom(source: SmolLM, query: String, maxTokens: Int): Pair<String, Boolean> {
+        verifyHandle()
+        source.verifyHandle()
+        val reused = nativeBridge.startCompletionFrom(this, nativePtr, source.nativePtr, query)
+        return collectResponse(maxTokens) to reused
+    }
+
+    private fun collectResponse(maxTokens: Int): String {
         var piece = nativeBridge.completionLoop(this@SmolLM, nativePtr)
         var response = ""
         var tokensGenerated = 0
+        lastResponseEscalated = false
         
-        while (piece != "[EOG]") {
+        while (piece != "[EOG]" && piece != "[ESCALATE]") {
             response += piece
             tokensGenerated++
             
@@ -722,6 +1389,18 @@ class SmolLM(useVulkan: Boolean = true) : AutoCloseable {
         }
         if (piece == "[EOG]") {
              logD(LOG_TAG, "getResponse: [EOG] received after $tokensGenerated tokens.")
+             val loopStats = nativeBridge.getLoopStats(this, nativePtr)
+             if (loopStats != null && loopStats.size >= 5 && loopStats[4] >= 0) {
+                 loopTokensSaved += if (maxTokens > 0) {
+                     (maxTokens - tokensGenerated).coerceAtLeast(0).toLong()
+                 } else {
+                     val maxContext = nativeBridge.getContextStats(this, nativePtr)?.getOrNull(1) ?: 0L
+                     (maxContext - nativeBridge.getContextSizeUsed(this, nativePtr)).coerceAtLeast(0L)
+                 }
+             }
+        } else if (piece == "[ESCALATE]") {
+            logD(LOG_TAG, "getResponse: low confidence after $tokensGenerated tokens, escalating.")
+            lastResponseEscalated = true
         }
         
         nativeBridge.stopCompletion(this, nativePtr)
@@ -729,6 +1408,84 @@ class SmolLM(useVulkan: Boolean = true) : AutoCloseable {
         return response
     }
 
+    /**
+     * Constrains subsequent responses to a GBNF grammar (root rule `root`), so structured output
+     * always parses instead of needing a retry. Grammars are compiled once per loaded model and
+     * cached by hash. Pass null to generate freely again.
+     *
+     * @throws IllegalArgumentException if the grammar does not parse.
+     */
+    fun setGrammar(gbnf: String?) {
+        verifyHandle()
+        nativeBridge.setGrammar(this, nativePtr, gbnf, false)
+    }
+
+    /**
+     * Constrains subsequent responses to JSON matching [schema] (a JSON Schema document). The
+     * schema is converted to a grammar once and cached like [setGrammar]. Pass null to remove it.
+     *
+     * @throws IllegalArgumentException if the schema is not valid or not supported.
+     */
+    fun setJsonSchema(schema: String?) {
+        verifyHandle()
+        nativeBridge.setGrammar(this, nativePtr, schema, true)
+    }
+
+    /** Returns mask cache and timing counters of the active grammar, or null without one. */
+    fun getGrammarStats(): GrammarStats? {
+        verifyHandle()
+        val stats = nativeBridge.getGrammarStats(this, nativePtr) ?: return null
+        if (stats.size < 3) return null
+        return GrammarStats(
+                maskCacheHits = stats[0],
+                maskCacheMisses = stats[1],
+                constraintMicros = stats[2]
+        )
+    }
+
+    /**
+     * Restricts subsequent responses to [tokens] (end-of-generation tokens are always allowed),
+     * for routing, classification and other answers from a small fixed set. The output
+     * projection is then computed only for those rows, from a weight slice gathered once per
+     * subset, instead of over the whole vocabulary. With [validate] the full projection still
+     * runs and every step is compared against it; see [getRestrictedHeadStats]. Pass null or an
+     * empty array to sample from the full vocabulary again.
+     *
+     * @throws IllegalStateException if the model's output weights cannot be read.
+     */
+    fun setAllowedTokens(tokens: IntArray?, validate: Boolean = false) {
+        verifyHandle()
+        nativeBridge.setAllowedTokens(this, nativePtr, tokens?.takeIf { it.isNotEmpty() }, validate)
+    }
+
+    /**
+     * Restricts responses to the tokens of [labels], e.g. the class names of an intent
+     * classifier. Each label is tokenized without special tokens; see [setAllowedTokens].
+     */
+    fun setAllowedTokenStrings(labels: List<String>, validate: Boolean = false) {
+        verifyHandle()
+        val tokens =
+                labels.flatMap { label ->
+                            nativeBridge.tokenize(this, nativePtr, label)?.asList().orEmpty()
+                        }
+                        .distinct()
+                        .toIntArray()
+        setAllowedTokens(tokens, validate)
+    }
+
+    /** Returns counters of the restricted output head since it was last set, or null without one. */
+    fun getRestrictedHeadStats(): RestrictedHeadStats? {
+        verifyHandle()
+        val stats = nativeBridge.getRestrictedHeadStats(this, nativePtr) ?: return null
+        if (stats.size < 4 || stats[0] == 0L) return null
+        return RestrictedHeadStats(
+                restrictedSteps = stats[0],
+                validatedSteps = stats[1],
+                argmaxMismatches = stats[2],
+                argmaxOutsideSubset = stats[3]
+        )
+    }
+
     /** Public helper to stop a currently running completion loop (best effort). */
     fun stopCompletion() {
         if (nativePtr == 0L) return
@@ -764,6 +1521,7 @@ class SmolLM(useVulkan: Boolean = true) : AutoCloseable {
             temperature: Float,
             storeChats: Boolean,
             contextSize: Long,
+            initialContextSize: Long,
             chatTemplate: String,
             nThreads: Int,
             useMmap: Boolean,
@@ -882,6 +1640,46 @@ class SmolLM(useVulkan: Boolean = true) : AutoCloseable {
         }
     }
 
+    /**
+     * Forgets the conversation (system messages are kept), clears the KV cache and shrinks it back
+     * to [InferenceParams.initialContextSize].
+     */
+    fun clearHistory() {
+        verifyHandle()
+        nativeBridge.clearHistory(this, nativePtr)
+    }
+
+    /** Returns the current size and growth counters of the KV cache, or null if unavailable. */
+    fun getContextStats(): ContextStats? {
+        verifyHandle()
+        val stats = nativeBridge.getContextStats(this, nativePtr) ?: return null
+        if (stats.size < 7) return null
+        return ContextStats(
+                allocatedTokens = stats[0],
+                maxTokens = stats[1],
+                grows = stats[2],
+                shrinks = stats[3],
+                migrationMicros = stats[4],
+                peakRssKb = stats[5],
+                rssKb = stats[6]
+        )
+    }
+
+    /** Returns KV paging counters of this session, or null if unavailable. */
+    fun getPagingStats(): PagingStats? {
+        verifyHandle()
+        val stats = nativeBridge.getPagingStats(this, nativePtr) ?: return null
+        if (stats.size < 6) return null
+        return PagingStats(
+                pageOuts = stats[0],
+                pageIns = stats[1],
+                lastRestoreMicros = stats[2],
+                lastRestoredTokens = stats[3],
+                estimatedPrefillMicros = stats[4],
+                isPagedOut = stats[5] != 0L
+        )
+    }
+
     /**
      * Clears the KV cache stored in the model context.
      */
@@ -905,6 +1703,89 @@ class SmolLM(useVulkan: Boolean = true) : AutoCloseable {
 
     private external fun stopCompletion(modelPtr: Long)
 
+    private external fun nativeSetGrammar(modelPtr: Long, grammar: String?, isJsonSchema: Boolean)
+
+    private external fun nativeGetGrammarStats(modelPtr: Long): LongArray?
+
+    private external fun nativeTokenize(modelPtr: Long, text: String): IntArray?
+
+    private external fun nativeSetAllowedTokens(modelPtr: Long, tokens: IntArray?, validate: Boolean)
+
+    private external fun nativeGetRestrictedHeadStats(modelPtr: Long): LongArray?
+
+    private external fun nativeClearHistory(modelPtr: Long)
+
+    private external fun nativeGetContextStats(modelPtr: Long): LongArray?
+
+    private external fun nativeGetPagingStats(modelPtr: Long): LongArray?
+
+    private external fun nativeEncodePassage(modelPtr: Long, text: String): ByteArray?
+
+    private external fun nativeStartCompletionWithPassages(
+            modelPtr: Long,
+            query: String,
+            passages: Array<ByteArray>,
+            gaps: Array<String>,
+            recomputeRatio: Float
+    )
+
+    private external fun nativeGetPassageStats(modelPtr: Long): LongArray?
+
+    private external fun nativeCompressContext(
+            modelPtr: Long,
+            query: String,
+            context: String,
+            targetRatio: Float
+    ): String?
+
+    private external fun nativeGetCompressionStats(modelPtr: Long): LongArray?
+
+    private external fun nativeSetLoopPolicy(
+            modelPtr: Long,
+            action: Int,
+            maxPeriod: Int,
+            minRepeats: Int,
+            minSpan: Int,
+            plateauWindow: Int,
+            plateauEntropy: Float,
+            maxNudges: Int
+    )
+
+    private external fun nativeGetLoopStats(modelPtr: Long): LongArray?
+
+    private external fun nativeSetDeadline(modelPtr: Long, budgetMicros: Long)
+
+    private external fun nativeGetDeadlineStats(modelPtr: Long): LongArray?
+
+    private external fun nativeSetConfidencePolicy(
+            modelPtr: Long,
+            enabled: Boolean,
+            window: Int,
+            minTokens: Int,
+            maxTokens: Int,
+            maxMeanEntropy: Float,
+            minMargin: Float,
+            maxLowMarginFraction: Float
+    )
+
+    private external fun nativeGetCascadeStats(modelPtr: Long): LongArray?
+
+    private external fun nativeStartCompletionFrom(modelPtr: Long, sourcePtr: Long, query: String): Boolean
+
+    private external fun nativeSetCompactionPolicy(
+            modelPtr: Long,
+            enabled: Boolean,
+            triggerTokens: Int,
+            keepRecentTurns: Int,
+            summaryTokens: Int,
+            idleMillis: Int,
+            nThreads: Int
+    )
+
+    private external fun nativeCompactHistory(modelPtr: Long): Boolean
+
+    private external fun nativeGetCompactionStats(modelPtr: Long): LongArray?
+
     private fun applyReasoningState(mode: ThinkingMode, budget: Int) {
         val effectiveMode = if (budget == 0) ThinkingMode.DISABLED else mode
         currentThinkingMode = effectiveMode
@@ -80,6 +80,7 @@ object SmolLMJavaCompat {
         private var contextSize: Long? = null
         private var chatTemplate: String? = null
         private var numThreads: Int = 4
+        private var initialContextSize: Long = 512L
         private var useMmap: Boolean = true
         private var useMlock: Boolean = false
         private var thinkingMode: SmolLM.ThinkingMode = SmolLM.ThinkingMode.DEFAULT
@@ -91,6 +92,7 @@ object SmolLMJavaCompat {
         fun setContextSize(v: Long?) = apply { contextSize = v }
         fun setChatTemplate(v: String?) = apply { chatTemplate = v }
         fun setNumThreads(v: Int) = apply { numThreads = v }
+        fun setInitialContextSize(v: Long) = apply { initialContextSize = v }
         fun setUseMmap(v: Boolean) = apply { useMmap = v }
         fun setUseMlock(v: Boolean) = apply { useMlock = v }
         fun setThinkingMode(v: SmolLM.ThinkingMode) = apply { thinkingMode = v }
@@ -104,6 +106,7 @@ object SmolLMJavaCompat {
             contextSize = contextSize,
             chatTemplate = chatTemplate,
             numThreads = numThreads,
+            initialContextSize = initialContextSize,
             useMmap = useMmap,
             useMlock = useMlock,
             thinkingMode = thinkingMode,
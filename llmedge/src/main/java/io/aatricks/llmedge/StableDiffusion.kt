@@ -10,12 +10,16 @@ import io.aatricks.llmedge.huggingface.WanModelRegistry
 import java.io.File
 import java.util.Locale
 import java.util.concurrent.atomic.AtomicBoolean
+import java.util.concurrent.atomic.AtomicLong
 import kotlin.math.min
+import kotlin.random.Random
 import kotlinx.coroutines.CancellationException
 import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.sync.Mutex
 import kotlinx.coroutines.sync.withLock
 import kotlinx.coroutines.withContext
+import org.json.JSONArray
+import org.json.JSONObject
 
 class StableDiffusion private constructor(private val handle: Long) : AutoCloseable {
     // Serialize concurrent generation calls - native library is not guaranteed to be reentrant.
@@ -27,7 +31,9 @@ class StableDiffusion private constructor(private val handle: Long) : AutoClosea
     @Volatile private var cachedProgressCallback: VideoProgressCallback? = null
 
     @Volatile private var lastGenerationMetrics: GenerationMetrics? = null
+    @Volatile private var upscaleFactor = 0
     private val nativeBridge: NativeBridge = Companion.nativeBridgeProvider(this)
+    private val pendingLatents = mutableListOf<LatentHandle>()
 
     internal interface NativeBridge {
         fun txt2img(
@@ -77,6 +83,90 @@ class StableDiffusion private constructor(private val handle: Long) : AutoClosea
                 clipSkip: Int
         ): PrecomputedCondition? = null
 
+        /**
+         * Precomputes cond ([prompt]) and uncond ([negative]) together. Bridges without a
+         * batched native path fall back to two [precomputeCondition] calls.
+         */
+        fun precomputeConditionPair(
+                handle: Long,
+                prompt: String,
+                negative: String,
+                width: Int,
+                height: Int,
+                clipSkip: Int
+        ): Pair<PrecomputedCondition, PrecomputedCondition>? {
+            val cond =
+                    precomputeCondition(handle, prompt, negative, width, height, clipSkip)
+                            ?: return null
+            val uncond =
+                    precomputeCondition(handle, negative, "", width, height, clipSkip)
+                            ?: return null
+            return cond to uncond
+        }
+
+        /** Selects the LoRA set applied by subsequent generation calls on [handle]. */
+        fun setLoras(
+                handle: Long,
+                paths: Array<String>,
+                multipliers: FloatArray,
+                highNoise: BooleanArray
+        ) {}
+
+        /**
+         * Inpaints [initImage] (RGB888) where [mask] (one byte per pixel) is set. With
+         * [cropEnabled] only the mask's bounding box is sampled and stitched back.
+         */
+        fun inpaint(
+                handle: Long,
+                prompt: String,
+                negative: String,
+                width: Int,
+                height: Int,
+                steps: Int,
+                cfg: Float,
+                seed: Long,
+                initImage: ByteArray,
+                mask: ByteArray,
+                strength: Float,
+                cropEnabled: Boolean,
+                cropPadding: Int,
+                cropFeather: Int,
+                cropTargetSize: Int,
+        ): ByteArray? = null
+
+        /** Enables deferred VAE decode (TAE drafts, latents kept native-side) on [handle]. */
+        fun setDeferredDecode(handle: Long, enabled: Boolean) {}
+
+        /** Takes ownership of the latents kept back by the last deferred generation. */
+        fun takeDeferredLatents(handle: Long): LongArray = LongArray(0)
+
+        fun decodeLatent(handle: Long, latent: Long, tiled: Boolean): DecodedFrames? = null
+
+        fun spillLatent(latent: Long, path: String): Boolean = false
+
+        fun freeLatent(latent: Long) {}
+
+        /** Checkpoints sampling to "<pathPrefix>.<n>"; a null prefix disables it. */
+        fun setCheckpoint(handle: Long, pathPrefix: String?, everyNSteps: Int, resume: Boolean) {}
+
+        fun setSparseAttention(handle: Long, enabled: Boolean, windowFrames: Int, globalStride: Int) {}
+
+        /** Loads the ESRGAN upscaler of [handle]; returns its scale factor or 0 on failure. */
+        fun loadUpscaler(handle: Long, path: String, tileSize: Int): Int = 0
+
+        /**
+         * Upscales [frames] with the upscaler of [handle]; null on failure or cancellation.
+         * [resetCancellation] clears a pending cancel first, which a generation that upscales its
+         * own output must not do.
+         */
+        fun upscale(
+                handle: Long,
+                frames: Array<ByteArray>,
+                width: Int,
+                height: Int,
+                resetCancellation: Boolean,
+        ): DecodedFrames? = null
+
         fun txt2vidWithPrecomputedCondition(
                 handle: Long,
                 prompt: String,
@@ -451,22 +541,134 @@ class StableDiffusion private constructor(private val handle: Long) : AutoClosea
                                     clipSkip
                             )
                                     ?: return null
-                    // Array layout: [float[] cross, int[] crossDims, float[] vector, int[]
-                    // vectorDims, float[] concat, int[] concatDims]
-                    val cross = raw.getOrNull(0) as? FloatArray
-                    val crossDims = raw.getOrNull(1) as? IntArray
-                    val vector = raw.getOrNull(2) as? FloatArray
-                    val vectorDims = raw.getOrNull(3) as? IntArray
-                    val concat = raw.getOrNull(4) as? FloatArray
-                    val concatDims = raw.getOrNull(5) as? IntArray
-                    return PrecomputedCondition(
-                            cCrossAttn = cross,
-                            cCrossAttnDims = crossDims,
-                            cVector = vector,
-                            cVectorDims = vectorDims,
-                            cConcat = concat,
-                            cConcatDims = concatDims
-                    )
+                    return instance.conditionFromNativeArray(raw)
+                }
+
+                override fun precomputeConditionPair(
+                        handle: Long,
+                        prompt: String,
+                        negative: String,
+                        width: Int,
+                        height: Int,
+                        clipSkip: Int
+                ): Pair<PrecomputedCondition, PrecomputedCondition>? {
+                    val raw =
+                            instance.nativePrecomputeConditionPair(
+                                    handle,
+                                    prompt,
+                                    negative,
+                                    width,
+                                    height,
+                                    clipSkip
+                            )
+                                    ?: return null
+                    val cond = raw.getOrNull(0) as? Array<*> ?: return null
+                    val uncond = raw.getOrNull(1) as? Array<*> ?: return null
+                    return instance.conditionFromNativeArray(cond) to
+                            instance.conditionFromNativeArray(uncond)
+                }
+
+                override fun setLoras(
+                        handle: Long,
+                        paths: Array<String>,
+                        multipliers: FloatArray,
+                        highNoise: BooleanArray
+                ) {
+                    instance.nativeSetLoras(handle, paths, multipliers, highNoise)
+                }
+
+                override fun inpaint(
+                        handle: Long,
+                        prompt: String,
+                        negative: String,
+                        width: Int,
+                        height: Int,
+                        steps: Int,
+                        cfg: Float,
+                        seed: Long,
+                        initImage: ByteArray,
+                        mask: ByteArray,
+                        strength: Float,
+                        cropEnabled: Boolean,
+                        cropPadding: Int,
+                        cropFeather: Int,
+                        cropTargetSize: Int,
+                ): ByteArray? =
+                        instance.nativeInpaint(
+                                handle,
+                                prompt,
+                                negative,
+                                width,
+                                height,
+                                steps,
+                                cfg,
+                                seed,
+                                initImage,
+                                mask,
+                                strength,
+                                cropEnabled,
+                                cropPadding,
+                                cropFeather,
+                                cropTargetSize,
+                        )
+
+                override fun setDeferredDecode(handle: Long, enabled: Boolean) {
+                    instance.nativeSetDeferredDecode(handle, enabled)
+                }
+
+                override fun takeDeferredLatents(handle: Long): LongArray =
+                        instance.nativeTakeDeferredLatents(handle) ?: LongArray(0)
+
+                override fun decodeLatent(
+                        handle: Long,
+                        latent: Long,
+                        tiled: Boolean
+                ): DecodedFrames? {
+                    val dims = IntArray(2)
+                    val frames = instance.nativeDecodeLatent(handle, latent, tiled, dims) ?: return null
+                    return DecodedFrames(dims[0], dims[1], frames)
+                }
+
+                override fun spillLatent(latent: Long, path: String): Boolean =
+                        nativeSpillLatent(latent, path)
+
+                override fun freeLatent(latent: Long) {
+                    nativeFreeLatent(latent)
+                }
+
+                override fun setCheckpoint(
+                        handle: Long,
+                        pathPrefix: String?,
+                        everyNSteps: Int,
+                        resume: Boolean
+                ) {
+                    instance.nativeSetCheckpoint(handle, pathPrefix, everyNSteps, resume)
+                }
+
+                override fun setSparseAttention(
+                        handle: Long,
+                        enabled: Boolean,
+                        windowFrames: Int,
+                        globalStride: Int
+                ) {
+                    instance.nativeSetSparseAttention(handle, enabled, windowFrames, globalStride)
+                }
+
+                override fun loadUpscaler(handle: Long, path: String, tileSize: Int): Int =
+                        instance.nativeLoadUpscaler(handle, path, tileSize)
+
+                override fun upscale(
+                        handle: Long,
+                        frames: Array<ByteArray>,
+                        width: Int,
+                        height: Int,
+                        resetCancellation: Boolean,
+                ): DecodedFrames? {
+                    val dims = IntArray(2)
+                    val upscaled =
+                            instance.nativeUpscale(handle, frames, width, height, resetCancellation, dims)
+                                    ?: return null
+                    return DecodedFrames(dims[0], dims[1], upscaled)
                 }
 
                 override fun txt2vidWithPrecomputedCondition(
@@ -618,7 +820,7 @@ class StableDiffusion private constructor(private val handle: Long) : AutoClosea
                 println("[StableDiffusion] Native load disabled via llmedge.disableNativeLoad=true")
             } else {
                 try {
-                    System.loadLibrary("sdcpp")
+                    logD(LOG_TAG, "Loaded lib${NativeLibraryLoader.load("sdcpp")}.so")
                     check(nativeCheckBindings()) { "Failed to link StableDiffusion JNI bindings" }
                 } catch (e: UnsatisfiedLinkError) {
                     logE(LOG_TAG, "Failed to load sdcpp native library", e)
@@ -722,9 +924,16 @@ class StableDiffusion private constructor(private val handle: Long) : AutoClosea
                 vaeDecodeOnly: Boolean,
                 flowShift: Float,
                 loraModelDir: String?,
-                loraApplyMode: Int
+                loraApplyMode: Int,
+                taePreviewOnly: Boolean
         ): Long
 
+        @JvmStatic
+        private external fun nativeSpillLatent(latent: Long, path: String): Boolean
+
+        @JvmStatic
+        private external fun nativeFreeLatent(latent: Long)
+
         @JvmStatic
         private external fun nativeGetVulkanDeviceCount(): Int
 
@@ -914,6 +1123,7 @@ class StableDiffusion private constructor(private val handle: Long) : AutoClosea
                 flowShift: Float = Float.POSITIVE_INFINITY,
                 loraModelDir: String? = null,
                 loraApplyMode: LoraApplyMode = LoraApplyMode.AUTO,
+                taePreviewOnly: Boolean = false,
         ): StableDiffusion =
                 withContext(Dispatchers.IO) {
                     var resolvedModelPath: String
@@ -950,6 +1160,7 @@ class StableDiffusion private constructor(private val handle: Long) : AutoClosea
                                         forceDownload = forceDownload,
                                         preferSystemDownloader = true,
                                         flowShift = flowShift,
+                                        taePreviewOnly = taePreviewOnly,
                                 )
                             }
                         } catch (t: Throwable) {
@@ -1184,6 +1395,7 @@ class StableDiffusion private constructor(private val handle: Long) : AutoClosea
                                     flowShift,
                                     loraModelDir,
                                     loraApplyMode.id,
+                                    taePreviewOnly,
                             )
                     // If we requested preferred GPU path but nativeCreate failed, retry with CPU
                     // offload
@@ -1210,6 +1422,7 @@ class StableDiffusion private constructor(private val handle: Long) : AutoClosea
                                         flowShift,
                                         loraModelDir,
                                         loraApplyMode.id,
+                                        taePreviewOnly,
                                 )
                     } 
                     if (handle == 0L) {
@@ -1258,6 +1471,7 @@ class StableDiffusion private constructor(private val handle: Long) : AutoClosea
                 flowShift: Float = Float.POSITIVE_INFINITY,
                 loraModelDir: String? = null,
                 loraApplyMode: LoraApplyMode = LoraApplyMode.AUTO,
+                taePreviewOnly: Boolean = false,
                 onProgress: ((name: String, downloaded: Long, total: Long?) -> Unit)? = null,
         ): StableDiffusion =
                 withContext(Dispatchers.IO) {
@@ -1397,6 +1611,7 @@ class StableDiffusion private constructor(private val handle: Long) : AutoClosea
                                     flowShift,
                                     loraModelDir,
                                     loraApplyMode.id,
+                                    taePreviewOnly,
                             )
                     if (handle == 0L && forceVulkan) {
                         android.util.Log.w(
@@ -1421,6 +1636,7 @@ class StableDiffusion private constructor(private val handle: Long) : AutoClosea
                                         flowShift,
                                         loraModelDir,
                                         loraApplyMode.id,
+                                        taePreviewOnly,
                                 )
                     }
                     if (handle == 0L)
@@ -1446,9 +1662,85 @@ class StableDiffusion private constructor(private val handle: Long) : AutoClosea
             val steps: Int = 20,
             val cfgScale: Float = 7.0f,
             val seed: Long = 42L,
-            val easyCacheParams: EasyCacheParams = EasyCacheParams()
+            val easyCacheParams: EasyCacheParams = EasyCacheParams(),
+            val loras: List<LoraSpec> = emptyList(),
+            val deferVaeDecode: Boolean = false,
+            val upscale: Boolean = false
+    )
+
+    /**
+     * A LoRA applied to a single generation request. With [LoraApplyMode.AT_RUNTIME] the native
+     * context keeps recently used LoRAs resident, so alternating LoRA sets between requests does
+     * not reload the files.
+     *
+     * @property path Path to the LoRA file.
+     * @property multiplier LoRA strength.
+     * @property highNoise Apply to the high-noise expert of Wan2.2 MoE models instead.
+     */
+    data class LoraSpec(
+            val path: String,
+            val multiplier: Float = 1.0f,
+            val highNoise: Boolean = false,
     )
 
+    /**
+     * Inpainting inputs for [inpaint].
+     *
+     * @property image Source image; its size sets the output size.
+     * @property mask Repaint mask. Bright pixels (red channel > 127) are regenerated.
+     * @property strength Denoising strength applied to the masked area.
+     * @property cropToMask Sample only the mask's bounding box and stitch it back, which makes
+     *   small edits on large images much cheaper. Falls back to the full image when the mask
+     *   covers most of it.
+     * @property cropPadding Context pixels kept around the mask's bounding box.
+     * @property feather Width in pixels of the blend ramp at the crop border.
+     * @property cropTargetSize Longest side the crop is sampled at; 0 uses the model's native
+     *   resolution. The crop is never sampled at more pixels than the full image.
+     */
+    data class InpaintParams(
+            val image: Bitmap,
+            val mask: Bitmap,
+            val strength: Float = 0.75f,
+            val cropToMask: Boolean = true,
+            val cropPadding: Int = 32,
+            val feather: Int = 16,
+            val cropTargetSize: Int = 0,
+    )
+
+    /**
+     * Final latent of a generation run with `deferVaeDecode = true`. The generation itself
+     * returns a tiny-autoencoder draft; pass this handle to [decodeLatent] to run the full VAE
+     * for the candidates worth keeping. Handles own native memory and must be closed.
+     */
+    class LatentHandle internal constructor(private val owner: StableDiffusion, pointer: Long) :
+            AutoCloseable {
+        private val ptr = AtomicLong(pointer)
+
+        internal val pointer: Long
+            get() = ptr.get()
+
+        val isClosed: Boolean
+            get() = ptr.get() == 0L
+
+        /**
+         * Moves the latent data to [file], releasing its RAM. [decodeLatent] reads it back and
+         * the file is deleted when the handle is closed.
+         */
+        fun spillTo(file: File): Boolean {
+            val p = ptr.get()
+            check(p != 0L) { "Latent has been released" }
+            return owner.nativeBridge.spillLatent(p, file.absolutePath)
+        }
+
+        override fun close() {
+            val p = ptr.getAndSet(0L)
+            if (p != 0L) owner.nativeBridge.freeLatent(p)
+        }
+    }
+
+    /** RGB888 frames returned by a full-VAE latent decode. */
+    internal class DecodedFrames(val width: Int, val height: Int, val frames: Array<ByteArray>)
+
     data class EasyCacheParams(
             val enabled: Boolean = false,
             val reuseThreshold: Float = 0.2f,
@@ -1550,7 +1842,12 @@ class StableDiffusion private constructor(private val handle: Long) : AutoClosea
             val vaceStrength: Float = 1.0f,
             val sampleMethod: SampleMethod = SampleMethod.DEFAULT,
             val scheduler: Scheduler = Scheduler.DEFAULT,
-            val easyCacheParams: EasyCacheParams = EasyCacheParams()
+            val easyCacheParams: EasyCacheParams = EasyCacheParams(),
+            val loras: List<LoraSpec> = emptyList(),
+            val deferVaeDecode: Boolean = false,
+            val checkpoint: CheckpointOptions? = null,
+            val sparseAttention: SparseAttention? = null,
+            val upscale: Boolean = false
     ) {
         /**
          * Calculate the actual number of frames that will be generated. Wan model uses formula:
@@ -1603,6 +1900,28 @@ class StableDiffusion private constructor(private val handle: Long) : AutoClosea
         }
     }
 
+    /**
+     * Periodic sampling checkpoints for long video generations. The request and the sampler
+     * progress are written to [directory] every [everyNSteps] steps; after an interruption
+     * [resumeGeneration] continues from the last checkpoint with the same output an
+     * uninterrupted run would have produced. The directory is deleted once generation succeeds.
+     */
+    data class CheckpointOptions(
+            val directory: File,
+            val everyNSteps: Int = 5,
+    )
+
+    /**
+     * Sparse self-attention for Wan models: each latent token attends to the tokens of its
+     * window of [windowFrames] latent frames plus every [globalStride]-th token of the clip
+     * (0 for none), instead of the whole clip. Step time then grows linearly with the frame
+     * count instead of quadratically, at some cost in long-range temporal coherence.
+     */
+    data class SparseAttention(
+            val windowFrames: Int = 3,
+            val globalStride: Int = 64,
+    )
+
     enum class LoraApplyMode(val id: Int) {
         AUTO(0),
         IMMEDIATELY(1),
@@ -1664,6 +1983,133 @@ class StableDiffusion private constructor(private val handle: Long) : AutoClosea
             val cConcatDims: IntArray? = null,
     )
 
+    private fun selectLoras(loras: List<LoraSpec>) {
+        nativeBridge.setLoras(
+                handle,
+                loras.map { it.path }.toTypedArray(),
+                FloatArray(loras.size) { loras[it].multiplier },
+                BooleanArray(loras.size) { loras[it].highNoise }
+        )
+    }
+
+    private fun setDeferredDecode(enabled: Boolean) {
+        nativeBridge.setDeferredDecode(handle, enabled)
+    }
+
+    private fun setSparseAttention(sparse: SparseAttention?) {
+        nativeBridge.setSparseAttention(
+                handle,
+                sparse != null,
+                sparse?.windowFrames ?: 0,
+                sparse?.globalStride ?: 0,
+        )
+    }
+
+    private fun stashDeferredLatents(enabled: Boolean) {
+        if (!enabled) return
+        val latents = nativeBridge.takeDeferredLatents(handle).map { LatentHandle(this, it) }
+        synchronized(pendingLatents) {
+            pendingLatents.forEach { it.close() }
+            pendingLatents.clear()
+            pendingLatents.addAll(latents)
+        }
+    }
+
+    /**
+     * Returns the latents of the most recent generation that ran with `deferVaeDecode = true`
+     * (one per image, or one per video). Ownership passes to the caller; latents that are not
+     * taken are released by the next deferred generation or by [close].
+     */
+    fun takeDeferredLatents(): List<LatentHandle> =
+            synchronized(pendingLatents) {
+                val taken = pendingLatents.toList()
+                pendingLatents.clear()
+                taken
+            }
+
+    /**
+     * Runs the full VAE on a latent kept back by a deferred generation. Returns one bitmap for
+     * images or every frame for videos. [tiled] decodes in tiles to bound peak memory.
+     */
+    suspend fun decodeLatent(latent: LatentHandle, tiled: Boolean = false): List<Bitmap> =
+            withContext(Dispatchers.Default) {
+                val p = latent.pointer
+                check(p != 0L) { "Latent has been released" }
+                val decoded =
+                        generationMutex.withLock { nativeBridge.decodeLatent(handle, p, tiled) }
+                                ?: throw IllegalStateException("Latent decode failed")
+                decoded.frames.map { rgbBytesToBitmap(it, decoded.width, decoded.height) }
+            }
+
+    /**
+     * Loads an ESRGAN-class upscaler (e.g. RealESRGAN x4 GGUF/safetensors) into this instance so
+     * generations can run at a fraction of the target resolution and be upscaled with
+     * `upscale = true`, or through [upscale]. Images are processed in [tileSize] tiles using all
+     * CPU cores. Returns the scale factor.
+     */
+    fun loadUpscaler(path: String, tileSize: Int = 128): Int {
+        require(tileSize > 0) { "Tile size must be positive" }
+        val factor = nativeBridge.loadUpscaler(handle, path, tileSize)
+        check(factor > 0) { "Failed to load upscaler from $path" }
+        upscaleFactor = factor
+        return factor
+    }
+
+    /** Upscales [images] (e.g. video frames, all of the same size) with the loaded upscaler. */
+    suspend fun upscale(images: List<Bitmap>): List<Bitmap> =
+            withContext(Dispatchers.Default) {
+                if (images.isEmpty()) return@withContext emptyList()
+                val first = images.first()
+                val frames =
+                        Array(images.size) { i ->
+                            val (rgb, width, height) = bitmapToRgbBytes(images[i])
+                            require(width == first.width && height == first.height) {
+                                "All images must have the same size"
+                            }
+                            rgb.copyOf(width * height * 3)
+                        }
+                val output =
+                        generationMutex.withLock {
+                            cancellationRequested.set(false)
+                            try {
+                                upscaleFrames(frames, first.width, first.height, resetCancellation = true)
+                            } finally {
+                                cancellationRequested.set(false)
+                            }
+                        }
+                output.frames.map { rgbBytesToBitmap(it, output.width, output.height) }
+            }
+
+    // Callers hold generationMutex, so the upscale runs in the same hold as the generation it
+    // follows and a cancelGeneration() in between still stops it.
+    private fun upscaleFrames(
+            frames: Array<ByteArray>,
+            width: Int,
+            height: Int,
+            resetCancellation: Boolean = false,
+    ): DecodedFrames {
+        check(upscaleFactor > 0) { "No upscaler loaded (call loadUpscaler first)" }
+        return nativeBridge.upscale(handle, frames, width, height, resetCancellation)
+                ?: if (cancellationRequested.get()) {
+                    throw CancellationException("Upscaling cancelled")
+                } else {
+                    throw IllegalStateException("Upscaling failed")
+                }
+    }
+
+    private fun conditionFromNativeArray(raw: Array<*>): PrecomputedCondition {
+        // Array layout: [float[] cross, int[] crossDims, float[] vector, int[]
+        // vectorDims, float[] concat, int[] concatDims]
+        return PrecomputedCondition(
+                cCrossAttn = raw.getOrNull(0) as? FloatArray,
+                cCrossAttnDims = raw.getOrNull(1) as? IntArray,
+                cVector = raw.getOrNull(2) as? FloatArray,
+                cVectorDims = raw.getOrNull(3) as? IntArray,
+                cConcat = raw.getOrNull(4) as? FloatArray,
+                cConcatDims = raw.getOrNull(5) as? IntArray
+        )
+    }
+
     internal data class VideoModelMetadata(
             val architecture: String?,
             val modelType: String?,
@@ -1685,12 +2131,46 @@ class StableDiffusion private constructor(private val handle: Long) : AutoClosea
     suspend fun txt2vid(
             params: VideoGenerateParams,
             onProgress: VideoProgressCallback? = null,
+    ): List<Bitmap> = generateVideo(params, onProgress, resume = false)
+
+    /**
+     * Continues a [txt2vid] run that was started with [VideoGenerateParams.checkpoint] and did
+     * not finish. [checkpoint] is the checkpoint directory; the original request is read back
+     * from it, so the frames match what the interrupted run would have returned.
+     */
+    suspend fun resumeGeneration(
+            checkpoint: File,
+            onProgress: VideoProgressCallback? = null,
+    ): List<Bitmap> {
+        val params =
+                withContext(Dispatchers.IO) { VideoCheckpointStore.read(checkpoint) }
+                        ?.let { stored ->
+                            stored.initImage?.let { (bytes, width, height) ->
+                                stored.params.copy(initImage = rgbBytesToBitmap(bytes, width, height))
+                            }
+                                    ?: stored.params
+                        }
+                        ?: throw IllegalArgumentException("No generation checkpoint in $checkpoint")
+        return generateVideo(params, onProgress, resume = true)
+    }
+
+    private suspend fun generateVideo(
+            requested: VideoGenerateParams,
+            onProgress: VideoProgressCallback?,
+            resume: Boolean,
     ): List<Bitmap> =
             withContext(Dispatchers.IO) {
                 check(isNativeLibraryAvailable) {
                     "Video generation is unavailable on this platform"
                 }
-                params.validate().getOrThrow()
+                requested.validate().getOrThrow()
+                // Checkpoints only replay for the same noise, so pin the seed up front.
+                val params =
+                        if (requested.checkpoint != null && requested.seed < 0) {
+                            requested.copy(seed = Random.nextLong(0, Int.MAX_VALUE.toLong()))
+                        } else {
+                            requested
+                        }
                 check(isVideoModel()) { "Loaded model is not a video model (use txt2img instead)" }
 
                 // T101: Context size capping based on model size
@@ -1715,6 +2195,15 @@ class StableDiffusion private constructor(private val handle: Long) : AutoClosea
                 val (initBytes, initWidth, initHeight) =
                         params.initImage?.let { bitmapToRgbBytes(it) } ?: Triple(null, 0, 0)
 
+                val checkpoint = params.checkpoint
+                if (checkpoint != null && !resume) {
+                    VideoCheckpointStore.write(
+                            checkpoint.directory,
+                            params,
+                            initBytes?.let { Triple(it, initWidth, initHeight) },
+                    )
+                }
+
                 val tempCallback = onProgress
                 if (tempCallback != null) {
                     nativeBridge.setProgressCallback(handle, tempCallback)
@@ -1722,33 +2211,50 @@ class StableDiffusion private constructor(private val handle: Long) : AutoClosea
 
                 val startNanos = System.nanoTime()
                 val memoryBefore = readNativeMemoryMb()
-                var frameBytes =
+                val output =
                         try {
                             generationMutex.withLock {
                                 cancellationRequested.set(false)
-                                nativeBridge.txt2vid(
+                                selectLoras(params.loras)
+                                setDeferredDecode(params.deferVaeDecode)
+                                setSparseAttention(params.sparseAttention)
+                                nativeBridge.setCheckpoint(
                                         handle,
-                                        params.prompt,
-                                        params.negative,
-                                        params.width,
-                                        params.height,
-                                        params.videoFrames,
-                                        params.steps,
-                                        params.cfgScale,
-                                        params.seed,
-                                        params.sampleMethod,
-                                        params.scheduler,
-                                        params.strength,
-                                        initBytes,
-                                        initWidth,
-                                        initHeight,
-                                        params.vaceStrength,
-                                        params.easyCacheParams.enabled,
-                                        params.easyCacheParams.reuseThreshold,
-                                        params.easyCacheParams.startPercent,
-                                        params.easyCacheParams.endPercent,
+                                        checkpoint?.let { VideoCheckpointStore.samplePrefix(it.directory) },
+                                        checkpoint?.everyNSteps ?: 0,
+                                        resume,
                                 )
-                                        ?: throw IllegalStateException("Video generation failed")
+                                val frames =
+                                        nativeBridge.txt2vid(
+                                                handle,
+                                                params.prompt,
+                                                params.negative,
+                                                params.width,
+                                                params.height,
+                                                params.videoFrames,
+                                                params.steps,
+                                                params.cfgScale,
+                                                params.seed,
+                                                params.sampleMethod,
+                                                params.scheduler,
+                                                params.strength,
+                                                initBytes,
+                                                initWidth,
+                                                initHeight,
+                                                params.vaceStrength,
+                                                params.easyCacheParams.enabled,
+                                                params.easyCacheParams.reuseThreshold,
+                                                params.easyCacheParams.startPercent,
+                                                params.easyCacheParams.endPercent,
+                                        )
+                                                ?.also { stashDeferredLatents(params.deferVaeDecode) }
+                                                ?: throw IllegalStateException("Video generation failed")
+                                val checked = checkVideoFrames(frames, params)
+                                if (params.upscale) {
+                                    upscaleFrames(checked, params.width, params.height)
+                                } else {
+                                    DecodedFrames(params.width, params.height, checked)
+                                }
                             }
                         } catch (t: Throwable) {
                             if (cancellationRequested.get()) {
@@ -1758,92 +2264,14 @@ class StableDiffusion private constructor(private val handle: Long) : AutoClosea
                             throw t
                         } finally {
                             cancellationRequested.set(false)
+                            if (checkpoint != null) {
+                                nativeBridge.setCheckpoint(handle, null, 0, false)
+                            }
                         }
-
-                if (frameBytes.isEmpty()) {
-                    throw IllegalStateException("Video generation returned no frames")
-                }
-
-                // Note: Wan model calculates actual frames as (n-1)/4*4+1
-                val expectedFrames = params.actualFrameCount()
-                if (frameBytes.size != expectedFrames) {
-                    Log.w(
-                            LOG_TAG,
-                            "Expected $expectedFrames frames (formula: (${params.videoFrames}-1)/4*4+1) but received ${frameBytes.size}",
-                    )
-                }
-
-                // Heuristic: if native output appears to be fully black/near zero, attempt
-                // a channel-swap fallback (common when channel ordering is reversed or
-                // when a plugin returns bytes in a different layout). This helps surface
-                // real frames instead of blank images in environments with inconsistent
-                // native outputs.
-                fun computeAvgBrightness(bytes: ByteArray): Double {
-                    var s = 0L
-                    var i = 0
-                    val totalPixels = (bytes.size / 3).coerceAtLeast(1)
-                    while (i + 2 < bytes.size) {
-                        val r = bytes[i++].toInt() and 0xFF
-                        val g = bytes[i++].toInt() and 0xFF
-                        val b = bytes[i++].toInt() and 0xFF
-                        s += (r + g + b) / 3
-                    }
-                    return s.toDouble() / totalPixels
-                }
-
-                val avg = frameBytes.map { computeAvgBrightness(it) }.average()
-                Log.d(
-                        LOG_TAG,
-                        "Video frame analysis: ${frameBytes.size} frames, avg brightness=$avg, first frame size=${frameBytes.firstOrNull()?.size ?: 0}"
-                )
-
-                if (avg < 1.0) {
-                    Log.w(
-                            LOG_TAG,
-                            "Detected potentially black frames (avg brightness < 1.0), attempting channel swap..."
-                    )
-                    // Try swapping R and B channels
-                    val swapped =
-                            frameBytes
-                                    .map { bytes ->
-                                        val out = ByteArray(bytes.size)
-                                        var j = 0
-                                        var k = 0
-                                        while (k + 2 < bytes.size) {
-                                            val r = bytes[k]
-                                            val g = bytes[k + 1]
-                                            val b = bytes[k + 2]
-                                            out[j++] = b
-                                            out[j++] = g
-                                            out[j++] = r
-                                            k += 3
-                                        }
-                                        out
-                                    }
-                                    .toTypedArray()
-                    val swappedAvg = swapped.map { computeAvgBrightness(it) }.average()
-                    Log.d(LOG_TAG, "After BGR swap: avg brightness=$swappedAvg")
-                    if (swappedAvg > avg) {
-                        frameBytes = swapped
-                        Log.w(
-                                LOG_TAG,
-                                "Swapped RGB->BGR for video frames to recover non-black output"
-                        )
-                    } else if (avg < 0.1) {
-                        // Still very dark - log raw byte samples for debugging
-                        val sample = frameBytes.firstOrNull()
-                        if (sample != null && sample.size >= 30) {
-                            val sampleBytes = sample.take(30).map { it.toInt() and 0xFF }
-                            Log.e(
-                                    LOG_TAG,
-                                    "Frame appears completely black. First 30 bytes: $sampleBytes"
-                            )
-                        }
-                    }
-                }
+                checkpoint?.directory?.deleteRecursively()
 
                 val conversionStart = System.nanoTime()
-                val bitmaps = convertFramesToBitmaps(frameBytes, params.width, params.height)
+                val bitmaps = convertFramesToBitmaps(output.frames, output.width, output.height)
                 val conversionSeconds = ((System.nanoTime() - conversionStart) / 1_000_000_000f)
                 val totalSeconds = ((System.nanoTime() - startNanos) / 1_000_000_000f)
                 val memoryAfter = readNativeMemoryMb()
@@ -1869,6 +2297,96 @@ class StableDiffusion private constructor(private val handle: Long) : AutoClosea
                 bitmaps
             }
 
+    // Checks the frame count and recovers frames whose channels came back swapped.
+    private fun checkVideoFrames(
+            frames: Array<ByteArray>,
+            params: VideoGenerateParams
+    ): Array<ByteArray> {
+        var frameBytes = frames
+        if (frameBytes.isEmpty()) {
+            throw IllegalStateException("Video generation returned no frames")
+        }
+
+        // Note: Wan model calculates actual frames as (n-1)/4*4+1
+        val expectedFrames = params.actualFrameCount()
+        if (frameBytes.size != expectedFrames) {
+            Log.w(
+                    LOG_TAG,
+                    "Expected $expectedFrames frames (formula: (${params.videoFrames}-1)/4*4+1) but received ${frameBytes.size}",
+            )
+        }
+
+        // Heuristic: if native output appears to be fully black/near zero, attempt
+        // a channel-swap fallback (common when channel ordering is reversed or
+        // when a plugin returns bytes in a different layout). This helps surface
+        // real frames instead of blank images in environments with inconsistent
+        // native outputs.
+        fun computeAvgBrightness(bytes: ByteArray): Double {
+            var s = 0L
+            var i = 0
+            val totalPixels = (bytes.size / 3).coerceAtLeast(1)
+            while (i + 2 < bytes.size) {
+                val r = bytes[i++].toInt() and 0xFF
+                val g = bytes[i++].toInt() and 0xFF
+                val b = bytes[i++].toInt() and 0xFF
+                s += (r + g + b) / 3
+            }
+            return s.toDouble() / totalPixels
+        }
+
+        val avg = frameBytes.map { computeAvgBrightness(it) }.average()
+        Log.d(
+                LOG_TAG,
+                "Video frame analysis: ${frameBytes.size} frames, avg brightness=$avg, first frame size=${frameBytes.firstOrNull()?.size ?: 0}"
+        )
+
+        if (avg < 1.0) {
+            Log.w(
+                    LOG_TAG,
+                    "Detected potentially black frames (avg brightness < 1.0), attempting channel swap..."
+            )
+            // Try swapping R and B channels
+            val swapped =
+                    frameBytes
+                            .map { bytes ->
+                                val out = ByteArray(bytes.size)
+                                var j = 0
+                                var k = 0
+                                while (k + 2 < bytes.size) {
+                                    val r = bytes[k]
+                                    val g = bytes[k + 1]
+                                    val b = bytes[k + 2]
+                                    out[j++] = b
+                                    out[j++] = g
+                                    out[j++] = r
+                                    k += 3
+                                }
+                                out
+                            }
+                            .toTypedArray()
+            val swappedAvg = swapped.map { computeAvgBrightness(it) }.average()
+            Log.d(LOG_TAG, "After BGR swap: avg brightness=$swappedAvg")
+            if (swappedAvg > avg) {
+                frameBytes = swapped
+                Log.w(
+                        LOG_TAG,
+                        "Swapped RGB->BGR for video frames to recover non-black output"
+                )
+            } else if (avg < 0.1) {
+                // Still very dark - log raw byte samples for debugging
+                val sample = frameBytes.firstOrNull()
+                if (sample != null && sample.size >= 30) {
+                    val sampleBytes = sample.take(30).map { it.toInt() and 0xFF }
+                    Log.e(
+                            LOG_TAG,
+                            "Frame appears completely black. First 30 bytes: $sampleBytes"
+                    )
+                }
+            }
+        }
+        return frameBytes
+    }
+
     fun setProgressCallback(callback: VideoProgressCallback?) {
         cachedProgressCallback = callback
         if (!isNativeLibraryAvailable) return
@@ -1887,37 +2405,53 @@ class StableDiffusion private constructor(private val handle: Long) : AutoClosea
             // Use Dispatchers.Default for CPU-bound generation to prefer a CPU-optimized
             // thread pool and reduce context-switching/stack allocations compared to IO.
             withContext(Dispatchers.Default) {
-                val bytes =
+                val output =
                         generationMutex.withLock {
-                            nativeBridge.txt2img(
-                                    handle,
-                                    params.prompt,
-                                    params.negative,
-                                    params.width,
-                                    params.height,
-                                    params.steps,
-                                    params.cfgScale,
-                                    params.seed,
-                                    params.easyCacheParams.enabled,
-                                    params.easyCacheParams.reuseThreshold,
-                                    params.easyCacheParams.startPercent,
-                                    params.easyCacheParams.endPercent
-                            )
-                                    ?: throw IllegalStateException("Image generation failed")
+                            cancellationRequested.set(false)
+                            try {
+                                selectLoras(params.loras)
+                                setDeferredDecode(params.deferVaeDecode)
+                                val bytes =
+                                        nativeBridge.txt2img(
+                                                handle,
+                                                params.prompt,
+                                                params.negative,
+                                                params.width,
+                                                params.height,
+                                                params.steps,
+                                                params.cfgScale,
+                                                params.seed,
+                                                params.easyCacheParams.enabled,
+                                                params.easyCacheParams.reuseThreshold,
+                                                params.easyCacheParams.startPercent,
+                                                params.easyCacheParams.endPercent
+                                        )
+                                                ?.also { stashDeferredLatents(params.deferVaeDecode) }
+                                                ?: throw IllegalStateException("Image generation failed")
+                                if (params.upscale) {
+                                    upscaleFrames(arrayOf(bytes), params.width, params.height)
+                                } else {
+                                    DecodedFrames(params.width, params.height, arrayOf(bytes))
+                                }
+                            } finally {
+                                cancellationRequested.set(false)
+                            }
                         }
+                val width = output.width
+                val height = output.height
 
                 // Convert raw RGB bytes to Bitmap
-                val bmp = Bitmap.createBitmap(params.width, params.height, Bitmap.Config.ARGB_8888)
+                val bmp = Bitmap.createBitmap(width, height, Bitmap.Config.ARGB_8888)
                 // Convert RGB to ARGB
-                val rgb = bytes
-                val expectedMin = params.width * params.height * 3
+                val rgb = output.frames[0]
+                val expectedMin = width * height * 3
                 if (rgb.size < expectedMin) {
                     Log.w(
                             LOG_TAG,
-                            "txt2img returned short RGB buffer: size=${rgb.size}, expectedAtLeast=$expectedMin (w=${params.width}, h=${params.height})"
+                            "txt2img returned short RGB buffer: size=${rgb.size}, expectedAtLeast=$expectedMin (w=$width, h=$height)"
                     )
                 }
-                val pixels = IntArray(params.width * params.height)
+                val pixels = IntArray(width * height)
                 var idx = 0
                 var p = 0
                 while (idx + 2 < rgb.size && p < pixels.size) {
@@ -1928,10 +2462,49 @@ class StableDiffusion private constructor(private val handle: Long) : AutoClosea
                     idx += 3
                     p += 1
                 }
-                bmp.setPixels(pixels, 0, params.width, 0, 0, params.width, params.height)
+                bmp.setPixels(pixels, 0, width, 0, 0, width, height)
                 bmp
             }
 
+    suspend fun inpaint(params: GenerateParams, inpaint: InpaintParams): Bitmap =
+            withContext(Dispatchers.Default) {
+                val (rgb, width, height) = bitmapToRgbBytes(inpaint.image)
+                val initBytes = rgb.copyOf(width * height * 3)
+                val maskBitmap =
+                        if (inpaint.mask.width == width && inpaint.mask.height == height) {
+                            inpaint.mask
+                        } else {
+                            Bitmap.createScaledBitmap(inpaint.mask, width, height, true)
+                        }
+                val maskPixels = IntArray(width * height)
+                maskBitmap.getPixels(maskPixels, 0, width, 0, 0, width, height)
+                val maskBytes = ByteArray(maskPixels.size) { ((maskPixels[it] shr 16) and 0xFF).toByte() }
+
+                val bytes =
+                        generationMutex.withLock {
+                            selectLoras(params.loras)
+                            nativeBridge.inpaint(
+                                    handle,
+                                    params.prompt,
+                                    params.negative,
+                                    width,
+                                    height,
+                                    params.steps,
+                                    params.cfgScale,
+                                    params.seed,
+                                    initBytes,
+                                    maskBytes,
+                                    inpaint.strength,
+                                    inpaint.cropToMask,
+                                    inpaint.cropPadding,
+                                    inpaint.feather,
+                                    inpaint.cropTargetSize,
+                            )
+                                    ?: throw IllegalStateException("Inpainting failed")
+                        }
+                rgbBytesToBitmap(bytes, width, height)
+            }
+
     fun isEasyCacheSupported(): Boolean {
         if (!isNativeLibraryAvailable) return false
         return nativeIsEasyCacheSupported(handle)
@@ -1948,6 +2521,7 @@ class StableDiffusion private constructor(private val handle: Long) : AutoClosea
         if (!Companion.nativeBridgeOverriddenForTests && isNativeLibraryAvailable) {
             nativeDestroy(handle)
         }
+        takeDeferredLatents().forEach { it.close() }
         modelMetadata = null
     }
 
@@ -1998,6 +2572,64 @@ class StableDiffusion private constructor(private val handle: Long) : AutoClosea
 
     private external fun nativeCancelGeneration(handle: Long)
 
+    private external fun nativeSetLoras(
+            handle: Long,
+            paths: Array<String>,
+            multipliers: FloatArray,
+            highNoise: BooleanArray,
+    )
+
+    private external fun nativeInpaint(
+            handle: Long,
+            prompt: String,
+            negative: String,
+            width: Int,
+            height: Int,
+            steps: Int,
+            cfg: Float,
+            seed: Long,
+            initImage: ByteArray,
+            mask: ByteArray,
+            strength: Float,
+            cropEnabled: Boolean,
+            cropPadding: Int,
+            cropFeather: Int,
+            cropTargetSize: Int,
+    ): ByteArray?
+
+    private external fun nativeLoadUpscaler(handle: Long, path: String, tileSize: Int): Int
+    private external fun nativeUpscale(
+            handle: Long,
+            frames: Array<ByteArray>,
+            width: Int,
+            height: Int,
+            resetCancellation: Boolean,
+            dimsOut: IntArray
+    ): Array<ByteArray>?
+    private external fun nativeSetSparseAttention(
+            handle: Long,
+            enabled: Boolean,
+            windowFrames: Int,
+            globalStride: Int
+    )
+    private external fun nativeSetCheckpoint(
+            handle: Long,
+            pathPrefix: String?,
+            everyNSteps: Int,
+            resume: Boolean
+    )
+
+    private external fun nativeSetDeferredDecode(handle: Long, enabled: Boolean)
+
+    private external fun nativeTakeDeferredLatents(handle: Long): LongArray?
+
+    private external fun nativeDecodeLatent(
+            handle: Long,
+            latent: Long,
+            tiled: Boolean,
+            dimsOut: IntArray,
+    ): Array<ByteArray>?
+
     private external fun nativePrecomputeCondition(
             handle: Long,
             prompt: String,
@@ -2007,6 +2639,15 @@ class StableDiffusion private constructor(private val handle: Long) : AutoClosea
             clipSkip: Int,
     ): Array<Any?>?
 
+    private external fun nativePrecomputeConditionPair(
+            handle: Long,
+            prompt: String,
+            negative: String,
+            width: Int,
+            height: Int,
+            clipSkip: Int,
+    ): Array<Any?>?
+
     private external fun nativeTxt2VidWithPrecomputedCondition(
             handle: Long,
             prompt: String,
@@ -2128,6 +2769,30 @@ class StableDiffusion private constructor(private val handle: Long) : AutoClosea
         return nativeBridge.precomputeCondition(handle, prompt, negative, width, height, clipSkip)
     }
 
+    /**
+     * Precomputes the conditioning for [prompt] and the unconditional conditioning for
+     * [negative] (empty string for plain CFG) in a single native call.
+     *
+     * The text encoder weights are loaded once for both prompts, and T5 encoders run both
+     * sequences as one batched forward pass. Returns `(cond, uncond)`.
+     */
+    fun precomputeConditionPair(
+            prompt: String,
+            negative: String = "",
+            width: Int = 512,
+            height: Int = 512,
+            clipSkip: Int = -1
+    ): Pair<PrecomputedCondition, PrecomputedCondition>? {
+        return nativeBridge.precomputeConditionPair(
+                handle,
+                prompt,
+                negative,
+                width,
+                height,
+                clipSkip
+        )
+    }
+
     /**
      * Variant of txt2vid that accepts precomputed conditioning for both cond/uncond.
      *
@@ -2166,35 +2831,58 @@ class StableDiffusion private constructor(private val handle: Long) : AutoClosea
 
                 val startNanos = System.nanoTime()
                 val memoryBefore = readNativeMemoryMb()
-                val frameBytes =
+                val output =
                         try {
                             generationMutex.withLock {
                                 cancellationRequested.set(false)
-                                nativeBridge.txt2vidWithPrecomputedCondition(
-                                        handle,
-                                        params.prompt,
-                                        params.negative,
-                                        params.width,
-                                        params.height,
-                                        params.videoFrames,
-                                        params.steps,
-                                        params.cfgScale,
-                                        params.seed,
-                                        params.sampleMethod,
-                                        params.scheduler,
-                                        params.strength,
-                                        initBytes,
-                                        initWidth,
-                                        initHeight,
-                                        cond,
-                                        uncond,
-                                        params.vaceStrength,
-                                        params.easyCacheParams.enabled,
-                                        params.easyCacheParams.reuseThreshold,
-                                        params.easyCacheParams.startPercent,
-                                        params.easyCacheParams.endPercent,
-                                )
-                                        ?: throw IllegalStateException("Video generation failed")
+                                selectLoras(params.loras)
+                                setDeferredDecode(params.deferVaeDecode)
+                                setSparseAttention(params.sparseAttention)
+                                val frames =
+                                        nativeBridge.txt2vidWithPrecomputedCondition(
+                                                handle,
+                                                params.prompt,
+                                                params.negative,
+                                                params.width,
+                                                params.height,
+                                                params.videoFrames,
+                                                params.steps,
+                                                params.cfgScale,
+                                                params.seed,
+                                                params.sampleMethod,
+                                                params.scheduler,
+                                                params.strength,
+                                                initBytes,
+                                                initWidth,
+                                                initHeight,
+                                                cond,
+                                                uncond,
+                                                params.vaceStrength,
+                                                params.easyCacheParams.enabled,
+                                                params.easyCacheParams.reuseThreshold,
+                                                params.easyCacheParams.startPercent,
+                                                params.easyCacheParams.endPercent,
+                                        )
+                                                ?.also { stashDeferredLatents(params.deferVaeDecode) }
+                                                ?: throw IllegalStateException("Video generation failed")
+                                if (frames.isEmpty()) {
+                                    throw IllegalStateException("Video generation returned no frames")
+                                }
+
+                                // Note: Wan model calculates actual frames as (n-1)/4*4+1
+                                val expectedFrames = params.actualFrameCount()
+                                if (frames.size != expectedFrames) {
+                                    Log.w(
+                                            LOG_TAG,
+                                            "Expected $expectedFrames frames (formula: (${params.videoFrames}-1)/4*4+1) but received ${frames.size}",
+                                    )
+                                }
+
+                                if (params.upscale) {
+                                    upscaleFrames(frames, params.width, params.height)
+                                } else {
+                                    DecodedFrames(params.width, params.height, frames)
+                                }
                             }
                         } catch (t: Throwable) {
                             if (cancellationRequested.get()) {
@@ -2206,21 +2894,8 @@ class StableDiffusion private constructor(private val handle: Long) : AutoClosea
                             cancellationRequested.set(false)
                         }
 
-                if (frameBytes.isEmpty()) {
-                    throw IllegalStateException("Video generation returned no frames")
-                }
-
-                // Note: Wan model calculates actual frames as (n-1)/4*4+1
-                val expectedFrames = params.actualFrameCount()
-                if (frameBytes.size != expectedFrames) {
-                    Log.w(
-                            LOG_TAG,
-                            "Expected $expectedFrames frames (formula: (${params.videoFrames}-1)/4*4+1) but received ${frameBytes.size}",
-                    )
-                }
-
                 val conversionStart = System.nanoTime()
-                val bitmaps = convertFramesToBitmaps(frameBytes, params.width, params.height)
+                val bitmaps = convertFramesToBitmaps(output.frames, output.width, output.height)
                 val conversionSeconds = ((System.nanoTime() - conversionStart) / 1_000_000_000f)
                 val totalSeconds = ((System.nanoTime() - startNanos) / 1_000_000_000f)
                 val memoryAfter = readNativeMemoryMb()
@@ -2327,6 +3002,133 @@ class StableDiffusion private constructor(private val handle: Long) : AutoClosea
             return VIDEO_KEYWORDS.any { keyword -> value.contains(keyword) }
         }
     }
+
+    /**
+     * On-disk layout of a checkpoint directory: the request as `request.json`, the raw RGB init
+     * image as `init.rgb`, and the native sampler checkpoints as `sample.<n>`.
+     */
+    internal object VideoCheckpointStore {
+        private const val REQUEST_FILE = "request.json"
+        private const val INIT_FILE = "init.rgb"
+
+        class Stored(
+                val params: VideoGenerateParams,
+                val initImage: Triple<ByteArray, Int, Int>?,
+        )
+
+        fun samplePrefix(directory: File): String = File(directory, "sample").absolutePath
+
+        fun write(
+                directory: File,
+                params: VideoGenerateParams,
+                initImage: Triple<ByteArray, Int, Int>?,
+        ) {
+            check(directory.isDirectory || directory.mkdirs()) {
+                "Cannot create checkpoint directory $directory"
+            }
+            val loras = JSONArray()
+            params.loras.forEach {
+                loras.put(
+                        JSONObject()
+                                .put("path", it.path)
+                                .put("multiplier", it.multiplier.toDouble())
+                                .put("highNoise", it.highNoise)
+                )
+            }
+            val json =
+                    JSONObject()
+                            .put("prompt", params.prompt)
+                            .put("negative", params.negative)
+                            .put("width", params.width)
+                            .put("height", params.height)
+                            .put("videoFrames", params.videoFrames)
+                            .put("steps", params.steps)
+                            .put("cfgScale", params.cfgScale.toDouble())
+                            .put("seed", params.seed)
+                            .put("strength", params.strength.toDouble())
+                            .put("vaceStrength", params.vaceStrength.toDouble())
+                            .put("sampleMethod", params.sampleMethod.name)
+                            .put("scheduler", params.scheduler.name)
+                            .put("easyCacheEnabled", params.easyCacheParams.enabled)
+                            .put("easyCacheReuseThreshold", params.easyCacheParams.reuseThreshold.toDouble())
+                            .put("easyCacheStartPercent", params.easyCacheParams.startPercent.toDouble())
+                            .put("easyCacheEndPercent", params.easyCacheParams.endPercent.toDouble())
+                            .put("loras", loras)
+                            .put("deferVaeDecode", params.deferVaeDecode)
+                            .put("upscale", params.upscale)
+                            .put("everyNSteps", params.checkpoint?.everyNSteps ?: 0)
+            params.sparseAttention?.let {
+                json.put("sparseWindowFrames", it.windowFrames).put("sparseGlobalStride", it.globalStride)
+            }
+            val initFile = File(directory, INIT_FILE)
+            if (initImage != null) {
+                json.put("initWidth", initImage.second).put("initHeight", initImage.third)
+                initFile.writeBytes(initImage.first)
+            } else {
+                initFile.delete()
+            }
+            File(directory, REQUEST_FILE).writeText(json.toString())
+        }
+
+        fun read(directory: File): Stored? {
+            val requestFile = File(directory, REQUEST_FILE)
+            if (!requestFile.isFile) return null
+            val json = JSONObject(requestFile.readText())
+            val lorasJson = json.optJSONArray("loras") ?: JSONArray()
+            val loras =
+                    List(lorasJson.length()) { i ->
+                        val lora = lorasJson.getJSONObject(i)
+                        LoraSpec(
+                                path = lora.getString("path"),
+                                multiplier = lora.getDouble("multiplier").toFloat(),
+                                highNoise = lora.getBoolean("highNoise"),
+                        )
+                    }
+            val params =
+                    VideoGenerateParams(
+                            prompt = json.getString("prompt"),
+                            negative = json.getString("negative"),
+                            width = json.getInt("width"),
+                            height = json.getInt("height"),
+                            videoFrames = json.getInt("videoFrames"),
+                            steps = json.getInt("steps"),
+                            cfgScale = json.getDouble("cfgScale").toFloat(),
+                            seed = json.getLong("seed"),
+                            strength = json.getDouble("strength").toFloat(),
+                            vaceStrength = json.getDouble("vaceStrength").toFloat(),
+                            sampleMethod = SampleMethod.valueOf(json.getString("sampleMethod")),
+                            scheduler = Scheduler.valueOf(json.getString("scheduler")),
+                            easyCacheParams =
+                                    EasyCacheParams(
+                                            enabled = json.getBoolean("easyCacheEnabled"),
+                                            reuseThreshold = json.getDouble("easyCacheReuseThreshold").toFloat(),
+                                            startPercent = json.getDouble("easyCacheStartPercent").toFloat(),
+                                            endPercent = json.getDouble("easyCacheEndPercent").toFloat(),
+                                    ),
+                            loras = loras,
+                            deferVaeDecode = json.getBoolean("deferVaeDecode"),
+                            upscale = json.optBoolean("upscale"),
+                            checkpoint = CheckpointOptions(directory, json.getInt("everyNSteps")),
+                            sparseAttention =
+                                    if (json.has("sparseWindowFrames")) {
+                                        SparseAttention(
+                                                windowFrames = json.getInt("sparseWindowFrames"),
+                                                globalStride = json.getInt("sparseGlobalStride"),
+                                        )
+                                    } else {
+                                        null
+                                    },
+                    )
+            val initFile = File(directory, INIT_FILE)
+            val initImage =
+                    if (json.has("initWidth") && initFile.isFile) {
+                        Triple(initFile.readBytes(), json.getInt("initWidth"), json.getInt("initHeight"))
+                    } else {
+                        null
+                    }
+            return Stored(params, initImage)
+        }
+    }
 }
 
 object SimpleGenerator {
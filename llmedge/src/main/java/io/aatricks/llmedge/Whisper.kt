@@ -17,7 +17,6 @@
 package io.aatricks.llmedge
 
 import android.content.Context
-import android.os.Build
 import android.util.Log
 import io.aatricks.llmedge.huggingface.HuggingFaceHub
 import java.io.File
@@ -341,7 +340,14 @@ class Whisper private constructor(private val handle: Long) : AutoCloseable {
             /** High-pass frequency cutoff for VAD in Hz */
             val vadFreqThreshold: Float = 100.0f,
             /** Enable VAD to only transcribe when speech is detected */
-            val useVad: Boolean = true
+            val useVad: Boolean = true,
+            /**
+             * Keyword gate (e.g. [KeywordSpotter]). When set, audio is dropped until the keyword is
+             * heard and transcribed only for [keywordWindowMs] afterwards.
+             */
+            val keywordGate: KeywordGate? = null,
+            /** How long a keyword detection keeps the transcriber listening. Default: 8000ms */
+            val keywordWindowMs: Int = 8000
     )
 
     /**
@@ -385,6 +391,9 @@ class Whisper private constructor(private val handle: Long) : AutoCloseable {
         private val samplesLength = params.lengthMs * samplesPerMs
         private val samplesKeep = min(params.keepMs, params.stepMs) * samplesPerMs
 
+        private val keywordWindow =
+                params.keywordGate?.let { KeywordWindow(it, params.keywordWindowMs * samplesPerMs) }
+
         /**
          * Feed audio samples to the streaming transcriber.
          *
@@ -398,7 +407,8 @@ class Whisper private constructor(private val handle: Long) : AutoCloseable {
         suspend fun feedAudio(samples: FloatArray) =
                 mutex.withLock {
                     if (isRunning && !isPaused) {
-                        for (sample in samples) {
+                        val admitted = keywordWindow?.admit(samples) ?: samples
+                        for (sample in admitted) {
                             audioBuffer.add(sample)
                         }
                     }
@@ -409,6 +419,9 @@ class Whisper private constructor(private val handle: Long) : AutoCloseable {
             return audioBuffer.size / samplesPerMs
         }
 
+        /** Whether a keyword detection currently lets audio through (always true without a gate). */
+        fun isListening(): Boolean = keywordWindow?.isOpen ?: true
+
         /** Check if enough audio is buffered for processing. */
         fun hasEnoughAudio(): Boolean {
             return audioBuffer.size >= samplesStep
@@ -710,32 +723,9 @@ class Whisper private constructor(private val handle: Long) : AutoCloseable {
                 println("[Whisper] Native library load disabled via llmedge.disableNativeLoad=true")
             } else {
                 try {
-                    // Try to load the whisper native library
-                    // On Android, we have architecture-specific variants
-                    // On desktop/JVM testing, we use whisper_jni
-
-                    // First, check if this is a desktop JVM environment (for testing)
-                    val osName = System.getProperty("os.name")?.lowercase() ?: ""
-                    val isDesktopJvm = osName.contains("linux") && !osName.contains("android")
-
-                    if (isDesktopJvm) {
-                        // Desktop JVM testing - load whisper_jni directly
-                        logD(LOG_TAG, "Loading libwhisper_jni.so for desktop testing")
-                        System.loadLibrary("whisper_jni")
-                    } else {
-                        // Android environment
-                        val isEmulated =
-                                Build.HARDWARE.contains("goldfish") ||
-                                        Build.HARDWARE.contains("ranchu")
-
-                        if (!isEmulated && supportsArm64V8a()) {
-                            logD(LOG_TAG, "Loading libwhisper_arm64.so")
-                            System.loadLibrary("whisper_arm64")
-                        } else {
-                            logD(LOG_TAG, "Loading default libwhisper.so")
-                            System.loadLibrary("whisper")
-                        }
-                    }
+                    // Load the whisper_jni build matching the CPU features (dotprod, i8mm, SVE
+                    // on arm64; AVX2/AVX-512 on desktop), falling back to the baseline library
+                    logD(LOG_TAG, "Loaded lib${NativeLibraryLoader.load("whisper_jni")}.so")
                 } catch (e: UnsatisfiedLinkError) {
                     logE(LOG_TAG, "Failed to load whisper native library: ${e.message}")
                 }
@@ -745,10 +735,6 @@ class Whisper private constructor(private val handle: Long) : AutoCloseable {
         // Dummy instance used to invoke static native methods that are now at the class level.
         private val staticInvoker by lazy { Whisper(0L) }
 
-        private fun supportsArm64V8a(): Boolean {
-            return Build.SUPPORTED_64_BIT_ABIS.any { it == "arm64-v8a" }
-        }
-
         /** Check if native bindings are available. */
         @JvmStatic
         fun checkBindings(): Boolean {
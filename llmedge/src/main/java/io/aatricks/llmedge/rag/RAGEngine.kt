@@ -18,6 +18,8 @@ package io.aatricks.llmedge.rag
 
 import android.content.Context
 import android.net.Uri
+import com.google.gson.Gson
+import com.google.gson.reflect.TypeToken
 import io.aatricks.llmedge.SmolLM
 import android.util.Log
 import kotlinx.coroutines.Dispatchers
@@ -25,6 +27,69 @@ import kotlinx.coroutines.withContext
 import java.io.File
 import java.util.UUID
 
+/**
+ * Precomputed per-passage KV caches.
+ *
+ * @property enabled Compute each chunk's KV cache at ingest time and splice the cached passages into
+ * prompts in [RAGEngine.ask] instead of prefilling them for every query. The KV files are only
+ * valid for the model that was loaded when the document was indexed.
+ * @property recomputeRatio Fraction of each passage's tokens decoded again at query time so the
+ * passage attends to the text and passages placed before it.
+ */
+data class PassageKvOptions(
+    val enabled: Boolean = false,
+    val recomputeRatio: Float = 0.15f,
+)
+
+/**
+ * Time to first token and answer agreement of spliced passage KV versus a full prefill of the same
+ * prompt, from [RAGEngine.comparePassageKv].
+ */
+data class PassageKvReport(
+    val ttftFullPrefillMs: Double,
+    val ttftPassageKvMs: Double,
+    val fullPrefillAnswer: String,
+    val passageKvAnswer: String,
+    val answerF1: Float,
+    val stats: SmolLM.PassageStats?,
+) {
+    val ttftSpeedup: Double
+        get() = if (ttftPassageKvMs <= 0.0) 0.0 else ttftFullPrefillMs / ttftPassageKvMs
+}
+
+/**
+ * Query-aware compression of the retrieved context before the prompt is built.
+ *
+ * @property compressor Small model that scores the context tokens (see [SmolLM.compressContext]);
+ * null disables compression. Compressed context is always prefilled, so [PassageKvOptions] is
+ * ignored while this is set.
+ * @property targetRatio Fraction of the context tokens to keep.
+ */
+data class ContextCompressionOptions(
+    val compressor: SmolLM? = null,
+    val targetRatio: Float = 0.5f,
+)
+
+/** A question and its reference answer, for [RAGEngine.evaluateCompression]. */
+data class RagEvalItem(
+    val question: String,
+    val answer: String,
+)
+
+/**
+ * Mean cost and answer quality of context compression over an eval set, from
+ * [RAGEngine.evaluateCompression]. F1 is the word overlap of each answer with the reference.
+ */
+data class CompressionEvalReport(
+    val items: Int,
+    val keptRatio: Float,
+    val compressionMs: Double,
+    val ttftFullContextMs: Double,
+    val ttftCompressedMs: Double,
+    val fullContextF1: Float,
+    val compressedF1: Float,
+)
+
 /**
  * Minimal on-device RAG pipeline wiring:
  * - Document load (PDF only for now)
@@ -38,12 +103,15 @@ class RAGEngine(
     private val smolLM: SmolLM,
     private val splitter: TextSplitter = TextSplitter(),
     embeddingConfig: EmbeddingConfig = EmbeddingConfig(),
+    private val passageKv: PassageKvOptions = PassageKvOptions(),
+    private val compression: ContextCompressionOptions = ContextCompressionOptions(),
 ) {
     private val embeddingProvider = EmbeddingProvider(context, embeddingConfig)
     @Volatile private var lastContext: String = ""
     private val vectorStore = InMemoryVectorStore(
         File(context.filesDir, "rag_store/index.json")
     )
+    private val passageKvDir = File(context.filesDir, "rag_store/kv")
     private var systemPromptInjected = false
 
     suspend fun init() {
@@ -63,34 +131,174 @@ class RAGEngine(
         }
         vectorStore.addAll(entries)
         vectorStore.save()
+        if (passageKv.enabled) {
+            storePassageKv(entries)
+        }
         return@withContext entries.size
     }
 
     suspend fun ask(question: String, topK: Int = 5): String = withContext(Dispatchers.Default) {
         checkNotNull(smolLM) { "SmolLM must be initialized and loaded with a model before calling ask()" }
-        val contextText = contextFor(question, topK)
-        if (contextText.isBlank()) {
+        val selection = selectContext(question, topK)
+        if (selection.text.isBlank()) {
             Log.w(TAG, "No retrieval hits; vector store empty or no similar content")
             return@withContext "No relevant context found in the indexed documents. If your PDF is a scanned image, text extraction may be empty (no OCR). Try a text-based PDF."
         }
         ensureSystemPrompt()
-        val prompt = buildPrompt(contextText, question)
-        val answer = smolLM.getResponse(prompt)
+        if (compression.compressor != null) {
+            val contextText = compress(question, selection.text)
+            return@withContext smolLM.getResponse(buildPrompt(contextText, question)).trim()
+        }
+        val passages = if (passageKv.enabled) loadPassageKv(selection) else null
+        val answer = if (passages != null) {
+            try {
+                smolLM.getResponseWithPassages(
+                    buildPrompt(SmolLM.PASSAGE_MARKER, question),
+                    passages,
+                    selection.gaps(),
+                    passageKv.recomputeRatio,
+                )
+            } catch (e: IllegalArgumentException) {
+                Log.w(TAG, "Passage KV unusable (${e.message}); prefilling the context instead")
+                smolLM.getResponse(buildPrompt(selection.text, question))
+            }
+        } else {
+            smolLM.getResponse(buildPrompt(selection.text, question))
+        }
         return@withContext answer.trim()
     }
+
     suspend fun contextFor(question: String, topK: Int = 5): String = withContext(Dispatchers.Default) {
-        val hitsWithScores = retrieve(question, topK)
-        if (hitsWithScores.isEmpty()) {
-            lastContext = ""
-            return@withContext ""
+        compress(question, selectContext(question, topK).text)
+    }
+
+    /**
+     * Answers [question] twice from the same retrieved context, once with a full prefill and once
+     * from the stored passage KV, and reports time to first token and how closely the answers
+     * agree. Clears the model's chat history (system prompts are kept) around each run.
+     */
+    suspend fun comparePassageKv(question: String, topK: Int = 5, maxTokens: Int = 64): PassageKvReport =
+        withContext(Dispatchers.Default) {
+            val selection = selectContext(question, topK)
+            val passages = checkNotNull(loadPassageKv(selection)) {
+                "No stored passage KV for the retrieved context; index with PassageKvOptions(enabled = true)"
+            }
+            ensureSystemPrompt()
+            val fullPrompt = buildPrompt(selection.text, question)
+            val kvPrompt = buildPrompt(SmolLM.PASSAGE_MARKER, question)
+            val gaps = selection.gaps()
+            val (_, ttftFull) = timed { smolLM.getResponse(fullPrompt, maxTokens = 1) }
+            val (_, ttftKv) = timed {
+                smolLM.getResponseWithPassages(kvPrompt, passages, gaps, passageKv.recomputeRatio, maxTokens = 1)
+            }
+            val stats = smolLM.getPassageStats()
+            val (fullAnswer, _) = timed { smolLM.getResponse(fullPrompt, maxTokens) }
+            val (kvAnswer, _) = timed {
+                smolLM.getResponseWithPassages(kvPrompt, passages, gaps, passageKv.recomputeRatio, maxTokens)
+            }
+            smolLM.clearHistory()
+            PassageKvReport(ttftFull, ttftKv, fullAnswer.trim(), kvAnswer.trim(), answerF1(fullAnswer, kvAnswer), stats)
+        }
+
+    /**
+     * Answers every question of [evalSet] with the full retrieved context and with the context
+     * compressed by [ContextCompressionOptions.compressor], and reports the mean kept ratio,
+     * compression cost, time to first token and answer F1 against the reference answers.
+     * Clears the model's chat history (system prompts are kept) around each run.
+     */
+    suspend fun evaluateCompression(
+        evalSet: List<RagEvalItem>,
+        topK: Int = 5,
+        maxTokens: Int = 64,
+    ): CompressionEvalReport = withContext(Dispatchers.Default) {
+        val compressor = checkNotNull(compression.compressor) { "No compressor configured" }
+        ensureSystemPrompt()
+        var kept = 0.0
+        var compressionMs = 0.0
+        var ttftFull = 0.0
+        var ttftCompressed = 0.0
+        var fullF1 = 0.0
+        var compressedF1 = 0.0
+        for (item in evalSet) {
+            val contextText = selectContext(item.question, topK).text
+            val start = System.nanoTime()
+            val compressed = compressor.compressContext(item.question, contextText, compression.targetRatio)
+            compressionMs += (System.nanoTime() - start) / 1e6
+            kept += compressor.getCompressionStats()?.ratio ?: 1f
+
+            val fullPrompt = buildPrompt(contextText, item.question)
+            val compressedPrompt = buildPrompt(compressed, item.question)
+            ttftFull += timed { smolLM.getResponse(fullPrompt, maxTokens = 1) }.second
+            ttftCompressed += timed { smolLM.getResponse(compressedPrompt, maxTokens = 1) }.second
+            fullF1 += answerF1(item.answer, timed { smolLM.getResponse(fullPrompt, maxTokens) }.first)
+            compressedF1 += answerF1(item.answer, timed { smolLM.getResponse(compressedPrompt, maxTokens) }.first)
         }
-        val ctx = buildContextFromHits(hitsWithScores)
-        lastContext = ctx
-        return@withContext ctx
+        smolLM.clearHistory()
+        val n = evalSet.size.coerceAtLeast(1)
+        CompressionEvalReport(
+            items = evalSet.size,
+            keptRatio = (kept / n).toFloat(),
+            compressionMs = compressionMs / n,
+            ttftFullContextMs = ttftFull / n,
+            ttftCompressedMs = ttftCompressed / n,
+            fullContextF1 = (fullF1 / n).toFloat(),
+            compressedF1 = (compressedF1 / n).toFloat(),
+        )
     }
 
     fun getLastContext(): String = lastContext
 
+    private suspend fun selectContext(question: String, topK: Int): ContextSelection {
+        val selection = selectContextFromHits(retrieve(question, topK))
+        lastContext = selection.text
+        return selection
+    }
+
+    private fun compress(question: String, contextText: String): String {
+        val compressor = compression.compressor ?: return contextText
+        if (contextText.isBlank()) return contextText
+        val compressed = try {
+            compressor.compressContext(question, contextText, compression.targetRatio)
+        } catch (e: IllegalStateException) {
+            Log.w(TAG, "Context compression failed (${e.message}); using the full context")
+            return contextText
+        }
+        lastContext = compressed
+        return compressed
+    }
+
+    /** Runs [block] on a cleared chat history; returns its result and wall time in ms. */
+    private fun timed(block: () -> String): Pair<String, Double> {
+        smolLM.clearHistory()
+        val start = System.nanoTime()
+        val answer = block()
+        return answer to (System.nanoTime() - start) / 1e6
+    }
+
+    private fun passageKvFile(entry: VectorEntry) = File(passageKvDir, "${entry.id}.kv")
+
+    private fun storePassageKv(entries: List<VectorEntry>) {
+        passageKvDir.mkdirs()
+        try {
+            for (entry in entries) {
+                val blob = smolLM.encodePassage(entry.text.trim()) ?: continue
+                passageKvFile(entry).writeBytes(blob)
+            }
+        } catch (e: Throwable) {
+            // queries fall back to prefilling the chunks that have no KV file
+            Log.w(TAG, "Could not precompute passage KV (is a model loaded?): ${e.message}")
+        }
+    }
+
+    private fun loadPassageKv(selection: ContextSelection): List<ByteArray>? {
+        if (!selection.spliceable) return null
+        return selection.entries.map { entry ->
+            val file = passageKvFile(entry)
+            if (!file.exists()) return null
+            file.readBytes()
+        }
+    }
+
     private fun ensureSystemPrompt() {
         if (!systemPromptInjected) {
             smolLM.addSystemPrompt(SYSTEM_PROMPT)
@@ -111,34 +319,6 @@ class RAGEngine(
         """.trimIndent()
     }
 
-    private fun buildContextFromHits(hitsWithScores: List<Pair<VectorEntry, Float>>): String {
-        // Filter weak matches and truncate to avoid overlong prompts
-        val minScore = 0.10f
-        val sb = StringBuilder()
-        var totalChars = 0
-        val maxChars = 3000
-        for ((entry, score) in hitsWithScores) {
-            if (score < minScore) continue
-            val piece = entry.text.trim()
-            if (piece.isEmpty()) continue
-            val header = "[score=${"%.3f".format(score)}]\n"
-            val toAdd = (header + piece + "\n\n---\n\n")
-            if (totalChars + toAdd.length > maxChars) break
-            sb.append(toAdd)
-            totalChars += toAdd.length
-        }
-        if (sb.isNotEmpty()) return sb.toString()
-        // Fallback: include top-1 chunk even if below threshold
-        if (hitsWithScores.isNotEmpty()) {
-            val (entry, score) = hitsWithScores.first()
-            val piece = entry.text.trim()
-            if (piece.isNotEmpty()) {
-                val header = "[score=${"%.3f".format(score)}]\n"
-                return (header + piece.take(1500))
-            }
-        }
-        return ""
-    }
 
     suspend fun retrieve(question: String, topK: Int = 5): List<Pair<VectorEntry, Float>> = withContext(Dispatchers.Default) {
         val qEmb = embeddingProvider.encode(question)
@@ -151,8 +331,75 @@ class RAGEngine(
         hits.joinToString("\n\n") { (e, s) -> "score=${"%.3f".format(s)}\n" + e.text.take(300) }
     }
 
+    /**
+     * Retrieved chunks chosen for a prompt: [text] is `headers[i] + entries[i].text.trim() +`
+     * [SEPARATOR] for each entry. [spliceable] is false when [text] is not made of whole chunks.
+     */
+    internal data class ContextSelection(
+        val entries: List<VectorEntry>,
+        val headers: List<String>,
+        val text: String,
+        val spliceable: Boolean,
+    ) {
+        /** Text around the passages, as [SmolLM.getResponseWithPassages] expects it. */
+        fun gaps(): List<String> =
+            headers.mapIndexed { i, header -> if (i == 0) header else SEPARATOR + header } + SEPARATOR
+    }
+
     companion object {
         private const val TAG = "RAGEngine"
+        internal const val SEPARATOR = "\n\n---\n\n"
+
+        internal fun selectContextFromHits(hitsWithScores: List<Pair<VectorEntry, Float>>): ContextSelection {
+            // Filter weak matches and truncate to avoid overlong prompts
+            val minScore = 0.10f
+            val sb = StringBuilder()
+            var totalChars = 0
+            val maxChars = 3000
+            val entries = mutableListOf<VectorEntry>()
+            val headers = mutableListOf<String>()
+            for ((entry, score) in hitsWithScores) {
+                if (score < minScore) continue
+                val piece = entry.text.trim()
+                if (piece.isEmpty()) continue
+                val header = "[score=${"%.3f".format(score)}]\n"
+                val toAdd = (header + piece + SEPARATOR)
+                if (totalChars + toAdd.length > maxChars) break
+                sb.append(toAdd)
+                totalChars += toAdd.length
+                entries += entry
+                headers += header
+            }
+            if (sb.isNotEmpty()) return ContextSelection(entries, headers, sb.toString(), spliceable = true)
+            // Fallback: include top-1 chunk even if below threshold
+            if (hitsWithScores.isNotEmpty()) {
+                val (entry, score) = hitsWithScores.first()
+                val piece = entry.text.trim()
+                if (piece.isNotEmpty()) {
+                    val header = "[score=${"%.3f".format(score)}]\n"
+                    return ContextSelection(listOf(entry), listOf(header), header + piece.take(1500), spliceable = false)
+                }
+            }
+            return ContextSelection(emptyList(), emptyList(), "", spliceable = false)
+        }
+
+        /** Reads a fixed eval set stored as a JSON array of `{"question": ..., "answer": ...}`. */
+        fun loadEvalSet(file: File): List<RagEvalItem> {
+            val type = object : TypeToken<List<RagEvalItem>>() {}.type
+            return Gson().fromJson<List<RagEvalItem>>(file.readText(), type).orEmpty()
+        }
+
+        /** Bag-of-words F1 between two answers, used to compare passage KV with full prefill. */
+        internal fun answerF1(reference: String, candidate: String): Float {
+            fun words(s: String) = s.lowercase().split(Regex("\\W+")).filter { it.isNotEmpty() }
+            val ref = words(reference).groupingBy { it }.eachCount()
+            val cand = words(candidate).groupingBy { it }.eachCount()
+            val common = ref.entries.sumOf { (word, n) -> minOf(n, cand[word] ?: 0) }
+            if (common == 0) return if (ref.isEmpty() && cand.isEmpty()) 1f else 0f
+            val precision = common.toFloat() / cand.values.sum()
+            val recall = common.toFloat() / ref.values.sum()
+            return 2 * precision * recall / (precision + recall)
+        }
         private const val SYSTEM_PROMPT = "You are a question answering assistant. Use only the provided context to answer. If the context does not contain the answer, say 'I don't know'."
     }
 }
@@ -2,6 +2,115 @@ package io.aatricks.llmedge.vision
 
 import android.util.Log
 
+/**
+ * Cap on the number of image tokens the projector may emit for one image.
+ *
+ * @property maxTokens Hard cap per image; 0 means no cap.
+ * @property automatic Also scale the budget with the image's edge density, so flat screenshots and
+ * low-detail photos get as little as a quarter of the projector's full token count.
+ */
+data class ImageTokenBudget(
+    val maxTokens: Int = 0,
+    val automatic: Boolean = false,
+) {
+    val isUnlimited: Boolean
+        get() = maxTokens <= 0 && !automatic
+
+    companion object {
+        val FULL = ImageTokenBudget()
+        val AUTO = ImageTokenBudget(automatic = true)
+    }
+}
+
+/**
+ * How one image was encoded under an [ImageTokenBudget].
+ *
+ * @property fullTokens Tokens the projector produces for the image as loaded.
+ * @property tokens Tokens written after downscaling and pooling.
+ * @property downscale Linear scale applied to the bitmap before encoding (1 = unchanged).
+ * @property poolFactor Side of the square cells the projector output grid was averaged over.
+ * @property complexity Edge density of the image in [0, 1], used by the automatic budget.
+ * @property encodeMicros Time spent loading, resizing, encoding and pooling.
+ */
+data class ImageEncodeStats(
+    val fullTokens: Int,
+    val tokens: Int,
+    val downscale: Float,
+    val poolFactor: Int,
+    val complexity: Float,
+    val encodeMicros: Long,
+) {
+    /** Fraction of the image tokens (and so of the image prefill) saved by the budget. */
+    val tokenReduction: Float
+        get() = if (fullTokens <= 0) 0f else 1f - tokens.toFloat() / fullTokens
+
+    companion object {
+        internal fun fromNative(stats: LongArray): ImageEncodeStats? {
+            if (stats.size < 6) return null
+            return ImageEncodeStats(
+                fullTokens = stats[0].toInt(),
+                tokens = stats[1].toInt(),
+                downscale = stats[2] / 1000f,
+                poolFactor = stats[3].toInt(),
+                complexity = stats[4] / 1000f,
+                encodeMicros = stats[5],
+            )
+        }
+    }
+}
+
+/**
+ * Which frames of a clip are encoded by [Projector.encodeFramesToFile].
+ *
+ * @property maxHashDistance A frame is skipped when its 64-bit difference hash is within this many
+ * bits of the last frame kept; 0 only drops exact look-alikes.
+ * @property maxFrames Distinct frames are sampled evenly down to this many; 0 keeps them all.
+ * @property clipTokenBudget Image tokens shared by all kept frames; 0 means no cap.
+ * @property automatic Also scale each frame's share with its edge density (see [ImageTokenBudget]).
+ */
+data class FrameSelection(
+    val maxHashDistance: Int = 6,
+    val maxFrames: Int = 8,
+    val clipTokenBudget: Int = 0,
+    val automatic: Boolean = false,
+)
+
+/**
+ * How a clip was encoded by [Projector.encodeFramesToFile].
+ *
+ * @property frames Frames passed in.
+ * @property keptFrames Indices into the input paths of the frames that were encoded, in order.
+ * @property fullTokens Tokens the kept frames would produce without a budget.
+ * @property tokens Tokens written for the whole clip.
+ * @property hashMicros Time spent decoding and hashing frames.
+ * @property totalMicros Total time, including encoding the kept frames.
+ */
+data class ClipEncodeStats(
+    val frames: Int,
+    val keptFrames: List<Int>,
+    val fullTokens: Int,
+    val tokens: Int,
+    val hashMicros: Long,
+    val totalMicros: Long,
+) {
+    val skippedFrames: Int
+        get() = frames - keptFrames.size
+
+    companion object {
+        internal fun fromNative(stats: LongArray): ClipEncodeStats? {
+            if (stats.size < 6 || stats.size < 6 + stats[1].toInt()) return null
+            return ClipEncodeStats(
+                frames = stats[0].toInt(),
+                keptFrames = (0 until stats[1].toInt()).map { stats[6 + it].toInt() },
+                fullTokens = stats[2].toInt(),
+                tokens = stats[3].toInt(),
+                hashMicros = stats[4],
+                totalMicros = stats[5],
+            )
+        }
+    }
+}
+
 /**
  * Native-backed helper for preparing images using an mmproj file.
  *
@@ -36,6 +145,28 @@ class Projector {
     private external fun nativeInitProjector(mmprojPath: String, textModelPtr: Long): Long
     private external fun nativeEncodeImage(nativePtr: Long, imagePath: String, outPath: String): Boolean
     private external fun nativeCloseProjector(nativePtr: Long)
+    private external fun nativeEncodeImageWithBudget(
+        nativePtr: Long,
+        imagePath: String,
+        outPath: String,
+        maxTokens: Int,
+        automatic: Boolean,
+    ): LongArray?
+
+    private external fun nativeEncodeFrames(
+        nativePtr: Long,
+        framePaths: Array<String>,
+        outPath: String,
+        maxDistance: Int,
+        maxFrames: Int,
+        clipTokenBudget: Int,
+        automatic: Boolean,
+    ): LongArray?
+
+    /** Stats of the last successful [encodeImageToFile] that ran under a budget, or null. */
+    @Volatile
+    var lastEncodeStats: ImageEncodeStats? = null
+        private set
 
     /** Initialize projector without a native text model pointer. */
     fun init(mmprojPath: String) {
@@ -86,6 +217,63 @@ class Projector {
         }
     }
 
+    /**
+     * Like [encodeImageToFile], but keeps at most the image tokens [budget] allows: the image is
+     * downscaled before encoding (which shrinks the output of dynamic-resolution projectors) and
+     * the projector's output grid is average-pooled if it is still over budget. The written
+     * `.meta.json` describes the reduced grid, so the result replays like any other encoding.
+     */
+    fun encodeImageToFile(imagePath: String, outPath: String, budget: ImageTokenBudget): Boolean {
+        if (budget.isUnlimited || nativePtr == 0L) {
+            return encodeImageToFile(imagePath, outPath)
+        }
+        return try {
+            val stats = nativeEncodeImageWithBudget(nativePtr, imagePath, outPath, budget.maxTokens, budget.automatic)
+                ?: return false
+            lastEncodeStats = ImageEncodeStats.fromNative(stats)
+            lastEncodeStats?.let {
+                Log.d(TAG, "image tokens ${it.fullTokens} -> ${it.tokens} (scale=${it.downscale}, pool=${it.poolFactor}, " +
+                    "complexity=${it.complexity}) in ${it.encodeMicros / 1000} ms")
+            }
+            true
+        } catch (e: UnsatisfiedLinkError) {
+            Log.w(TAG, "nativeEncodeImageWithBudget not available: ${e.message}")
+            encodeImageToFile(imagePath, outPath)
+        }
+    }
+
+    /**
+     * Encodes the frames of a clip into one prepared-embedding file, in order, skipping frames that
+     * look like the frame before them (see [FrameSelection]). The result replays into the model as
+     * a single image prompt, so only the distinct frames pay for projector encoding and prefill.
+     * Returns null if the native projector is unavailable or encoding failed.
+     */
+    fun encodeFramesToFile(
+        framePaths: List<String>,
+        outPath: String,
+        selection: FrameSelection = FrameSelection(),
+    ): ClipEncodeStats? {
+        if (nativePtr == 0L || framePaths.isEmpty()) return null
+        return try {
+            val stats = nativeEncodeFrames(
+                nativePtr,
+                framePaths.toTypedArray(),
+                outPath,
+                selection.maxHashDistance,
+                selection.maxFrames,
+                selection.clipTokenBudget,
+                selection.automatic,
+            ) ?: return null
+            ClipEncodeStats.fromNative(stats)?.also {
+                Log.d(TAG, "clip frames ${it.frames} -> ${it.keptFrames.size}, tokens ${it.fullTokens} -> ${it.tokens} " +
+                    "in ${it.totalMicros / 1000} ms")
+            }
+        } catch (e: UnsatisfiedLinkError) {
+            Log.w(TAG, "nativeEncodeFrames not available: ${e.message}")
+            null
+        }
+    }
+
     fun close() {
         try {
             if (nativePtr != 0L) {
@@ -0,0 +1,36 @@
+#pragma once
+// Stand-in for LLMInference with only the paging surface KvSessionManager.cpp uses. CMake copies
+// it next to a copy of KvSessionManager.cpp as "LLMInference.h", so the manager's LRU and budget
+// logic can be tested without loading a model.
+#include <cstddef>
+#include <string>
+
+class LLMInference {
+  public:
+    explicit LLMInference(size_t kvBytes) : _kvBytes(kvBytes) {}
+
+    size_t kvCacheBytes() const { return isPagedOut() ? 0 : _kvBytes; }
+    bool   isPagedOut() const { return !_pagedPath.empty(); }
+
+    bool pageOut(const std::string& path) {
+        if (failPageOut) {
+            return false;
+        }
+        _pagedPath = path;
+        pageOuts++;
+        return true;
+    }
+
+    void pageIn() {
+        _pagedPath.clear();
+        pageIns++;
+    }
+
+    bool failPageOut = false;
+    int  pageOuts = 0;
+    int  pageIns = 0;
+
+  private:
+    size_t      _kvBytes;
+    std::string _pagedPath;
+};
@@ -132,9 +132,15 @@ sd_image_t* generate_video(sd_ctx_t*, const sd_vid_gen_params_t* params, int* nu
     return images;
 }
 
-upscaler_ctx_t* new_upscaler_ctx(const char*, bool, bool, int) { return nullptr; }
+upscaler_ctx_t* new_upscaler_ctx(const char*, bool, bool, int, int) { return nullptr; }
 void free_upscaler_ctx(upscaler_ctx_t*) {}
-sd_image_t upscale(upscaler_ctx_t*, sd_image_t input_image, uint32_t) { return input_image; }
+sd_image_t upscale(upscaler_ctx_t*, sd_image_t input_image, uint32_t) {
+    const size_t bytes = static_cast<size_t>(input_image.width) * input_image.height * input_image.channel;
+    sd_image_t out = input_image;
+    out.data = static_cast<uint8_t*>(malloc(bytes));
+    memcpy(out.data, input_image.data, bytes);
+    return out;
+}
 int get_upscale_factor(upscaler_ctx_t*) { return 1; }
 
 bool convert(const char*, const char*, const char*, enum sd_type_t, const char*) { return true; }
@@ -247,6 +253,39 @@ void sd_free_condition(sd_condition_raw_t* cond) {
     free(cond);
 }
 
+bool sd_precompute_condition_pair(sd_ctx_t* sd_ctx,
+                                  const char* text,
+                                  const char* negative_text,
+                                  int clip_skip,
+                                  int width,
+                                  int height,
+                                  bool zero_out_masked,
+                                  sd_condition_raw_t** cond_out,
+                                  sd_condition_raw_t** uncond_out) {
+    (void)text;
+    (void)negative_text;
+    (void)clip_skip;
+    (void)width;
+    (void)height;
+    (void)zero_out_masked;
+    if (!cond_out || !uncond_out) return false;
+    *cond_out = sd_precompute_condition(sd_ctx, nullptr);
+    *uncond_out = sd_precompute_condition(sd_ctx, nullptr);
+    return *cond_out != nullptr && *uncond_out != nullptr;
+}
+
+bool sd_t5_precompute_condition_pair(void* t5_embedder,
+                                     int n_threads,
+                                     const char* text,
+                                     const char* negative_text,
+                                     bool zero_out_masked,
+                                     sd_condition_raw_t** cond_out,
+                                     sd_condition_raw_t** uncond_out) {
+    (void)t5_embedder;
+    (void)n_threads;
+    return sd_precompute_condition_pair(nullptr, text, negative_text, 0, 0, 0, zero_out_masked, cond_out, uncond_out);
+}
+
 sd_image_t* sd_generate_video_with_precomputed_condition(sd_ctx_t* sd_ctx,
                                                         const sd_vid_gen_params_t* sd_vid_gen_params,
                                                         const sd_condition_raw_t* cond,
@@ -258,4 +297,42 @@ sd_image_t* sd_generate_video_with_precomputed_condition(sd_ctx_t* sd_ctx,
     return generate_video(sd_ctx, sd_vid_gen_params, num_frames_out);
 }
 
+
+struct sd_latent_t {
+    int width;
+    int height;
+};
+
+void sd_set_deferred_decode(sd_ctx_t*, bool) {}
+
+int sd_take_deferred_latents(sd_ctx_t*, sd_latent_t** latents_out, int max_latents) {
+    if (latents_out == nullptr || max_latents <= 0) {
+        return 0;
+    }
+    latents_out[0] = new sd_latent_t{64, 64};
+    return 1;
+}
+
+sd_image_t* sd_decode_latent(sd_ctx_t*, const sd_latent_t* latent, bool, int* num_frames_out) {
+    if (latent == nullptr || num_frames_out == nullptr) {
+        return nullptr;
+    }
+    auto* image = static_cast<sd_image_t*>(std::calloc(1, sizeof(sd_image_t)));
+    fill_image(*image, latent->width, latent->height, 3, 7);
+    *num_frames_out = 1;
+    return image;
+}
+
+bool sd_latent_spill_to_file(sd_latent_t* latent, const char* path) {
+    return latent != nullptr && path != nullptr;
+}
+
+void sd_free_latent(sd_latent_t* latent) {
+    delete latent;
+}
+
+void sd_set_sampling_checkpoint(sd_ctx_t*, const char*, int, bool) {}
+
+void sd_set_sparse_attention(sd_ctx_t*, const sd_sparse_attention_params_t*) {}
+
 }  // extern "C"
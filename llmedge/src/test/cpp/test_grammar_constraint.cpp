@@ -0,0 +1,150 @@
+#include "GrammarConstraint.h"
+
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifndef LLAMA_TEST_VOCAB
+#define LLAMA_TEST_VOCAB "ggml-vocab-gpt-2.gguf"
+#endif
+
+static bool check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::cerr << what << std::endl;
+    }
+    return ok;
+}
+
+static std::vector<llama_token> tokenize(const llama_vocab* vocab, const std::string& text) {
+    std::vector<llama_token> tokens(text.size() + 4);
+    const int32_t n = llama_tokenize(vocab, text.c_str(), static_cast<int32_t>(text.size()), tokens.data(),
+                                     static_cast<int32_t>(tokens.size()), false, false);
+    tokens.resize(n > 0 ? n : 0);
+    return tokens;
+}
+
+// Every token of the vocabulary as a candidate, all with logit 0.
+static std::vector<llama_token_data> all_candidates(const llama_vocab* vocab) {
+    std::vector<llama_token_data> data(llama_vocab_n_tokens(vocab));
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = {static_cast<llama_token>(i), 0.0f, 0.0f};
+    }
+    return data;
+}
+
+static bool allowed(const std::vector<llama_token_data>& data, llama_token token) {
+    return !std::isinf(data[token].logit);
+}
+
+static bool test_grammar_masks(const llama_vocab* vocab) {
+    CompiledGrammar grammar(vocab, "root ::= \"yes\" | \"no\"", "root");
+    if (!grammar.valid()) {
+        std::cerr << "Grammar did not parse" << std::endl;
+        return false;
+    }
+    const std::vector<llama_token> yes = tokenize(vocab, "yes");
+    const std::vector<llama_token> no = tokenize(vocab, "no");
+    const std::vector<llama_token> maybe = tokenize(vocab, "maybe");
+    if (yes.empty() || no.empty() || maybe.empty()) {
+        std::cerr << "Could not tokenize the test words" << std::endl;
+        return false;
+    }
+    bool success = true;
+
+    std::vector<llama_token_data> data = all_candidates(vocab);
+    llama_token_data_array cur = {data.data(), data.size(), -1, false};
+    grammar.apply(&cur);
+    success &= check(allowed(data, yes[0]) && allowed(data, no[0]), "The start of yes and no should be allowed");
+    success &= check(!allowed(data, maybe[0]), "The start of maybe should be masked out");
+    size_t nAllowed = 0;
+    for (const llama_token_data& candidate: data) {
+        nAllowed += !std::isinf(candidate.logit);
+    }
+    success &= check(nAllowed > 0 && nAllowed < data.size(), "The mask should allow a strict subset");
+    success &= check(grammar.maskMisses == 1 && grammar.maskHits == 0, "The first state should be a miss");
+
+    // the same parser state again is a mask lookup, with the same result
+    grammar.reset();
+    data = all_candidates(vocab);
+    cur = {data.data(), data.size(), -1, false};
+    grammar.apply(&cur);
+    success &= check(grammar.maskMisses == 1 && grammar.maskHits == 1, "The start state should hit the cache");
+    success &= check(allowed(data, yes[0]) && !allowed(data, maybe[0]), "A cached mask should match the walk");
+
+    // candidates that share no token with the grammar cannot be sampled from
+    llama_token_data restricted = {maybe[0], 0.0f, 0.0f};
+    llama_token_data_array none = {&restricted, 1, -1, false};
+    bool threw = false;
+    try {
+        grammar.apply(&none);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    success &= check(threw, "A fully masked candidate set should throw");
+
+    // once "yes" is complete, "no" is no longer a continuation
+    grammar.reset();
+    for (llama_token token: yes) {
+        grammar.accept(token);
+    }
+    data = all_candidates(vocab);
+    cur = {data.data(), data.size(), -1, false};
+    grammar.apply(&cur);
+    success &= check(!allowed(data, no[0]) && !allowed(data, yes[0]), "A finished grammar should mask out words");
+    success &= check(grammar.maskMisses == 2, "The finished state should be a new mask");
+    return success;
+}
+
+static bool test_grammar_cache(const llama_vocab* vocab) {
+    GrammarCache cache(2);
+    bool success = true;
+    CompiledGrammar* first = cache.get(vocab, "root ::= \"a\"", "root");
+    success &= check(first != nullptr, "A valid grammar should compile");
+    success &= check(cache.get(vocab, "root ::= \"a\"", "root") == first, "A cached grammar should be reused");
+    success &= check(cache.get(vocab, "root ::= (", "root") == nullptr, "An invalid grammar should return null");
+
+    bool threw = false;
+    try {
+        cache.getForJsonSchema(vocab, "{not json");
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    success &= check(threw, "An invalid schema should throw");
+    CompiledGrammar* boolean = cache.getForJsonSchema(vocab, "{\"type\": \"boolean\"}");
+    success &= check(boolean != nullptr, "A JSON schema should compile");
+    success &= check(cache.getForJsonSchema(vocab, "{\"type\": \"boolean\"}") == boolean,
+                     "A JSON schema grammar should be reused");
+    return success;
+}
+
+int main() {
+    llama_backend_init();
+    llama_model_params params = llama_model_default_params();
+    params.vocab_only = true;
+    llama_model* model = llama_model_load_from_file(LLAMA_TEST_VOCAB, params);
+    if (!model) {
+        std::cerr << "Could not load " << LLAMA_TEST_VOCAB << std::endl;
+        return 1;
+    }
+    const llama_vocab* vocab = llama_model_get_vocab(model);
+
+    bool success = false;
+    try {
+        const bool masksResult = test_grammar_masks(vocab);
+        const bool cacheResult = test_grammar_cache(vocab);
+        success = masksResult && cacheResult;
+    } catch (const std::exception& ex) {
+        std::cerr << "Exception during tests: " << ex.what() << std::endl;
+    }
+    llama_model_free(model);
+    llama_backend_free();
+
+    if (!success) {
+        std::cerr << "grammar_constraint_tests FAILED" << std::endl;
+        return 1;
+    }
+    std::cout << "grammar_constraint_tests PASSED" << std::endl;
+    return 0;
+}
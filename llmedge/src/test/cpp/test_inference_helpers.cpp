@@ -0,0 +1,334 @@
+#include "ConfidenceMonitor.h"
+#include "FrameDedup.h"
+#include "HistoryCompactor.h"
+#include "ImageTokenBudget.h"
+#include "KvSessionManager.h"
+#include "LLMInference.h"
+#include "LoopDetector.h"
+
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static bool check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::cerr << what << std::endl;
+    }
+    return ok;
+}
+
+// Index of the first push that returns something other than NONE, or -1.
+static int first_detection(LoopDetector& detector, const std::vector<llama_token>& tokens, float entropy,
+                           LoopDetector::Detection& detection) {
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        detection = detector.push(tokens[i], entropy);
+        if (detection != LoopDetector::NONE) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+static bool test_loop_detector_off_by_default() {
+    LoopDetector detector;
+    bool success = check(detector.policy().action == LoopPolicy::OFF, "LoopPolicy should default to OFF");
+    for (int i = 0; i < 200; ++i) {
+        if (detector.push(7, 0.0f) != LoopDetector::NONE) {
+            std::cerr << "Default LoopDetector fired on push " << i << std::endl;
+            return false;
+        }
+    }
+    return success;
+}
+
+static bool test_loop_detector_cycles() {
+    LoopPolicy policy;
+    policy.action = LoopPolicy::STOP;
+    policy.plateauWindow = 0;
+    LoopDetector detector;
+    detector.setPolicy(policy);
+
+    // enough distinct tokens to compact the hash window many times over before the loop starts
+    std::vector<llama_token> tokens;
+    for (llama_token t = 0; t < 5000; ++t) {
+        tokens.push_back(t);
+    }
+    const size_t loopStart = tokens.size();
+    for (int r = 0; r < 8; ++r) {
+        for (llama_token t = 100; t < 105; ++t) {
+            tokens.push_back(t);
+        }
+    }
+
+    bool success = true;
+    LoopDetector::Detection detection = LoopDetector::NONE;
+    const int fired = first_detection(detector, tokens, -1.0f, detection);
+    // period 5 must repeat ceil(minSpan / 5) = 5 times, so the 25th looping token trips it
+    success &= check(fired == static_cast<int>(loopStart) + 24,
+                     "Cycle detected at token " + std::to_string(fired) + ", expected " +
+                             std::to_string(loopStart + 24));
+    success &= check(detection == LoopDetector::CYCLE, "Expected a CYCLE detection");
+    success &= check(detector.period() == 5, "Expected period 5, got " + std::to_string(detector.period()));
+    success &= check(detector.continuation() == 100,
+                     "Expected continuation 100, got " + std::to_string(detector.continuation()));
+
+    // a short repeat that covers less than minSpan is left alone
+    detector.reset();
+    const std::vector<llama_token> shortRepeat = {1, 2, 1, 2, 1, 2, 3, 4, 5};
+    success &= check(first_detection(detector, shortRepeat, -1.0f, detection) == -1,
+                     "Short repeat should not count as a cycle");
+    return success;
+}
+
+static bool test_loop_detector_plateau() {
+    LoopPolicy policy;
+    policy.action = LoopPolicy::STOP;
+    policy.minSpan = 1000; // no cycle can cover this in the tokens below
+    policy.plateauWindow = 8;
+    policy.plateauEntropy = 0.1f;
+    LoopDetector detector;
+    detector.setPolicy(policy);
+
+    const std::vector<llama_token> fewTokens = {1, 2, 1, 1, 2, 2, 1, 2};
+    const std::vector<llama_token> distinct = {1, 2, 3, 4, 5, 6, 7, 8};
+    bool success = true;
+    LoopDetector::Detection detection = LoopDetector::NONE;
+
+    success &= check(first_detection(detector, fewTokens, 0.01f, detection) == 7 &&
+                             detection == LoopDetector::PLATEAU,
+                     "Low entropy over two tokens should be a plateau once the window fills");
+    detector.reset();
+    success &= check(first_detection(detector, fewTokens, 0.5f, detection) == -1,
+                     "Entropy above plateauEntropy should not be a plateau");
+    detector.reset();
+    success &= check(first_detection(detector, distinct, 0.01f, detection) == -1,
+                     "Low entropy over distinct tokens should not be a plateau");
+    detector.reset();
+    success &= check(first_detection(detector, fewTokens, -1.0f, detection) == -1,
+                     "Tokens without an entropy should not be a plateau");
+    return success;
+}
+
+static bool test_confidence_monitor_window() {
+    ConfidencePolicy policy;
+    policy.enabled = true;
+    policy.window = 4;
+    policy.minTokens = 1; // raised to the window by setPolicy
+    policy.maxTokens = 0;
+    policy.maxMeanEntropy = 2.0f;
+    policy.minMargin = 0.1f;
+    policy.maxLowMarginFraction = 0.5f;
+    ConfidenceMonitor monitor;
+    monitor.setPolicy(policy);
+    bool success = true;
+
+    // no decision before a full window
+    for (int i = 0; i < 3; ++i) {
+        success &= check(!monitor.push(5.0f, 1.0f), "Tripped before minTokens");
+    }
+    success &= check(monitor.push(5.0f, 1.0f), "High mean entropy over a full window should trip");
+
+    // high entropy has to fill enough of the rolling window to lift its mean
+    monitor.reset();
+    for (int i = 0; i < 4; ++i) {
+        success &= check(!monitor.push(0.5f, 1.0f), "Confident tokens tripped the monitor");
+    }
+    success &= check(!monitor.push(5.0f, 1.0f), "Window mean 1.625 should not trip");
+    success &= check(monitor.push(5.0f, 1.0f), "Window mean 2.75 should trip");
+
+    // low margins leaving the window are subtracted again
+    monitor.reset();
+    const float margins[] = {0.05f, 0.05f, 1.0f, 1.0f, 0.05f, 0.05f};
+    for (float margin: margins) {
+        success &= check(!monitor.push(0.5f, margin), "Half the window at low margin should not trip");
+    }
+    success &= check(monitor.push(0.5f, 0.05f), "Three of four low margins should trip");
+
+    // past maxTokens the small model keeps the turn
+    policy.maxTokens = 4;
+    monitor.setPolicy(policy);
+    for (int i = 0; i < 4; ++i) {
+        monitor.push(0.5f, 1.0f);
+    }
+    for (int i = 0; i < 4; ++i) {
+        success &= check(!monitor.push(5.0f, 0.0f), "Tripped after maxTokens");
+    }
+    success &= check(monitor.tokens() == 4, "Tokens after maxTokens should not be recorded");
+
+    policy.enabled = false;
+    monitor.setPolicy(policy);
+    success &= check(!monitor.push(100.0f, 0.0f) && monitor.tokens() == 0, "A disabled monitor should not trip");
+    return success;
+}
+
+static bool test_history_split_point() {
+    const std::vector<llama_chat_message> messages = {
+            {"system", "s"}, {"user", "u1"}, {"assistant", "a1"}, {"tool", "t1"}, {"assistant", "a1b"},
+            {"user", "u2"},  {"assistant", "a2"}, {"user", "u3"}, {"assistant", "a3"},
+    };
+    bool success = true;
+    // u1 and everything it led to is folded, u2 onwards is kept
+    success &= check(HistoryCompactor::splitPoint(messages, 1, 2) == 5, "keep 2 turns should split before u2");
+    success &= check(HistoryCompactor::splitPoint(messages, 1, 1) == 7, "keep 1 turn should split before u3");
+    success &= check(HistoryCompactor::splitPoint(messages, 1, 0) == messages.size(),
+                     "keep 0 turns should fold everything");
+    success &= check(HistoryCompactor::splitPoint(messages, 1, 3) == 1, "keep 3 turns should fold nothing");
+    // turns before firstTurn (an earlier summary's range) are never counted
+    success &= check(HistoryCompactor::splitPoint(messages, 5, 2) == 5, "firstTurn should bound the search");
+
+    std::string base;
+    std::string summary;
+    HistoryCompactor::splitSystemPrompt(HistoryCompactor::joinSystemPrompt("Be brief.", "They like tea."), base,
+                                        summary);
+    success &= check(base == "Be brief." && summary == "They like tea.", "System prompt did not round trip");
+    HistoryCompactor::splitSystemPrompt("Be brief.", base, summary);
+    success &= check(base == "Be brief." && summary.empty(), "A prompt without a summary should stay whole");
+    return success;
+}
+
+static bool test_image_token_target() {
+    bool success = true;
+    success &= check(imageTokenTarget({0, false}, 576, 0.0f) == 576, "No budget should keep every token");
+    success &= check(imageTokenTarget({100, false}, 576, 1.0f) == 100, "maxTokens should cap the image");
+    success &= check(imageTokenTarget({0, true}, 576, 0.0f) == 144, "Flat images keep a quarter of the tokens");
+    success &= check(imageTokenTarget({0, true}, 576, 0.061f) == 293,
+                     "A little over half the full-detail density keeps a little over half");
+    success &= check(imageTokenTarget({0, true}, 576, 0.5f) == 576, "Detailed images keep every token");
+    success &= check(imageTokenTarget({100, true}, 576, 0.5f) == 100, "maxTokens should cap the automatic budget");
+    success &= check(imageTokenTarget({0, false}, 0, 0.0f) == 1, "The target is never below 1");
+
+    std::vector<uint8_t> flat(64 * 64 * 3, 128);
+    std::vector<uint8_t> stripes(64 * 64 * 3);
+    for (size_t i = 0; i < stripes.size(); ++i) {
+        stripes[i] = (i / 3) % 2 ? 255 : 0;
+    }
+    success &= check(imageComplexity(flat.data(), 64, 64) == 0.0f, "A flat image should have no edges");
+    success &= check(imageComplexity(stripes.data(), 64, 64) == 1.0f, "One-pixel stripes should be all edges");
+
+    success &= check(imagePoolFactor(24, 24, 576) == 1, "A grid that fits should not be pooled");
+    success &= check(imagePoolFactor(24, 24, 144) == 2, "144 tokens of a 24x24 grid need 2x2 pooling");
+    success &= check(imagePoolFactor(24, 24, 100) == 3, "100 tokens of a 24x24 grid need 3x3 pooling");
+    return success;
+}
+
+static bool test_pool_image_embeddings() {
+    // 3x2 grid of 2-float embeddings: token value in the first lane, +100 in the second
+    const int32_t nEmbd = 2;
+    std::vector<float> embd;
+    for (int32_t token = 0; token < 6; ++token) {
+        embd.push_back(static_cast<float>(token));
+        embd.push_back(token + 100.0f);
+    }
+    int32_t nx = 3;
+    int32_t ny = 2;
+    const std::vector<float> pooled = poolImageEmbeddings(embd.data(), nEmbd, nx, ny, 2);
+
+    bool success = check(nx == 2 && ny == 1, "Pooled grid should be 2x1, got " + std::to_string(nx) + "x" +
+                                                     std::to_string(ny));
+    // the right edge cell only covers column 2 (tokens 2 and 5)
+    const std::vector<float> expected = {2.0f, 102.0f, 3.5f, 103.5f};
+    success &= check(pooled.size() == expected.size(), "Pooled embeddings have the wrong size");
+    for (size_t i = 0; i < expected.size() && i < pooled.size(); ++i) {
+        success &= check(std::fabs(pooled[i] - expected[i]) < 1e-6f,
+                         "Pooled value " + std::to_string(i) + " is " + std::to_string(pooled[i]));
+    }
+    return success;
+}
+
+static std::vector<uint8_t> gradient_frame(uint32_t nx, uint32_t ny, bool darkening) {
+    std::vector<uint8_t> rgb(3 * static_cast<size_t>(nx) * ny);
+    for (uint32_t y = 0; y < ny; ++y) {
+        for (uint32_t x = 0; x < nx; ++x) {
+            const auto level = static_cast<uint8_t>(x * 255 / (nx - 1));
+            uint8_t* px = rgb.data() + 3 * (static_cast<size_t>(y) * nx + x);
+            px[0] = px[1] = px[2] = darkening ? 255 - level : level;
+        }
+    }
+    return rgb;
+}
+
+static bool test_frame_dedup() {
+    const std::vector<uint8_t> darkening = gradient_frame(90, 80, true);
+    const std::vector<uint8_t> darkeningLarge = gradient_frame(180, 160, true);
+    const std::vector<uint8_t> brightening = gradient_frame(90, 80, false);
+    bool success = true;
+    success &= check(frameDifferenceHash(darkening.data(), 90, 80) == ~0ULL,
+                     "Every sample of a darkening gradient is brighter than its right neighbour");
+    success &= check(frameDifferenceHash(brightening.data(), 90, 80) == 0, "A brightening gradient hashes to 0");
+    success &= check(frameDifferenceHash(darkeningLarge.data(), 180, 160) == ~0ULL,
+                     "The hash should not depend on resolution");
+
+    const std::vector<uint64_t> hashes = {0x0, 0x0, 0x1, 0xff, 0xff, 0xffff};
+    success &= check(selectDistinctFrames(hashes, 2, 0) == std::vector<size_t>({0, 3, 5}),
+                     "Near-duplicates of the last kept frame should be skipped");
+    success &= check(selectDistinctFrames(hashes, 2, 2) == std::vector<size_t>({0, 5}),
+                     "Sampling should keep the first and last distinct frames");
+    success &= check(selectDistinctFrames(hashes, 2, 1) == std::vector<size_t>({0}),
+                     "A single frame should be the first one");
+    success &= check(selectDistinctFrames(hashes, 64, 0) == std::vector<size_t>({0}),
+                     "A distance of 64 makes every frame a duplicate of the first");
+    success &= check(isDistinctFrame(0xff, 0x0, 7) && !isDistinctFrame(0xff, 0x0, 8),
+                     "A frame is distinct only beyond maxDistance bits");
+    return success;
+}
+
+static bool test_kv_session_eviction() {
+    KvSessionManager& manager = KvSessionManager::instance();
+    LLMInference a(100);
+    LLMInference b(100);
+    LLMInference c(100);
+    manager.configure("/tmp", 250);
+    bool success = true;
+
+    manager.acquire(&a, false);
+    manager.acquire(&b, false);
+    manager.acquire(&c, false);
+    success &= check(a.isPagedOut() && !b.isPagedOut() && !c.isPagedOut(),
+                     "Going over budget should page out the least recently used session");
+
+    success &= check(!manager.acquire(&b, true), "b was not busy before");
+    success &= check(manager.acquire(&b, true), "b should report that it was already busy");
+    manager.acquire(&a, false);
+    success &= check(a.pageIns == 1 && !a.isPagedOut(), "Acquiring a paged-out session should page it in");
+    success &= check(c.isPagedOut() && !b.isPagedOut(), "c is now the least recently used idle session");
+
+    // b is older than a but busy, so a goes
+    manager.acquire(&c, false);
+    success &= check(a.isPagedOut() && !b.isPagedOut() && !c.isPagedOut(), "Busy sessions must not be paged out");
+
+    // a session that fails to page out keeps counting against the budget
+    manager.release(&b);
+    c.failPageOut = true;
+    manager.configure("/tmp", 50);
+    success &= check(b.isPagedOut() && !c.isPagedOut(), "Released sessions should be paged out again");
+
+    manager.configure("", 0);
+    manager.remove(&a);
+    manager.remove(&b);
+    manager.remove(&c);
+    return success;
+}
+
+int main() {
+    const bool results[] = {
+            test_loop_detector_off_by_default(),
+            test_loop_detector_cycles(),
+            test_loop_detector_plateau(),
+            test_confidence_monitor_window(),
+            test_history_split_point(),
+            test_image_token_target(),
+            test_pool_image_embeddings(),
+            test_frame_dedup(),
+            test_kv_session_eviction(),
+    };
+    for (bool result: results) {
+        if (!result) {
+            std::cerr << "inference_helpers_tests FAILED" << std::endl;
+            return 1;
+        }
+    }
+    std::cout << "inference_helpers_tests PASSED" << std::endl;
+    return 0;
+}
@@ -0,0 +1,147 @@
+// The SHA-256 implementation lives in ResultCache.cpp's anonymous namespace, so the store is
+// compiled into this test directly.
+#include "ResultCache.cpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+static bool check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::cerr << what << std::endl;
+    }
+    return ok;
+}
+
+static std::string sha256_hex(const std::string& message, size_t chunk) {
+    Sha256 sha;
+    for (size_t i = 0; i < message.size(); i += chunk) {
+        sha.update(message.data() + i, std::min(chunk, message.size() - i));
+    }
+    return sha.hex();
+}
+
+static bool test_sha256_known_answers() {
+    // FIPS 180-4 examples
+    const std::string abc = "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad";
+    const std::string twoBlocks = "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1";
+    const std::string millionA = "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0";
+    bool success = true;
+    success &= check(sha256_hex("", 1) == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+                     "SHA-256 of the empty message is wrong");
+    success &= check(sha256_hex("abc", 3) == abc, "SHA-256 of \"abc\" is wrong");
+    success &= check(sha256_hex("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 7) == twoBlocks,
+                     "SHA-256 of the 448-bit message is wrong");
+    // odd chunk sizes cross block boundaries at every offset
+    success &= check(sha256_hex(std::string(1000000, 'a'), 997) == millionA,
+                     "SHA-256 of a million \"a\" is wrong");
+    success &= check(sha256_hex(std::string(1000000, 'a'), 1000000) == millionA,
+                     "SHA-256 of a million \"a\" in one update is wrong");
+    return success;
+}
+
+static void write_file(const std::string& path, const std::string& content) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file << content;
+}
+
+static std::string text_key(const std::string& text) {
+    return ResultCache::instance().key("text", {}, "", reinterpret_cast<const uint8_t*>(text.data()), text.size());
+}
+
+static bool test_keys(const std::string& dir) {
+    ResultCache& cache = ResultCache::instance();
+    // larger than two identity spans, so the head and the tail are digested separately
+    std::string weights(3 << 20, 'w');
+    write_file(dir + "/model.gguf", weights);
+    write_file(dir + "/moved.gguf", weights);
+    weights.back() = 'x';
+    write_file(dir + "/retrained.gguf", weights);
+
+    const uint8_t input[] = {1, 2, 3};
+    auto key = [&](const std::string& kind, const std::string& model, const std::string& params) {
+        const std::vector<std::string> models = model.empty() ? std::vector<std::string>() : std::vector{dir + model};
+        return cache.key(kind, models, params, input, sizeof(input));
+    };
+    const std::string base = key("text", "/model.gguf", "seed=1\n");
+    bool success = true;
+    success &= check(base.size() == 64, "A key should be 64 hex digits");
+    success &= check(key("text", "/model.gguf", "seed=1\n") == base, "Keys should be deterministic");
+    success &= check(key("text", "/moved.gguf", "seed=1\n") == base, "A copied model should keep its keys");
+    success &= check(key("text", "/retrained.gguf", "seed=1\n") != base, "A different model tail should change keys");
+    success &= check(key("text", "/model.gguf", "seed=2\n") != base, "Different params should change keys");
+    success &= check(key("image", "/model.gguf", "seed=1\n") != base, "A different kind should change keys");
+    success &= check(key("text", "/missing.gguf", "seed=1\n").empty(), "A missing model should give no key");
+    // fields are length-prefixed, so moving bytes between them changes the key
+    success &= check(key("ab", "", "c") != key("a", "", "bc"), "Fields should not run into each other");
+    return success;
+}
+
+static bool test_eviction_and_restart(const std::string& dir) {
+    ResultCache& cache = ResultCache::instance();
+    const std::string k1 = text_key("1"), k2 = text_key("2"), k3 = text_key("3"), k4 = text_key("4");
+    const std::vector<uint8_t> value(100, 7); // 116 bytes on disk with the entry header
+    // file mtimes carry recency across restarts and may be as coarse as a scheduler tick
+    auto tick = [] { std::this_thread::sleep_for(std::chrono::milliseconds(20)); };
+    std::vector<uint8_t> read;
+    bool success = true;
+
+    cache.configure(dir + "/results", 350);
+    for (const std::string& k: {k1, k2, k3}) {
+        cache.put(k, value.data(), value.size());
+        tick();
+    }
+    success &= check(cache.get(k1, read) && read == value, "A stored value should be returned");
+    tick();
+    cache.put(k4, value.data(), value.size());
+    success &= check(!cache.get(k2, read), "The least recently used entry should be evicted");
+
+    // a restart re-indexes the directory in mtime order; a smaller budget then evicts the oldest
+    write_file(dir + "/results/" + k2 + ".res.tmp123", "partial");
+    cache.configure(dir + "/results", 240);
+    success &= check(!std::filesystem::exists(dir + "/results/" + k2 + ".res.tmp123"),
+                     "Leftover temporary files should be removed");
+    success &= check(cache.get(k1, read) && read == value, "Entries should survive a restart");
+    success &= check(!cache.get(k3, read), "The oldest entry should be evicted after the restart");
+
+    // an entry truncated behind the cache's back is dropped instead of returned
+    write_file(dir + "/results/" + k4 + ".res", "short");
+    success &= check(!cache.get(k4, read), "A truncated entry should be a miss");
+
+    const std::vector<int64_t> stats = cache.stats();
+    const std::vector<int64_t> expected = {2, 3, 4, 2, 1, 116};
+    if (stats != expected) {
+        std::cerr << "Unexpected stats:";
+        for (int64_t s: stats) {
+            std::cerr << " " << s;
+        }
+        std::cerr << std::endl;
+        success = false;
+    }
+    cache.configure("", 0);
+    success &= check(!cache.get(k1, read), "A disabled cache should not return entries");
+    return success;
+}
+
+int main() {
+    char dirTemplate[] = "/tmp/result_cache_testXXXXXX";
+    if (!mkdtemp(dirTemplate)) {
+        std::cerr << "Could not create a temporary directory" << std::endl;
+        return 1;
+    }
+    const std::string dir = dirTemplate;
+    const bool shaResult = test_sha256_known_answers();
+    const bool keyResult = test_keys(dir);
+    const bool storeResult = test_eviction_and_restart(dir);
+    std::filesystem::remove_all(dir);
+
+    if (!shaResult || !keyResult || !storeResult) {
+        std::cerr << "result_cache_tests FAILED" << std::endl;
+        return 1;
+    }
+    std::cout << "result_cache_tests PASSED" << std::endl;
+    return 0;
+}
@@ -0,0 +1,73 @@
+package io.aatricks.llmedge
+
+import org.junit.Assert.assertArrayEquals
+import org.junit.Assert.assertEquals
+import org.junit.Assert.assertFalse
+import org.junit.Assert.assertTrue
+import org.junit.Test
+
+class KeywordSpotterTest {
+
+    private class ScriptedGate(private val detections: MutableList<Int>) : KeywordGate {
+        var fed = 0
+        var resets = 0
+
+        override fun detect(samples: FloatArray): Int {
+            fed += samples.size
+            return if (detections.isEmpty()) -1 else detections.removeAt(0)
+        }
+
+        override fun reset() {
+            resets++
+        }
+    }
+
+    private fun chunk(size: Int, value: Float = 0.1f) = FloatArray(size) { value }
+
+    @Test
+    fun `audio is dropped until the keyword is heard`() {
+        val gate = ScriptedGate(mutableListOf(-1, -1))
+        val window = KeywordWindow(gate, windowSamples = 1000)
+
+        assertEquals(0, window.admit(chunk(400)).size)
+        assertEquals(0, window.admit(chunk(400)).size)
+        assertFalse(window.isOpen)
+        assertEquals(800, gate.fed)
+    }
+
+    @Test
+    fun `detection passes the keyword chunk and opens the window`() {
+        val gate = ScriptedGate(mutableListOf(100))
+        val window = KeywordWindow(gate, windowSamples = 1000)
+
+        val keyword = chunk(400)
+        assertArrayEquals(keyword, window.admit(keyword), 0f)
+        assertTrue(window.isOpen)
+
+        // 300 samples after the keyword already count; 700 remain.
+        assertEquals(400, window.admit(chunk(400)).size)
+        assertEquals(300, window.admit(chunk(400)).size)
+        assertFalse(window.isOpen)
+        assertEquals(1, gate.resets)
+        // The tail after the window went back to the spotter.
+        assertEquals(400 + 100, gate.fed)
+    }
+
+    @Test
+    fun `sensitivity maps to a clamped posterior threshold`() {
+        assertEquals(0.5f, KeywordSpotter.thresholdFor(0.5f), 1e-6f)
+        assertEquals(0.2f, KeywordSpotter.thresholdFor(0.8f), 1e-6f)
+        assertEquals(0.05f, KeywordSpotter.thresholdFor(1f), 1e-6f)
+        assertEquals(0.95f, KeywordSpotter.thresholdFor(0f), 1e-6f)
+    }
+
+    @Test
+    fun `Stats reports CPU cost per audio second`() {
+        val stats = KeywordSpotter.Stats.fromNative(doubleArrayOf(120.0, 360.0, 4000.0, 3.0, 0.25))
+
+        assertEquals(3.0, stats.cpuMsPerAudioSecond, 1e-9)
+        assertEquals(4000L, stats.evaluations)
+        assertEquals(3L, stats.detections)
+        assertEquals(0.0, KeywordSpotter.Stats(0.0, 0.0, 0, 0, 0f).cpuMsPerAudioSecond, 0.0)
+    }
+}
@@ -0,0 +1,50 @@
+package io.aatricks.llmedge
+
+import org.junit.Assert.assertEquals
+import org.junit.Assert.assertTrue
+import org.junit.Test
+
+class NativeLibraryLoaderTest {
+
+    @Test
+    fun `arm64 variants are ordered best first and always end with the baseline`() {
+        val armV9 =
+                NativeLibraryLoader.parseCpuFeatures(
+                        "processor\t: 0\nFeatures\t: fp asimd aes crc32 fphp asimdhp asimddp dcpop uscat sve i8mm\n"
+                )
+        assertEquals(
+                listOf(
+                        "v8_4_fp16_dotprod_i8mm_sve",
+                        "v8_4_fp16_dotprod_sve",
+                        "v8_4_fp16_dotprod_i8mm",
+                        "v8_4_fp16_dotprod",
+                        "v8_2_fp16_dotprod",
+                        "v8_2_fp16",
+                        "v8"
+                ),
+                NativeLibraryLoader.arm64Variants(armV9)
+        )
+
+        val armV82 = setOf("fp", "asimd", "aes", "crc32", "fphp", "asimdhp")
+        assertEquals(listOf("v8_2_fp16", "v8"), NativeLibraryLoader.arm64Variants(armV82))
+        assertEquals(listOf("v8"), NativeLibraryLoader.arm64Variants(emptySet()))
+    }
+
+    @Test
+    fun `x86 variants require the full AVX2 and AVX-512 feature sets`() {
+        val avx2 = setOf("sse4_2", "avx", "avx2", "fma", "f16c", "bmi2")
+        val avx512 = avx2 + setOf("avx512f", "avx512cd", "avx512vl", "avx512dq", "avx512bw")
+
+        assertEquals(listOf("avx512", "avx2"), NativeLibraryLoader.x86Variants(avx512))
+        assertEquals(listOf("avx2"), NativeLibraryLoader.x86Variants(avx2 + "avx512f"))
+        assertTrue(NativeLibraryLoader.x86Variants(avx2 - "fma").isEmpty())
+    }
+
+    @Test
+    fun `cpuinfo flags line is parsed on x86`() {
+        val features = NativeLibraryLoader.parseCpuFeatures("model name\t: cpu\nflags\t\t: fpu avx2  fma\nbugs\t: none\n")
+
+        assertEquals(setOf("fpu", "avx2", "fma"), features)
+        assertTrue(NativeLibraryLoader.parseCpuFeatures("").isEmpty())
+    }
+}
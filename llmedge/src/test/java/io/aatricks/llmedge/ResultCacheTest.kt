@@ -0,0 +1,56 @@
+package io.aatricks.llmedge
+
+import org.junit.Assert.assertArrayEquals
+import org.junit.Assert.assertEquals
+import org.junit.Assert.assertFalse
+import org.junit.Assert.assertNull
+import org.junit.Test
+
+class ResultCacheTest {
+
+    @Test
+    fun `canonical params do not depend on map order`() {
+        val a = ResultCache.canonicalParams(linkedMapOf("seed" to 42L, "cfgScale" to 7f, "lora" to null))
+        val b = ResultCache.canonicalParams(linkedMapOf("lora" to null, "cfgScale" to 7f, "seed" to 42L))
+
+        assertEquals(a, b)
+        assertEquals("format=1\ncfgScale=7.0\nlora=null\nseed=42\n", a)
+    }
+
+    @Test
+    fun `results round trip through their encodings`() {
+        val rgb = ByteArray(2 * 3 * 3) { it.toByte() }
+        val image = ResultCache.decodeImage(ResultCache.encodeImage(2, 3, rgb))!!
+        assertEquals(2, image.width)
+        assertEquals(3, image.height)
+        assertArrayEquals(rgb, image.rgb)
+
+        val segments =
+                listOf(
+                        Whisper.TranscriptionSegment(0, 0L, 150L, " Hello"),
+                        Whisper.TranscriptionSegment(1, 150L, 320L, " wörld"),
+                )
+        assertEquals(segments, ResultCache.decodeSegments(ResultCache.encodeSegments(segments)))
+
+        val audio = BarkTTS.AudioResult(floatArrayOf(0f, 0.5f, -0.25f), 24000, 0.000125f)
+        assertEquals(audio, ResultCache.decodeAudio(ResultCache.encodeAudio(audio)))
+
+        assertEquals("naïve", ResultCache.decodeText(ResultCache.encodeText("naïve")))
+    }
+
+    @Test
+    fun `truncated values are rejected`() {
+        assertNull(ResultCache.decodeImage(ResultCache.encodeImage(2, 3, ByteArray(5))))
+        val segments = ResultCache.encodeSegments(listOf(Whisper.TranscriptionSegment(0, 0L, 1L, "a")))
+        assertNull(ResultCache.decodeSegments(segments.copyOf(segments.size - 1)))
+        assertNull(ResultCache.decodeAudio(ByteArray(9)))
+    }
+
+    @Test
+    fun `cache is a no-op until configured`() {
+        assertFalse(ResultCache.isEnabled)
+        assertNull(ResultCache.key(ResultCache.Kind.TEXT, emptyList(), emptyMap(), ByteArray(0)))
+        assertNull(ResultCache.get("0".repeat(64)))
+        assertNull(ResultCache.getStats())
+    }
+}
@@ -34,6 +34,7 @@ class SmolLMInferenceTest {
                 temperature: Float,
                 storeChats: Boolean,
                 contextSize: Long,
+                initialContextSize: Long,
                 chatTemplate: String,
                 nThreads: Int,
                 useMmap: Boolean,
@@ -35,6 +35,7 @@ class SmolLMLoadTest {
     @Test
     fun `load resolves context and template and applies reasoning options`() = runTest {
         var capturedCtx: Long = -1
+        var capturedInitialCtx: Long = -1
         var capturedTemplate: String? = null
         val setReasoningArgs = mutableListOf<Pair<Boolean, Int>>()
 
@@ -47,6 +48,7 @@ class SmolLMLoadTest {
                     temperature: Float,
                     storeChats: Boolean,
                     contextSize: Long,
+                    initialContextSize: Long,
                     chatTemplate: String,
                     nThreads: Int,
                     useMmap: Boolean,
@@ -54,6 +56,7 @@ class SmolLMLoadTest {
                     useVulkan: Boolean,
                 ): Long {
                     capturedCtx = contextSize
+                    capturedInitialCtx = initialContextSize
                     capturedTemplate = chatTemplate
                     return 123L
                 }
@@ -88,6 +91,8 @@ class SmolLMLoadTest {
 
         // Verify resolved metadata from GGUFReader was used
         assertEquals(4096L, capturedCtx)
+        // The KV cache starts small and grows towards the resolved context size
+        assertEquals(512L, capturedInitialCtx)
         assertEquals("<|im_start|>system {{content}}<|im_end|>", capturedTemplate)
         // Verify reasoning options applied at least once
         assertNotNull(smol.getThinkingMode()) // ensure instance is usable
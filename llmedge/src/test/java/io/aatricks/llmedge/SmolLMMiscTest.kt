@@ -1,8 +1,12 @@
 package io.aatricks.llmedge
 
+import kotlinx.coroutines.flow.toList
+import kotlinx.coroutines.runBlocking
 import org.junit.After
 import org.junit.Assert.assertEquals
 import org.junit.Assert.assertFalse
+import org.junit.Assert.assertNull
+import org.junit.Assert.assertThrows
 import org.junit.Assert.assertTrue
 import org.junit.Before
 import org.junit.Test
@@ -18,6 +22,7 @@ class SmolLMMiscTest {
             temperature: Float,
             storeChats: Boolean,
             contextSize: Long,
+            initialContextSize: Long,
             chatTemplate: String,
             nThreads: Int,
             useMmap: Boolean,
@@ -26,7 +31,11 @@ class SmolLMMiscTest {
         ): Long = 1L
 
         override fun setReasoningOptions(instance: SmolLM, modelPtr: Long, disableThinking: Boolean, reasoningBudget: Int) { /* no-op */ }
-        override fun addChatMessage(instance: SmolLM, modelPtr: Long, message: String, role: String) { /* no-op */ }
+        val chatMessages = mutableListOf<Triple<Long, String, String>>()
+
+        override fun addChatMessage(instance: SmolLM, modelPtr: Long, message: String, role: String) {
+            chatMessages += Triple(modelPtr, role, message)
+        }
         override fun getResponseGenerationSpeed(instance: SmolLM, modelPtr: Long): Float = 12.5f
         override fun getResponseGeneratedTokenCount(instance: SmolLM, modelPtr: Long): Long = 7
         override fun getResponseGenerationDurationMicros(instance: SmolLM, modelPtr: Long): Long = 2_000_000L
@@ -35,8 +44,109 @@ class SmolLMMiscTest {
         override fun nativeDecodePreparedEmbeddings(instance: SmolLM, modelPtr: Long, embdPath: String, metaPath: String, nBatch: Int): Boolean = true
         override fun close(instance: SmolLM, modelPtr: Long) { closeCalled = true }
         override fun startCompletion(instance: SmolLM, modelPtr: Long, prompt: String) { /* no-op */ }
-        override fun completionLoop(instance: SmolLM, modelPtr: Long): String = "[EOG]"
-        override fun stopCompletion(instance: SmolLM, modelPtr: Long) { /* no-op */ }
+        val escalatingPtrs = mutableSetOf<Long>()
+
+        override fun completionLoop(instance: SmolLM, modelPtr: Long): String =
+            if (modelPtr in escalatingPtrs) "[ESCALATE]" else "[EOG]"
+        var stopCalls = 0
+
+        override fun stopCompletion(instance: SmolLM, modelPtr: Long) { stopCalls++ }
+
+        val grammarCalls = mutableListOf<Pair<String?, Boolean>>()
+
+        override fun setGrammar(instance: SmolLM, modelPtr: Long, grammar: String?, isJsonSchema: Boolean) {
+            grammarCalls += grammar to isJsonSchema
+        }
+        override fun getGrammarStats(instance: SmolLM, modelPtr: Long): LongArray = longArrayOf(30, 10, 1_500)
+
+        val allowedCalls = mutableListOf<Pair<List<Int>?, Boolean>>()
+
+        override fun tokenize(instance: SmolLM, modelPtr: Long, text: String): IntArray =
+            text.split(" ").map { it.length }.toIntArray()
+        override fun setAllowedTokens(instance: SmolLM, modelPtr: Long, tokens: IntArray?, validate: Boolean) {
+            allowedCalls += tokens?.toList() to validate
+        }
+        override fun getRestrictedHeadStats(instance: SmolLM, modelPtr: Long): LongArray = longArrayOf(12, 12, 0, 3)
+
+        var historyCleared = false
+
+        override fun clearHistory(instance: SmolLM, modelPtr: Long) { historyCleared = true }
+        override fun getContextStats(instance: SmolLM, modelPtr: Long): LongArray =
+            longArrayOf(512, 4096, 2, 1, 1_800, 310_000, 250_000)
+        override fun getPagingStats(instance: SmolLM, modelPtr: Long): LongArray =
+            longArrayOf(3, 2, 4_000, 900, 180_000, 0)
+        override fun compressContext(
+            instance: SmolLM,
+            modelPtr: Long,
+            query: String,
+            context: String,
+            targetRatio: Float,
+        ): String = context.split(" ").filter { it.length > 3 }.joinToString(" ")
+        override fun getCompressionStats(instance: SmolLM, modelPtr: Long): LongArray = longArrayOf(400, 100, 8_000)
+
+        val loopPolicies = mutableListOf<List<Number>>()
+
+        override fun setLoopPolicy(
+            instance: SmolLM,
+            modelPtr: Long,
+            action: Int,
+            maxPeriod: Int,
+            minRepeats: Int,
+            minSpan: Int,
+            plateauWindow: Int,
+            plateauEntropy: Float,
+            maxNudges: Int,
+        ) {
+            loopPolicies += listOf(action, maxPeriod, minRepeats, minSpan, plateauWindow, plateauEntropy, maxNudges)
+        }
+        override fun getLoopStats(instance: SmolLM, modelPtr: Long): LongArray = longArrayOf(2, 1, 1, 2, 40)
+
+        val deadlines = mutableListOf<Long>()
+
+        override fun setDeadline(instance: SmolLM, modelPtr: Long, budgetMicros: Long) {
+            deadlines += budgetMicros
+        }
+        override fun getDeadlineStats(instance: SmolLM, modelPtr: Long): LongArray? =
+            deadlines.lastOrNull()?.let { longArrayOf(it, 1_250_000, 96, 1) }
+
+        val confidencePolicies = mutableListOf<Pair<Long, Boolean>>()
+        val escalatedStarts = mutableListOf<Pair<Long, Long>>()
+
+        override fun setConfidencePolicy(
+            instance: SmolLM,
+            modelPtr: Long,
+            enabled: Boolean,
+            window: Int,
+            minTokens: Int,
+            maxTokens: Int,
+            maxMeanEntropy: Float,
+            minMargin: Float,
+            maxLowMarginFraction: Float,
+        ) {
+            confidencePolicies += modelPtr to enabled
+        }
+        override fun getCascadeStats(instance: SmolLM, modelPtr: Long): LongArray = longArrayOf(4, 1, 16, 1, 2_350, 80)
+        override fun startCompletionFrom(instance: SmolLM, modelPtr: Long, sourcePtr: Long, query: String): Boolean {
+            escalatedStarts += modelPtr to sourcePtr
+            return true
+        }
+
+        val compactionPolicies = mutableListOf<List<Any>>()
+
+        override fun setCompactionPolicy(
+            instance: SmolLM,
+            modelPtr: Long,
+            enabled: Boolean,
+            triggerTokens: Int,
+            keepRecentTurns: Int,
+            summaryTokens: Int,
+            idleMillis: Int,
+            nThreads: Int,
+        ) {
+            compactionPolicies += listOf(enabled, triggerTokens, keepRecentTurns, summaryTokens, idleMillis, nThreads)
+        }
+        override fun compactHistory(instance: SmolLM, modelPtr: Long): Boolean = true
+        override fun getCompactionStats(instance: SmolLM, modelPtr: Long): LongArray = longArrayOf(3, 1, 2_900, 640, 4_200_000)
     }
 
     @Before
@@ -81,4 +191,190 @@ class SmolLMMiscTest {
         assertEquals(SmolLM.ThinkingMode.DEFAULT, smol.getThinkingMode())
         assertEquals(-1, smol.getReasoningBudget())
     }
+
+    @Test
+    fun `grammar and json schema are forwarded to the native sampler`() {
+        val bridge = TestBridge()
+        SmolLM.overrideNativeBridgeForTests { _ -> bridge }
+        val smol = SmolLM.createLoadedForTests(123L)
+
+        smol.setGrammar("root ::= \"yes\" | \"no\"")
+        smol.setJsonSchema("{\"type\": \"object\"}")
+        smol.setGrammar(null)
+
+        assertEquals(
+            listOf<Pair<String?, Boolean>>(
+                "root ::= \"yes\" | \"no\"" to false,
+                "{\"type\": \"object\"}" to true,
+                null to false,
+            ),
+            bridge.grammarCalls,
+        )
+        val stats = smol.getGrammarStats()!!
+        assertEquals(30L, stats.maskCacheHits)
+        assertEquals(0.75f, stats.maskCacheHitRate, 1e-6f)
+    }
+
+    @Test
+    fun `allowed token subsets are tokenized and forwarded to the native head`() {
+        val bridge = TestBridge()
+        SmolLM.overrideNativeBridgeForTests { _ -> bridge }
+        val smol = SmolLM.createLoadedForTests(123L)
+
+        smol.setAllowedTokenStrings(listOf("billing", "tech support", "billing"), validate = true)
+        smol.setAllowedTokens(intArrayOf())
+
+        assertEquals(
+            listOf<Pair<List<Int>?, Boolean>>(
+                listOf(7, 4) to true,
+                null to false,
+            ),
+            bridge.allowedCalls,
+        )
+        val stats = smol.getRestrictedHeadStats()!!
+        assertEquals(12L, stats.validatedSteps)
+        assertTrue(stats.exactMatch)
+    }
+
+    @Test
+    fun `clearHistory and context stats are forwarded to the native context`() {
+        val bridge = TestBridge()
+        SmolLM.overrideNativeBridgeForTests { _ -> bridge }
+        val smol = SmolLM.createLoadedForTests(123L)
+
+        smol.clearHistory()
+
+        assertTrue(bridge.historyCleared)
+        val stats = smol.getContextStats()!!
+        assertEquals(512L, stats.allocatedTokens)
+        assertEquals(4096L, stats.maxTokens)
+        assertEquals(2L, stats.grows)
+        assertEquals(310_000L, stats.peakRssKb)
+    }
+
+    @Test
+    fun `paging stats compare restore time with re-prefill`() {
+        val bridge = TestBridge()
+        SmolLM.overrideNativeBridgeForTests { _ -> bridge }
+        val smol = SmolLM.createLoadedForTests(123L)
+
+        val stats = smol.getPagingStats()!!
+
+        assertEquals(3L, stats.pageOuts)
+        assertEquals(900L, stats.lastRestoredTokens)
+        assertFalse(stats.isPagedOut)
+        assertEquals(45.0, stats.restoreSpeedup, 1e-9)
+    }
+
+    @Test
+    fun `context compression is forwarded to the native scorer`() {
+        val bridge = TestBridge()
+        SmolLM.overrideNativeBridgeForTests { _ -> bridge }
+        val smol = SmolLM.createLoadedForTests(123L)
+
+        assertEquals("quick brown jumps", smol.compressContext("q", "the quick brown fox jumps", 0.5f))
+        val stats = smol.getCompressionStats()!!
+        assertEquals(0.25f, stats.ratio, 1e-6f)
+        assertEquals(8_000L, stats.scoringMicros)
+        assertThrows(IllegalArgumentException::class.java) { smol.compressContext("q", "text", 0f) }
+    }
+
+    @Test
+    fun `loop policy is forwarded and stopped responses count the tokens saved`() {
+        val bridge = TestBridge()
+        SmolLM.overrideNativeBridgeForTests { _ -> bridge }
+        val smol = SmolLM.createLoadedForTests(123L)
+
+        smol.setLoopPolicy(SmolLM.LoopPolicy(action = SmolLM.LoopPolicy.Action.NUDGE, plateauWindow = 0))
+        smol.getResponse("hello", maxTokens = 100)
+        val stats = smol.getLoopStats()!!
+
+        assertEquals(listOf<Number>(2, 32, 3, 24, 0, 0.1f, 2), bridge.loopPolicies.single())
+        assertEquals(2L, stats.cycleDetections)
+        assertEquals(1L, stats.stoppedResponses)
+        assertEquals(100L, stats.tokensSaved)
+    }
+
+    @Test
+    fun `deadline is armed before the completion and reported with its slack`() {
+        val bridge = TestBridge()
+        SmolLM.overrideNativeBridgeForTests { _ -> bridge }
+        val smol = SmolLM.createLoadedForTests(123L)
+
+        assertNull(smol.getDeadlineReport())
+        smol.getResponseWithDeadline("hello", deadlineMs = 1500)
+        val report = smol.getDeadlineReport()!!
+
+        assertEquals(listOf(1_500_000L), bridge.deadlines)
+        assertTrue(report.met)
+        assertEquals(250L, report.slackMs)
+        assertEquals(96L, report.droppedPromptTokens)
+        assertEquals(SmolLM.DeadlineReport.StopReason.SENTENCE_BOUNDARY, report.stopReason)
+        assertThrows(IllegalArgumentException::class.java) { smol.getResponseWithDeadline("hello", 0) }
+    }
+
+    @Test
+    fun `cascade answers with the small model and escalates when it gives up`() {
+        val bridge = TestBridge()
+        SmolLM.overrideNativeBridgeForTests { _ -> bridge }
+        val small = SmolLM.createLoadedForTests(1L)
+        val large = SmolLM.createLoadedForTests(2L)
+        val cascade = ModelCascade(small, large)
+
+        val confident = cascade.getResponse("hi")
+        assertEquals(ModelCascade.Tier.SMALL, confident.tier)
+        assertFalse(confident.reusedTokenization)
+        assertEquals(listOf(Triple(2L, "user", "hi"), Triple(2L, "assistant", "")), bridge.chatMessages)
+
+        bridge.escalatingPtrs += 1L
+        bridge.chatMessages.clear()
+        val escalated = cascade.getResponse("prove it")
+        assertEquals(ModelCascade.Tier.LARGE, escalated.tier)
+        assertTrue(escalated.reusedTokenization)
+        assertEquals(listOf(2L to 1L), bridge.escalatedStarts)
+        assertEquals(listOf(Triple(1L, "user", "prove it"), Triple(1L, "assistant", "")), bridge.chatMessages)
+        assertEquals(listOf(1L to true), bridge.confidencePolicies)
+        assertEquals(0.5f, cascade.getStats().smallTierFraction, 1e-6f)
+
+        val stats = small.getCascadeStats()!!
+        assertEquals(1L, stats.escalations)
+        assertEquals(2.35f, stats.lastMeanEntropy, 1e-6f)
+    }
+
+    @Test
+    fun `streamed responses end and stop the completion when the small model escalates`() = runBlocking {
+        val bridge = TestBridge()
+        SmolLM.overrideNativeBridgeForTests { _ -> bridge }
+        val smol = SmolLM.createLoadedForTests(1L)
+
+        bridge.escalatingPtrs += 1L
+        assertEquals(emptyList<String>(), smol.getResponseAsFlow("prove it").toList())
+        assertTrue(smol.lastResponseEscalated)
+        assertEquals(1, bridge.stopCalls)
+
+        bridge.escalatingPtrs.clear()
+        smol.getResponseAsFlow("hi").toList()
+        assertFalse(smol.lastResponseEscalated)
+        assertEquals(2, bridge.stopCalls)
+    }
+
+    @Test
+    fun `history compaction policy is forwarded and its stats decoded`() {
+        val bridge = TestBridge()
+        SmolLM.overrideNativeBridgeForTests { _ -> bridge }
+        val smol = SmolLM.createLoadedForTests(123L)
+
+        smol.setHistoryCompaction(SmolLM.CompactionPolicy(triggerTokens = 1024, idleMs = 500))
+        smol.setHistoryCompaction(null)
+        assertEquals(
+            listOf(listOf<Any>(true, 1024, 2, 256, 500, 1), listOf<Any>(false, 2048, 2, 256, 1500, 1)),
+            bridge.compactionPolicies
+        )
+        assertTrue(smol.compactHistory())
+
+        val stats = smol.getCompactionStats()!!
+        assertEquals(3L, stats.compactions)
+        assertEquals(640L, stats.tokensAfter)
+        assertEquals(4_200L, stats.lastDurationMs)
+    }
 }
@@ -20,6 +20,7 @@ class SmolLMThinkingModeTest {
                     temperature: Float,
                     storeChats: Boolean,
                     contextSize: Long,
+                    initialContextSize: Long,
                     chatTemplate: String,
                     nThreads: Int,
                     useMmap: Boolean,
@@ -0,0 +1,118 @@
+package io.aatricks.llmedge
+
+import org.junit.After
+import org.junit.Assert.assertEquals
+import org.junit.Assert.assertNull
+import org.junit.Assert.assertSame
+import org.junit.Before
+import org.junit.Test
+import org.junit.runner.RunWith
+import org.robolectric.RobolectricTestRunner
+import org.robolectric.annotation.Config
+
+@RunWith(RobolectricTestRunner::class)
+@Config(sdk = [34])
+class StableDiffusionPrecomputeConditionTest {
+    @Before
+    fun setUp() {
+        System.setProperty("llmedge.disableNativeLoad", "true")
+        StableDiffusion.enableNativeBridgeForTests()
+    }
+
+    @After
+    fun tearDown() {
+        StableDiffusion.resetNativeBridgeForTests()
+        System.clearProperty("llmedge.disableNativeLoad")
+    }
+
+    private class RecordingBridge(
+        private val failOn: String? = null,
+    ) : StableDiffusion.NativeBridge {
+        val calls = mutableListOf<Pair<String, String>>()
+        val results = mutableMapOf<String, StableDiffusion.PrecomputedCondition>()
+
+        override fun txt2img(
+            handle: Long,
+            prompt: String,
+            negative: String,
+            width: Int,
+            height: Int,
+            steps: Int,
+            cfg: Float,
+            seed: Long,
+            easyCacheEnabled: Boolean,
+            easyCacheReuseThreshold: Float,
+            easyCacheStartPercent: Float,
+            easyCacheEndPercent: Float,
+        ): ByteArray? = null
+
+        override fun txt2vid(
+            handle: Long,
+            prompt: String,
+            negative: String,
+            width: Int,
+            height: Int,
+            videoFrames: Int,
+            steps: Int,
+            cfg: Float,
+            seed: Long,
+            sampleMethod: StableDiffusion.SampleMethod,
+            scheduler: StableDiffusion.Scheduler,
+            strength: Float,
+            initImage: ByteArray?,
+            initWidth: Int,
+            initHeight: Int,
+            vaceStrength: Float,
+            easyCacheEnabled: Boolean,
+            easyCacheReuseThreshold: Float,
+            easyCacheStartPercent: Float,
+            easyCacheEndPercent: Float,
+        ): Array<ByteArray>? = null
+
+        override fun setProgressCallback(handle: Long, callback: StableDiffusion.VideoProgressCallback?) {}
+        override fun cancelGeneration(handle: Long) {}
+
+        override fun precomputeCondition(
+            handle: Long,
+            prompt: String,
+            negative: String,
+            width: Int,
+            height: Int,
+            clipSkip: Int,
+        ): StableDiffusion.PrecomputedCondition? {
+            calls += prompt to negative
+            if (prompt == failOn) return null
+            return results.getOrPut(prompt) {
+                StableDiffusion.PrecomputedCondition(
+                    cCrossAttn = floatArrayOf(prompt.length.toFloat()),
+                    cCrossAttnDims = intArrayOf(1),
+                )
+            }
+        }
+    }
+
+    private fun newInstance(): StableDiffusion =
+        StableDiffusion::class.java.getDeclaredConstructor(Long::class.javaPrimitiveType)
+            .apply { isAccessible = true }
+            .newInstance(1L)
+
+    @Test
+    fun `precomputeConditionPair falls back to two single encodes`() {
+        val bridge = RecordingBridge()
+        StableDiffusion.overrideNativeBridgeForTests { _ -> bridge }
+
+        val pair = newInstance().precomputeConditionPair("a cat", "blurry", 64, 64)!!
+
+        assertEquals(listOf("a cat" to "blurry", "blurry" to ""), bridge.calls)
+        assertSame(bridge.results["a cat"], pair.first)
+        assertSame(bridge.results["blurry"], pair.second)
+    }
+
+    @Test
+    fun `precomputeConditionPair returns null when uncond fails`() {
+        val bridge = RecordingBridge(failOn = "")
+        StableDiffusion.overrideNativeBridgeForTests { _ -> bridge }
+
+        assertNull(newInstance().precomputeConditionPair("a cat"))
+    }
+}
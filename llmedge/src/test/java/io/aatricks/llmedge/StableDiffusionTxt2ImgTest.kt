@@ -100,4 +100,343 @@ class StableDiffusionTxt2ImgTest {
         assertEquals(Color.rgb(0x70, 0x80, 0x90), bmp.getPixel(0, 1))
         assertEquals(Color.rgb(0xAA, 0xBB, 0xCC), bmp.getPixel(1, 1))
     }
+
+    @Test
+    fun `txt2img selects the request LoRA set before generating`() = runTest {
+        val events = mutableListOf<String>()
+
+        StableDiffusion.overrideNativeBridgeForTests { _ ->
+            object : StableDiffusion.NativeBridge {
+                override fun txt2img(
+                    handle: Long,
+                    prompt: String,
+                    negative: String,
+                    width: Int,
+                    height: Int,
+                    steps: Int,
+                    cfg: Float,
+                    seed: Long,
+                    easyCacheEnabled: Boolean,
+                    easyCacheReuseThreshold: Float,
+                    easyCacheStartPercent: Float,
+                    easyCacheEndPercent: Float,
+                ): ByteArray? {
+                    events += "txt2img:$prompt"
+                    return ByteArray(width * height * 3)
+                }
+
+                override fun txt2vid(
+                    handle: Long,
+                    prompt: String,
+                    negative: String,
+                    width: Int,
+                    height: Int,
+                    videoFrames: Int,
+                    steps: Int,
+                    cfg: Float,
+                    seed: Long,
+                    sampleMethod: StableDiffusion.SampleMethod,
+                    scheduler: StableDiffusion.Scheduler,
+                    strength: Float,
+                    initImage: ByteArray?,
+                    initWidth: Int,
+                    initHeight: Int,
+                    vaceStrength: Float,
+                    easyCacheEnabled: Boolean,
+                    easyCacheReuseThreshold: Float,
+                    easyCacheStartPercent: Float,
+                    easyCacheEndPercent: Float,
+                ): Array<ByteArray>? = null
+
+                override fun setProgressCallback(handle: Long, callback: StableDiffusion.VideoProgressCallback?) {}
+                override fun cancelGeneration(handle: Long) {}
+
+                override fun setLoras(
+                    handle: Long,
+                    paths: Array<String>,
+                    multipliers: FloatArray,
+                    highNoise: BooleanArray,
+                ) {
+                    events += "loras:" + paths.indices.joinToString(",") { "${paths[it]}@${multipliers[it]}/${highNoise[it]}" }
+                }
+            }
+        }
+
+        val sd = StableDiffusion::class.java.getDeclaredConstructor(Long::class.javaPrimitiveType).apply { isAccessible = true }
+            .newInstance(1L)
+
+        sd.txt2img(
+            StableDiffusion.GenerateParams(
+                prompt = "a",
+                width = 1,
+                height = 1,
+                loras = listOf(
+                    StableDiffusion.LoraSpec("style.safetensors", 0.8f),
+                    StableDiffusion.LoraSpec("detail.safetensors", highNoise = true),
+                ),
+            )
+        )
+        sd.txt2img(StableDiffusion.GenerateParams(prompt = "b", width = 1, height = 1))
+
+        assertEquals(
+            listOf(
+                "loras:style.safetensors@0.8/false,detail.safetensors@1.0/true",
+                "txt2img:a",
+                "loras:",
+                "txt2img:b",
+            ),
+            events,
+        )
+    }
+
+    @Test
+    fun `deferred txt2img keeps the latent for a later full decode`() = runTest {
+        val events = mutableListOf<String>()
+
+        StableDiffusion.overrideNativeBridgeForTests { _ ->
+            object : StableDiffusion.NativeBridge {
+                override fun txt2img(
+                    handle: Long,
+                    prompt: String,
+                    negative: String,
+                    width: Int,
+                    height: Int,
+                    steps: Int,
+                    cfg: Float,
+                    seed: Long,
+                    easyCacheEnabled: Boolean,
+                    easyCacheReuseThreshold: Float,
+                    easyCacheStartPercent: Float,
+                    easyCacheEndPercent: Float,
+                ): ByteArray? {
+                    events += "txt2img:$prompt"
+                    return ByteArray(width * height * 3)
+                }
+
+                override fun txt2vid(
+                    handle: Long,
+                    prompt: String,
+                    negative: String,
+                    width: Int,
+                    height: Int,
+                    videoFrames: Int,
+                    steps: Int,
+                    cfg: Float,
+                    seed: Long,
+                    sampleMethod: StableDiffusion.SampleMethod,
+                    scheduler: StableDiffusion.Scheduler,
+                    strength: Float,
+                    initImage: ByteArray?,
+                    initWidth: Int,
+                    initHeight: Int,
+                    vaceStrength: Float,
+                    easyCacheEnabled: Boolean,
+                    easyCacheReuseThreshold: Float,
+                    easyCacheStartPercent: Float,
+                    easyCacheEndPercent: Float,
+                ): Array<ByteArray>? = null
+
+                override fun setProgressCallback(handle: Long, callback: StableDiffusion.VideoProgressCallback?) {}
+                override fun cancelGeneration(handle: Long) {}
+
+                override fun setDeferredDecode(handle: Long, enabled: Boolean) {
+                    events += "defer:$enabled"
+                }
+
+                override fun takeDeferredLatents(handle: Long): LongArray = longArrayOf(42L)
+
+                override fun decodeLatent(handle: Long, latent: Long, tiled: Boolean): StableDiffusion.DecodedFrames? {
+                    events += "decode:$latent/$tiled"
+                    return StableDiffusion.DecodedFrames(1, 1, arrayOf(byteArrayOf(255.toByte(), 0, 0)))
+                }
+
+                override fun freeLatent(latent: Long) {
+                    events += "free:$latent"
+                }
+            }
+        }
+
+        val sd = StableDiffusion::class.java.getDeclaredConstructor(Long::class.javaPrimitiveType).apply { isAccessible = true }
+            .newInstance(1L)
+
+        sd.txt2img(StableDiffusion.GenerateParams(prompt = "a", width = 1, height = 1, deferVaeDecode = true))
+        val latents = sd.takeDeferredLatents()
+        assertEquals(1, latents.size)
+        assertEquals(emptyList<StableDiffusion.LatentHandle>(), sd.takeDeferredLatents())
+
+        val decoded = sd.decodeLatent(latents[0], tiled = true)
+        assertEquals(Color.RED, decoded.single().getPixel(0, 0))
+        latents[0].close()
+        latents[0].close()
+
+        assertEquals(listOf("defer:true", "txt2img:a", "decode:42/true", "free:42"), events)
+    }
+
+    @Test
+    fun `inpaint forwards the image, mask and crop settings`() = runTest {
+        var captured: String? = null
+
+        StableDiffusion.overrideNativeBridgeForTests { _ ->
+            object : StableDiffusion.NativeBridge {
+                override fun txt2img(
+                    handle: Long,
+                    prompt: String,
+                    negative: String,
+                    width: Int,
+                    height: Int,
+                    steps: Int,
+                    cfg: Float,
+                    seed: Long,
+                    easyCacheEnabled: Boolean,
+                    easyCacheReuseThreshold: Float,
+                    easyCacheStartPercent: Float,
+                    easyCacheEndPercent: Float,
+                ): ByteArray? = null
+
+                override fun txt2vid(
+                    handle: Long,
+                    prompt: String,
+                    negative: String,
+                    width: Int,
+                    height: Int,
+                    videoFrames: Int,
+                    steps: Int,
+                    cfg: Float,
+                    seed: Long,
+                    sampleMethod: StableDiffusion.SampleMethod,
+                    scheduler: StableDiffusion.Scheduler,
+                    strength: Float,
+                    initImage: ByteArray?,
+                    initWidth: Int,
+                    initHeight: Int,
+                    vaceStrength: Float,
+                    easyCacheEnabled: Boolean,
+                    easyCacheReuseThreshold: Float,
+                    easyCacheStartPercent: Float,
+                    easyCacheEndPercent: Float,
+                ): Array<ByteArray>? = null
+
+                override fun setProgressCallback(handle: Long, callback: StableDiffusion.VideoProgressCallback?) {}
+                override fun cancelGeneration(handle: Long) {}
+
+                override fun inpaint(
+                    handle: Long,
+                    prompt: String,
+                    negative: String,
+                    width: Int,
+                    height: Int,
+                    steps: Int,
+                    cfg: Float,
+                    seed: Long,
+                    initImage: ByteArray,
+                    mask: ByteArray,
+                    strength: Float,
+                    cropEnabled: Boolean,
+                    cropPadding: Int,
+                    cropFeather: Int,
+                    cropTargetSize: Int,
+                ): ByteArray {
+                    captured = "${width}x$height mask=${mask.map { it.toInt() and 0xFF }} " +
+                        "crop=$cropEnabled/$cropPadding/$cropFeather/$cropTargetSize strength=$strength"
+                    return initImage
+                }
+            }
+        }
+
+        val sd = StableDiffusion::class.java.getDeclaredConstructor(Long::class.javaPrimitiveType).apply { isAccessible = true }
+            .newInstance(1L)
+
+        val image = android.graphics.Bitmap.createBitmap(2, 1, android.graphics.Bitmap.Config.ARGB_8888)
+        image.setPixel(0, 0, Color.rgb(0x10, 0x20, 0x30))
+        image.setPixel(1, 0, Color.rgb(0x40, 0x50, 0x60))
+        val mask = android.graphics.Bitmap.createBitmap(2, 1, android.graphics.Bitmap.Config.ARGB_8888)
+        mask.setPixel(0, 0, Color.BLACK)
+        mask.setPixel(1, 0, Color.WHITE)
+
+        val result = sd.inpaint(
+            StableDiffusion.GenerateParams(prompt = "a"),
+            StableDiffusion.InpaintParams(image, mask, strength = 0.5f, cropPadding = 8, feather = 4),
+        )
+
+        assertEquals("2x1 mask=[0, 255] crop=true/8/4/0 strength=0.5", captured)
+        assertEquals(Color.rgb(0x40, 0x50, 0x60), result.getPixel(1, 0))
+    }
+
+    @Test
+    fun `txt2img upscales the output with the loaded upscaler`() = runTest {
+        val events = mutableListOf<String>()
+
+        StableDiffusion.overrideNativeBridgeForTests { _ ->
+            object : StableDiffusion.NativeBridge {
+                override fun txt2img(
+                    handle: Long,
+                    prompt: String,
+                    negative: String,
+                    width: Int,
+                    height: Int,
+                    steps: Int,
+                    cfg: Float,
+                    seed: Long,
+                    easyCacheEnabled: Boolean,
+                    easyCacheReuseThreshold: Float,
+                    easyCacheStartPercent: Float,
+                    easyCacheEndPercent: Float,
+                ): ByteArray? = byteArrayOf(0, 255.toByte(), 0)
+
+                override fun txt2vid(
+                    handle: Long,
+                    prompt: String,
+                    negative: String,
+                    width: Int,
+                    height: Int,
+                    videoFrames: Int,
+                    steps: Int,
+                    cfg: Float,
+                    seed: Long,
+                    sampleMethod: StableDiffusion.SampleMethod,
+                    scheduler: StableDiffusion.Scheduler,
+                    strength: Float,
+                    initImage: ByteArray?,
+                    initWidth: Int,
+                    initHeight: Int,
+                    vaceStrength: Float,
+                    easyCacheEnabled: Boolean,
+                    easyCacheReuseThreshold: Float,
+                    easyCacheStartPercent: Float,
+                    easyCacheEndPercent: Float,
+                ): Array<ByteArray>? = null
+
+                override fun setProgressCallback(handle: Long, callback: StableDiffusion.VideoProgressCallback?) {}
+                override fun cancelGeneration(handle: Long) {}
+
+                override fun loadUpscaler(handle: Long, path: String, tileSize: Int): Int {
+                    events += "load:$path/$tileSize"
+                    return 2
+                }
+
+                override fun upscale(
+                    handle: Long,
+                    frames: Array<ByteArray>,
+                    width: Int,
+                    height: Int,
+                    resetCancellation: Boolean,
+                ): StableDiffusion.DecodedFrames? {
+                    events += "upscale:${frames.size}x${width}x$height"
+                    val frame = ByteArray(2 * width * 2 * height * 3) { if (it % 3 == 1) 255.toByte() else 0 }
+                    return StableDiffusion.DecodedFrames(2 * width, 2 * height, frames.map { frame }.toTypedArray())
+                }
+            }
+        }
+
+        val sd = StableDiffusion::class.java.getDeclaredConstructor(Long::class.javaPrimitiveType).apply { isAccessible = true }
+            .newInstance(1L)
+
+        assertEquals(2, sd.loadUpscaler("/models/esrgan-x2.gguf", tileSize = 64))
+        val result = sd.txt2img(StableDiffusion.GenerateParams(prompt = "a", width = 1, height = 1, upscale = true))
+
+        assertEquals(2, result.width)
+        assertEquals(2, result.height)
+        assertEquals(Color.GREEN, result.getPixel(1, 1))
+        assertEquals(listOf("load:/models/esrgan-x2.gguf/64", "upscale:1x1x1"), events)
+    }
 }
@@ -2,11 +2,14 @@ package io.aatricks.llmedge
 
 import android.graphics.Bitmap
 import android.graphics.Color
+import java.io.File
+import java.nio.file.Files
 import kotlinx.coroutines.CancellationException
 import kotlinx.coroutines.ExperimentalCoroutinesApi
 import kotlinx.coroutines.test.runTest
 import org.junit.After
 import org.junit.Assert.assertEquals
+import org.junit.Assert.assertFalse
 import org.junit.Assert.assertNotNull
 import org.junit.Assert.assertTrue
 import org.junit.Before
@@ -472,6 +475,179 @@ class StableDiffusionTxt2VidTest {
         assertTrue(setProgressInvocations.isEmpty())
     }
 
+    @OptIn(ExperimentalCoroutinesApi::class)
+    @Test
+    fun resumeGenerationReplaysCheckpointedRequest() = runTest {
+        val frames = buildFrames(frameCount = TEST_FRAMES, width = TEST_DIMENSION, height = TEST_DIMENSION)
+        val seeds = mutableListOf<Long>()
+        val checkpointCalls = mutableListOf<Triple<String?, Int, Boolean>>()
+        var failRun = true
+        StableDiffusion.overrideNativeBridgeForTests {
+            object : StableDiffusion.NativeBridge {
+                override fun txt2img(
+                    handle: Long,
+                    prompt: String,
+                    negative: String,
+                    width: Int,
+                    height: Int,
+                    steps: Int,
+                    cfg: Float,
+                    seed: Long,
+                    easyCacheEnabled: Boolean,
+                    easyCacheReuseThreshold: Float,
+                    easyCacheStartPercent: Float,
+                    easyCacheEndPercent: Float,
+                ): ByteArray? = null
+                override fun txt2vid(
+                    handle: Long,
+                    prompt: String,
+                    negative: String,
+                    width: Int,
+                    height: Int,
+                    videoFrames: Int,
+                    steps: Int,
+                    cfg: Float,
+                    seed: Long,
+                    sampleMethod: StableDiffusion.SampleMethod,
+                    scheduler: StableDiffusion.Scheduler,
+                    strength: Float,
+                    initImage: ByteArray?,
+                    initWidth: Int,
+                    initHeight: Int,
+                    vaceStrength: Float,
+                    easyCacheEnabled: Boolean,
+                    easyCacheReuseThreshold: Float,
+                    easyCacheStartPercent: Float,
+                    easyCacheEndPercent: Float,
+                ): Array<ByteArray>? {
+                    seeds += seed
+                    return if (failRun) null else frames.map { it.clone() }.toTypedArray()
+                }
+
+                override fun setCheckpoint(handle: Long, pathPrefix: String?, everyNSteps: Int, resume: Boolean) {
+                    checkpointCalls += Triple(pathPrefix, everyNSteps, resume)
+                }
+
+                override fun setProgressCallback(handle: Long, callback: StableDiffusion.VideoProgressCallback?) = Unit
+                override fun cancelGeneration(handle: Long) = Unit
+                override fun precomputeCondition(
+                    handle: Long,
+                    prompt: String,
+                    negative: String,
+                    width: Int,
+                    height: Int,
+                    clipSkip: Int,
+                ): StableDiffusion.PrecomputedCondition? = null
+            }
+        }
+        val sd = testableStableDiffusion()
+        val directory = Files.createTempDirectory("sd-checkpoint").toFile()
+        val params = StableDiffusion.VideoGenerateParams(
+            prompt = "wan",
+            width = TEST_DIMENSION,
+            height = TEST_DIMENSION,
+            videoFrames = TEST_FRAMES,
+            steps = 30,
+            checkpoint = StableDiffusion.CheckpointOptions(directory, everyNSteps = 4),
+        )
+
+        assertTrue(runCatching { sd.txt2vid(params) }.isFailure)
+        assertTrue(File(directory, "request.json").isFile)
+
+        failRun = false
+        val bitmaps = sd.resumeGeneration(directory)
+
+        assertEquals(TEST_FRAMES, bitmaps.size)
+        assertEquals(2, seeds.size)
+        assertTrue(seeds[0] >= 0)
+        assertEquals(seeds[0], seeds[1])
+        val prefix = File(directory, "sample").absolutePath
+        assertEquals(
+            listOf(
+                Triple(prefix, 4, false),
+                Triple(null, 0, false),
+                Triple(prefix, 4, true),
+                Triple(null, 0, false),
+            ),
+            checkpointCalls,
+        )
+        assertFalse(directory.exists())
+    }
+
+    @OptIn(ExperimentalCoroutinesApi::class)
+    @Test
+    fun txt2vidForwardsSparseAttentionSettings() = runTest {
+        val frames = buildFrames(frameCount = TEST_FRAMES, width = TEST_DIMENSION, height = TEST_DIMENSION)
+        val sparseCalls = mutableListOf<Triple<Boolean, Int, Int>>()
+        StableDiffusion.overrideNativeBridgeForTests {
+            object : StableDiffusion.NativeBridge {
+                override fun txt2img(
+                    handle: Long,
+                    prompt: String,
+                    negative: String,
+                    width: Int,
+                    height: Int,
+                    steps: Int,
+                    cfg: Float,
+                    seed: Long,
+                    easyCacheEnabled: Boolean,
+                    easyCacheReuseThreshold: Float,
+                    easyCacheStartPercent: Float,
+                    easyCacheEndPercent: Float,
+                ): ByteArray? = null
+                override fun txt2vid(
+                    handle: Long,
+                    prompt: String,
+                    negative: String,
+                    width: Int,
+                    height: Int,
+                    videoFrames: Int,
+                    steps: Int,
+                    cfg: Float,
+                    seed: Long,
+                    sampleMethod: StableDiffusion.SampleMethod,
+                    scheduler: StableDiffusion.Scheduler,
+                    strength: Float,
+                    initImage: ByteArray?,
+                    initWidth: Int,
+                    initHeight: Int,
+                    vaceStrength: Float,
+                    easyCacheEnabled: Boolean,
+                    easyCacheReuseThreshold: Float,
+                    easyCacheStartPercent: Float,
+                    easyCacheEndPercent: Float,
+                ): Array<ByteArray> = frames.map { it.clone() }.toTypedArray()
+
+                override fun setSparseAttention(handle: Long, enabled: Boolean, windowFrames: Int, globalStride: Int) {
+                    sparseCalls += Triple(enabled, windowFrames, globalStride)
+                }
+
+                override fun setProgressCallback(handle: Long, callback: StableDiffusion.VideoProgressCallback?) = Unit
+                override fun cancelGeneration(handle: Long) = Unit
+                override fun precomputeCondition(
+                    handle: Long,
+                    prompt: String,
+                    negative: String,
+                    width: Int,
+                    height: Int,
+                    clipSkip: Int,
+                ): StableDiffusion.PrecomputedCondition? = null
+            }
+        }
+        val sd = testableStableDiffusion()
+        val params = StableDiffusion.VideoGenerateParams(
+            prompt = "wan",
+            width = TEST_DIMENSION,
+            height = TEST_DIMENSION,
+            videoFrames = TEST_FRAMES,
+        )
+
+        sd.txt2vid(params.copy(sparseAttention = StableDiffusion.SparseAttention(windowFrames = 2, globalStride = 32)))
+        sd.txt2vid(params)
+
+        assertEquals(listOf(Triple(true, 2, 32), Triple(false, 0, 0)), sparseCalls)
+    }
+
     private fun testableStableDiffusion(): StableDiffusion {
         val constructor = StableDiffusion::class.java.getDeclaredConstructor(Long::class.javaPrimitiveType)
         constructor.isAccessible = true
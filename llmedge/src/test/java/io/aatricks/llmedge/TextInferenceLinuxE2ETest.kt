@@ -87,4 +87,44 @@ class TextInferenceLinuxE2ETest {
             smol.close()
         }
     }
+
+    @Test
+    fun `elastic context lowers peak RSS for a short chat`() = runBlocking {
+        val modelPath = System.getenv(MODEL_PATH_ENV) ?: System.getProperty(MODEL_PATH_ENV)
+        Assume.assumeTrue("No text test model specified in $MODEL_PATH_ENV", !modelPath.isNullOrBlank())
+
+        // Same short chat with the KV cache allocated upfront and grown on demand.
+        val upfront = shortChat(modelPath!!, initialContextSize = 8192)
+        val elastic = shortChat(modelPath, initialContextSize = 512)
+
+        assertEquals(8192L, upfront.allocatedTokens)
+        assertTrue("Short chat should not need the full context", elastic.allocatedTokens < elastic.maxTokens)
+        // peakRssKb is 0 where /proc/self/status has no VmHWM
+        if (upfront.peakRssKb > 0 && elastic.peakRssKb > 0) {
+            assertTrue(
+                "Elastic peak RSS ${elastic.peakRssKb} kB should be below upfront ${upfront.peakRssKb} kB",
+                elastic.peakRssKb < upfront.peakRssKb,
+            )
+        }
+    }
+
+    private suspend fun shortChat(modelPath: String, initialContextSize: Long): SmolLM.ContextStats {
+        // "5" resets VmHWM so each configuration reports its own peak
+        runCatching { File("/proc/self/clear_refs").writeText("5") }
+        val smol = SmolLM(useVulkan = false)
+        try {
+            smol.load(
+                modelPath,
+                SmolLM.InferenceParams(contextSize = 8192, initialContextSize = initialContextSize),
+            )
+            for (prompt in listOf("Hi!", "Name a color.", "And a fruit?")) {
+                smol.getResponse(prompt, maxTokens = 32)
+            }
+            val stats = smol.getContextStats()!!
+            smol.clearHistory()
+            return stats
+        } finally {
+            smol.close()
+        }
+    }
 }
@@ -145,4 +145,51 @@ class RAGTest {
         assertEquals(2, store.size())
         assertEquals(false, store.isEmpty())
     }
-}
\ No newline at end of file
+
+    @Test
+    fun `context selection gaps interleave with passages to rebuild the prompt text`() {
+        val hits = listOf(
+            VectorEntry("a", "  first chunk ", floatArrayOf(1f)) to 0.9f,
+            VectorEntry("b", "second chunk", floatArrayOf(1f)) to 0.5f,
+            VectorEntry("c", "weak chunk", floatArrayOf(1f)) to 0.05f,
+        )
+
+        val selection = RAGEngine.selectContextFromHits(hits)
+        val gaps = selection.gaps()
+
+        assertEquals(listOf("a", "b"), selection.entries.map { it.id })
+        assertEquals(true, selection.spliceable)
+        assertEquals(selection.entries.size + 1, gaps.size)
+        val rebuilt = StringBuilder(gaps[0])
+        selection.entries.forEachIndexed { i, entry -> rebuilt.append(entry.text.trim()).append(gaps[i + 1]) }
+        assertEquals(selection.text, rebuilt.toString())
+    }
+
+    @Test
+    fun `top-1 fallback context is not spliceable`() {
+        val hits = listOf(VectorEntry("a", "weak chunk", floatArrayOf(1f)) to 0.05f)
+
+        val selection = RAGEngine.selectContextFromHits(hits)
+
+        assertEquals(false, selection.spliceable)
+        assertEquals(true, selection.text.endsWith("weak chunk"))
+    }
+
+    @Test
+    fun `answerF1 compares answers by word overlap`() {
+        assertEquals(1f, RAGEngine.answerF1("The cat sat.", "the cat sat"), 1e-6f)
+        assertEquals(0f, RAGEngine.answerF1("cat", "dog"), 1e-6f)
+        assertEquals(0.5f, RAGEngine.answerF1("a b", "a c"), 1e-6f)
+    }
+
+    @Test
+    fun `loadEvalSet reads question and answer pairs`() {
+        val file = File.createTempFile("rag_eval", ".json")
+        file.writeText("""[{"question": "Who wrote it?", "answer": "Ada"}, {"question": "When?", "answer": "1843"}]""")
+
+        val items = RAGEngine.loadEvalSet(file)
+        file.delete()
+
+        assertEquals(listOf(RagEvalItem("Who wrote it?", "Ada"), RagEvalItem("When?", "1843")), items)
+    }
+}
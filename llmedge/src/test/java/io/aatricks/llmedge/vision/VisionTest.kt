@@ -220,4 +220,25 @@ class VisionTest {
 
         assertTrue(!adapter.hasVisionCapabilities())
     }
-}
\ No newline at end of file
+
+    @Test
+    fun `ImageEncodeStats decodes native stats and reports token reduction`() {
+        val stats = ImageEncodeStats.fromNative(longArrayOf(576, 144, 1000, 2, 35, 42_000))!!
+
+        assertEquals(144, stats.tokens)
+        assertEquals(2, stats.poolFactor)
+        assertEquals(0.035f, stats.complexity, 1e-6f)
+        assertEquals(0.75f, stats.tokenReduction, 1e-6f)
+        assertTrue(ImageTokenBudget.FULL.isUnlimited)
+        assertTrue(!ImageTokenBudget.AUTO.isUnlimited)
+    }
+
+    @Test
+    fun `ClipEncodeStats decodes kept frame indices`() {
+        val stats = ClipEncodeStats.fromNative(longArrayOf(30, 3, 1728, 1728, 9_000, 610_000, 0, 12, 29))!!
+
+        assertEquals(listOf(0, 12, 29), stats.keptFrames)
+        assertEquals(27, stats.skippedFrames)
+        assertEquals(null, ClipEncodeStats.fromNative(longArrayOf(30, 3, 1728, 1728, 9_000, 610_000, 0)))
+    }
+}
@@ -1185,6 +1185,130 @@ __STATIC_INLINE__ struct ggml_tensor* ggml_ext_attention(struct ggml_context* ct
     return kqv;
 }
 
+// Sparse self-attention for sequences laid out frame by frame (video DiTs).
+// Each query attends to the tokens of its temporal window plus every global_stride-th token of
+// the whole sequence, which cuts the attention cost from L^2 to about L * (window + L / stride).
+// Set per thread around the graph build; frames == 0 disables it.
+struct ggml_ext_sparse_attention_params {
+    int64_t frames           = 0;
+    int64_t tokens_per_frame = 0;
+    int window_frames        = 0;
+    int global_stride        = 0;
+};
+
+__STATIC_INLINE__ ggml_ext_sparse_attention_params& ggml_ext_sparse_attention() {
+    static thread_local ggml_ext_sparse_attention_params params;
+    return params;
+}
+
+__STATIC_INLINE__ struct ggml_tensor* ggml_ext_attention_ext(struct ggml_context* ctx,
+                                                             ggml_backend_t backend,
+                                                             struct ggml_tensor* q,
+                                                             struct ggml_tensor* k,
+                                                             struct ggml_tensor* v,
+                                                             int64_t n_head,
+                                                             struct ggml_tensor* mask,
+                                                             bool diag_mask_inf,
+                                                             bool skip_reshape,
+                                                             bool flash_attn,
+                                                             float kv_scale);
+
+// q, k, v as for ggml_ext_attention_ext with N == 1 and L_q == L_k == frames * tokens_per_frame.
+// return: [1, L, C]
+__STATIC_INLINE__ struct ggml_tensor* ggml_ext_sparse_attention_ext(struct ggml_context* ctx,
+                                                                    ggml_backend_t backend,
+                                                                    struct ggml_tensor* q,
+                                                                    struct ggml_tensor* k,
+                                                                    struct ggml_tensor* v,
+                                                                    int64_t n_head,
+                                                                    bool skip_reshape,
+                                                                    bool flash_attn,
+                                                                    float kv_scale) {
+    const ggml_ext_sparse_attention_params& sparse = ggml_ext_sparse_attention();
+
+    const int64_t L = q->ne[1];
+    int64_t d_head;
+    if (!skip_reshape) {
+        d_head = q->ne[0] / n_head;
+        q      = ggml_reshape_4d(ctx, q, d_head, n_head, L, 1);
+        q      = ggml_ext_cont(ctx, ggml_permute(ctx, q, 0, 2, 1, 3));  // [n_head, L, d_head]
+        k      = ggml_reshape_4d(ctx, k, d_head, n_head, L, 1);
+        k      = ggml_ext_cont(ctx, ggml_permute(ctx, k, 0, 2, 1, 3));  // [n_head, L, d_head]
+        v      = ggml_reshape_4d(ctx, v, d_head, n_head, L, 1);
+    } else {
+        d_head = v->ne[0];
+    }
+    v = ggml_ext_cont(ctx, ggml_permute(ctx, v, 0, 2, 1, 3));  // [n_head, L, d_head]
+
+    const int64_t S        = sparse.tokens_per_frame;
+    const int64_t window_L = sparse.window_frames * S;
+    const int64_t n_full   = sparse.frames / sparse.window_frames;
+    const int64_t rest_L   = L - n_full * window_L;
+    const int64_t n_global = sparse.global_stride > 0 ? L / sparse.global_stride : 0;
+
+    // every global_stride-th token: [n_head, n_global, d_head]
+    ggml_tensor* k_global = nullptr;
+    ggml_tensor* v_global = nullptr;
+    if (n_global > 0) {
+        k_global = ggml_ext_cont(ctx, ggml_view_3d(ctx, k, d_head, n_global, n_head, k->nb[1] * sparse.global_stride, k->nb[2], 0));
+        v_global = ggml_ext_cont(ctx, ggml_view_3d(ctx, v, d_head, n_global, n_head, v->nb[1] * sparse.global_stride, v->nb[2], 0));
+    }
+
+    // Attends n_windows consecutive windows of window_len tokens starting at token `offset`.
+    // The windows are batched next to the heads; returns [n_head, n_windows * window_len, d_head].
+    auto windows = [&](int64_t offset, int64_t window_len, int64_t n_windows) -> ggml_tensor* {
+        auto split = [&](ggml_tensor* t) {
+            t = ggml_view_4d(ctx, t, d_head, window_len, n_windows, n_head,
+                             t->nb[1], t->nb[1] * window_len, t->nb[2], t->nb[1] * offset);
+            t = ggml_ext_cont(ctx, t);
+            return ggml_reshape_3d(ctx, t, d_head, window_len, n_windows * n_head);  // [n_head * n_windows, window_len, d_head]
+        };
+        auto with_global = [&](ggml_tensor* t, ggml_tensor* global) {
+            if (global == nullptr) {
+                return t;
+            }
+            global = ggml_reshape_4d(ctx, global, d_head, n_global, 1, n_head);
+            global = ggml_repeat_4d(ctx, global, d_head, n_global, n_windows, n_head);
+            global = ggml_reshape_3d(ctx, global, d_head, n_global, n_windows * n_head);
+            return ggml_concat(ctx, t, global, 1);
+        };
+        ggml_tensor* q_w  = split(q);
+        ggml_tensor* k_w  = with_global(split(k), k_global);
+        ggml_tensor* v_w  = with_global(split(v), v_global);
+        const int64_t L_k = k_w->ne[1];
+        v_w               = ggml_reshape_4d(ctx, v_w, d_head, L_k, n_windows * n_head, 1);
+        v_w               = ggml_permute(ctx, v_w, 0, 2, 1, 3);  // [1, L_k, n_head * n_windows, d_head]
+
+        ggml_tensor* out = ggml_ext_attention_ext(ctx, backend, q_w, k_w, v_w, n_windows * n_head, nullptr, false, true, flash_attn, kv_scale);
+        // [window_len, n_head, n_windows, d_head] -> [n_windows, window_len, n_head, d_head]
+        out = ggml_reshape_4d(ctx, out, d_head, n_windows, n_head, window_len);
+        out = ggml_ext_cont(ctx, ggml_permute(ctx, out, 0, 3, 1, 2));
+        return ggml_reshape_3d(ctx, out, d_head * n_head, n_windows * window_len, 1);
+    };
+
+    ggml_tensor* out = windows(0, window_L, n_full);
+    if (rest_L > 0) {
+        out = ggml_concat(ctx, out, windows(n_full * window_L, rest_L, 1), 1);
+    }
+    return out;  // [1, L, C]
+}
+
+__STATIC_INLINE__ bool ggml_ext_sparse_attention_applies(struct ggml_tensor* q,
+                                                         struct ggml_tensor* k,
+                                                         struct ggml_tensor* v,
+                                                         int64_t n_head,
+                                                         struct ggml_tensor* mask,
+                                                         bool diag_mask_inf,
+                                                         bool skip_reshape) {
+    const ggml_ext_sparse_attention_params& sparse = ggml_ext_sparse_attention();
+    if (sparse.frames <= sparse.window_frames || sparse.window_frames <= 0 || mask != nullptr || diag_mask_inf) {
+        return false;
+    }
+    const int64_t N = skip_reshape ? v->ne[3] : q->ne[2];
+    return N == 1 && q->ne[1] == sparse.frames * sparse.tokens_per_frame && k->ne[1] == q->ne[1] &&
+           k->ne[0] == q->ne[0] && (skip_reshape ? k->ne[2] == n_head : q->ne[0] % n_head == 0);
+}
+
 // q: [N, L_q, C(n_head*d_head)] or [N*n_head, L_q, d_head]
 // k: [N, L_k, n_kv_head*d_head] or [N*n_kv_head, L_k, d_head]
 // v: [N, L_k, n_kv_head*d_head] or [N, L_k, n_kv_head, d_head]
@@ -1201,6 +1325,10 @@ __STATIC_INLINE__ struct ggml_tensor* ggml_ext_attention_ext(struct ggml_context
                                                              bool skip_reshape        = false,
                                                              bool flash_attn          = false,
                                                              float kv_scale           = 1.0f) {  // avoid overflow
+    if (ggml_ext_sparse_attention_applies(q, k, v, n_head, mask, diag_mask_inf, skip_reshape)) {
+        return ggml_ext_sparse_attention_ext(ctx, backend, q, k, v, n_head, skip_reshape, flash_attn, kv_scale);
+    }
+
     int64_t L_q;
     int64_t L_k;
     int64_t C;
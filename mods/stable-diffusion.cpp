@@ -89,6 +89,240 @@ void suppress_pp(int step, int steps, float time, void* data) {
     return;
 }
 
+/*================================================= sd_latent_t ==================================================*/
+
+// Final latent kept back by deferred VAE decode (see sd_set_deferred_decode). The data
+// lives in host memory until sd_latent_spill_to_file() moves it to disk; the spill file
+// is owned by the latent and removed with it.
+struct sd_latent_t {
+    int64_t ne[4] = {1, 1, 1, 1};
+    bool video    = false;
+    std::vector<float> data;
+    std::string spill_path;
+
+    ~sd_latent_t() {
+        if (!spill_path.empty()) {
+            std::remove(spill_path.c_str());
+        }
+    }
+
+    size_t nelements() const {
+        return (size_t)(ne[0] * ne[1] * ne[2] * ne[3]);
+    }
+};
+
+// Enables sparse attention for the graphs built on this thread while in scope.
+struct SparseAttentionScope {
+    explicit SparseAttentionScope(const ggml_ext_sparse_attention_params& params) {
+        ggml_ext_sparse_attention() = params;
+    }
+    ~SparseAttentionScope() {
+        ggml_ext_sparse_attention() = {};
+    }
+};
+
+/*=============================================== SamplingCheckpoint =================================================*/
+
+// Resumable sampling. Every denoiser output is appended to a log file; every `every_n_steps`
+// sampler steps the header is rewritten with the number of committed outputs. On resume the same request (same seed, sigmas and condition) is sampled again and
+// the committed outputs are fed back instead of running the model, so the sampler rebuilds its
+// multistep history and consumes the RNG exactly like the interrupted run did. The run then
+// continues from the last commit bit-identically.
+//
+// Layout: Header | sigmas[n_sigmas] | denoised outputs (latent_bytes each)
+class SamplingCheckpoint {
+public:
+    struct Header {
+        char magic[4]            = {'S', 'D', 'C', 'K'};
+        uint32_t version         = 2;
+        int64_t ne[4]            = {0, 0, 0, 0};
+        uint32_t n_sigmas        = 0;
+        uint32_t completed       = 0;
+        uint64_t cond_hash       = 0;
+        uint64_t x0_hash         = 0;
+        uint32_t committed_calls = 0;
+        int32_t committed_step   = 0;
+    };
+
+    static uint64_t hash_bytes(const void* data, size_t size, uint64_t h = 1469598103934665603ULL) {
+        const uint8_t* p = (const uint8_t*)data;
+        for (size_t i = 0; i < size; i++) {
+            h = (h ^ p[i]) * 1099511628211ULL;
+        }
+        return h;
+    }
+
+    static uint64_t hash_condition(const SDCondition& cond) {
+        uint64_t h = 1469598103934665603ULL;
+        for (ggml_tensor* t : {cond.c_crossattn, cond.c_vector, cond.c_concat}) {
+            if (t != nullptr && t->data != nullptr) {
+                h = hash_bytes(t->data, ggml_nbytes(t), h);
+            }
+        }
+        return h;
+    }
+
+    SamplingCheckpoint(const std::string& path, int every_n_steps, bool resume)
+        : path(path), every_n_steps(std::max(1, every_n_steps)), resume(resume) {}
+
+    ~SamplingCheckpoint() {
+        if (fp != nullptr) {
+            fclose(fp);
+        }
+    }
+
+    // Loads the committed outputs when resuming a matching run; otherwise starts a new file.
+    bool open(const ggml_tensor* x, const std::vector<float>& sigmas, uint64_t cond_hash) {
+        latent_bytes = ggml_nbytes(x);
+        expected.n_sigmas  = (uint32_t)sigmas.size();
+        expected.cond_hash = cond_hash;
+        for (int i = 0; i < 4; i++) {
+            expected.ne[i] = x->ne[i];
+        }
+        if (resume && load(sigmas)) {
+            LOG_INFO("resuming sampling from checkpoint '%s' (step %d, %u cached outputs%s)",
+                     path.c_str(), header.committed_step, header.committed_calls, header.completed ? ", completed" : "");
+        } else {
+            header = expected;
+            replay.clear();
+        }
+        fp = fopen(path.c_str(), replay.empty() ? "w+b" : "r+b");
+        if (fp == nullptr) {
+            LOG_WARN("failed to open checkpoint '%s', sampling without checkpoints", path.c_str());
+            return false;
+        }
+        this->sigmas = sigmas;
+        if (replay.empty()) {
+            write_preamble();
+        }
+        return true;
+    }
+
+    // Returns the cached output of denoiser call `call`, or nullptr when it must be computed.
+    // The first call checks the noised input so a different seed never replays stale outputs.
+    const float* cached(int call, const ggml_tensor* input) {
+        if (call == 0 && !replay.empty()) {
+            if (hash_bytes(input->data, ggml_nbytes(input)) != header.x0_hash) {
+                LOG_WARN("checkpoint '%s' does not match this request (different seed or init), starting over", path.c_str());
+                replay.clear();
+                header = expected;
+                truncate();
+            }
+        }
+        if (call < (int)header.committed_calls && (size_t)call * latent_elems() < replay.size()) {
+            return replay.data() + (size_t)call * latent_elems();
+        }
+        return nullptr;
+    }
+
+    void record(int call, int step, const ggml_tensor* input, const ggml_tensor* denoised) {
+        if (fp == nullptr || call < (int)header.committed_calls) {
+            return;
+        }
+        if (call == 0) {
+            header.x0_hash = hash_bytes(input->data, ggml_nbytes(input));
+        }
+        seek(fp, data_offset() + (uint64_t)call * latent_bytes);
+        fwrite(denoised->data, 1, latent_bytes, fp);
+        pending_calls = call + 1;
+        if (step > 0 && step % every_n_steps == 0) {
+            commit(step);
+        }
+    }
+
+    void finish() {
+        if (fp == nullptr) {
+            return;
+        }
+        header.completed = 1;
+        commit(header.committed_step);
+    }
+
+    bool replaying(int call) const {
+        return call < (int)header.committed_calls;
+    }
+
+private:
+    std::string path;
+    int every_n_steps;
+    bool resume;
+    FILE* fp            = nullptr;
+    size_t latent_bytes = 0;
+    int pending_calls   = 0;
+    Header header;
+    Header expected;
+    std::vector<float> sigmas;
+    std::vector<float> replay;
+
+    size_t latent_elems() const {
+        return latent_bytes / sizeof(float);
+    }
+
+    // Outputs of long video runs exceed 2 GiB, past what fseek's long offset covers on 32-bit ABIs.
+    static bool seek(FILE* file, uint64_t offset) {
+#ifdef _WIN32
+        return _fseeki64(file, (__int64)offset, SEEK_SET) == 0;
+#else
+        return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+    }
+
+    uint64_t data_offset() const {
+        return sizeof(Header) + (uint64_t)header.n_sigmas * sizeof(float);
+    }
+
+    bool load(const std::vector<float>& sigmas) {
+        FILE* in = fopen(path.c_str(), "rb");
+        if (in == nullptr) {
+            return false;
+        }
+        Header h;
+        bool ok = fread(&h, sizeof(h), 1, in) == 1 && memcmp(h.magic, "SDCK", 4) == 0 && h.version == expected.version &&
+                  h.n_sigmas == expected.n_sigmas && h.cond_hash == expected.cond_hash &&
+                  memcmp(h.ne, expected.ne, sizeof(h.ne)) == 0;
+        std::vector<float> file_sigmas(h.n_sigmas);
+        ok = ok && fread(file_sigmas.data(), sizeof(float), h.n_sigmas, in) == h.n_sigmas && file_sigmas == sigmas;
+        if (ok) {
+            header = h;
+            replay.resize((size_t)h.committed_calls * latent_elems());
+            ok = seek(in, data_offset()) &&
+                 fread(replay.data(), sizeof(float), replay.size(), in) == replay.size();
+        }
+        fclose(in);
+        if (!ok) {
+            LOG_WARN("checkpoint '%s' does not match this request, starting over", path.c_str());
+            replay.clear();
+        }
+        return ok;
+    }
+
+    void write_header() {
+        seek(fp, 0);
+        fwrite(&header, sizeof(header), 1, fp);
+    }
+
+    void write_preamble() {
+        write_header();
+        fwrite(sigmas.data(), sizeof(float), sigmas.size(), fp);
+        fflush(fp);
+    }
+
+    void truncate() {
+        if (fp != nullptr && (fp = freopen(path.c_str(), "w+b", fp)) != nullptr) {
+            write_preamble();
+        }
+    }
+
+    void commit(int step) {
+        fflush(fp);
+        header.committed_calls = pending_calls;
+        header.committed_step  = step;
+        write_header();
+        fflush(fp);
+        LOG_DEBUG("sampling checkpoint committed at step %d", step);
+    }
+};
+
 /*=============================================== StableDiffusionGGML ================================================*/
 
 class StableDiffusionGGML {
@@ -123,6 +357,34 @@ public:
     std::vector<std::shared_ptr<LoraModel>> first_stage_lora_models;
     bool apply_lora_immediately = false;
 
+    // Runtime LoRAs stay resident across requests so that switching LoRA sets between
+    // jobs only rebuilds the adapters. Entries not used by the current request are
+    // evicted least-recently-used first once the pool exceeds runtime_lora_pool_capacity.
+    struct RuntimeLora {
+        std::shared_ptr<LoraModel> cond_stage;
+        std::shared_ptr<LoraModel> diffusion;
+        std::shared_ptr<LoraModel> first_stage;
+        uint64_t last_used = 0;
+    };
+    std::unordered_map<std::string, RuntimeLora> runtime_lora_pool;
+    uint64_t runtime_lora_clock       = 0;
+    size_t runtime_lora_pool_capacity = 4;
+
+    // Deferred VAE decode: outputs are decoded with the tiny autoencoder as drafts and the
+    // final latents are kept until the caller takes them (sd_take_deferred_latents).
+    bool defer_vae_decode = false;
+    std::vector<std::unique_ptr<sd_latent_t>> deferred_latents;
+
+    // Sampling checkpoints (sd_set_sampling_checkpoint). Each sample() call of a generation
+    // gets its own file "<checkpoint_prefix>.<index>" so multi-stage video models resume too.
+    std::string checkpoint_prefix;
+    int checkpoint_every_n_steps = 0;
+    bool checkpoint_resume       = false;
+    int checkpoint_index         = 0;
+
+    // Windowed + strided-global self-attention for Wan video DiTs (sd_set_sparse_attention).
+    sd_sparse_attention_params_t sparse_attention = {false, 0, 0};
+
     std::string taesd_path;
     bool use_tiny_autoencoder            = false;
     sd_tiling_params_t vae_tiling_params = {false, 0, 0, 0.5f, 0, 0};
@@ -1015,113 +1277,111 @@ public:
         curr_lora_state = lora_state;
     }
 
-    void apply_loras_at_runtime(const std::unordered_map<std::string, float>& lora_state) {
-        cond_stage_lora_models.clear();
-        diffusion_lora_models.clear();
-        first_stage_lora_models.clear();
-        if (lora_state.empty()) {
-            return;
+    RuntimeLora& get_runtime_lora(const std::string& lora_id) {
+        auto iter = runtime_lora_pool.find(lora_id);
+        if (iter != runtime_lora_pool.end()) {
+            iter->second.last_used = ++runtime_lora_clock;
+            return iter->second;
         }
-        LOG_INFO("apply lora at runtime");
+
+        auto load_stage = [&](ggml_backend_t stage_backend, LoraModel::filter_t lora_tensor_filter) -> std::shared_ptr<LoraModel> {
+            auto lora = load_lora_model_from_file(lora_id, 1.f, stage_backend, lora_tensor_filter);
+            if (!lora || lora->lora_tensors.empty()) {
+                return nullptr;
+            }
+            lora->preprocess_lora_tensors(tensors);
+            return lora;
+        };
+
+        RuntimeLora runtime_lora;
         if (cond_stage_model) {
-            std::vector<std::shared_ptr<LoraModel>> lora_models;
-            auto lora_state_diff = lora_state;
-            for (auto& lora_model : cond_stage_lora_models) {
-                auto iter = lora_state_diff.find(lora_model->lora_id);
+            runtime_lora.cond_stage = load_stage(clip_backend, [&](const std::string& tensor_name) {
+                return is_cond_stage_model_name(tensor_name);
+            });
+        }
+        if (diffusion_model) {
+            runtime_lora.diffusion = load_stage(backend, [&](const std::string& tensor_name) {
+                return is_diffusion_model_name(tensor_name);
+            });
+        }
+        if (first_stage_model) {
+            runtime_lora.first_stage = load_stage(vae_backend, [&](const std::string& tensor_name) {
+                return is_first_stage_model_name(tensor_name);
+            });
+        }
+        runtime_lora.last_used = ++runtime_lora_clock;
+        return runtime_lora_pool[lora_id] = runtime_lora;
+    }
 
-                if (iter != lora_state_diff.end()) {
-                    lora_model->multiplier = iter->second;
-                    lora_models.push_back(lora_model);
-                    lora_state_diff.erase(iter);
+    void evict_runtime_loras(const std::unordered_map<std::string, float>& lora_state) {
+        while (runtime_lora_pool.size() > runtime_lora_pool_capacity) {
+            auto victim = runtime_lora_pool.end();
+            for (auto iter = runtime_lora_pool.begin(); iter != runtime_lora_pool.end(); ++iter) {
+                bool in_use = lora_state.find(iter->first) != lora_state.end();
+                if (!in_use && (victim == runtime_lora_pool.end() || iter->second.last_used < victim->second.last_used)) {
+                    victim = iter;
                 }
             }
-            cond_stage_lora_models  = lora_models;
-            auto lora_tensor_filter = [&](const std::string& tensor_name) {
-                if (is_cond_stage_model_name(tensor_name)) {
-                    return true;
-                }
-                return false;
-            };
-            for (auto& kv : lora_state_diff) {
-                const std::string& lora_id = kv.first;
-                float multiplier           = kv.second;
-
-                auto lora = load_lora_model_from_file(lora_id, multiplier, clip_backend, lora_tensor_filter);
-                if (lora && !lora->lora_tensors.empty()) {
-                    lora->preprocess_lora_tensors(tensors);
-                    cond_stage_lora_models.push_back(lora);
-                }
+            if (victim == runtime_lora_pool.end()) {
+                break;
             }
-            auto multi_lora_adapter = std::make_shared<MultiLoraAdapter>(cond_stage_lora_models);
-            cond_stage_model->set_weight_adapter(multi_lora_adapter);
+            LOG_DEBUG("evicting runtime lora %s", victim->first.c_str());
+            runtime_lora_pool.erase(victim);
         }
-        if (diffusion_model) {
-            std::vector<std::shared_ptr<LoraModel>> lora_models;
-            auto lora_state_diff = lora_state;
-            for (auto& lora_model : diffusion_lora_models) {
-                auto iter = lora_state_diff.find(lora_model->lora_id);
+    }
 
-                if (iter != lora_state_diff.end()) {
-                    lora_model->multiplier = iter->second;
-                    lora_models.push_back(lora_model);
-                    lora_state_diff.erase(iter);
-                }
+    void apply_loras_at_runtime(const std::unordered_map<std::string, float>& lora_state) {
+        cond_stage_lora_models.clear();
+        diffusion_lora_models.clear();
+        first_stage_lora_models.clear();
+
+        if (lora_state.empty()) {
+            if (cond_stage_model) {
+                cond_stage_model->set_weight_adapter(nullptr);
             }
-            diffusion_lora_models   = lora_models;
-            auto lora_tensor_filter = [&](const std::string& tensor_name) {
-                if (is_diffusion_model_name(tensor_name)) {
-                    return true;
-                }
-                return false;
-            };
-            for (auto& kv : lora_state_diff) {
-                const std::string& lora_name = kv.first;
-                float multiplier             = kv.second;
-
-                auto lora = load_lora_model_from_file(lora_name, multiplier, backend, lora_tensor_filter);
-                if (lora && !lora->lora_tensors.empty()) {
-                    lora->preprocess_lora_tensors(tensors);
-                    diffusion_lora_models.push_back(lora);
-                }
+            if (diffusion_model) {
+                diffusion_model->set_weight_adapter(nullptr);
             }
-            auto multi_lora_adapter = std::make_shared<MultiLoraAdapter>(diffusion_lora_models);
-            diffusion_model->set_weight_adapter(multi_lora_adapter);
             if (high_noise_diffusion_model) {
-                high_noise_diffusion_model->set_weight_adapter(multi_lora_adapter);
+                high_noise_diffusion_model->set_weight_adapter(nullptr);
+            }
+            if (first_stage_model) {
+                first_stage_model->set_weight_adapter(nullptr);
             }
+            evict_runtime_loras(lora_state);
+            return;
         }
+        LOG_INFO("apply lora at runtime");
 
-        if (first_stage_model) {
-            std::vector<std::shared_ptr<LoraModel>> lora_models;
-            auto lora_state_diff = lora_state;
-            for (auto& lora_model : first_stage_lora_models) {
-                auto iter = lora_state_diff.find(lora_model->lora_id);
-
-                if (iter != lora_state_diff.end()) {
-                    lora_model->multiplier = iter->second;
-                    lora_models.push_back(lora_model);
-                    lora_state_diff.erase(iter);
-                }
+        auto add_lora = [](std::vector<std::shared_ptr<LoraModel>>& stage_lora_models,
+                           const std::shared_ptr<LoraModel>& lora,
+                           float multiplier) {
+            if (!lora) {
+                return;
             }
-            first_stage_lora_models = lora_models;
-            auto lora_tensor_filter = [&](const std::string& tensor_name) {
-                if (is_first_stage_model_name(tensor_name)) {
-                    return true;
-                }
-                return false;
-            };
-            for (auto& kv : lora_state_diff) {
-                const std::string& lora_name = kv.first;
-                float multiplier             = kv.second;
-
-                auto lora = load_lora_model_from_file(lora_name, multiplier, vae_backend, lora_tensor_filter);
-                if (lora && !lora->lora_tensors.empty()) {
-                    lora->preprocess_lora_tensors(tensors);
-                    first_stage_lora_models.push_back(lora);
-                }
+            lora->multiplier = multiplier;
+            stage_lora_models.push_back(lora);
+        };
+        for (auto& kv : lora_state) {
+            RuntimeLora& runtime_lora = get_runtime_lora(kv.first);
+            add_lora(cond_stage_lora_models, runtime_lora.cond_stage, kv.second);
+            add_lora(diffusion_lora_models, runtime_lora.diffusion, kv.second);
+            add_lora(first_stage_lora_models, runtime_lora.first_stage, kv.second);
+        }
+        evict_runtime_loras(lora_state);
+
+        if (cond_stage_model) {
+            cond_stage_model->set_weight_adapter(std::make_shared<MultiLoraAdapter>(cond_stage_lora_models));
+        }
+        if (diffusion_model) {
+            auto diffusion_adapter = std::make_shared<MultiLoraAdapter>(diffusion_lora_models);
+            diffusion_model->set_weight_adapter(diffusion_adapter);
+            if (high_noise_diffusion_model) {
+                high_noise_diffusion_model->set_weight_adapter(diffusion_adapter);
             }
-            auto multi_lora_adapter = std::make_shared<MultiLoraAdapter>(first_stage_lora_models);
-            first_stage_model->set_weight_adapter(multi_lora_adapter);
+        }
+        if (first_stage_model) {
+            first_stage_model->set_weight_adapter(std::make_shared<MultiLoraAdapter>(first_stage_lora_models));
         }
     }
 
@@ -1607,7 +1867,7 @@ public:
             }
         }
 
-        auto denoise = [&](ggml_tensor* input, float sigma, int step) -> ggml_tensor* {
+        auto denoise_model = [&](ggml_tensor* input, float sigma, int step) -> ggml_tensor* {
             auto sd_preview_cb      = sd_get_preview_callback();
             auto sd_preview_cb_data = sd_get_preview_callback_data();
             auto sd_preview_mode    = sd_get_preview_mode();
@@ -1864,6 +2124,25 @@ public:
             return denoised;
         };
 
+        SparseAttentionScope sparse_attention_scope(sparse_attention_for(x));
+
+        std::unique_ptr<SamplingCheckpoint> checkpoint = open_sampling_checkpoint(x, sigmas, cond, easycache_enabled);
+        int denoise_calls                              = 0;
+        auto denoise                                   = [&](ggml_tensor* input, float sigma, int step) -> ggml_tensor* {
+            int call = denoise_calls++;
+            if (checkpoint) {
+                if (const float* cached = checkpoint->cached(call, input)) {
+                    memcpy(denoised->data, cached, ggml_nbytes(denoised));
+                    return denoised;
+                }
+            }
+            ggml_tensor* result = denoise_model(input, sigma, step);
+            if (checkpoint && result != nullptr) {
+                checkpoint->record(call, step, input, result);
+            }
+            return result;
+        };
+
         if (!sample_k_diffusion(method, denoise, work_ctx, x, sigmas, sampler_rng, eta)) {
             LOG_ERROR("Diffusion model sampling failed");
             if (control_net) {
@@ -1873,6 +2152,9 @@ public:
             diffusion_model->free_compute_buffer();
             return NULL;
         }
+        if (checkpoint) {
+            checkpoint->finish();
+        }
 
         if (easycache_enabled) {
             size_t total_steps = sigmas.size() > 0 ? sigmas.size() - 1 : 0;
@@ -2267,7 +2549,50 @@ public:
         return get_first_stage_encoding(work_ctx, vae_output);
     }
 
-    ggml_tensor* decode_first_stage(ggml_context* work_ctx, ggml_tensor* x, bool decode_video = false) {
+    // Wan patchifies latents into 1x2x2 patches, frame by frame.
+    ggml_ext_sparse_attention_params sparse_attention_for(const ggml_tensor* x) const {
+        ggml_ext_sparse_attention_params params;
+        if (!sparse_attention.enabled || !sd_version_is_wan(version) || x->ne[2] <= sparse_attention.window_frames) {
+            return params;
+        }
+        params.frames           = x->ne[2];
+        params.tokens_per_frame = ((x->ne[0] + 1) / 2) * ((x->ne[1] + 1) / 2);
+        params.window_frames    = sparse_attention.window_frames;
+        params.global_stride    = sparse_attention.global_stride;
+
+        const double L        = (double)params.frames * params.tokens_per_frame;
+        const double window_L = std::min<double>(L, (double)params.window_frames * params.tokens_per_frame);
+        const double n_global = params.global_stride > 0 ? std::floor(L / params.global_stride) : 0.0;
+        LOG_INFO("sparse attention: %" PRId64 " frames in windows of %d, %.0f global tokens, %.1f%% of dense attention cost",
+                 params.frames, params.window_frames, n_global, 100.0 * L * (window_L + n_global) / (L * L));
+        return params;
+    }
+
+    void begin_generation() {
+        deferred_latents.clear();
+        checkpoint_index = 0;
+    }
+
+    std::unique_ptr<SamplingCheckpoint> open_sampling_checkpoint(ggml_tensor* x,
+                                                                 const std::vector<float>& sigmas,
+                                                                 const SDCondition& cond,
+                                                                 bool easycache_enabled) {
+        if (checkpoint_prefix.empty() || checkpoint_every_n_steps <= 0) {
+            return nullptr;
+        }
+        if (easycache_enabled) {
+            LOG_WARN("easycache keeps state outside the sampler, resumed runs may differ from uninterrupted ones");
+        }
+        std::string path = checkpoint_prefix + "." + std::to_string(checkpoint_index++);
+        auto checkpoint  = std::make_unique<SamplingCheckpoint>(path, checkpoint_every_n_steps, checkpoint_resume);
+        if (!checkpoint->open(x, sigmas, SamplingCheckpoint::hash_condition(cond))) {
+            return nullptr;
+        }
+        return checkpoint;
+    }
+
+    ggml_tensor* decode_first_stage(ggml_context* work_ctx, ggml_tensor* x, bool decode_video = false, bool draft = false) {
+        const bool use_tae         = use_tiny_autoencoder || (draft && tae_first_stage != nullptr);
         const int vae_scale_factor = get_vae_scale_factor();
         int64_t W                  = x->ne[0] * vae_scale_factor;
         int64_t H                  = x->ne[1] * vae_scale_factor;
@@ -2293,7 +2618,7 @@ public:
                                         x->ne[3]);
         }
         int64_t t0 = ggml_time_ms();
-        if (!use_tiny_autoencoder) {
+        if (!use_tae) {
             if (sd_version_is_qwen_image(version)) {
                 x = ggml_reshape_4d(work_ctx, x, x->ne[0], x->ne[1], 1, x->ne[2] * x->ne[3]);
             }
@@ -2334,6 +2659,28 @@ public:
         ggml_ext_tensor_clamp_inplace(result, 0.0f, 1.0f);
         return result;
     }
+
+    // Decodes a generation output. With deferred decode enabled the latent is kept for a
+    // later full decode and the returned image is a tiny-autoencoder draft.
+    ggml_tensor* decode_output(ggml_context* work_ctx, ggml_tensor* x, bool decode_video = false) {
+        if (!defer_vae_decode) {
+            return decode_first_stage(work_ctx, x, decode_video);
+        }
+        auto latent   = std::make_unique<sd_latent_t>();
+        latent->video = decode_video;
+        for (int i = 0; i < 4; i++) {
+            latent->ne[i] = x->ne[i];
+        }
+        latent->data.resize(ggml_nelements(x));
+        for (size_t i = 0; i < latent->data.size(); i++) {
+            latent->data[i] = ggml_get_f32_1d(x, (int)i);
+        }
+        deferred_latents.push_back(std::move(latent));
+        if (tae_first_stage == nullptr) {
+            LOG_WARN("deferred decode requested without a tiny autoencoder, draft uses the full VAE");
+        }
+        return decode_first_stage(work_ctx, x, decode_video, true);
+    }
 };
 
 /*================================================= SD API ==================================================*/
@@ -2675,6 +3022,7 @@ void sd_img_gen_params_init(sd_img_gen_params_t* sd_img_gen_params) {
     sd_img_gen_params->pm_params         = {nullptr, 0, nullptr, 20.f};
     sd_img_gen_params->vae_tiling_params = {false, 0, 0, 0.5f, 0.0f, 0.0f};
     sd_easycache_params_init(&sd_img_gen_params->easycache);
+    sd_img_gen_params->inpaint_crop      = {false, 32, 16, 0};
 }
 
 char* sd_img_gen_params_to_str(const sd_img_gen_params_t* sd_img_gen_params) {
@@ -2890,6 +3238,17 @@ static SDCondition sd_condition_from_raw(ggml_context* ctx, const sd_condition_r
     return SDCondition(c_crossattn, c_vector, c_concat);
 }
 
+static sd_condition_raw_t* sd_condition_to_raw(const SDCondition& cond) {
+    sd_condition_raw_t* out = (sd_condition_raw_t*)calloc(1, sizeof(sd_condition_raw_t));
+    if (!out) {
+        return nullptr;
+    }
+    sd_tensor_raw_from_ggml_tensor(out->c_crossattn, cond.c_crossattn);
+    sd_tensor_raw_from_ggml_tensor(out->c_vector, cond.c_vector);
+    sd_tensor_raw_from_ggml_tensor(out->c_concat, cond.c_concat);
+    return out;
+}
+
 SD_API void sd_free_condition(sd_condition_raw_t* cond) {
     if (!cond) {
         return;
@@ -2946,18 +3305,244 @@ SD_API sd_condition_raw_t* sd_precompute_condition(sd_ctx_t* sd_ctx,
         sd_ctx->sd->cond_stage_model->free_params_buffer();
     }
 
-    sd_condition_raw_t* out = (sd_condition_raw_t*)calloc(1, sizeof(sd_condition_raw_t));
-    if (!out) {
-        ggml_free(work_ctx);
-        return nullptr;
+    sd_condition_raw_t* out = sd_condition_to_raw(cond);
+    ggml_free(work_ctx);
+    return out;
+}
+
+// Encodes a positive/negative prompt pair with a T5 embedder in a single forward pass by
+// stacking both token sequences into one [n_token, 2] batch. This is only possible when
+// the embedder runs without a padding mask (T5Runner takes one [n_token] mask that would
+// be shared by both sequences) and both prompts fit in a single chunk. Returns false when
+// the caller should fall back to encoding the prompts one after the other.
+static bool t5_get_learned_condition_pair(T5CLIPEmbedder* t5_embedder,
+                                          ggml_context* work_ctx,
+                                          int n_threads,
+                                          const std::string& text,
+                                          const std::string& negative_text,
+                                          bool zero_out_masked,
+                                          SDCondition& cond,
+                                          SDCondition& uncond) {
+    if (t5_embedder == nullptr || t5_embedder->use_mask) {
+        return false;
+    }
+
+    const size_t chunk_len = t5_embedder->chunk_len;
+    auto pos_tokenized     = t5_embedder->tokenize(text, chunk_len, true);
+    auto neg_tokenized     = t5_embedder->tokenize(negative_text, chunk_len, true);
+    if (std::get<0>(pos_tokenized).size() != chunk_len || std::get<0>(neg_tokenized).size() != chunk_len) {
+        return false;
+    }
+
+    ggml_tensor* input_ids = ggml_new_tensor_2d(work_ctx, GGML_TYPE_I32, chunk_len, 2);
+    int32_t* ids           = (int32_t*)input_ids->data;
+    for (size_t i = 0; i < chunk_len; i++) {
+        ids[i]             = std::get<0>(pos_tokenized)[i];
+        ids[chunk_len + i] = std::get<0>(neg_tokenized)[i];
+    }
+
+    int64_t t0                 = ggml_time_ms();
+    ggml_tensor* hidden_states = nullptr;  // [2, n_token, model_dim]
+    t5_embedder->t5->compute(n_threads, input_ids, nullptr, &hidden_states, work_ctx);
+    if (hidden_states == nullptr ||
+        hidden_states->type != GGML_TYPE_F32 ||
+        hidden_states->ne[1] != (int64_t)chunk_len ||
+        ggml_nelements(hidden_states) != hidden_states->ne[0] * (int64_t)chunk_len * 2) {
+        LOG_WARN("batched T5 encode returned an unexpected shape, falling back to per-prompt encode");
+        return false;
+    }
+
+    auto split_condition = [&](int idx, const std::tuple<std::vector<int>, std::vector<float>, std::vector<float>>& tokenized) {
+        const std::vector<float>& weights  = std::get<1>(tokenized);
+        const std::vector<float>& mask_vec = std::get<2>(tokenized);
+
+        ggml_tensor* tensor = ggml_new_tensor_2d(work_ctx, GGML_TYPE_F32, hidden_states->ne[0], chunk_len);
+        memcpy(tensor->data,
+               (const float*)hidden_states->data + idx * ggml_nelements(tensor),
+               ggml_nbytes(tensor));
+
+        float original_mean = ggml_ext_tensor_mean(tensor);
+        for (int i1 = 0; i1 < tensor->ne[1]; i1++) {
+            for (int i0 = 0; i0 < tensor->ne[0]; i0++) {
+                float value = ggml_ext_tensor_get_f32(tensor, i0, i1);
+                value *= weights[i1];
+                ggml_ext_tensor_set_f32(tensor, value, i0, i1);
+            }
+        }
+        float new_mean = ggml_ext_tensor_mean(tensor);
+        ggml_ext_tensor_scale_inplace(tensor, (original_mean / new_mean));
+
+        if (zero_out_masked) {
+            for (int i1 = 0; i1 < tensor->ne[1]; i1++) {
+                if (mask_vec[i1] < 0.f) {
+                    for (int i0 = 0; i0 < tensor->ne[0]; i0++) {
+                        ggml_ext_tensor_set_f32(tensor, 0.f, i0, i1);
+                    }
+                }
+            }
+        }
+
+        // Same mask post-processing as T5CLIPEmbedder: let the first `mask_pad` padding
+        // tokens be attended to.
+        ggml_tensor* attn_mask = vector_to_ggml_tensor(work_ctx, mask_vec);
+        float* mask_data       = (float*)attn_mask->data;
+        int num_pad            = 0;
+        for (int64_t i = 0; i < ggml_nelements(attn_mask) && num_pad < t5_embedder->mask_pad; i++) {
+            if (std::isinf(mask_data[i])) {
+                mask_data[i] = 0.f;
+                num_pad++;
+            }
+        }
+        return SDCondition(tensor, attn_mask, nullptr);
+    };
+
+    cond   = split_condition(0, pos_tokenized);
+    uncond = split_condition(1, neg_tokenized);
+    LOG_DEBUG("computing batched cond/uncond condition graph completed, taking %" PRId64 " ms", ggml_time_ms() - t0);
+    return true;
+}
+
+// Computes cond and uncond with the conditioner parameters resident once. T5 embedders
+// batch both prompts into one forward pass; every other conditioner encodes them back to
+// back inside the same work context.
+static void sd_get_learned_condition_pair(Conditioner* cond_stage_model,
+                                          ggml_context* work_ctx,
+                                          int n_threads,
+                                          const ConditionerParams& condition_params,
+                                          const std::string& negative_text,
+                                          SDCondition& cond,
+                                          SDCondition& uncond) {
+    auto t5_embedder = dynamic_cast<T5CLIPEmbedder*>(cond_stage_model);
+    if (t5_get_learned_condition_pair(t5_embedder,
+                                      work_ctx,
+                                      n_threads,
+                                      condition_params.text,
+                                      negative_text,
+                                      condition_params.zero_out_masked,
+                                      cond,
+                                      uncond)) {
+        return;
     }
 
-    sd_tensor_raw_from_ggml_tensor(out->c_crossattn, cond.c_crossattn);
-    sd_tensor_raw_from_ggml_tensor(out->c_vector, cond.c_vector);
-    sd_tensor_raw_from_ggml_tensor(out->c_concat, cond.c_concat);
+    cond = cond_stage_model->get_learned_condition(work_ctx, n_threads, condition_params);
+
+    ConditionerParams uncond_params = condition_params;
+    uncond_params.text              = negative_text;
+    uncond                          = cond_stage_model->get_learned_condition(work_ctx, n_threads, uncond_params);
+}
+
+SD_API bool sd_precompute_condition_pair(sd_ctx_t* sd_ctx,
+                                         const char* text,
+                                         const char* negative_text,
+                                         int clip_skip,
+                                         int width,
+                                         int height,
+                                         bool zero_out_masked,
+                                         sd_condition_raw_t** cond_out,
+                                         sd_condition_raw_t** uncond_out) {
+    if (sd_ctx == nullptr || sd_ctx->sd == nullptr || cond_out == nullptr || uncond_out == nullptr) {
+        return false;
+    }
+    *cond_out   = nullptr;
+    *uncond_out = nullptr;
 
+    struct ggml_init_params params;
+    params.mem_size   = static_cast<size_t>(1024 * 1024) * 1024;  // 1G
+    params.mem_buffer = nullptr;
+    params.no_alloc   = false;
+
+    struct ggml_context* work_ctx = ggml_init(params);
+    if (!work_ctx) {
+        LOG_ERROR("ggml_init() failed");
+        return false;
+    }
+
+    ConditionerParams condition_params;
+    condition_params.text            = SAFE_STR(text);
+    condition_params.clip_skip       = clip_skip;
+    condition_params.width           = width;
+    condition_params.height          = height;
+    condition_params.zero_out_masked = zero_out_masked;
+    condition_params.adm_in_channels = sd_ctx->sd->diffusion_model ? sd_ctx->sd->diffusion_model->get_adm_in_channels() : -1;
+
+    SDCondition cond;
+    SDCondition uncond;
+    sd_get_learned_condition_pair(sd_ctx->sd->cond_stage_model.get(),
+                                  work_ctx,
+                                  sd_ctx->sd->n_threads,
+                                  condition_params,
+                                  SAFE_STR(negative_text),
+                                  cond,
+                                  uncond);
+
+    if (sd_ctx->sd->free_params_immediately) {
+        sd_ctx->sd->cond_stage_model->free_params_buffer();
+    }
+
+    *cond_out   = sd_condition_to_raw(cond);
+    *uncond_out = sd_condition_to_raw(uncond);
     ggml_free(work_ctx);
-    return out;
+
+    if (*cond_out == nullptr || *uncond_out == nullptr) {
+        sd_free_condition(*cond_out);
+        sd_free_condition(*uncond_out);
+        *cond_out   = nullptr;
+        *uncond_out = nullptr;
+        return false;
+    }
+    return true;
+}
+
+SD_API bool sd_t5_precompute_condition_pair(void* t5_embedder,
+                                            int n_threads,
+                                            const char* text,
+                                            const char* negative_text,
+                                            bool zero_out_masked,
+                                            sd_condition_raw_t** cond_out,
+                                            sd_condition_raw_t** uncond_out) {
+    if (t5_embedder == nullptr || cond_out == nullptr || uncond_out == nullptr) {
+        return false;
+    }
+    *cond_out   = nullptr;
+    *uncond_out = nullptr;
+
+    struct ggml_init_params params;
+    params.mem_size   = static_cast<size_t>(1024 * 1024) * 1024;  // 1G
+    params.mem_buffer = nullptr;
+    params.no_alloc   = false;
+
+    struct ggml_context* work_ctx = ggml_init(params);
+    if (!work_ctx) {
+        LOG_ERROR("ggml_init() failed");
+        return false;
+    }
+
+    ConditionerParams condition_params;
+    condition_params.text            = SAFE_STR(text);
+    condition_params.zero_out_masked = zero_out_masked;
+
+    SDCondition cond;
+    SDCondition uncond;
+    sd_get_learned_condition_pair(static_cast<T5CLIPEmbedder*>(t5_embedder),
+                                  work_ctx,
+                                  n_threads,
+                                  condition_params,
+                                  SAFE_STR(negative_text),
+                                  cond,
+                                  uncond);
+
+    *cond_out   = sd_condition_to_raw(cond);
+    *uncond_out = sd_condition_to_raw(uncond);
+    ggml_free(work_ctx);
+
+    if (*cond_out == nullptr || *uncond_out == nullptr) {
+        sd_free_condition(*cond_out);
+        sd_free_condition(*uncond_out);
+        *cond_out   = nullptr;
+        *uncond_out = nullptr;
+        return false;
+    }
+    return true;
 }
 
 sd_image_t* generate_image_internal(sd_ctx_t* sd_ctx,
@@ -2986,6 +3571,7 @@ sd_image_t* generate_image_internal(sd_ctx_t* sd_ctx,
                                     const sd_easycache_params_t* easycache_params = nullptr,
                                     const SDCondition* precomputed_cond           = nullptr,
                                     const SDCondition* precomputed_uncond         = nullptr) {
+    sd_ctx->sd->begin_generation();
     if (seed < 0) {
         // Generally, when using the provided command line, the seed is always >0.
         // However, to prevent potential issues if 'stable-diffusion.cpp' is invoked as a library
@@ -3317,7 +3903,7 @@ sd_image_t* generate_image_internal(sd_ctx_t* sd_ctx,
     std::vector<struct ggml_tensor*> decoded_images;  // collect decoded images
     for (size_t i = 0; i < final_latents.size(); i++) {
         t1                      = ggml_time_ms();
-        struct ggml_tensor* img = sd_ctx->sd->decode_first_stage(work_ctx, final_latents[i] /* x_0 */);
+        struct ggml_tensor* img = sd_ctx->sd->decode_output(work_ctx, final_latents[i] /* x_0 */);
         // print_ggml_tensor(img);
         if (img != nullptr) {
             decoded_images.push_back(img);
@@ -3329,7 +3915,7 @@ sd_image_t* generate_image_internal(sd_ctx_t* sd_ctx,
     int64_t t4 = ggml_time_ms();
     LOG_INFO("decode_first_stage completed, taking %.2fs", (t4 - t3) * 1.0f / 1000);
     if (sd_ctx->sd->free_params_immediately && !sd_ctx->sd->use_tiny_autoencoder) {
-        if (sd_ctx->sd->first_stage_model) {
+        if (sd_ctx->sd->first_stage_model && !sd_ctx->sd->defer_vae_decode) {
             sd_ctx->sd->first_stage_model->free_params_buffer();
         }
         if (sd_ctx->sd->tae_first_stage) {
@@ -3356,6 +3942,173 @@ sd_image_t* generate_image_internal(sd_ctx_t* sd_ctx,
     return result_images;
 }
 
+// -------------------------------------------------------------------------------------------------
+// Crop-and-stitch inpainting (llmedge extension)
+// -------------------------------------------------------------------------------------------------
+
+struct InpaintCrop {
+    int x0, y0, x1, y1;     // crop rect in init image pixels (x1/y1 exclusive)
+    int width, height;      // sampling resolution of the crop
+};
+
+static bool compute_inpaint_crop(sd_ctx_t* sd_ctx, const sd_img_gen_params_t* params, InpaintCrop& crop) {
+    const sd_image_t& init = params->init_image;
+    const sd_image_t& mask = params->mask_image;
+    if (init.data == nullptr || mask.data == nullptr ||
+        mask.width != init.width || mask.height != init.height ||
+        (int)init.width != params->width || (int)init.height != params->height) {
+        return false;
+    }
+
+    int mx0 = (int)mask.width, my0 = (int)mask.height, mx1 = -1, my1 = -1;
+    for (int y = 0; y < (int)mask.height; y++) {
+        for (int x = 0; x < (int)mask.width; x++) {
+            if (mask.data[(y * mask.width + x) * mask.channel] > 127) {
+                mx0 = std::min(mx0, x);
+                my0 = std::min(my0, y);
+                mx1 = std::max(mx1, x);
+                my1 = std::max(my1, y);
+            }
+        }
+    }
+    if (mx1 < 0) {
+        LOG_INFO("inpaint crop: mask is empty, sampling the full image");
+        return false;
+    }
+
+    const int pad = std::max(0, params->inpaint_crop.padding);
+    crop.x0       = std::max(0, mx0 - pad);
+    crop.y0       = std::max(0, my0 - pad);
+    crop.x1       = std::min((int)init.width, mx1 + 1 + pad);
+    crop.y1       = std::min((int)init.height, my1 + 1 + pad);
+
+    const int crop_w = crop.x1 - crop.x0;
+    const int crop_h = crop.y1 - crop.y0;
+    if ((int64_t)crop_w * crop_h * 4 > (int64_t)init.width * init.height * 3) {
+        LOG_INFO("inpaint crop: mask covers most of the image, sampling the full image");
+        return false;
+    }
+
+    StableDiffusionGGML* sd = sd_ctx->sd;
+    const int multiple      = sd->get_vae_scale_factor() * sd->get_diffusion_model_down_factor();
+    int target              = params->inpaint_crop.target_size;
+    if (target <= 0) {
+        target = (sd_version_is_sd1(sd->version) || sd_version_is_sd2(sd->version)) ? 512 : 1024;
+    }
+    // Upscaling a small crop to the native resolution must not cost more than sampling the
+    // whole image, so the crop never gets more pixels than the full image has.
+    const double full_pixels = (double)params->width * params->height;
+    double scale             = (double)target / std::max(crop_w, crop_h);
+    scale                    = std::min(scale, std::sqrt(full_pixels / ((double)crop_w * crop_h)));
+    crop.width               = std::max(multiple, (int)(crop_w * scale / multiple) * multiple);
+    crop.height              = std::max(multiple, (int)(crop_h * scale / multiple) * multiple);
+    if ((double)crop.width * crop.height >= full_pixels) {
+        LOG_INFO("inpaint crop: %dx%d crop saves nothing over the %dx%d image, sampling the full image",
+                 crop.width, crop.height, params->width, params->height);
+        return false;
+    }
+    return true;
+}
+
+static sd_image_t resize_sd_image(const sd_image_t& image, int x0, int y0, int w, int h, int target_w, int target_h) {
+    sd_image_t region = {(uint32_t)w, (uint32_t)h, image.channel, (uint8_t*)malloc((size_t)w * h * image.channel)};
+    for (int y = 0; y < h; y++) {
+        memcpy(region.data + (size_t)y * w * image.channel,
+               image.data + ((size_t)(y0 + y) * image.width + x0) * image.channel,
+               (size_t)w * image.channel);
+    }
+    if (w == target_w && h == target_h) {
+        return region;
+    }
+    sd_image_f32_t region_f32  = sd_image_t_to_sd_image_f32_t(region);
+    sd_image_f32_t resized_f32 = resize_sd_image_f32_t(region_f32, target_w, target_h);
+    free(region.data);
+    free(region_f32.data);
+
+    sd_image_t resized = {(uint32_t)target_w, (uint32_t)target_h, image.channel, (uint8_t*)malloc((size_t)target_w * target_h * image.channel)};
+    for (size_t i = 0; i < (size_t)target_w * target_h * image.channel; i++) {
+        resized.data[i] = (uint8_t)std::clamp(resized_f32.data[i] + 0.5f, 0.0f, 255.0f);
+    }
+    free(resized_f32.data);
+    return resized;
+}
+
+// Runs `generate` on the masked crop only and stitches each result back into a copy of the
+// init image. The blend weight is the mask, feathered by distance to the crop border so the
+// padded context fades into the untouched original.
+template <typename GenerateFn>
+static sd_image_t* generate_inpaint_cropped(const sd_img_gen_params_t* params, const InpaintCrop& crop, GenerateFn generate) {
+    const int crop_w = crop.x1 - crop.x0;
+    const int crop_h = crop.y1 - crop.y0;
+    LOG_INFO("inpaint crop: sampling %dx%d region at (%d,%d) as %dx%d instead of %dx%d",
+             crop_w, crop_h, crop.x0, crop.y0, crop.width, crop.height, params->width, params->height);
+
+    sd_image_t crop_init = resize_sd_image(params->init_image, crop.x0, crop.y0, crop_w, crop_h, crop.width, crop.height);
+    sd_image_t crop_mask = resize_sd_image(params->mask_image, crop.x0, crop.y0, crop_w, crop_h, crop.width, crop.height);
+
+    sd_img_gen_params_t crop_params  = *params;
+    crop_params.init_image           = crop_init;
+    crop_params.mask_image           = crop_mask;
+    crop_params.width                = crop.width;
+    crop_params.height               = crop.height;
+    crop_params.inpaint_crop.enabled = false;
+
+    sd_image_t* crop_images = generate(&crop_params);
+    free(crop_init.data);
+    free(crop_mask.data);
+    if (crop_images == nullptr) {
+        return nullptr;
+    }
+
+    const sd_image_t& init = params->init_image;
+    const sd_image_t& mask = params->mask_image;
+    const int feather      = std::max(1, params->inpaint_crop.feather);
+    const int batch_count  = std::max(1, params->batch_count);
+
+    sd_image_t* result_images = (sd_image_t*)calloc(batch_count, sizeof(sd_image_t));
+    for (int b = 0; result_images != nullptr && b < batch_count; b++) {
+        sd_image_t& out = result_images[b];
+        out             = {init.width, init.height, 3, (uint8_t*)malloc((size_t)init.width * init.height * 3)};
+        for (size_t i = 0; i < (size_t)init.width * init.height; i++) {
+            for (int c = 0; c < 3; c++) {
+                out.data[i * 3 + c] = init.data[i * init.channel + std::min(c, (int)init.channel - 1)];
+            }
+        }
+        if (crop_images[b].data == nullptr) {
+            continue;
+        }
+        sd_image_t patch = resize_sd_image(crop_images[b], 0, 0, crop_images[b].width, crop_images[b].height, crop_w, crop_h);
+        for (int y = 0; y < crop_h; y++) {
+            for (int x = 0; x < crop_w; x++) {
+                const int gx = crop.x0 + x;
+                const int gy = crop.y0 + y;
+                // Only fade towards crop edges that are inside the image.
+                int edge = feather;
+                if (crop.x0 > 0) edge = std::min(edge, x);
+                if (crop.y0 > 0) edge = std::min(edge, y);
+                if (crop.x1 < (int)init.width) edge = std::min(edge, crop_w - 1 - x);
+                if (crop.y1 < (int)init.height) edge = std::min(edge, crop_h - 1 - y);
+                const float m     = mask.data[((size_t)gy * mask.width + gx) * mask.channel] / 255.0f;
+                const float alpha = m * std::min(1.0f, (float)edge / feather);
+                if (alpha <= 0.0f) {
+                    continue;
+                }
+                uint8_t* dst       = out.data + ((size_t)gy * init.width + gx) * 3;
+                const uint8_t* src = patch.data + ((size_t)y * crop_w + x) * patch.channel;
+                for (int c = 0; c < 3; c++) {
+                    dst[c] = (uint8_t)(dst[c] + (src[c] - dst[c]) * alpha + 0.5f);
+                }
+            }
+        }
+        free(patch.data);
+    }
+    for (int b = 0; b < batch_count; b++) {
+        free(crop_images[b].data);
+    }
+    free(crop_images);
+    return result_images;
+}
+
 SD_API sd_image_t* sd_generate_image_with_precomputed_condition(sd_ctx_t* sd_ctx,
                                                                 const sd_img_gen_params_t* sd_img_gen_params,
                                                                 const sd_condition_raw_t* cond_raw,
@@ -3364,6 +4117,13 @@ SD_API sd_image_t* sd_generate_image_with_precomputed_condition(sd_ctx_t* sd_ctx
         return nullptr;
     }
 
+    InpaintCrop inpaint_crop;
+    if (sd_img_gen_params->inpaint_crop.enabled && compute_inpaint_crop(sd_ctx, sd_img_gen_params, inpaint_crop)) {
+        return generate_inpaint_cropped(sd_img_gen_params, inpaint_crop, [&](const sd_img_gen_params_t* crop_params) {
+            return sd_generate_image_with_precomputed_condition(sd_ctx, crop_params, cond_raw, uncond_raw);
+        });
+    }
+
     sd_ctx->sd->vae_tiling_params = sd_img_gen_params->vae_tiling_params;
     int width                     = sd_img_gen_params->width;
     int height                    = sd_img_gen_params->height;
@@ -3572,6 +4332,13 @@ sd_image_t* generate_image(sd_ctx_t* sd_ctx, const sd_img_gen_params_t* sd_img_g
         return nullptr;
     }
 
+    InpaintCrop inpaint_crop;
+    if (sd_img_gen_params->inpaint_crop.enabled && compute_inpaint_crop(sd_ctx, sd_img_gen_params, inpaint_crop)) {
+        return generate_inpaint_cropped(sd_img_gen_params, inpaint_crop, [&](const sd_img_gen_params_t* crop_params) {
+            return generate_image(sd_ctx, crop_params);
+        });
+    }
+
     sd_ctx->sd->vae_tiling_params = sd_img_gen_params->vae_tiling_params;
     int width                     = sd_img_gen_params->width;
     int height                    = sd_img_gen_params->height;
@@ -3867,6 +4634,7 @@ SD_API sd_image_t* sd_generate_video_with_precomputed_condition(sd_ctx_t* sd_ctx
         LOG_ERROR("sd_generate_video_with_precomputed_condition: cond is null");
         return nullptr;
     }
+    sd_ctx->sd->begin_generation();
 
     std::string prompt          = SAFE_STR(sd_vid_gen_params->prompt);
     std::string negative_prompt = SAFE_STR(sd_vid_gen_params->negative_prompt);
@@ -4276,11 +5044,11 @@ SD_API sd_image_t* sd_generate_video_with_precomputed_condition(sd_ctx_t* sd_ctx
 
     int64_t t4 = ggml_time_ms();
     LOG_INFO("generating latent video completed, taking %.2fs", (t4 - t0) * 1.0f / 1000);
-    struct ggml_tensor* vid = sd_ctx->sd->decode_first_stage(work_ctx, final_latent, true);
+    struct ggml_tensor* vid = sd_ctx->sd->decode_output(work_ctx, final_latent, true);
     int64_t t5              = ggml_time_ms();
     LOG_INFO("decode_first_stage completed, taking %.2fs", (t5 - t4) * 1.0f / 1000);
     if (sd_ctx->sd->free_params_immediately) {
-        if (sd_ctx->sd->first_stage_model) {
+        if (sd_ctx->sd->first_stage_model && !sd_ctx->sd->defer_vae_decode) {
             sd_ctx->sd->first_stage_model->free_params_buffer();
         }
         if (sd_ctx->sd->tae_first_stage) {
@@ -4313,6 +5081,7 @@ SD_API sd_image_t* generate_video(sd_ctx_t* sd_ctx, const sd_vid_gen_params_t* s
     if (sd_ctx == nullptr || sd_vid_gen_params == nullptr) {
         return nullptr;
     }
+    sd_ctx->sd->begin_generation();
 
     std::string prompt          = SAFE_STR(sd_vid_gen_params->prompt);
     std::string negative_prompt = SAFE_STR(sd_vid_gen_params->negative_prompt);
@@ -4727,11 +5496,11 @@ SD_API sd_image_t* generate_video(sd_ctx_t* sd_ctx, const sd_vid_gen_params_t* s
 
     int64_t t4 = ggml_time_ms();
     LOG_INFO("generating latent video completed, taking %.2fs", (t4 - t2) * 1.0f / 1000);
-    struct ggml_tensor* vid = sd_ctx->sd->decode_first_stage(work_ctx, final_latent, true);
+    struct ggml_tensor* vid = sd_ctx->sd->decode_output(work_ctx, final_latent, true);
     int64_t t5              = ggml_time_ms();
     LOG_INFO("decode_first_stage completed, taking %.2fs", (t5 - t4) * 1.0f / 1000);
     if (sd_ctx->sd->free_params_immediately) {
-        if (sd_ctx->sd->first_stage_model) {
+        if (sd_ctx->sd->first_stage_model && !sd_ctx->sd->defer_vae_decode) {
             sd_ctx->sd->first_stage_model->free_params_buffer();
         }
         if (sd_ctx->sd->tae_first_stage) {
@@ -4760,3 +5529,180 @@ SD_API sd_image_t* generate_video(sd_ctx_t* sd_ctx, const sd_vid_gen_params_t* s
 
     return result_images;
 }
+
+// -------------------------------------------------------------------------------------------------
+// Deferred VAE decode (llmedge extension)
+// -------------------------------------------------------------------------------------------------
+
+SD_API void sd_set_deferred_decode(sd_ctx_t* sd_ctx, bool enabled) {
+    if (sd_ctx == nullptr || sd_ctx->sd == nullptr) {
+        return;
+    }
+    sd_ctx->sd->defer_vae_decode = enabled;
+    if (!enabled) {
+        sd_ctx->sd->deferred_latents.clear();
+    }
+}
+
+SD_API int sd_deferred_latent_count(sd_ctx_t* sd_ctx) {
+    if (sd_ctx == nullptr || sd_ctx->sd == nullptr) {
+        return 0;
+    }
+    return (int)sd_ctx->sd->deferred_latents.size();
+}
+
+SD_API int sd_take_deferred_latents(sd_ctx_t* sd_ctx, sd_latent_t** latents_out, int max_latents) {
+    if (sd_ctx == nullptr || sd_ctx->sd == nullptr || latents_out == nullptr || max_latents <= 0) {
+        return 0;
+    }
+    auto& latents = sd_ctx->sd->deferred_latents;
+    int count     = std::min<int>(max_latents, (int)latents.size());
+    for (int i = 0; i < count; i++) {
+        latents_out[i] = latents[i].release();
+    }
+    // latents that did not fit stay queued for the next call
+    latents.erase(latents.begin(), latents.begin() + count);
+    return count;
+}
+
+SD_API bool sd_latent_spill_to_file(sd_latent_t* latent, const char* path) {
+    if (latent == nullptr || path == nullptr) {
+        return false;
+    }
+    if (latent->data.empty()) {
+        return !latent->spill_path.empty();
+    }
+    FILE* fp = fopen(path, "wb");
+    if (fp == nullptr) {
+        LOG_ERROR("failed to open '%s' for writing", path);
+        return false;
+    }
+    size_t written = fwrite(latent->data.data(), sizeof(float), latent->data.size(), fp);
+    fclose(fp);
+    if (written != latent->data.size()) {
+        LOG_ERROR("failed to write latent to '%s'", path);
+        std::remove(path);
+        return false;
+    }
+    if (!latent->spill_path.empty() && latent->spill_path != path) {
+        std::remove(latent->spill_path.c_str());
+    }
+    latent->spill_path = path;
+    std::vector<float>().swap(latent->data);
+    return true;
+}
+
+SD_API void sd_free_latent(sd_latent_t* latent) {
+    delete latent;
+}
+
+SD_API sd_image_t* sd_decode_latent(sd_ctx_t* sd_ctx,
+                                    const sd_latent_t* latent,
+                                    bool vae_tiling,
+                                    int* num_frames_out) {
+    if (sd_ctx == nullptr || sd_ctx->sd == nullptr || latent == nullptr || num_frames_out == nullptr) {
+        return nullptr;
+    }
+    *num_frames_out = 0;
+
+    StableDiffusionGGML* sd = sd_ctx->sd;
+    if (sd->first_stage_model == nullptr && sd->tae_first_stage == nullptr) {
+        LOG_ERROR("sd_decode_latent: context has no VAE");
+        return nullptr;
+    }
+    if (sd->first_stage_model == nullptr) {
+        LOG_WARN("sd_decode_latent: full VAE not loaded, decoding with the tiny autoencoder");
+    }
+
+    const size_t n_latent      = latent->nelements();
+    const int vae_scale_factor = sd->get_vae_scale_factor();
+    int64_t frames             = latent->video ? latent->ne[2] : latent->ne[3];
+    if (latent->video && sd_version_is_wan(sd->version)) {
+        frames = (frames - 1) * 4 + 1;
+    }
+    const size_t n_output = (size_t)(latent->ne[0] * vae_scale_factor) * (latent->ne[1] * vae_scale_factor) * 3 * frames;
+
+    struct ggml_init_params params;
+    params.mem_size   = (n_latent + n_output) * sizeof(float) + static_cast<size_t>(10 * 1024 * 1024);
+    params.mem_buffer = nullptr;
+    params.no_alloc   = false;
+
+    struct ggml_context* work_ctx = ggml_init(params);
+    if (!work_ctx) {
+        LOG_ERROR("ggml_init() failed");
+        return nullptr;
+    }
+
+    ggml_tensor* x = ggml_new_tensor_4d(work_ctx, GGML_TYPE_F32, latent->ne[0], latent->ne[1], latent->ne[2], latent->ne[3]);
+    if (!latent->data.empty()) {
+        memcpy(x->data, latent->data.data(), n_latent * sizeof(float));
+    } else {
+        FILE* fp    = fopen(latent->spill_path.c_str(), "rb");
+        size_t read = 0;
+        if (fp != nullptr) {
+            read = fread(x->data, sizeof(float), n_latent, fp);
+            fclose(fp);
+        }
+        if (read != n_latent) {
+            LOG_ERROR("failed to read spilled latent from '%s'", latent->spill_path.c_str());
+            ggml_free(work_ctx);
+            return nullptr;
+        }
+    }
+
+    sd_tiling_params_t prev_tiling = sd->vae_tiling_params;
+    sd->vae_tiling_params.enabled  = vae_tiling;
+
+    int64_t t0       = ggml_time_ms();
+    ggml_tensor* out = sd->decode_first_stage(work_ctx, x, latent->video, sd->first_stage_model == nullptr);
+    int64_t t1       = ggml_time_ms();
+    LOG_INFO("sd_decode_latent completed, taking %.2fs", (t1 - t0) * 1.0f / 1000);
+    sd->vae_tiling_params = prev_tiling;
+
+    const int count           = latent->video ? (int)out->ne[2] : (int)out->ne[3];
+    sd_image_t* result_images = (sd_image_t*)calloc(count, sizeof(sd_image_t));
+    if (result_images == nullptr) {
+        ggml_free(work_ctx);
+        return nullptr;
+    }
+    for (int i = 0; i < count; i++) {
+        result_images[i].width   = out->ne[0];
+        result_images[i].height  = out->ne[1];
+        result_images[i].channel = 3;
+        result_images[i].data    = latent->video ? ggml_tensor_to_sd_image(out, i, true) : ggml_tensor_to_sd_image(out, i);
+    }
+    *num_frames_out = count;
+    ggml_free(work_ctx);
+    return result_images;
+}
+
+// -------------------------------------------------------------------------------------------------
+// Sampling checkpoints (llmedge extension)
+// -------------------------------------------------------------------------------------------------
+
+SD_API void sd_set_sampling_checkpoint(sd_ctx_t* sd_ctx, const char* path_prefix, int every_n_steps, bool resume) {
+    if (sd_ctx == nullptr || sd_ctx->sd == nullptr) {
+        return;
+    }
+    StableDiffusionGGML* sd      = sd_ctx->sd;
+    sd->checkpoint_prefix        = path_prefix != nullptr ? path_prefix : "";
+    sd->checkpoint_every_n_steps = every_n_steps;
+    sd->checkpoint_resume        = resume;
+}
+
+// -------------------------------------------------------------------------------------------------
+// Sparse attention (llmedge extension)
+// -------------------------------------------------------------------------------------------------
+
+SD_API void sd_set_sparse_attention(sd_ctx_t* sd_ctx, const sd_sparse_attention_params_t* params) {
+    if (sd_ctx == nullptr || sd_ctx->sd == nullptr) {
+        return;
+    }
+    if (params == nullptr || !params->enabled) {
+        sd_ctx->sd->sparse_attention = {false, 0, 0};
+        return;
+    }
+    sd_ctx->sd->sparse_attention               = *params;
+    sd_ctx->sd->sparse_attention.window_frames = std::max(1, params->window_frames);
+    sd_ctx->sd->sparse_attention.global_stride = std::max(0, params->global_stride);
+}
@@ -269,6 +269,17 @@ typedef struct {
     float end_percent;
 } sd_easycache_params_t;
 
+// Crop-and-stitch inpainting: sample only the mask's bounding box (plus `padding` pixels of
+// context), resized so its longest side is `target_size` (0 = the model's native resolution)
+// but never to more pixels than the full image, then blend the result back into the init image
+// with a `feather`-pixel ramp. A crop that would save nothing samples the full image instead.
+typedef struct {
+    bool enabled;
+    int padding;
+    int feather;
+    int target_size;
+} sd_inpaint_crop_params_t;
+
 typedef struct {
     bool is_high_noise;
     float multiplier;
@@ -298,6 +309,7 @@ typedef struct {
     sd_pm_params_t pm_params;
     sd_tiling_params_t vae_tiling_params;
     sd_easycache_params_t easycache;
+    sd_inpaint_crop_params_t inpaint_crop;
 } sd_img_gen_params_t;
 
 typedef struct {
@@ -380,6 +392,32 @@ SD_API sd_condition_raw_t* sd_precompute_condition(sd_ctx_t* sd_ctx,
                                                    bool zero_out_masked);
 SD_API void sd_free_condition(sd_condition_raw_t* cond);
 
+// Compute cond (`text`) and uncond (`negative_text`, may be empty) in one call.
+//
+// The conditioner weights stay resident for both prompts and are released once afterwards
+// (when free_params_immediately is set). T5 text encoders run both prompts as a single
+// batched forward pass when no padding mask is used. On success both outputs are owned by
+// the caller and must be released with sd_free_condition().
+SD_API bool sd_precompute_condition_pair(sd_ctx_t* sd_ctx,
+                                         const char* text,
+                                         const char* negative_text,
+                                         int clip_skip,
+                                         int width,
+                                         int height,
+                                         bool zero_out_masked,
+                                         sd_condition_raw_t** cond_out,
+                                         sd_condition_raw_t** uncond_out);
+
+// Same as sd_precompute_condition_pair() for a standalone T5CLIPEmbedder (T5-only contexts
+// that are created without a diffusion model). `t5_embedder` must point to a T5CLIPEmbedder.
+SD_API bool sd_t5_precompute_condition_pair(void* t5_embedder,
+                                            int n_threads,
+                                            const char* text,
+                                            const char* negative_text,
+                                            bool zero_out_masked,
+                                            sd_condition_raw_t** cond_out,
+                                            sd_condition_raw_t** uncond_out);
+
 SD_API sd_image_t* sd_generate_image_with_precomputed_condition(sd_ctx_t* sd_ctx,
                                                                 const sd_img_gen_params_t* sd_img_gen_params,
                                                                 const sd_condition_raw_t* cond,
@@ -394,6 +432,51 @@ SD_API sd_image_t* sd_generate_video_with_precomputed_condition(sd_ctx_t* sd_ctx
                                                                 const sd_condition_raw_t* uncond,
                                                                 int* num_frames_out);
 
+// Deferred VAE decode.
+//
+// When enabled, generation decodes its output with the tiny autoencoder (a fast draft) and
+// keeps the final latent back instead of running the full VAE. The full VAE must be resident
+// next to the TAE (tae_preview_only = true); without a TAE the draft uses the full VAE.
+// Latents of the last generation are collected with sd_take_deferred_latents() and decoded on
+// demand with sd_decode_latent(). Each returned latent is owned by the caller; latents beyond
+// `max_latents` stay queued, and sd_deferred_latent_count() tells how many are waiting.
+typedef struct sd_latent_t sd_latent_t;
+
+SD_API void sd_set_deferred_decode(sd_ctx_t* sd_ctx, bool enabled);
+SD_API int sd_deferred_latent_count(sd_ctx_t* sd_ctx);
+SD_API int sd_take_deferred_latents(sd_ctx_t* sd_ctx, sd_latent_t** latents_out, int max_latents);
+SD_API sd_image_t* sd_decode_latent(sd_ctx_t* sd_ctx,
+                                    const sd_latent_t* latent,
+                                    bool vae_tiling,
+                                    int* num_frames_out);
+// Write the latent to `path` and drop its host copy; sd_decode_latent() reads it back.
+// The file is removed when the latent is freed.
+SD_API bool sd_latent_spill_to_file(sd_latent_t* latent, const char* path);
+SD_API void sd_free_latent(sd_latent_t* latent);
+
+// Resumable sampling.
+//
+// While a path prefix is set, every sample() of a generation writes "<prefix>.<n>" and commits
+// it every `every_n_steps` steps. With `resume` set, a generation started with the same
+// request and seed replays the committed denoiser outputs instead of running the model and
+// continues from the last commit, bit-identical to an uninterrupted run (EasyCache excluded).
+// Pass a NULL prefix to disable. Files are left in place; the caller removes them.
+SD_API void sd_set_sampling_checkpoint(sd_ctx_t* sd_ctx, const char* path_prefix, int every_n_steps, bool resume);
+
+// Sparse spatio-temporal attention for Wan video models.
+//
+// Self-attention over the latent tokens is restricted to temporal windows of `window_frames`
+// latent frames plus every `global_stride`-th token of the whole clip (0 for no global
+// tokens), instead of all-to-all. Applies to the generations that follow; NULL or
+// enabled == false restores full attention.
+typedef struct {
+    bool enabled;
+    int window_frames;
+    int global_stride;
+} sd_sparse_attention_params_t;
+
+SD_API void sd_set_sparse_attention(sd_ctx_t* sd_ctx, const sd_sparse_attention_params_t* params);
+
 typedef struct upscaler_ctx_t upscaler_ctx_t;
 
 SD_API upscaler_ctx_t* new_upscaler_ctx(const char* esrgan_path,
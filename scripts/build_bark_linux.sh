@@ -2,11 +2,11 @@
 set -euo pipefail
 
 # Build bark.cpp JNI library for Linux (x86_64).
-# Places the resulting libbark_jni.so into build/native/linux-x86_64
+# Places the resulting libbark_jni.so into build/native/linux-x86_64, together with
+# libbark_jni_avx2.so and libbark_jni_avx512.so; NativeLibraryLoader picks the best
+# variant the host supports at runtime.
 
 ROOT_DIR="$(dirname "$(realpath "$0")")/.."
-BUILD_DIR="$ROOT_DIR/scripts/jni-desktop/build-bark"
-mkdir -p "$BUILD_DIR"
 
 # Point to bark.cpp directory
 BARK_DIR="$ROOT_DIR/bark.cpp"
@@ -24,19 +24,6 @@ cd "$BARK_DIR"
 git submodule update --init --recursive 2>/dev/null || true
 cd "$ROOT_DIR"
 
-# Configure CMake for a host build of bark.cpp
-cmake -S "$BARK_DIR" -B "$BUILD_DIR" \
-    -DCMAKE_BUILD_TYPE=Release \
-    -DCMAKE_POSITION_INDEPENDENT_CODE=ON \
-    -DBUILD_SHARED_LIBS=OFF \
-    -DBARK_BUILD_EXAMPLES=OFF
-
-cmake --build "$BUILD_DIR" --parallel $(nproc)
-
-# Now build the JNI wrapper
-JNI_BUILD_DIR="$ROOT_DIR/scripts/jni-desktop/build-bark-jni"
-mkdir -p "$JNI_BUILD_DIR"
-
 # Find JNI headers
 if [[ -z "${JAVA_HOME:-}" ]]; then
     JAVA_HOME=$(dirname $(dirname $(readlink -f $(which java))))
@@ -48,10 +35,35 @@ if [[ ! -d "$JNI_INCLUDE_DIR" ]]; then
     exit 1
 fi
 
-# Create a minimal CMakeLists.txt for JNI wrapper
-cat > "$JNI_BUILD_DIR/CMakeLists.txt" <<EOF
+# build_variant <library name> <ISA flags>
+# bark.cpp bundles an older ggml whose ISA options differ from upstream, so the variant flags
+# are passed as compiler flags with ggml's -march=native detection turned off.
+build_variant() {
+    local LIB_NAME="$1"
+    local ISA_FLAGS="$2"
+    local BUILD_DIR="$ROOT_DIR/scripts/jni-desktop/build-${LIB_NAME/bark_jni/bark}"
+    mkdir -p "$BUILD_DIR"
+
+    # Configure CMake for a host build of bark.cpp
+    cmake -S "$BARK_DIR" -B "$BUILD_DIR" \
+        -DCMAKE_BUILD_TYPE=Release \
+        -DCMAKE_POSITION_INDEPENDENT_CODE=ON \
+        -DBUILD_SHARED_LIBS=OFF \
+        -DBARK_BUILD_EXAMPLES=OFF \
+        -DGGML_NATIVE=OFF \
+        -DCMAKE_C_FLAGS="$ISA_FLAGS" \
+        -DCMAKE_CXX_FLAGS="$ISA_FLAGS"
+
+    cmake --build "$BUILD_DIR" --parallel $(nproc)
+
+    # Now build the JNI wrapper
+    local JNI_BUILD_DIR="$ROOT_DIR/scripts/jni-desktop/build-${LIB_NAME//_/-}"
+    mkdir -p "$JNI_BUILD_DIR"
+
+    # Create a minimal CMakeLists.txt for JNI wrapper
+    cat > "$JNI_BUILD_DIR/CMakeLists.txt" <<EOF
 cmake_minimum_required(VERSION 3.10)
-project(bark_jni)
+project($LIB_NAME)
 
 set(CMAKE_CXX_STANDARD 17)
 set(CMAKE_POSITION_INDEPENDENT_CODE ON)
@@ -67,11 +79,11 @@ find_package(JNI REQUIRED)
 find_package(OpenMP)
 
 # Build bark_jni shared library
-add_library(bark_jni SHARED
+add_library($LIB_NAME SHARED
     $LLMEDGE_CPP_ROOT/bark_jni.cpp
 )
 
-target_include_directories(bark_jni PRIVATE
+target_include_directories($LIB_NAME PRIVATE
     \${BARK_DIR}
     \${BARK_DIR}/encodec.cpp
     \${BARK_DIR}/encodec.cpp/ggml/include
@@ -79,7 +91,7 @@ target_include_directories(bark_jni PRIVATE
 )
 
 # Link against the static bark library
-target_link_libraries(bark_jni PRIVATE
+target_link_libraries($LIB_NAME PRIVATE
     \${BARK_BUILD_DIR}/libbark.a
     \${BARK_BUILD_DIR}/encodec.cpp/libencodec.a
     \${BARK_BUILD_DIR}/encodec.cpp/ggml/src/libggml.a
@@ -89,23 +101,32 @@ target_link_libraries(bark_jni PRIVATE
 )
 
 if(OpenMP_CXX_FOUND)
-    target_link_libraries(bark_jni PRIVATE OpenMP::OpenMP_CXX)
+    target_link_libraries($LIB_NAME PRIVATE OpenMP::OpenMP_CXX)
 endif()
 
-target_compile_options(bark_jni PUBLIC -fvisibility=hidden -fvisibility-inlines-hidden)
+target_compile_options($LIB_NAME PUBLIC -fvisibility=hidden -fvisibility-inlines-hidden)
 EOF
 
-cmake -S "$JNI_BUILD_DIR" -B "$JNI_BUILD_DIR/build" \
-    -DCMAKE_BUILD_TYPE=Release
+    cmake -S "$JNI_BUILD_DIR" -B "$JNI_BUILD_DIR/build" \
+        -DCMAKE_BUILD_TYPE=Release
 
-cmake --build "$JNI_BUILD_DIR/build" --parallel $(nproc)
+    cmake --build "$JNI_BUILD_DIR/build" --parallel $(nproc)
 
-# Copy the library to the native directory
-mkdir -p "$ROOT_DIR/llmedge/build/native/linux-x86_64"
-cp "$JNI_BUILD_DIR/build/libbark_jni.so" "$ROOT_DIR/llmedge/build/native/linux-x86_64/"
+    # Copy the library to the native directory
+    mkdir -p "$ROOT_DIR/llmedge/build/native/linux-x86_64"
+    cp "$JNI_BUILD_DIR/build/lib$LIB_NAME.so" "$ROOT_DIR/llmedge/build/native/linux-x86_64/"
 
-# Also copy to a more accessible location
-mkdir -p "$ROOT_DIR/scripts/jni-desktop/build/bin"
-cp "$JNI_BUILD_DIR/build/libbark_jni.so" "$ROOT_DIR/scripts/jni-desktop/build/bin/"
+    # Also copy to a more accessible location
+    mkdir -p "$ROOT_DIR/scripts/jni-desktop/build/bin"
+    cp "$JNI_BUILD_DIR/build/lib$LIB_NAME.so" "$ROOT_DIR/scripts/jni-desktop/build/bin/"
 
-echo "Built and copied libbark_jni.so to llmedge/build/native/linux-x86_64/libbark_jni.so"
+    echo "Built and copied lib$LIB_NAME.so to llmedge/build/native/linux-x86_64/lib$LIB_NAME.so"
+}
+
+# Portable baseline, then the ISA variants (x86-64 only)
+build_variant bark_jni ""
+if [[ "$(uname -m)" == "x86_64" ]]; then
+    AVX2_FLAGS="-mavx -mavx2 -mfma -mf16c -mbmi2"
+    build_variant bark_jni_avx2 "$AVX2_FLAGS"
+    build_variant bark_jni_avx512 "$AVX2_FLAGS -mavx512f -mavx512cd -mavx512vl -mavx512dq -mavx512bw"
+fi
@@ -1,7 +1,8 @@
 #!/usr/bin/env bash
 set -euo pipefail
 
-# Build sdcpp JNI library for Linux (x86_64). Places the resulting libsdcpp.so into build/native/linux-x86_64
+# Build sdcpp JNI library for Linux (x86_64). Places the resulting libsdcpp.so (and its
+# libsdcpp_avx2.so / libsdcpp_avx512.so variants) into build/native/linux-x86_64
 
 ROOT_DIR="$(dirname "$(realpath "$0")")/.."
 BUILD_DIR="$ROOT_DIR/scripts/jni-desktop/build"
@@ -79,16 +80,23 @@ cmake -S "$SRC_DIR" -B "$BUILD_DIR" \
   -DSDC_TEST_DESKTOP_JNI=ON \
   "${CMAKE_EXTRA_ARGS[@]}"
 
-cmake --build "$BUILD_DIR" --target sdcpp --parallel $(nproc)
-
-# Try to find libsdcpp
-LIB_PATH=$(find "$BUILD_DIR" -type f -name 'libsdcpp*.so' -print -quit || true)
-if [[ -z "$LIB_PATH" ]]; then
-  echo "libsdcpp.so not found. CMake build might have failed or name different. Inspect $BUILD_DIR"
-  exit 1
+# On x86-64 the CMake project also defines AVX2/AVX-512 variants (LLMEDGE_X86_VARIANTS);
+# NativeLibraryLoader picks the best one at runtime.
+TARGETS=(sdcpp)
+if [[ "$(uname -m)" == "x86_64" ]]; then
+  TARGETS+=(sdcpp_avx2 sdcpp_avx512)
 fi
 
-mkdir -p "$ROOT_DIR/llmedge/build/native/linux-x86_64"
-cp "$LIB_PATH" "$ROOT_DIR/llmedge/build/native/linux-x86_64/libsdcpp.so"
+cmake --build "$BUILD_DIR" --target "${TARGETS[@]}" --parallel $(nproc)
 
-echo "Built and copied libsdcpp.so to llmedge/build/native/linux-x86_64/libsdcpp.so"
+mkdir -p "$ROOT_DIR/llmedge/build/native/linux-x86_64"
+for target in "${TARGETS[@]}"; do
+  # Try to find lib<target>.so
+  LIB_PATH=$(find "$BUILD_DIR" -type f -name "lib${target}.so" -print -quit || true)
+  if [[ -z "$LIB_PATH" ]]; then
+    echo "lib${target}.so not found. CMake build might have failed or name different. Inspect $BUILD_DIR"
+    exit 1
+  fi
+  cp "$LIB_PATH" "$ROOT_DIR/llmedge/build/native/linux-x86_64/lib${target}.so"
+  echo "Built and copied lib${target}.so to llmedge/build/native/linux-x86_64/lib${target}.so"
+done
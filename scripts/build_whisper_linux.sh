@@ -2,11 +2,11 @@
 set -euo pipefail
 
 # Build whisper.cpp JNI library for Linux (x86_64).
-# Places the resulting libwhisper_jni.so into build/native/linux-x86_64
+# Places the resulting libwhisper_jni.so into build/native/linux-x86_64, together with
+# libwhisper_jni_avx2.so and libwhisper_jni_avx512.so; NativeLibraryLoader picks the best
+# variant the host supports at runtime.
 
 ROOT_DIR="$(dirname "$(realpath "$0")")/.."
-BUILD_DIR="$ROOT_DIR/scripts/jni-desktop/build-whisper"
-mkdir -p "$BUILD_DIR"
 
 # Point to whisper.cpp directory
 WHISPER_DIR="$ROOT_DIR/whisper.cpp"
@@ -18,25 +18,6 @@ if [[ ! -f "$WHISPER_DIR/include/whisper.h" ]]; then
     exit 1
 fi
 
-# Configure CMake for a host build
-cmake -S "$WHISPER_DIR" -B "$BUILD_DIR" \
-    -DCMAKE_BUILD_TYPE=Release \
-    -DCMAKE_POSITION_INDEPENDENT_CODE=ON \
-    -DBUILD_SHARED_LIBS=OFF \
-    -DWHISPER_BUILD_TESTS=OFF \
-    -DWHISPER_BUILD_EXAMPLES=OFF \
-    -DWHISPER_BUILD_SERVER=OFF \
-    -DWHISPER_SDL2=OFF \
-    -DWHISPER_CURL=OFF \
-    -DWHISPER_COREML=OFF \
-    -DWHISPER_OPENVINO=OFF
-
-cmake --build "$BUILD_DIR" --target whisper --parallel $(nproc)
-
-# Now build the JNI wrapper
-JNI_BUILD_DIR="$ROOT_DIR/scripts/jni-desktop/build-whisper-jni"
-mkdir -p "$JNI_BUILD_DIR"
-
 # Find JNI headers
 if [[ -z "${JAVA_HOME:-}" ]]; then
     JAVA_HOME=$(dirname $(dirname $(readlink -f $(which java))))
@@ -48,10 +29,37 @@ if [[ ! -d "$JNI_INCLUDE_DIR" ]]; then
     exit 1
 fi
 
-# Create a minimal CMakeLists.txt for JNI wrapper
-cat > "$JNI_BUILD_DIR/CMakeLists.txt" <<EOF
+# build_variant <library name> <extra whisper.cpp CMake args...>
+build_variant() {
+    local LIB_NAME="$1"
+    shift
+    local BUILD_DIR="$ROOT_DIR/scripts/jni-desktop/build-${LIB_NAME/whisper_jni/whisper}"
+    mkdir -p "$BUILD_DIR"
+
+    # Configure CMake for a host build
+    cmake -S "$WHISPER_DIR" -B "$BUILD_DIR" \
+        -DCMAKE_BUILD_TYPE=Release \
+        -DCMAKE_POSITION_INDEPENDENT_CODE=ON \
+        -DBUILD_SHARED_LIBS=OFF \
+        -DWHISPER_BUILD_TESTS=OFF \
+        -DWHISPER_BUILD_EXAMPLES=OFF \
+        -DWHISPER_BUILD_SERVER=OFF \
+        -DWHISPER_SDL2=OFF \
+        -DWHISPER_CURL=OFF \
+        -DWHISPER_COREML=OFF \
+        -DWHISPER_OPENVINO=OFF \
+        "$@"
+
+    cmake --build "$BUILD_DIR" --target whisper --parallel $(nproc)
+
+    # Now build the JNI wrapper
+    local JNI_BUILD_DIR="$ROOT_DIR/scripts/jni-desktop/build-${LIB_NAME//_/-}"
+    mkdir -p "$JNI_BUILD_DIR"
+
+    # Create a minimal CMakeLists.txt for JNI wrapper
+    cat > "$JNI_BUILD_DIR/CMakeLists.txt" <<EOF
 cmake_minimum_required(VERSION 3.10)
-project(whisper_jni)
+project($LIB_NAME)
 
 set(CMAKE_CXX_STANDARD 17)
 set(CMAKE_POSITION_INDEPENDENT_CODE ON)
@@ -67,18 +75,18 @@ find_package(JNI REQUIRED)
 find_package(OpenMP REQUIRED)
 
 # Build whisper_jni shared library
-add_library(whisper_jni SHARED
+add_library($LIB_NAME SHARED
     $LLMEDGE_CPP_ROOT/whisper_jni.cpp
 )
 
-target_include_directories(whisper_jni PRIVATE
+target_include_directories($LIB_NAME PRIVATE
     \${WHISPER_DIR}/include
     \${WHISPER_DIR}/ggml/include
     \${JNI_INCLUDE_DIRS}
 )
 
 # Link against the static whisper library
-target_link_libraries(whisper_jni PRIVATE
+target_link_libraries($LIB_NAME PRIVATE
     \${WHISPER_BUILD_DIR}/src/libwhisper.a
     \${WHISPER_BUILD_DIR}/ggml/src/libggml.a
     \${WHISPER_BUILD_DIR}/ggml/src/libggml-base.a
@@ -89,20 +97,29 @@ target_link_libraries(whisper_jni PRIVATE
     m
 )
 
-target_compile_options(whisper_jni PUBLIC -fvisibility=hidden -fvisibility-inlines-hidden)
+target_compile_options($LIB_NAME PUBLIC -fvisibility=hidden -fvisibility-inlines-hidden)
 EOF
 
-cmake -S "$JNI_BUILD_DIR" -B "$JNI_BUILD_DIR/build" \
-    -DCMAKE_BUILD_TYPE=Release
+    cmake -S "$JNI_BUILD_DIR" -B "$JNI_BUILD_DIR/build" \
+        -DCMAKE_BUILD_TYPE=Release
+
+    cmake --build "$JNI_BUILD_DIR/build" --parallel $(nproc)
 
-cmake --build "$JNI_BUILD_DIR/build" --parallel $(nproc)
+    # Copy the library to the native directory
+    mkdir -p "$ROOT_DIR/llmedge/build/native/linux-x86_64"
+    cp "$JNI_BUILD_DIR/build/lib$LIB_NAME.so" "$ROOT_DIR/llmedge/build/native/linux-x86_64/"
 
-# Copy the library to the native directory
-mkdir -p "$ROOT_DIR/llmedge/build/native/linux-x86_64"
-cp "$JNI_BUILD_DIR/build/libwhisper_jni.so" "$ROOT_DIR/llmedge/build/native/linux-x86_64/"
+    # Also copy to a more accessible location
+    mkdir -p "$ROOT_DIR/scripts/jni-desktop/build/bin"
+    cp "$JNI_BUILD_DIR/build/lib$LIB_NAME.so" "$ROOT_DIR/scripts/jni-desktop/build/bin/"
 
-# Also copy to a more accessible location
-mkdir -p "$ROOT_DIR/scripts/jni-desktop/build/bin"
-cp "$JNI_BUILD_DIR/build/libwhisper_jni.so" "$ROOT_DIR/scripts/jni-desktop/build/bin/"
+    echo "Built and copied lib$LIB_NAME.so to llmedge/build/native/linux-x86_64/lib$LIB_NAME.so"
+}
 
-echo "Built and copied libwhisper_jni.so to llmedge/build/native/linux-x86_64/libwhisper_jni.so"
+# Portable baseline, then the ISA variants (x86-64 only)
+build_variant whisper_jni -DGGML_NATIVE=OFF
+if [[ "$(uname -m)" == "x86_64" ]]; then
+    AVX2_ARGS=(-DGGML_NATIVE=OFF -DGGML_AVX=ON -DGGML_AVX2=ON -DGGML_FMA=ON -DGGML_F16C=ON -DGGML_BMI2=ON)
+    build_variant whisper_jni_avx2 "${AVX2_ARGS[@]}"
+    build_variant whisper_jni_avx512 "${AVX2_ARGS[@]}" -DGGML_AVX512=ON
+fi
@@ -0,0 +1,159 @@
+#!/usr/bin/env python3
+"""Feature extraction and GGUF export for KeywordSpotter models.
+
+keyword_spotter.cpp runs a three-layer MLP over a sliding window of log-mel frames. Train it
+with any framework on the features this script computes (they match the native front end up
+to float rounding), then export the weights:
+
+    # one row of n_frames x n_mels features per 16 kHz mono wav, ending at the clip's end
+    python3 scripts/export_kws_gguf.py features clips/*.wav -o features.npz
+
+    # weights as an .npz (or a PyTorch state_dict .pt) with fc1/fc2/out Linear layers,
+    # class 0 = filler; optional feat.mean / feat.std (n_mels each) normalize every band
+    # before the model, so train on (features - mean) / std if you export them
+    python3 scripts/export_kws_gguf.py export weights.npz -o kws-hey-edge.gguf
+
+Linear weights are stored as [out_features, in_features], PyTorch's layout, which ggml reads
+as ne = [in_features, out_features]. Requires numpy and the gguf package
+(pip install gguf, or llama.cpp/gguf-py).
+"""
+
+import argparse
+import sys
+import wave
+
+import numpy as np
+
+SAMPLE_RATE = 16000
+FRAME_LENGTH = 400  # 25 ms
+FRAME_SHIFT = 160  # 10 ms
+FFT_SIZE = 512
+DEFAULT_MELS = 40
+DEFAULT_FRAMES = 98
+
+LAYERS = ("fc1", "fc2", "out")
+
+
+def hz_to_mel(hz):
+    return 2595.0 * np.log10(1.0 + hz / 700.0)
+
+
+def mel_to_hz(mel):
+    return 700.0 * (10.0 ** (mel / 2595.0) - 1.0)
+
+
+def mel_bank(n_mels):
+    """Triangular filters over 20 Hz..8 kHz in FFT bins, as KeywordSpotter::initFrontEnd."""
+    n_bins = FFT_SIZE // 2 + 1
+    mel_lo, mel_hi = hz_to_mel(20.0), hz_to_mel(SAMPLE_RATE / 2.0)
+    edges = mel_to_hz(mel_lo + (mel_hi - mel_lo) * np.arange(n_mels + 2) / (n_mels + 1))
+    edges = edges * FFT_SIZE / SAMPLE_RATE
+    k = np.arange(n_bins, dtype=np.float64)
+    bank = np.zeros((n_mels, n_bins), dtype=np.float32)
+    for m in range(n_mels):
+        up = (k - edges[m]) / max(edges[m + 1] - edges[m], 1e-6)
+        down = (edges[m + 2] - k) / max(edges[m + 2] - edges[m + 1], 1e-6)
+        bank[m] = np.maximum(0.0, np.minimum(up, down))
+    return bank
+
+
+def log_mel(samples, n_mels=DEFAULT_MELS):
+    """Log-mel frames (n, n_mels) of float samples in -1..1, as KeywordSpotter::logMel."""
+    window = 0.5 - 0.5 * np.cos(2.0 * np.pi * np.arange(FRAME_LENGTH) / (FRAME_LENGTH - 1))
+    bank = mel_bank(n_mels)
+    n = 0 if len(samples) < FRAME_LENGTH else 1 + (len(samples) - FRAME_LENGTH) // FRAME_SHIFT
+    frames = np.empty((n, n_mels), dtype=np.float32)
+    for i in range(n):
+        frame = samples[i * FRAME_SHIFT : i * FRAME_SHIFT + FRAME_LENGTH] * window
+        spectrum = np.fft.rfft(frame, FFT_SIZE)
+        power = spectrum.real**2 + spectrum.imag**2
+        frames[i] = np.log(np.maximum(bank @ power, 1e-10))
+    return frames
+
+
+def read_wav(path):
+    with wave.open(path, "rb") as f:
+        if f.getframerate() != SAMPLE_RATE or f.getnchannels() != 1 or f.getsampwidth() != 2:
+            sys.exit(f"{path}: expected 16 kHz mono 16-bit PCM")
+        pcm = np.frombuffer(f.readframes(f.getnframes()), dtype="<i2")
+    return pcm.astype(np.float32) / 32768.0
+
+
+def features(args):
+    rows = []
+    for path in args.wavs:
+        frames = log_mel(read_wav(path), args.n_mels)
+        if len(frames) < args.n_frames:
+            # clips shorter than the window are padded with silence
+            pad = np.full((args.n_frames - len(frames), args.n_mels), np.log(1e-10), np.float32)
+            frames = np.concatenate([pad, frames])
+        # the spotter stacks the most recent frames, oldest first
+        rows.append(frames[-args.n_frames :].reshape(-1))
+    np.savez(args.output, features=np.stack(rows), paths=np.array(args.wavs))
+    print(f"wrote {len(rows)} x {args.n_frames * args.n_mels} features to {args.output}")
+
+
+def load_weights(path):
+    if path.endswith((".pt", ".pth")):
+        import torch
+
+        state = torch.load(path, map_location="cpu")
+        return {k: v.float().numpy() for k, v in state.items()}
+    with np.load(path) as data:
+        return {k: data[k] for k in data.files}
+
+
+def export(args):
+    import gguf
+
+    weights = load_weights(args.weights)
+    tensors = {}
+    for layer in LAYERS:
+        for part in ("weight", "bias"):
+            name = f"{layer}.{part}"
+            if name not in weights:
+                sys.exit(f"{args.weights}: missing {name}")
+            tensors[name] = np.ascontiguousarray(weights[name], dtype=np.float32)
+    n_in = args.n_mels * args.n_frames
+    if tensors["fc1.weight"].shape[1] != n_in:
+        sys.exit(f"fc1.weight takes {tensors['fc1.weight'].shape[1]} inputs, features give {n_in}")
+    if tensors["out.weight"].shape[0] < 2:
+        sys.exit("out.weight needs at least two classes (class 0 = filler)")
+    for name in ("feat.mean", "feat.std"):
+        if name in weights:
+            tensors[name] = np.ascontiguousarray(weights[name], dtype=np.float32).reshape(-1)
+
+    writer = gguf.GGUFWriter(args.output, "kws")
+    writer.add_uint32("kws.n_mels", args.n_mels)
+    writer.add_uint32("kws.n_frames", args.n_frames)
+    for name, data in tensors.items():
+        writer.add_tensor(name, data)
+    writer.write_header_to_file()
+    writer.write_kv_data_to_file()
+    writer.write_tensors_to_file()
+    writer.close()
+    print(f"wrote {args.output}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--n-mels", type=int, default=DEFAULT_MELS)
+    parser.add_argument("--n-frames", type=int, default=DEFAULT_FRAMES)
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    p = sub.add_parser("features", help="compute model inputs for 16 kHz mono wav clips")
+    p.add_argument("wavs", nargs="+")
+    p.add_argument("-o", "--output", required=True)
+    p.set_defaults(run=features)
+
+    p = sub.add_parser("export", help="write trained weights as a KeywordSpotter GGUF")
+    p.add_argument("weights", help=".npz or PyTorch state_dict .pt")
+    p.add_argument("-o", "--output", required=True)
+    p.set_defaults(run=export)
+
+    args = parser.parse_args()
+    args.run(args)
+
+
+if __name__ == "__main__":
+    main()